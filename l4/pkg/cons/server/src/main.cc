@@ -56,7 +56,7 @@ struct Config_opts
 static Config_opts config;
 
 
-static L4::Server<L4Re::Util::Br_manager_hooks>  server(l4_utcb());
+static L4::Server<L4Re::Util::Br_manager_timeout_hooks>  server(l4_utcb());
 static Registry registry(&server);
 
 class My_mux : public Mux_i, public cxx::H_list_item
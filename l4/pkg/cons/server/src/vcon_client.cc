@@ -9,9 +9,23 @@
 #include "vcon_client.h"
 
 #include <l4/sys/typeinfo_svr>
+#include <l4/re/env>
+#include <l4/sys/kip.h>
+
+#include <cstdio>
 
 unsigned Vcon_client::_dfl_obufsz = Vcon_client::Default_obuf_size;
 
+Vcon_client::~Vcon_client()
+{
+  if (!_log_irq.obj_cap())
+    return;
+
+  if (_log_timeout.queued)
+    _log_irq.server_iface()->remove_timeout(&_log_timeout);
+  _registry->unregister_obj(&_log_irq);
+}
+
 void
 Vcon_client::vcon_write(const char *buf, unsigned size) throw()
 { cooked_write(buf, size); }
@@ -49,6 +63,132 @@ Vcon_client::vcon_read(char *buf, unsigned size) throw()
   return i | status;
 }
 
+long
+Vcon_client::op_setup(L4Re::Bulk_channel::Rights, L4::Ipc::Snd_fpage ds,
+                      l4_size_t size)
+{
+  if (!ds.cap_received())
+    return -L4_EINVAL;
+
+  L4::Cap<L4Re::Dataspace> c = server_iface()->rcv_cap<L4Re::Dataspace>(0);
+  int r = server_iface()->realloc_rcv_cap(0);
+  if (r < 0)
+    return r;
+
+  return _bulk.setup(c, size);
+}
+
+long
+Vcon_client::op_transfer(L4Re::Bulk_channel::Rights, l4_umword_t op,
+                         l4_addr_t offset, l4_size_t size)
+{
+  if (op != L4Re::Bulk_channel::Write)
+    return -L4_ENOSYS;
+
+  char const *d = _bulk.data(offset, size);
+  if (!d)
+    return -L4_EINVAL;
+
+  // cooked_write() only copies the data into the output buffer
+  cooked_write(d, size);
+  return size;
+}
+
+long
+Vcon_client::op_setup(L4Re::Log_ring::Rights, L4::Ipc::Snd_fpage ds,
+                      l4_size_t size, L4::Ipc::Cap<L4::Irq> &notify)
+{
+  if (!ds.cap_received())
+    return -L4_EINVAL;
+
+  L4::Cap<L4Re::Dataspace> c = server_iface()->rcv_cap<L4Re::Dataspace>(0);
+  int r = server_iface()->realloc_rcv_cap(0);
+  if (r < 0)
+    return r;
+
+  // output left in a previous ring goes first
+  log_drain();
+
+  r = _log.setup(c, size);
+  if (r < 0)
+    return r;
+
+  if (!_log_irq.obj_cap() && !_registry->register_irq_obj(&_log_irq))
+    {
+      _log.fini();
+      return -L4_ENOMEM;
+    }
+
+  // triggering is all the producer can do with the IRQ
+  notify = L4::Ipc::Cap<L4::Irq>(_log_irq.obj_cap(), L4_CAP_FPAGE_RO);
+  return 0;
+}
+
+long
+Vcon_client::op_drain(L4Re::Log_ring::Rights)
+{
+  if (!_log.valid())
+    return -L4_EINVAL;
+
+  log_drain();
+  return 0;
+}
+
+/**
+ * The producer wrote into an idle ring or filled it up to the watermark.
+ *
+ * Both notifications may be merged into one IRQ, so schedule the timeout
+ * in any case.
+ */
+void
+Vcon_client::log_notify()
+{
+  if (!_log.valid())
+    return;
+
+  if (_log.above_watermark())
+    log_drain();
+
+  log_schedule();
+}
+
+void
+Vcon_client::log_timeout()
+{
+  log_drain();
+  if (_log.valid() && _log.disarm())
+    log_schedule();
+}
+
+void
+Vcon_client::log_schedule()
+{
+  if (_log_timeout.queued)
+    return;
+
+  _log_timeout.queued = true;
+  _log_irq.server_iface()->add_timeout(&_log_timeout,
+                                       l4_kip_clock(l4re_kip())
+                                       + Log_flush_delay);
+}
+
+void
+Vcon_client::log_drain()
+{
+  if (!_log.valid())
+    return;
+
+  l4_uint32_t dropped
+    = _log.drain([this](char const *d, l4_size_t l) { cooked_write(d, l); });
+
+  if (dropped)
+    {
+      char b[40];
+      snprintf(b, sizeof(b), "\n[%u bytes dropped]\n", dropped);
+      cooked_write(b);
+    }
+}
+
 int
 Vcon_client::vcon_set_attr(l4_vcon_attr_t const *a) throw()
 {
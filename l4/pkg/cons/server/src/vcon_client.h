@@ -12,12 +12,18 @@
 #include "client.h"
 #include "server.h"
 
+#include <l4/re/util/bulk_channel>
+#include <l4/re/util/log_ring>
 #include <l4/re/util/icu_svr>
 #include <l4/re/util/vcon_svr>
 #include <l4/re/util/object_registry>
+#include <l4/cxx/ipc_timeout_queue>
 
 class Vcon_client
-: public L4::Epiface_t<Vcon_client, L4::Vcon, Server_object>,
+: public L4::Epiface_t<Vcon_client,
+                       L4::Kobject_3t<void, L4::Vcon, L4Re::Bulk_channel,
+                                      L4Re::Log_ring>,
+                       Server_object>,
   public L4Re::Util::Icu_cap_array_svr<Vcon_client>,
   public L4Re::Util::Vcon_svr<Vcon_client>,
   public Client
@@ -27,22 +33,38 @@ public:
   typedef L4Re::Util::Vcon_svr<Vcon_client> My_vcon_svr;
 
   Vcon_client(std::string const &name, int color, size_t bufsz, Key key,
-              L4Re::Util::Object_registry *)
+              L4Re::Util::Object_registry *registry)
   : Icu_svr(1, &_irq),
-    Client(name, color, 512, bufsz < 512 ? _dfl_obufsz : bufsz, key)
+    Client(name, color, 512, bufsz < 512 ? _dfl_obufsz : bufsz, key),
+    _registry(registry), _log_irq(this), _log_timeout(this)
   {}
 
+  ~Vcon_client();
+
   void vcon_write(const char *buffer, unsigned size) throw();
   unsigned vcon_read(char *buffer, unsigned size) throw();
 
   int vcon_set_attr(l4_vcon_attr_t const *a) throw();
   int vcon_get_attr(l4_vcon_attr_t *attr) throw();
 
+  long op_setup(L4Re::Bulk_channel::Rights, L4::Ipc::Snd_fpage ds,
+                l4_size_t size);
+  long op_transfer(L4Re::Bulk_channel::Rights, l4_umword_t op,
+                   l4_addr_t offset, l4_size_t size);
+
+  long op_setup(L4Re::Log_ring::Rights, L4::Ipc::Snd_fpage ds,
+                l4_size_t size, L4::Ipc::Cap<L4::Irq> &notify);
+  long op_drain(L4Re::Log_ring::Rights);
+
   const l4_vcon_attr_t *attr() const { return &_attr; }
 
   void trigger() const { _irq.trigger(); }
 
-  bool collected() { return Client::collected(); }
+  bool collected()
+  {
+    log_drain();
+    return Client::collected();
+  }
 
   static void default_obuf_size(unsigned bufsz)
   {
@@ -50,7 +72,40 @@ public:
   }
 
 private:
-  enum { Default_obuf_size = 40960 };
+  enum
+  {
+    Default_obuf_size = 40960,
+    /// Time in us to collect log ring output after a notification.
+    Log_flush_delay = 2000,
+  };
+
+  /// Notification from the producer of the log ring.
+  struct Log_irq : L4::Irqep_t<Log_irq>
+  {
+    explicit Log_irq(Vcon_client *c) : c(c) {}
+    void handle_irq() { c->log_notify(); }
+    Vcon_client *c;
+  };
+
+  struct Log_timeout : L4::Ipc_svr::Timeout
+  {
+    explicit Log_timeout(Vcon_client *c) : c(c), queued(false) {}
+    void expired() { queued = false; c->log_timeout(); }
+    Vcon_client *c;
+    bool queued;
+  };
+
+  void log_notify();
+  void log_timeout();
+  void log_drain();
+  void log_schedule();
+
   static unsigned _dfl_obufsz;
   Icu_svr::Irq _irq;
+  L4Re::Util::Bulk_buffer_svr _bulk;
+
+  L4Re::Util::Object_registry *_registry;
+  L4Re::Util::Log_ring_consumer _log;
+  Log_irq _log_irq;
+  Log_timeout _log_timeout;
 };
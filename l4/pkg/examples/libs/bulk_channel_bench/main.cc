@@ -0,0 +1,201 @@
+/**
+ * \file
+ * \brief Throughput of console writes through the UTCB and a bulk channel.
+ *
+ * A server thread provides a console that copies all written data into a
+ * local buffer.  The client writes blocks of increasing size, once in
+ * L4_VCON_WRITE_SIZE messages as Vcon_stream did so far, and once through
+ * an L4Re::Bulk_channel with a shared buffer.
+ * Usage: ex_bulk_channel_bench [megabytes per run]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/br_manager>
+#include <l4/re/util/bulk_channel>
+#include <l4/re/util/cap_alloc>
+#include <l4/re/util/icu_svr>
+#include <l4/re/util/object_registry>
+#include <l4/re/util/vcon_svr>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <pthread-l4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+class Sink
+: public L4::Epiface_t<Sink, L4::Kobject_2t<void, L4::Vcon, L4Re::Bulk_channel> >,
+  public L4Re::Util::Icu_cap_array_svr<Sink>,
+  public L4Re::Util::Vcon_svr<Sink>
+{
+public:
+  typedef L4Re::Util::Icu_cap_array_svr<Sink> Icu_svr;
+
+  Sink() : Icu_svr(1, &_irq), _pos(0) {}
+
+  void vcon_write(const char *buf, unsigned size) throw()
+  { consume(buf, size); }
+
+  unsigned vcon_read(char *, unsigned) throw()
+  { return L4_VCON_READ_STAT_DONE; }
+
+  long op_setup(L4Re::Bulk_channel::Rights, L4::Ipc::Snd_fpage ds,
+                l4_size_t size)
+  {
+    if (!ds.cap_received())
+      return -L4_EINVAL;
+
+    L4::Cap<L4Re::Dataspace> c = server_iface()->rcv_cap<L4Re::Dataspace>(0);
+    int r = server_iface()->realloc_rcv_cap(0);
+    if (r < 0)
+      return r;
+
+    return _bulk.setup(c, size);
+  }
+
+  long op_transfer(L4Re::Bulk_channel::Rights, l4_umword_t op,
+                   l4_addr_t offset, l4_size_t size)
+  {
+    if (op != L4Re::Bulk_channel::Write)
+      return -L4_ENOSYS;
+
+    char const *d = _bulk.data(offset, size);
+    if (!d)
+      return -L4_EINVAL;
+
+    consume(d, size);
+    return size;
+  }
+
+private:
+  enum { Out_size = 64 << 10 };
+
+  void consume(char const *d, unsigned long size)
+  {
+    while (size)
+      {
+        unsigned long n = size < Out_size - _pos ? size : Out_size - _pos;
+        memcpy(_out + _pos, d, n);
+        _pos = (_pos + n) % Out_size;
+        d += n;
+        size -= n;
+      }
+  }
+
+  Icu_svr::Irq _irq;
+  L4Re::Util::Bulk_buffer_svr _bulk;
+  unsigned long _pos;
+  char _out[Out_size];
+};
+
+static L4::Cap<L4::Vcon> sink_cap;
+static unsigned volatile server_ready;
+
+static void *server_fn(void *)
+{
+  static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks>
+    server(l4_utcb(), Pthread::L4::cap(pthread_self()),
+           L4Re::Env::env()->factory());
+  static Sink sink;
+
+  sink_cap = L4::cap_cast<L4::Vcon>(server.registry()->register_obj(&sink));
+  server_ready = 1;
+  server.loop();
+  return 0;
+}
+
+static unsigned long total;
+
+static l4_cpu_time_t now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static void report(char const *name, unsigned long block, l4_cpu_time_t d)
+{
+  if (!d)
+    d = 1;
+  printf("%-5s %6lu byte blocks: %llu us, %llu MB/s\n",
+         name, block, d, (unsigned long long)total / d);
+}
+
+static void run_utcb(char const *src, unsigned long block)
+{
+  l4_cpu_time_t start = now_us();
+  for (unsigned long done = 0; done < total; done += block)
+    {
+      char const *b = src;
+      unsigned long l = block;
+      for (; l > L4_VCON_WRITE_SIZE; l -= L4_VCON_WRITE_SIZE, b += L4_VCON_WRITE_SIZE)
+        sink_cap->send(b, L4_VCON_WRITE_SIZE);
+      sink_cap->send(b, l);
+    }
+  report("utcb", block, now_us() - start);
+}
+
+static void run_bulk(L4Re::Util::Bulk_buffer *bulk, char const *src,
+                     unsigned long block)
+{
+  l4_cpu_time_t start = now_us();
+  for (unsigned long done = 0; done < total; done += block)
+    {
+      long offset = bulk->alloc(block);
+      if (offset < 0)
+        {
+          printf("bulk alloc failed: %ld\n", offset);
+          exit(1);
+        }
+
+      memcpy(bulk->data(offset), src, block);
+      long r = bulk->transfer(L4Re::Bulk_channel::Write, offset, block);
+      bulk->complete(offset);
+      if (r != long(block))
+        {
+          printf("bulk transfer failed: %ld\n", r);
+          exit(1);
+        }
+    }
+  report("bulk", block, now_us() - start);
+}
+
+int main(int argc, char **argv)
+{
+  enum { Max_block = 64 << 10 };
+  total = (argc > 1 ? strtoul(argv[1], NULL, 0) : 64) << 20;
+  if (!total)
+    total = Max_block;
+
+  pthread_t t;
+  if (pthread_create(&t, NULL, server_fn, NULL))
+    {
+      printf("pthread_create failed\n");
+      return 1;
+    }
+
+  while (!server_ready)
+    l4_thread_yield();
+
+  static char src[Max_block];
+  memset(src, 'x', sizeof(src));
+
+  L4Re::Util::Bulk_buffer bulk;
+  L4::Cap<L4Re::Dataspace> ds
+    = L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>());
+  L4Re::chksys(bulk.init(L4::cap_reinterpret_cast<L4Re::Bulk_channel>(sink_cap),
+                         ds, L4Re::Env::env()->mem_alloc(), 4 * Max_block),
+               "bulk channel setup");
+
+  for (unsigned long block = 256; block <= Max_block; block *= 4)
+    {
+      run_utcb(src, block);
+      run_bulk(&bulk, src, block);
+    }
+
+  return 0;
+}
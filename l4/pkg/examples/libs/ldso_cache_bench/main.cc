@@ -0,0 +1,78 @@
+/**
+ * \file
+ * \brief Start-up cost of a dynamically linked program.
+ *
+ * ldso_cache_bench.cfg starts the program many times, with and without the
+ * relocation cache of the dynamic loader.  Every instance reports
+ *  - the CPU time its main thread spent before main(), mostly in the
+ *    dynamic loader, and
+ *  - how much of its address space is mapped writable, i.e., private, and
+ *    read-only.  Shared RELRO pages move from the former to the latter.
+ * Usage: ex_ldso_cache_bench [tag]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env>
+#include <l4/re/rm>
+#include <l4/re/dataspace>
+#include <l4/sys/thread>
+
+#include <stdio.h>
+
+static void
+mapped(unsigned long *rw, unsigned long *ro)
+{
+  enum { Batch = 32 };
+  L4::Cap<L4Re::Rm> rm = L4Re::Env::env()->rm();
+  L4Re::Rm::Region regs[Batch];
+  L4Re::Rm::Region const *rl;
+  l4_addr_t addr = 0;
+  long n;
+
+  *rw = *ro = 0;
+  while ((n = rm->get_regions(addr, &rl)) > 0)
+    {
+      if (n > Batch)
+        n = Batch;
+
+      // the list is in the UTCB, find() overwrites it
+      for (long i = 0; i < n; ++i)
+        regs[i] = rl[i];
+
+      for (long i = 0; i < n; ++i)
+        {
+          l4_addr_t a = regs[i].start;
+          unsigned long size = 1;
+          l4_addr_t offset;
+          unsigned flags;
+          L4::Cap<L4Re::Dataspace> ds;
+
+          if (rm->find(&a, &size, &offset, &flags, &ds) >= 0)
+            {
+              if (flags & L4Re::Rm::Read_only)
+                *ro += size;
+              else
+                *rw += size;
+            }
+
+          addr = regs[i].end + 1;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+  l4_kernel_clock_t us = 0;
+  L4Re::Env::env()->main_thread()->stats_time(&us);
+
+  unsigned long rw, ro;
+  mapped(&rw, &ro);
+
+  printf("%s: start-up %llu us, writable %lu KiB, read-only %lu KiB\n",
+         argc > 1 ? argv[1] : "run", (unsigned long long)us,
+         rw >> 10, ro >> 10);
+  return 0;
+}
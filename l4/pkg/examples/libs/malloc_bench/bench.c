@@ -0,0 +1,188 @@
+/**
+ * \file
+ * \brief Multi-threaded malloc benchmark.
+ *
+ * Every thread keeps a working set of blocks and replaces random entries
+ * with blocks of random size.  A second run passes blocks to a neighbour
+ * thread that frees them, which exercises frees of remote memory.  The
+ * program is built twice, against the libc allocator (ex_malloc_bench) and
+ * against libc_be_malloc_tc (ex_malloc_bench_tc).
+ * Usage: ex_malloc_bench [operations per thread] [max threads] [max size]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { MAX_THREADS = 32, WORKING_SET = 512, HANDOFF_SLOTS = 256 };
+
+static unsigned ops;
+static unsigned max_size;
+
+static l4_cpu_time_t now_us(void)
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static inline unsigned next_rand(unsigned *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/* Mostly small blocks, occasionally up to max_size. */
+static inline size_t rand_size(unsigned *seed)
+{
+  unsigned r = next_rand(seed);
+  if ((r & 15) == 0)
+    return r % max_size + 1;
+  return r % 256 + 1;
+}
+
+static void *local_fn(void *arg)
+{
+  void *set[WORKING_SET];
+  unsigned seed = (unsigned long)arg;
+
+  memset(set, 0, sizeof(set));
+  for (unsigned i = 0; i < ops; ++i)
+    {
+      unsigned slot = next_rand(&seed) % WORKING_SET;
+      size_t s = rand_size(&seed);
+      free(set[slot]);
+      set[slot] = malloc(s);
+      if (!set[slot])
+        {
+          printf("malloc(%zu) failed\n", s);
+          exit(1);
+        }
+      *(char *)set[slot] = 1;
+    }
+
+  for (unsigned i = 0; i < WORKING_SET; ++i)
+    free(set[i]);
+
+  return NULL;
+}
+
+/* Single-producer single-consumer ring of blocks between two threads. */
+struct handoff
+{
+  void *slot[HANDOFF_SLOTS];
+};
+
+static struct handoff rings[MAX_THREADS];
+static unsigned nthreads;
+
+/* Free the next block from ring in, if there is one. */
+static int take(struct handoff *in, unsigned *r)
+{
+  void *p = __atomic_load_n(&in->slot[*r], __ATOMIC_ACQUIRE);
+  if (!p)
+    return 0;
+
+  __atomic_store_n(&in->slot[*r], NULL, __ATOMIC_RELEASE);
+  *r = (*r + 1) % HANDOFF_SLOTS;
+  free(p);
+  return 1;
+}
+
+static void *remote_fn(void *arg)
+{
+  unsigned me = (unsigned long)arg - 1;
+  struct handoff *out = &rings[me];
+  struct handoff *in = &rings[(me + nthreads - 1) % nthreads];
+  unsigned seed = me + 1;
+  unsigned w = 0, r = 0, freed = 0;
+
+  for (unsigned i = 0; i < ops; ++i)
+    {
+      while (__atomic_load_n(&out->slot[w], __ATOMIC_ACQUIRE))
+        {
+          if (take(in, &r))
+            ++freed;
+          else
+            sched_yield();
+        }
+
+      __atomic_store_n(&out->slot[w], malloc(rand_size(&seed)),
+                       __ATOMIC_RELEASE);
+      w = (w + 1) % HANDOFF_SLOTS;
+
+      if (take(in, &r))
+        ++freed;
+    }
+
+  while (freed < ops)
+    {
+      if (take(in, &r))
+        ++freed;
+      else
+        sched_yield();
+    }
+
+  return NULL;
+}
+
+static int run(char const *name, void *(*fn)(void *), unsigned threads)
+{
+  pthread_t t[MAX_THREADS];
+  l4_cpu_time_t start;
+
+  nthreads = threads;
+  memset(rings, 0, sizeof(rings));
+
+  start = now_us();
+  for (unsigned long i = 0; i < threads; ++i)
+    if (pthread_create(&t[i], NULL, fn, (void *)(i + 1)))
+      {
+        printf("pthread_create failed\n");
+        return 1;
+      }
+
+  for (unsigned i = 0; i < threads; ++i)
+    pthread_join(t[i], NULL);
+
+  l4_cpu_time_t d = now_us() - start;
+  unsigned long total = (unsigned long)threads * ops;
+  printf("%-7s %2u threads: %9lu malloc/free pairs in %8llu us, "
+         "%5llu ns/pair, %7llu pairs/ms\n",
+         name, threads, total, d, d * 1000 / total,
+         d ? total * 1000 / d : 0);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned max_threads;
+
+  ops         = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  max_threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 8;
+  max_size    = argc > 3 ? strtoul(argv[3], NULL, 0) : 64 << 10;
+
+  if (!ops)
+    ops = 1;
+  if (!max_size)
+    max_size = 1;
+  if (!max_threads || max_threads > MAX_THREADS)
+    max_threads = MAX_THREADS;
+
+  for (unsigned n = 1; n <= max_threads; n *= 2)
+    if (run("local", local_fn, n))
+      return 1;
+
+  for (unsigned n = 2; n <= max_threads; n *= 2)
+    if (run("remote", remote_fn, n))
+      return 1;
+
+  return 0;
+}
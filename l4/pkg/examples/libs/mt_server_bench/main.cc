@@ -0,0 +1,164 @@
+/**
+ * \file
+ * \brief Scaling benchmark for the multi-threaded registry server.
+ *
+ * Runs N client threads on N CPUs, for N from 1 to the number of online
+ * CPUs, each calling a null RPC in a loop.  In the first run all server
+ * objects are handled by one worker, as with a Registry_server; in the
+ * second run every client calls an object handled by the worker on its
+ * own CPU.
+ * Usage: ex_mt_server_bench [calls per client]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env>
+#include <l4/re/util/mt_registry_server>
+#include <l4/sys/cxx/ipc_epiface>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Bench : L4::Kobject_t<Bench, L4::Kobject, 0x45>
+{
+  L4_INLINE_RPC(long, ping, (l4_umword_t x));
+  typedef L4::Typeid::Rpcs<ping_t> Rpcs;
+};
+
+struct Bench_server : L4::Epiface_t<Bench_server, Bench>
+{
+  long op_ping(Bench::Rights, l4_umword_t x)
+  { return x & 1; }
+};
+
+enum { Max_clients = L4Re::Util::Mt_registry_server<>::Max_workers };
+
+static L4Re::Util::Mt_registry_server<> server;
+
+struct Client
+{
+  pthread_t thread;
+  unsigned cpu;
+  L4::Cap<Bench> obj;
+  l4_cpu_time_t time;
+};
+
+static Client clients[Max_clients];
+static unsigned calls;
+static unsigned go;
+
+static l4_cpu_time_t now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static void *client_fn(void *arg)
+{
+  Client *c = static_cast<Client *>(arg);
+
+  cpu_set_t s;
+  CPU_ZERO(&s);
+  CPU_SET(c->cpu, &s);
+  pthread_setaffinity_np(pthread_self(), sizeof(s), &s);
+
+  while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+    sched_yield();
+
+  l4_cpu_time_t start = now_us();
+  for (unsigned i = 0; i < calls; ++i)
+    if (c->obj->ping(i) != long(i & 1))
+      {
+        printf("RPC failed on CPU %u\n", c->cpu);
+        exit(1);
+      }
+
+  c->time = now_us() - start;
+  return 0;
+}
+
+/* Run n clients, the one on CPU i calling objs[i]. */
+static void run(char const *name, unsigned n, L4::Cap<Bench> const *objs)
+{
+  __atomic_store_n(&go, 0, __ATOMIC_RELAXED);
+  for (unsigned i = 0; i < n; ++i)
+    {
+      clients[i].cpu = server.worker(i)->cpu();
+      clients[i].obj = objs[i];
+      if (pthread_create(&clients[i].thread, NULL, client_fn, &clients[i]))
+        {
+          printf("pthread_create failed\n");
+          exit(1);
+        }
+    }
+
+  __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+
+  l4_cpu_time_t max = 1;
+  for (unsigned i = 0; i < n; ++i)
+    {
+      pthread_join(clients[i].thread, NULL);
+      if (clients[i].time > max)
+        max = clients[i].time;
+    }
+
+  unsigned long long total = (unsigned long long)calls * n;
+  printf("%-8s %2u clients: %llu calls in %llu us, %llu calls/s\n",
+         name, n, total, max, total * 1000000 / max);
+}
+
+static void *bench_fn(void *)
+{
+  unsigned n = server.num_workers();
+  L4::Cap<Bench> single[Max_clients];
+  L4::Cap<Bench> sharded[Max_clients];
+
+  for (unsigned i = 0; i < n; ++i)
+    {
+      single[i] = L4::cap_cast<Bench>(server.register_obj(new Bench_server(), 0u));
+      sharded[i] = L4::cap_cast<Bench>(server.register_obj(new Bench_server(), i));
+      if (!single[i].is_valid() || !sharded[i].is_valid())
+        {
+          printf("Could not register server objects\n");
+          exit(1);
+        }
+    }
+
+  for (unsigned c = 1; c <= n; ++c)
+    run("single", c, single);
+
+  for (unsigned c = 1; c <= n; ++c)
+    run("sharded", c, sharded);
+
+  printf("Done\n");
+  exit(0);
+}
+
+int main(int argc, char **argv)
+{
+  calls = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+  if (!calls)
+    calls = 1;
+
+  int n = server.start();
+  if (n < 0)
+    {
+      printf("Could not start workers: %d\n", n);
+      return 1;
+    }
+
+  printf("%d workers, %u calls per client\n", n, calls);
+
+  pthread_t t;
+  if (pthread_create(&t, NULL, bench_fn, NULL))
+    {
+      printf("pthread_create failed\n");
+      return 1;
+    }
+
+  server.loop();
+}
@@ -0,0 +1,243 @@
+/**
+ * \file
+ * \brief Synchronization primitive benchmark.
+ *
+ * Measures uncontended and contended mutex lock/unlock pairs for a growing
+ * number of threads, condition variable and semaphore ping-pong between two
+ * threads, and condition variable broadcasts to a group of waiters.
+ * Usage: ex_pthread_sync_bench [iterations] [max threads]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum { MAX_THREADS = 64 };
+
+static unsigned iterations;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long counter;
+
+static l4_cpu_time_t now_us(void)
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static void report(char const *what, unsigned threads, unsigned long ops,
+                   l4_cpu_time_t d)
+{
+  printf("%-12s %2u threads: %8lu ops in %8llu us, %6llu ns/op\n",
+         what, threads, ops, d, ops ? d * 1000 / ops : 0);
+}
+
+static void *mutex_fn(void *arg)
+{
+  (void)arg;
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      pthread_mutex_lock(&mutex);
+      ++counter;
+      pthread_mutex_unlock(&mutex);
+    }
+  return NULL;
+}
+
+static int run_mutex(unsigned threads)
+{
+  pthread_t t[MAX_THREADS];
+  l4_cpu_time_t start = now_us();
+
+  counter = 0;
+  for (unsigned i = 0; i < threads; ++i)
+    if (pthread_create(&t[i], NULL, mutex_fn, NULL))
+      {
+        printf("pthread_create failed\n");
+        return 1;
+      }
+
+  for (unsigned i = 0; i < threads; ++i)
+    pthread_join(t[i], NULL);
+
+  l4_cpu_time_t d = now_us() - start;
+  if (counter != (unsigned long)threads * iterations)
+    {
+      printf("mutex: counter mismatch: %lu\n", counter);
+      return 1;
+    }
+
+  report("mutex", threads, counter, d);
+  return 0;
+}
+
+/* Condition variable ping-pong: two threads take turns. */
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static unsigned turn;
+
+static void *cond_fn(void *arg)
+{
+  unsigned me = (unsigned long)arg;
+
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      pthread_mutex_lock(&mutex);
+      while (turn != me)
+        pthread_cond_wait(&turn_cond, &mutex);
+      turn = !me;
+      pthread_cond_signal(&turn_cond);
+      pthread_mutex_unlock(&mutex);
+    }
+  return NULL;
+}
+
+static int run_cond(void)
+{
+  pthread_t t[2];
+  l4_cpu_time_t start = now_us();
+
+  turn = 0;
+  for (unsigned long i = 0; i < 2; ++i)
+    if (pthread_create(&t[i], NULL, cond_fn, (void *)i))
+      {
+        printf("pthread_create failed\n");
+        return 1;
+      }
+
+  pthread_join(t[0], NULL);
+  pthread_join(t[1], NULL);
+
+  report("cond handoff", 2, 2UL * iterations, now_us() - start);
+  return 0;
+}
+
+/* Semaphore ping-pong */
+static sem_t sem[2];
+
+static void *sem_fn(void *arg)
+{
+  unsigned me = (unsigned long)arg;
+
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      sem_wait(&sem[me]);
+      sem_post(&sem[!me]);
+    }
+  return NULL;
+}
+
+static int run_sem(void)
+{
+  pthread_t t[2];
+  l4_cpu_time_t start;
+
+  sem_init(&sem[0], 0, 1);
+  sem_init(&sem[1], 0, 0);
+
+  start = now_us();
+  for (unsigned long i = 0; i < 2; ++i)
+    if (pthread_create(&t[i], NULL, sem_fn, (void *)i))
+      {
+        printf("pthread_create failed\n");
+        return 1;
+      }
+
+  pthread_join(t[0], NULL);
+  pthread_join(t[1], NULL);
+
+  report("sem handoff", 2, 2UL * iterations, now_us() - start);
+  sem_destroy(&sem[0]);
+  sem_destroy(&sem[1]);
+  return 0;
+}
+
+/* Broadcast: the main thread starts a new generation once all waiters
+   have seen the previous one. */
+static pthread_cond_t gen_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned generation, seen;
+
+static void *bcast_fn(void *arg)
+{
+  unsigned gen = 0;
+  (void)arg;
+
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      pthread_mutex_lock(&mutex);
+      while (generation == gen)
+        pthread_cond_wait(&gen_cond, &mutex);
+      gen = generation;
+      ++seen;
+      pthread_cond_signal(&done_cond);
+      pthread_mutex_unlock(&mutex);
+    }
+  return NULL;
+}
+
+static int run_broadcast(unsigned threads)
+{
+  pthread_t t[MAX_THREADS];
+  l4_cpu_time_t start;
+
+  generation = 0;
+  seen = threads;
+
+  start = now_us();
+  for (unsigned i = 0; i < threads; ++i)
+    if (pthread_create(&t[i], NULL, bcast_fn, NULL))
+      {
+        printf("pthread_create failed\n");
+        return 1;
+      }
+
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      pthread_mutex_lock(&mutex);
+      while (seen < threads)
+        pthread_cond_wait(&done_cond, &mutex);
+      seen = 0;
+      ++generation;
+      pthread_cond_broadcast(&gen_cond);
+      pthread_mutex_unlock(&mutex);
+    }
+
+  for (unsigned i = 0; i < threads; ++i)
+    pthread_join(t[i], NULL);
+
+  report("broadcast", threads, iterations, now_us() - start);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned max_threads;
+
+  iterations  = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+  max_threads = argc > 2 ? strtoul(argv[2], NULL, 0) : 8;
+
+  if (!iterations)
+    iterations = 1;
+  if (!max_threads || max_threads > MAX_THREADS)
+    max_threads = MAX_THREADS;
+
+  for (unsigned n = 1; n <= max_threads; n *= 2)
+    if (run_mutex(n))
+      return 1;
+
+  if (run_cond() || run_sem())
+    return 1;
+
+  for (unsigned n = 2; n <= max_threads; n *= 2)
+    if (run_broadcast(n))
+      return 1;
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * \file
+ * \brief Thread creation benchmark.
+ *
+ * Creates and joins a large number of threads, first one after another and
+ * then in batches, and reports the average cost of a create/join pair.
+ * Usage: ex_pthread_create_bench [threads] [batch size]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum { MAX_BATCH = 256 };
+
+static void *thread_fn(void *arg)
+{
+  return arg;
+}
+
+static l4_cpu_time_t now_us(void)
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static int run_sequential(unsigned threads)
+{
+  l4_cpu_time_t start = now_us();
+
+  for (unsigned i = 0; i < threads; ++i)
+    {
+      pthread_t t;
+      void *ret;
+      if (pthread_create(&t, NULL, thread_fn, (void *)(unsigned long)i))
+        {
+          printf("pthread_create failed after %u threads\n", i);
+          return 1;
+        }
+
+      if (pthread_join(t, &ret) || ret != (void *)(unsigned long)i)
+        {
+          printf("pthread_join failed for thread %u\n", i);
+          return 1;
+        }
+    }
+
+  l4_cpu_time_t d = now_us() - start;
+  printf("sequential: %u create/join pairs in %llu us, %llu ns each\n",
+         threads, d, d * 1000 / threads);
+  return 0;
+}
+
+static int run_batched(unsigned threads, unsigned batch)
+{
+  static pthread_t t[MAX_BATCH];
+  l4_cpu_time_t start = now_us();
+
+  for (unsigned done = 0; done < threads; done += batch)
+    {
+      for (unsigned i = 0; i < batch; ++i)
+        if (pthread_create(&t[i], NULL, thread_fn, NULL))
+          {
+            printf("pthread_create failed after %u threads\n", done + i);
+            return 1;
+          }
+
+      for (unsigned i = 0; i < batch; ++i)
+        pthread_join(t[i], NULL);
+    }
+
+  l4_cpu_time_t d = now_us() - start;
+  printf("batched (%u): %u create/join pairs in %llu us, %llu ns each\n",
+         batch, threads, d, d * 1000 / threads);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned threads = argc > 1 ? strtoul(argv[1], NULL, 0) : 5000;
+  unsigned batch   = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+
+  if (!threads)
+    threads = 1;
+  if (!batch || batch > MAX_BATCH)
+    batch = MAX_BATCH;
+
+  threads = (threads + batch - 1) / batch * batch;
+
+  if (run_sequential(threads))
+    return 1;
+
+  /* Second round of sequential runs is served from the stack cache. */
+  if (run_sequential(threads))
+    return 1;
+
+  return run_batched(threads, batch);
+}
@@ -0,0 +1,131 @@
+/**
+ * \file
+ * \brief Lookup and search costs of L4Re::Util::Region_map.
+ *
+ * Fills a region map with many small regions separated by one-page holes,
+ * as a task with many mappings has, and measures
+ *  - attaching with Search_addr, which has to skip all holes that are too
+ *    small,
+ *  - page-fault style lookups, once within one region and once at random
+ *    addresses,
+ *  - searching a free range that only exists above all regions, and
+ *  - detaching all regions again.
+ * Usage: ex_region_map_bench [number of regions]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env>
+#include <l4/re/util/region_mapping>
+#include <l4/cxx/std_alloc>
+#include <l4/sys/kip.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+struct Ops
+{
+  typedef int Map_result;
+  template<typename H>
+  static void unmap(H const *, l4_addr_t, l4_addr_t, unsigned long) {}
+  template<typename H>
+  static void free(H const *, l4_addr_t, unsigned long) {}
+  template<typename H>
+  static void take(H const *) {}
+  template<typename H>
+  static void release(H const *) {}
+};
+
+typedef L4Re::Util::Region_handler<int, Ops> Handler;
+typedef L4Re::Util::Region_map<Handler, cxx::New_allocator> Map;
+
+enum
+{
+  Base = 0x10000000,
+  Region_pages = 3,
+  Lookups = 1000000,
+};
+
+l4_cpu_time_t now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+void report(char const *what, unsigned long ops, l4_cpu_time_t us)
+{
+  printf("%-20s %8lu ops: %8llu us, %6llu ns/op\n", what, ops, us,
+         ops ? us * 1000 / ops : 0);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long regions = argc > 1 ? strtoul(argv[1], 0, 0) : 100000;
+  unsigned long stride = (Region_pages + 1) * L4_PAGESIZE;
+  Map *rm = new Map(Base, Base + (regions + 64) * stride * 2);
+
+  // regions with one-page holes in between
+  l4_cpu_time_t start = now_us();
+  for (unsigned long i = 0; i < regions; ++i)
+    if (rm->attach((void *)(Base + i * stride), Region_pages * L4_PAGESIZE,
+                   Handler(0, L4_INVALID_CAP)) == L4_INVALID_PTR)
+      {
+        printf("attach %lu failed\n", i);
+        return 1;
+      }
+  report("attach fixed", regions, now_us() - start);
+
+  // none of the holes fits two pages
+  start = now_us();
+  for (unsigned i = 0; i < 1000; ++i)
+    {
+      void *a = rm->attach((void *)Base, 2 * L4_PAGESIZE,
+                           Handler(0, L4_INVALID_CAP), Map::Search);
+      if (a == L4_INVALID_PTR)
+        {
+          printf("search attach failed\n");
+          return 1;
+        }
+    }
+  report("attach search", 1000, now_us() - start);
+
+  start = now_us();
+  unsigned long hits = 0;
+  for (unsigned long i = 0; i < Lookups; ++i)
+    hits += rm->find(L4Re::Util::Region(Base + (i & 0xfff))).valid();
+  report("find same region", Lookups, now_us() - start);
+
+  start = now_us();
+  srand(1);
+  for (unsigned long i = 0; i < Lookups; ++i)
+    {
+      l4_addr_t a = Base + (rand() % regions) * stride + L4_PAGESIZE;
+      hits += rm->find(L4Re::Util::Region(a)).valid();
+    }
+  report("find random", Lookups, now_us() - start);
+
+  start = now_us();
+  for (unsigned i = 0; i < 1000; ++i)
+    if (rm->find_free(Base, rm->max_addr(), 16 * L4_PAGESIZE, L4_PAGESHIFT,
+                      Map::None) == L4_INVALID_ADDR)
+      {
+        printf("find_free failed\n");
+        return 1;
+      }
+  report("find_free", 1000, now_us() - start);
+
+  start = now_us();
+  for (unsigned long i = 0; i < regions; ++i)
+    rm->detach((void *)(Base + i * stride), Region_pages * L4_PAGESIZE,
+               0, 0, 0);
+  report("detach", regions, now_us() - start);
+
+  printf("%lu lookups hit\n", hits);
+  delete rm;
+  return 0;
+}
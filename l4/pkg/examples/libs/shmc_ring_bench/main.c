@@ -0,0 +1,213 @@
+/**
+ * \file
+ * \brief Throughput and latency of lock-free shmc rings between two tasks.
+ *
+ * One instance runs as producer, another one as consumer, both need a name
+ * space capability "ring" and should run on different CPUs, see
+ * shmc_ring_bench.cfg.  The producer streams messages in batches of
+ * increasing size, then measures the round trip of single messages with
+ * blocking and with polling receivers.
+ * Usage: ex_shmc_ring_bench producer|consumer [mpmc]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/shmc/ring.h>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+  Msg_size  = 56,      // one cache line per slot
+  Num_msgs  = 1 << 21,
+  Num_pings = 1 << 15,
+  Slots     = 256,
+  Max_batch = 32,
+};
+
+enum { Data, End, Ping_block, Ping_poll, Quit };
+
+typedef struct
+{
+  l4_uint32_t cmd;
+  l4_uint32_t seq;
+} msg_t;
+
+#define CHK(func) \
+  do { long r_ = (func); \
+       if (r_ < 0) { printf("%s failed: %ld\n", #func, r_); exit(1); } \
+  } while (0)
+
+static l4_cpu_time_t now_us(void)
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static void send(l4shmc_ring_t *r, unsigned cmd, unsigned n, l4_uint32_t *seq)
+{
+  while (n)
+    {
+      l4_uint32_t pos;
+      unsigned i, m = l4shmc_ring_reserve(r, n, &pos);
+      if (!m)
+        {
+          CHK(l4shmc_ring_wait_space(r, L4_IPC_NEVER));
+          continue;
+        }
+
+      for (i = 0; i < m; ++i)
+        {
+          l4shmc_ring_slot_t *s = l4shmc_ring_slot(r, pos + i);
+          msg_t *msg = (msg_t *)s->data;
+          msg->cmd = cmd;
+          msg->seq = (*seq)++;
+          s->len = Msg_size;
+        }
+
+      l4shmc_ring_publish(r, pos, m);
+      n -= m;
+    }
+}
+
+static msg_t recv_one(l4shmc_ring_t *r, int poll)
+{
+  l4_uint32_t pos;
+  msg_t msg;
+
+  while (!l4shmc_ring_peek(r, 1, &pos))
+    if (!poll)
+      CHK(l4shmc_ring_wait_data(r, L4_IPC_NEVER));
+
+  msg = *(msg_t *)l4shmc_ring_slot(r, pos)->data;
+  l4shmc_ring_release(r, pos, 1);
+  return msg;
+}
+
+static void producer(l4shmc_ring_t *tx, l4shmc_ring_t *rx)
+{
+  static unsigned const batches[] = { 1, 4, 16, Max_batch };
+  l4_uint32_t seq = 0, other = 0;
+  unsigned b, i;
+
+  for (b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b)
+    {
+      l4_cpu_time_t d, start = now_us();
+      for (i = 0; i < Num_msgs; i += batches[b])
+        send(tx, Data, batches[b], &seq);
+      send(tx, End, 1, &other);
+      recv_one(rx, 0);
+
+      d = now_us() - start;
+      if (!d)
+        d = 1;
+      printf("batch %2u: %llu us, %llu kmsg/s, %llu MB/s\n", batches[b], d,
+             Num_msgs * 1000ULL / d, Num_msgs * (unsigned long long)Msg_size / d);
+    }
+
+  for (b = Ping_block; b <= Ping_poll; ++b)
+    {
+      l4_cpu_time_t start = now_us();
+      for (i = 0; i < Num_pings; ++i)
+        {
+          send(tx, b, 1, &other);
+          recv_one(rx, b == Ping_poll);
+        }
+
+      printf("round trip, %s: %llu ns\n", b == Ping_poll ? "polling" : "blocking",
+             (now_us() - start) * 1000ULL / Num_pings);
+    }
+
+  send(tx, Quit, 1, &other);
+}
+
+static void consumer(l4shmc_ring_t *rx, l4shmc_ring_t *tx)
+{
+  l4_uint32_t expect = 0, other = 0;
+  int poll = 0;
+
+  for (;;)
+    {
+      l4_uint32_t pos;
+      unsigned i, n = l4shmc_ring_peek(rx, Max_batch, &pos);
+      if (!n)
+        {
+          if (!poll)
+            CHK(l4shmc_ring_wait_data(rx, L4_IPC_NEVER));
+          continue;
+        }
+
+      for (i = 0; i < n; ++i)
+        {
+          msg_t *m = (msg_t *)l4shmc_ring_slot(rx, pos + i)->data;
+          switch (m->cmd)
+            {
+            case Data:
+              if (m->seq != expect)
+                {
+                  printf("lost message %u, got %u\n", expect, m->seq);
+                  exit(1);
+                }
+              ++expect;
+              break;
+            case Ping_block:
+            case Ping_poll:
+              poll = m->cmd == Ping_poll;
+              /* fall through */
+            case End:
+              send(tx, m->cmd, 1, &other);
+              break;
+            default:
+              l4shmc_ring_release(rx, pos, n);
+              return;
+            }
+        }
+
+      l4shmc_ring_release(rx, pos, n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  l4_cap_idx_t self = l4re_env()->main_thread;
+  unsigned flags = 0;
+  l4shmc_area_t area;
+  l4shmc_ring_t data, ack;
+
+  if (argc < 2)
+    {
+      printf("usage: %s producer|consumer [mpmc]\n", argv[0]);
+      return 1;
+    }
+
+  if (argc > 2 && !strcmp(argv[2], "mpmc"))
+    flags = L4SHMC_RING_MP | L4SHMC_RING_MC;
+
+  if (!strcmp(argv[1], "producer"))
+    {
+      CHK(l4shmc_create("ring", 2 * Slots * L4SHMC_RING_CACHELINE + 8192));
+      CHK(l4shmc_attach("ring", &area));
+      CHK(l4shmc_ring_create(&data, &area, "data", Slots, Msg_size, flags));
+      CHK(l4shmc_ring_create(&ack, &area, "ack", Slots, Msg_size, flags));
+      CHK(l4shmc_ring_attach_producer(&data, self));
+      CHK(l4shmc_ring_attach_consumer(&ack, self));
+      printf("%s rings\n", flags ? "MPMC" : "SPSC");
+      producer(&data, &ack);
+    }
+  else
+    {
+      CHK(l4shmc_attach_to("ring", 10000, &area));
+      CHK(l4shmc_ring_attach(&data, &area, "data", 10000));
+      CHK(l4shmc_ring_attach(&ack, &area, "ack", 10000));
+      CHK(l4shmc_ring_attach_consumer(&data, self));
+      CHK(l4shmc_ring_attach_producer(&ack, self));
+      consumer(&data, &ack);
+    }
+
+  return 0;
+}
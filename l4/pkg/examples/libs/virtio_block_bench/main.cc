@@ -0,0 +1,330 @@
+/**
+ * \file
+ * \brief fio-style throughput and latency of a virtio block device.
+ *
+ * Drives the device passed as "disk" as a minimal virtio block driver.  One
+ * thread per request queue, each pinned to its own CPU and with its own
+ * notification IRQ, keeps Iodepth requests in flight.  Sequential and random
+ * writes and reads are run with 4 KiB and 64 KiB blocks, IOPS, bandwidth and
+ * the average completion latency are reported for every run.
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/l4virtio/client/l4virtio>
+#include <l4/l4virtio/virtio_block.h>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/pinned_thread>
+#include <l4/sys/kip.h>
+#include <pthread-l4.h>
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+
+enum
+{
+  Max_queues   = 4,
+  Queue_num    = 128,
+  Iodepth      = 32,      // requests in flight per queue, 3 descriptors each
+  Max_bs       = 64 << 10,
+  Slot_size    = L4_PAGESIZE + Max_bs,
+  Sector_size  = 512,
+  Run_bytes    = 256 << 20,
+
+  Feature_ro        = 5,
+  Feature_mq        = 12,
+  Feature_version_1 = 32,
+};
+
+using L4Re::chksys;
+using L4Re::chkcap;
+using L4virtio::Driver::Virtqueue;
+
+/**
+ * The block device, seen from the driver side.
+ */
+class Disk : public L4virtio::Driver::Device
+{
+public:
+  explicit Disk(char const *name)
+  : Device(name, L4VIRTIO_ID_BLOCK)
+  {
+    l4virtio_block_config_t const *bc
+      = device_config<l4virtio_block_config_t>();
+    capacity = bc->capacity * Sector_size;
+    num_queues = 1;
+    if (dev_feature(Feature_mq))
+      num_queues = bc->num_queues;
+    if (num_queues > Max_queues)
+      num_queues = Max_queues;
+    read_only = dev_feature(Feature_ro);
+
+    // one guest IRQ per queue, notification index q is queue q
+    for (unsigned q = 0; q < num_queues; ++q)
+      create_notification_irq(q, &_queue_irq[q]);
+
+    _ring_size = l4_round_page(Virtqueue::total_size(Queue_num));
+    _base = alloc_shared_mem(Max_queues * (_ring_size + Iodepth * Slot_size));
+
+    start();
+  }
+
+  /// Deliver the guest interrupt of queue `q` to the calling thread.
+  void bind(unsigned q)
+  {
+    chksys(_queue_irq[q]->bind_thread(Pthread::L4::cap(pthread_self()), q),
+           "bind queue irq");
+  }
+
+  Virtqueue *queue(unsigned q) { return &_q[q]; }
+
+  /// Request slot s of queue q: header, status byte, then the data.
+  char *slot(unsigned q, unsigned s) const
+  {
+    return _base + Max_queues * _ring_size
+           + (q * Iodepth + s) * Slot_size;
+  }
+
+  void notify(unsigned q)
+  {
+    if (_q[q].notify_host_needed())
+      host_irq()->trigger();
+  }
+
+  void wait(unsigned q)
+  { l4_ipc_receive(_queue_irq[q].cap(), l4_utcb(), L4_IPC_NEVER); }
+
+  l4_uint64_t capacity;
+  unsigned num_queues;
+  bool read_only;
+
+private:
+  void start()
+  {
+    reset();
+
+    if (dev_feature(Feature_version_1))
+      driver_feature(Feature_version_1);
+    if (num_queues > 1)
+      driver_feature(Feature_mq);
+
+    features_ok();
+
+    for (unsigned q = 0; q < num_queues; ++q)
+      config_queue(q, &_q[q], Queue_num, _base + q * _ring_size, q);
+
+    driver_ok();
+  }
+
+  L4Re::Util::Auto_del_cap<L4::Irq>::Cap _queue_irq[Max_queues];
+  char *_base;
+  unsigned long _ring_size;
+  Virtqueue _q[Max_queues];
+};
+
+struct Job
+{
+  Disk *disk;
+  unsigned queue;
+  bool write;
+  bool random;
+  unsigned bs;
+  unsigned long ops;
+  // results
+  unsigned long errors;
+  l4_uint64_t lat_us;
+};
+
+static pthread_barrier_t go;
+
+static void *io_loop(void *arg)
+{
+  Job *j = static_cast<Job *>(arg);
+  Disk *disk = j->disk;
+  Virtqueue *q = disk->queue(j->queue);
+
+  // every queue works on its own part of the disk
+  l4_uint64_t area = disk->capacity / disk->num_queues / j->bs * j->bs;
+  l4_uint64_t first = j->queue * area;
+  l4_uint64_t pos = 0;
+  l4_uint32_t rnd = 0x9e3779b9 * (j->queue + 1);
+
+  unsigned free_slots[Iodepth];
+  unsigned num_free = Iodepth;
+  for (unsigned s = 0; s < Iodepth; ++s)
+    free_slots[s] = s;
+
+  // per head descriptor: slot, tail of the chain, submission time
+  unsigned slot_of[Queue_num];
+  l4_uint16_t tail_of[Queue_num];
+  l4_cpu_time_t start_of[Queue_num];
+
+  unsigned long issued = 0, done = 0;
+
+  disk->bind(j->queue);
+  pthread_barrier_wait(&go);
+
+  while (done < j->ops)
+    {
+      bool progress = false;
+      l4_cpu_time_t now = l4_kip_clock(l4re_kip());
+
+      for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq;
+           progress = true)
+        {
+          char *s = disk->slot(j->queue, slot_of[d]);
+          if (*(l4_uint8_t volatile *)(s + sizeof(l4virtio_block_header_t))
+              != L4VIRTIO_BLOCK_S_OK)
+            ++j->errors;
+
+          j->lat_us += now - start_of[d];
+          free_slots[num_free++] = slot_of[d];
+          q->free_descriptor(d, tail_of[d]);
+          ++done;
+        }
+
+      unsigned n = 0;
+      for (; issued < j->ops && num_free; ++issued, ++n)
+        {
+          l4_uint64_t off;
+          if (j->random)
+            {
+              rnd ^= rnd << 13;
+              rnd ^= rnd >> 17;
+              rnd ^= rnd << 5;
+              off = (rnd % (area / j->bs)) * j->bs;
+            }
+          else
+            {
+              off = pos;
+              pos += j->bs;
+              if (pos >= area)
+                pos = 0;
+            }
+
+          unsigned s = free_slots[--num_free];
+          char *b = disk->slot(j->queue, s);
+          l4virtio_block_header_t *hdr = (l4virtio_block_header_t *)b;
+          l4_uint8_t *status = (l4_uint8_t *)(b + sizeof(*hdr));
+          hdr->type = j->write ? L4VIRTIO_BLOCK_T_OUT : L4VIRTIO_BLOCK_T_IN;
+          hdr->ioprio = 0;
+          hdr->sector = (first + off) / Sector_size;
+          *status = 0xff;
+
+          l4_uint16_t h = q->alloc_descriptor();
+          l4_uint16_t d = q->alloc_descriptor();
+          l4_uint16_t t = q->alloc_descriptor();
+
+          q->desc(h).addr = L4virtio::Ptr<void>((l4_addr_t)hdr);
+          q->desc(h).len = sizeof(*hdr);
+          q->desc(h).flags.raw = 0;
+          q->desc(h).flags.next() = 1;
+          q->desc(h).next = d;
+
+          q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)b + L4_PAGESIZE);
+          q->desc(d).len = j->bs;
+          q->desc(d).flags.raw = 0;
+          q->desc(d).flags.next() = 1;
+          q->desc(d).flags.write() = !j->write;
+          q->desc(d).next = t;
+
+          q->desc(t).addr = L4virtio::Ptr<void>((l4_addr_t)status);
+          q->desc(t).len = 1;
+          q->desc(t).flags.raw = 0;
+          q->desc(t).flags.write() = 1;
+
+          slot_of[h] = s;
+          tail_of[h] = t;
+          start_of[h] = now;
+          q->enqueue_descriptor(h);
+        }
+
+      if (n)
+        disk->notify(j->queue);
+      else if (!progress)
+        disk->wait(j->queue);
+    }
+
+  return 0;
+}
+
+static L4Re::Util::Online_cpus *cpus;
+
+static void run(Disk *disk, bool write, bool random, unsigned bs)
+{
+  Job jobs[Max_queues];
+  pthread_t threads[Max_queues];
+  unsigned nq = disk->num_queues;
+  unsigned long ops = Run_bytes / bs / nq;
+
+  pthread_barrier_init(&go, NULL, nq + 1);
+  for (unsigned i = 0; i < nq; ++i)
+    {
+      jobs[i] = Job{disk, i, write, random, bs, ops, 0, 0};
+      threads[i] = L4Re::Util::start_pinned_thread(io_loop, &jobs[i],
+                                                   (*cpus)[i],
+                                                   "start I/O thread");
+    }
+
+  pthread_barrier_wait(&go);
+  l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+
+  for (unsigned i = 0; i < nq; ++i)
+    pthread_join(threads[i], 0);
+
+  l4_cpu_time_t us = l4_kip_clock(l4re_kip()) - start;
+  if (!us)
+    us = 1;
+  pthread_barrier_destroy(&go);
+
+  unsigned long total = ops * nq, errors = 0;
+  l4_uint64_t lat = 0;
+  for (unsigned i = 0; i < nq; ++i)
+    {
+      errors += jobs[i].errors;
+      lat += jobs[i].lat_us;
+    }
+
+  printf("%s%-5s bs=%2uk: %7llu IOPS %6llu MB/s lat %5llu us%s\n",
+         random ? "rand" : "seq", write ? "write" : "read", bs >> 10,
+         total * 1000000ULL / us, total * bs / us, lat / total,
+         errors ? " (errors)" : "");
+}
+
+int main()
+{
+  try
+    {
+      Disk disk("disk");
+
+      L4Re::Util::Online_cpus online;
+      cpus = &online;
+
+      printf("%u CPUs, %llu MiB disk, %u queue(s), iodepth %u\n",
+             online.num(), disk.capacity >> 20, disk.num_queues,
+             (unsigned)Iodepth);
+
+      if (disk.capacity < (l4_uint64_t)disk.num_queues * Max_bs)
+        chksys(-L4_ERANGE, "disk too small");
+
+      static unsigned const block_sizes[] = { 4 << 10, Max_bs };
+      for (unsigned bs : block_sizes)
+        for (int random = 0; random < 2; ++random)
+          {
+            if (!disk.read_only)
+              run(&disk, true, random, bs);
+            run(&disk, false, random, bs);
+          }
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      printf("error: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
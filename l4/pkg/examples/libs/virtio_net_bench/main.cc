@@ -0,0 +1,233 @@
+/**
+ * \file
+ * \brief Packet rate over a virtio-net link with and without event indices.
+ *
+ * Drives the two ports of a virtio-net point-to-point link (l4vio_net_p2p)
+ * as minimal virtio drivers: the main thread sends small packets on "port0",
+ * a second thread receives them on "port1" and recycles the buffers.  The
+ * run is done once with VIRTIO_RING_F_EVENT_IDX negotiated and once with
+ * the notification flags only, reporting the packet rate and the number of
+ * notifications needed per packet in each direction.
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/l4virtio/client/l4virtio>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/sys/kip.h>
+#include <pthread-l4.h>
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+
+enum
+{
+  Num_pkts  = 1 << 20,
+  Pkt_size  = 64,
+  Hdr_size  = 12,   // struct virtio_net_hdr with num_buffers
+  Buf_size  = 2048,
+  Queue_num = 256,
+  Rx = 0,
+  Tx = 1,
+
+  Feature_event_idx = 29,
+  Feature_version_1 = 32,
+};
+
+using L4Re::chksys;
+using L4virtio::Driver::Virtqueue;
+
+/**
+ * One port of the link, seen from the driver side.
+ */
+class Port : public L4virtio::Driver::Device
+{
+public:
+  explicit Port(char const *name)
+  : Device(name)
+  {
+    _ring_size = l4_round_page(Virtqueue::total_size(Queue_num));
+    _base = alloc_shared_mem(2 * _ring_size + 2 * Queue_num * Buf_size);
+  }
+
+  /// (Re-)negotiate the features and set up both queues.
+  void start(bool event_idx)
+  {
+    reset();
+
+    if (!dev_feature(Feature_version_1))
+      chksys(-L4_ENODEV, "virtio 1.0 device");
+
+    event_idx = event_idx && dev_feature(Feature_event_idx);
+
+    driver_feature(Feature_version_1);
+    if (event_idx)
+      driver_feature(Feature_event_idx);
+
+    features_ok();
+
+    for (unsigned q = 0; q < 2; ++q)
+      {
+        config_queue(q, &_q[q], Queue_num, _base + q * _ring_size);
+        _q[q].event_index(event_idx);
+      }
+
+    driver_ok();
+
+    kicks = irqs = 0;
+  }
+
+  /// Deliver the guest interrupt to the calling thread.
+  void bind(L4::Cap<L4::Thread> thread)
+  { chksys(guest_irq()->bind_thread(thread, 0), "bind guest irq"); }
+
+  Virtqueue *queue(unsigned q) { return &_q[q]; }
+
+  /// Buffer of descriptor d of queue q.
+  char *buf(unsigned q, l4_uint16_t d) const
+  { return _base + 2 * _ring_size + (q * Queue_num + d) * Buf_size; }
+
+  /// Notify the device about new buffers in q, if it wants to know.
+  void notify(unsigned q)
+  {
+    if (!_q[q].notify_host_needed())
+      return;
+
+    host_irq()->trigger();
+    ++kicks;
+  }
+
+  void wait()
+  {
+    l4_ipc_receive(guest_irq().cap(), l4_utcb(), L4_IPC_NEVER);
+    ++irqs;
+  }
+
+  unsigned long kicks;
+  unsigned long irqs;
+
+private:
+  char *_base;
+  unsigned long _ring_size;
+  Virtqueue _q[2];
+};
+
+static void *receiver(void *arg)
+{
+  Port *p = static_cast<Port *>(arg);
+  Virtqueue *q = p->queue(Rx);
+  unsigned long received = 0;
+
+  p->bind(Pthread::L4::cap(pthread_self()));
+
+  for (unsigned i = 0; i < Queue_num; ++i)
+    {
+      l4_uint16_t d = q->alloc_descriptor();
+      q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)p->buf(Rx, d));
+      q->desc(d).len = Buf_size;
+      q->desc(d).flags.raw = 0;
+      q->desc(d).flags.write() = 1;
+      q->enqueue_descriptor(d);
+    }
+  p->notify(Rx);
+
+  while (received < Num_pkts)
+    {
+      bool got = false;
+      for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq; got = true)
+        {
+          ++received;
+          q->enqueue_descriptor(d);
+        }
+
+      if (got)
+        p->notify(Rx);
+      else
+        p->wait();
+    }
+
+  return 0;
+}
+
+static void run(Port *tx, Port *rx, bool event_idx)
+{
+  Virtqueue *q = tx->queue(Tx);
+  unsigned long sent = 0, done = 0;
+  pthread_t thread;
+
+  rx->start(event_idx);
+  tx->start(event_idx);
+  tx->bind(Pthread::L4::cap(pthread_self()));
+
+  l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+  if (pthread_create(&thread, 0, receiver, rx))
+    chksys(-L4_ENOMEM, "create receiver");
+
+  while (done < Num_pkts)
+    {
+      bool progress = false;
+
+      for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq;
+           progress = true)
+        {
+          q->free_descriptor(d, d);
+          ++done;
+        }
+
+      unsigned n = 0;
+      for (l4_uint16_t d; sent < Num_pkts
+                          && (d = q->alloc_descriptor()) != Virtqueue::Eoq;
+           ++sent, ++n)
+        {
+          char *b = tx->buf(Tx, d);
+          memset(b, 0, Hdr_size);
+          memset(b + Hdr_size, 0xff, 12); // broadcast, no source
+          q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)b);
+          q->desc(d).len = Hdr_size + Pkt_size;
+          q->desc(d).flags.raw = 0;
+          q->enqueue_descriptor(d);
+        }
+
+      if (n)
+        tx->notify(Tx);
+      else if (!progress)
+        tx->wait();
+    }
+
+  pthread_join(thread, 0);
+  l4_cpu_time_t us = l4_kip_clock(l4re_kip()) - start;
+  if (!us)
+    us = 1;
+
+  printf("event index %s: %u packets in %llu us, %llu kpkt/s\n",
+         event_idx ? "on " : "off", Num_pkts, us, Num_pkts * 1000ULL / us);
+  printf("  tx: %lu kicks (%lu.%03lu/pkt), %lu irqs (%lu.%03lu/pkt)\n",
+         tx->kicks, tx->kicks / Num_pkts, tx->kicks * 1000 / Num_pkts % 1000,
+         tx->irqs, tx->irqs / Num_pkts, tx->irqs * 1000 / Num_pkts % 1000);
+  printf("  rx: %lu kicks (%lu.%03lu/pkt), %lu irqs (%lu.%03lu/pkt)\n",
+         rx->kicks, rx->kicks / Num_pkts, rx->kicks * 1000 / Num_pkts % 1000,
+         rx->irqs, rx->irqs / Num_pkts, rx->irqs * 1000 / Num_pkts % 1000);
+}
+
+int main()
+{
+  try
+    {
+      Port tx("port0");
+      Port rx("port1");
+
+      run(&tx, &rx, false);
+      run(&tx, &rx, true);
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      printf("error: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
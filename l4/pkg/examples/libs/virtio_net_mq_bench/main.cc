@@ -0,0 +1,372 @@
+/**
+ * \file
+ * \brief Aggregate packet rate over a multi-queue virtio-net link.
+ *
+ * Drives the two ports of l4vio_net_p2p started with several queue pairs
+ * as minimal virtio drivers with VIRTIO_NET_F_MQ.  Every queue has its own
+ * notification IRQs in both directions.  For 1, 2, 4 and 8 queue pairs the
+ * number of pairs is set through the control queue, then one thread per
+ * pair sends small packets on "port0" and one receives them on "port1",
+ * each pinned to its own CPU.  The aggregate packet rate is reported.
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/l4virtio/client/l4virtio>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/cap_alloc>
+#include <l4/re/util/pinned_thread>
+#include <l4/sys/kip.h>
+#include <pthread-l4.h>
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+
+enum
+{
+  Max_pairs = 8,
+  Num_pkts  = 1 << 20,
+  Pkt_size  = 64,
+  Hdr_size  = 12,   // struct virtio_net_hdr with num_buffers
+  Buf_size  = 256,
+  Queue_num = 256,
+  Rx = 0,
+  Tx = 1,
+  Max_queues = 2 * Max_pairs + 1,
+
+  Feature_ctrl_vq   = 17,
+  Feature_mq        = 22,
+  Feature_event_idx = 29,
+  Feature_version_1 = 32,
+
+  Ctrl_mq              = 4,
+  Ctrl_mq_vq_pairs_set = 0,
+};
+
+using L4Re::chksys;
+using L4Re::chkcap;
+using L4virtio::Driver::Virtqueue;
+
+struct Net_config
+{
+  l4_uint8_t mac[6];
+  l4_uint16_t status;
+  l4_uint16_t max_virtqueue_pairs;
+};
+
+/**
+ * One port of the link, seen from the driver side.
+ */
+class Port : public L4virtio::Driver::Device
+{
+public:
+  explicit Port(char const *name)
+  : Device(name)
+  {
+    if (!dev_feature(Feature_mq))
+      chksys(-L4_ENODEV, "multi-queue device, start l4vio_net_p2p with -q");
+
+    num_pairs = device_config<Net_config>()->max_virtqueue_pairs;
+    if (num_pairs > Max_pairs)
+      num_pairs = Max_pairs;
+
+    // one guest IRQ per pair, notification index i is pair i
+    for (unsigned i = 0; i < num_pairs; ++i)
+      create_notification_irq(i, &_pair_irq[i]);
+
+    _ring_size = l4_round_page(Virtqueue::total_size(Queue_num));
+    unsigned long size = Max_queues * _ring_size
+                         + 2 * Max_pairs * Queue_num * Buf_size + L4_PAGESIZE;
+    _base = alloc_shared_mem(size);
+    _ctrl_buf = _base + size - L4_PAGESIZE;
+  }
+
+  /// (Re-)negotiate the features and set up `pairs` queue pairs.
+  void start(unsigned pairs)
+  {
+    reset();
+
+    if (!dev_feature(Feature_version_1))
+      chksys(-L4_ENODEV, "virtio 1.0 device");
+
+    bool event_idx = dev_feature(Feature_event_idx);
+
+    driver_feature(Feature_version_1);
+    driver_feature(Feature_mq);
+    driver_feature(Feature_ctrl_vq);
+    if (event_idx)
+      driver_feature(Feature_event_idx);
+
+    features_ok();
+
+    for (unsigned q = 0; q < 2 * pairs; ++q)
+      setup_queue(q, q, q / 2, event_idx);
+
+    // control completions arrive on the guest IRQ of register_iface()
+    setup_queue(Max_queues - 1, 2 * num_pairs, num_pairs, event_idx);
+
+    driver_ok();
+
+    set_pairs(pairs);
+  }
+
+  /// Deliver the guest interrupt of `pair` to the calling thread.
+  void bind(unsigned pair)
+  {
+    chksys(_pair_irq[pair]->bind_thread(Pthread::L4::cap(pthread_self()),
+                                        pair),
+           "bind pair irq");
+  }
+
+  Virtqueue *queue(unsigned q) { return &_q[q]; }
+
+  /// Buffer of descriptor d of queue q.
+  char *buf(unsigned q, l4_uint16_t d) const
+  {
+    return _base + Max_queues * _ring_size
+           + (q * Queue_num + d) * Buf_size;
+  }
+
+  /// Notify the device about new buffers in q, if it wants to know.
+  void notify(unsigned q)
+  {
+    if (_q[q].notify_host_needed())
+      _notify[q]->trigger();
+  }
+
+  void wait(unsigned pair)
+  { l4_ipc_receive(_pair_irq[pair].cap(), l4_utcb(), L4_IPC_NEVER); }
+
+  unsigned num_pairs;
+
+private:
+  /**
+   * Set up driver queue `slot` as device queue `qn`, with notification
+   * index `notify` for device-to-driver notifications.
+   */
+  void setup_queue(unsigned slot, unsigned qn, unsigned notify, bool event_idx)
+  {
+    unsigned idx = config_queue(qn, &_q[slot], Queue_num,
+                                _base + slot * _ring_size, notify);
+    _q[slot].event_index(event_idx);
+
+    if (idx >= Max_queues)
+      chksys(-L4_ERANGE, "device notification index");
+
+    if (!_dev_irq[idx].is_valid())
+      {
+        _dev_irq[idx] = chkcap(L4Re::Util::cap_alloc.alloc<L4::Irq>(),
+                               "allocate device irq cap");
+        chksys(dev()->device_notification_irq(idx, _dev_irq[idx].get()),
+               "get device notification irq");
+      }
+    _notify[slot] = _dev_irq[idx].get();
+  }
+
+  /// Enable `pairs` queue pairs with VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET.
+  void set_pairs(unsigned pairs)
+  {
+    Virtqueue *q = &_q[Max_queues - 1];
+    l4_uint8_t *cmd = (l4_uint8_t *)_ctrl_buf;
+    l4_uint8_t *ack = cmd + 4;
+
+    cmd[0] = Ctrl_mq;
+    cmd[1] = Ctrl_mq_vq_pairs_set;
+    cmd[2] = pairs & 0xff;
+    cmd[3] = pairs >> 8;
+    *ack = 0xff;
+
+    l4_uint16_t d = q->alloc_descriptor();
+    l4_uint16_t a = q->alloc_descriptor();
+    q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)cmd);
+    q->desc(d).len = 4;
+    q->desc(d).flags.raw = 0;
+    q->desc(d).flags.next() = 1;
+    q->desc(d).next = a;
+    q->desc(a).addr = L4virtio::Ptr<void>((l4_addr_t)ack);
+    q->desc(a).len = 1;
+    q->desc(a).flags.raw = 0;
+    q->desc(a).flags.write() = 1;
+    q->enqueue_descriptor(d);
+    _notify[Max_queues - 1]->trigger();
+
+    l4_uint16_t u;
+    while ((u = q->find_next_used()) == Virtqueue::Eoq)
+      l4_ipc_receive(guest_irq().cap(), l4_utcb(), L4_IPC_NEVER);
+    q->free_descriptor(u, a);
+
+    if (*ack != 0)
+      chksys(-L4_EINVAL, "set number of queue pairs");
+  }
+
+  L4Re::Util::Auto_del_cap<L4::Irq>::Cap _pair_irq[Max_pairs];
+  L4Re::Util::Auto_cap<L4::Irq>::Cap _dev_irq[Max_queues];
+  L4::Cap<L4::Irq> _notify[Max_queues];
+  char *_base;
+  char *_ctrl_buf;
+  unsigned long _ring_size;
+  Virtqueue _q[Max_queues];
+};
+
+struct Job
+{
+  Port *port;
+  unsigned pair;
+  unsigned long pkts;
+};
+
+static pthread_barrier_t go;
+
+static void *receiver(void *arg)
+{
+  Job *j = static_cast<Job *>(arg);
+  Port *p = j->port;
+  unsigned qn = 2 * j->pair + Rx;
+  Virtqueue *q = p->queue(qn);
+  unsigned long received = 0;
+
+  p->bind(j->pair);
+
+  for (unsigned i = 0; i < Queue_num; ++i)
+    {
+      l4_uint16_t d = q->alloc_descriptor();
+      q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)p->buf(qn, d));
+      q->desc(d).len = Buf_size;
+      q->desc(d).flags.raw = 0;
+      q->desc(d).flags.write() = 1;
+      q->enqueue_descriptor(d);
+    }
+  p->notify(qn);
+
+  pthread_barrier_wait(&go);
+
+  while (received < j->pkts)
+    {
+      bool got = false;
+      for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq; got = true)
+        {
+          ++received;
+          q->enqueue_descriptor(d);
+        }
+
+      if (got)
+        p->notify(qn);
+      else
+        p->wait(j->pair);
+    }
+
+  return 0;
+}
+
+static void *sender(void *arg)
+{
+  Job *j = static_cast<Job *>(arg);
+  Port *p = j->port;
+  unsigned qn = 2 * j->pair + Tx;
+  Virtqueue *q = p->queue(qn);
+  unsigned long sent = 0, done = 0;
+
+  p->bind(j->pair);
+  pthread_barrier_wait(&go);
+
+  while (done < j->pkts)
+    {
+      bool progress = false;
+
+      for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq;
+           progress = true)
+        {
+          q->free_descriptor(d, d);
+          ++done;
+        }
+
+      unsigned n = 0;
+      for (l4_uint16_t d; sent < j->pkts
+                          && (d = q->alloc_descriptor()) != Virtqueue::Eoq;
+           ++sent, ++n)
+        {
+          char *b = p->buf(qn, d);
+          memset(b, 0, Hdr_size);
+          memset(b + Hdr_size, 0xff, 12); // broadcast, no source
+          q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)b);
+          q->desc(d).len = Hdr_size + Pkt_size;
+          q->desc(d).flags.raw = 0;
+          q->enqueue_descriptor(d);
+        }
+
+      if (n)
+        p->notify(qn);
+      else if (!progress)
+        p->wait(j->pair);
+    }
+
+  return 0;
+}
+
+static L4Re::Util::Online_cpus *cpus;
+
+static void run(Port *tx, Port *rx, unsigned pairs)
+{
+  Job jobs[2 * Max_pairs];
+  pthread_t threads[2 * Max_pairs];
+
+  rx->start(pairs);
+  tx->start(pairs);
+
+  pthread_barrier_init(&go, NULL, 2 * pairs + 1);
+  for (unsigned i = 0; i < pairs; ++i)
+    {
+      jobs[2 * i]     = Job{rx, i, Num_pkts / pairs};
+      jobs[2 * i + 1] = Job{tx, i, Num_pkts / pairs};
+      threads[2 * i]
+        = L4Re::Util::start_pinned_thread(receiver, &jobs[2 * i],
+                                          (*cpus)[2 * i], "start receiver");
+      threads[2 * i + 1]
+        = L4Re::Util::start_pinned_thread(sender, &jobs[2 * i + 1],
+                                          (*cpus)[2 * i + 1], "start sender");
+    }
+
+  pthread_barrier_wait(&go);
+  l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+
+  for (unsigned i = 0; i < 2 * pairs; ++i)
+    pthread_join(threads[i], 0);
+
+  l4_cpu_time_t us = l4_kip_clock(l4re_kip()) - start;
+  if (!us)
+    us = 1;
+  pthread_barrier_destroy(&go);
+
+  unsigned long total = Num_pkts / pairs * pairs;
+  printf("%u queue pair(s): %lu packets in %llu us, %llu kpkt/s\n",
+         pairs, total, us, total * 1000ULL / us);
+}
+
+int main()
+{
+  try
+    {
+      Port tx("port0");
+      Port rx("port1");
+
+      L4Re::Util::Online_cpus online;
+      cpus = &online;
+
+      printf("%u CPUs, link with %u queue pairs\n", online.num(),
+             tx.num_pairs);
+
+      for (unsigned pairs = 1; pairs <= tx.num_pairs; pairs *= 2)
+        run(&tx, &rx, pairs);
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      printf("error: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
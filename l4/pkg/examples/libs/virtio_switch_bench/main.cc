@@ -0,0 +1,328 @@
+/**
+ * \file
+ * \brief Throughput and latency through the multi-port virtio-net switch.
+ *
+ * Drives the ports "port0" ... "port<n-1>" of l4vio_switch as minimal
+ * virtio drivers, one thread per port.  All ports first send a broadcast
+ * so the switch learns their addresses.  Then port 2i streams small
+ * unicast packets to port 2i+1, all pairs at the same time, and the
+ * aggregate packet rate is reported.  Finally port0 and port1 exchange
+ * single packets to measure the round trip through the switch.
+ * Usage: ex_virtio_switch_bench [number of ports]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/l4virtio/client/l4virtio>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/sys/kip.h>
+#include <pthread-l4.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+enum
+{
+  Max_ports = 16,
+  Num_pkts  = 1 << 19,
+  Num_pings = 1 << 14,
+  Pkt_size  = 64,
+  Hdr_size  = 12,   // struct virtio_net_hdr with num_buffers
+  Buf_size  = 2048,
+  Queue_num = 256,
+  Rx = 0,
+  Tx = 1,
+
+  Feature_event_idx = 29,
+  Feature_mrg_rxbuf = 15,
+  Feature_version_1 = 32,
+};
+
+using L4Re::chksys;
+using L4virtio::Driver::Virtqueue;
+
+/**
+ * One port of the switch, seen from the driver side.
+ */
+class Port : public L4virtio::Driver::Device
+{
+public:
+  Port(char const *name, unsigned index)
+  : Device(name), kicks(0), irqs(0)
+  {
+    _ring_size = l4_round_page(Virtqueue::total_size(Queue_num));
+    _base = alloc_shared_mem(2 * _ring_size + 2 * Queue_num * Buf_size);
+
+    // locally administered unicast address
+    static unsigned char const prefix[] = { 0x02, 0, 0, 0, 0 };
+    memcpy(mac, prefix, sizeof(prefix));
+    mac[5] = index;
+
+    start();
+  }
+
+  /// Negotiate the features, set up both queues and post receive buffers.
+  void start()
+  {
+    reset();
+
+    if (!dev_feature(Feature_version_1))
+      chksys(-L4_ENODEV, "virtio 1.0 device");
+
+    driver_feature(Feature_version_1);
+    bool event_idx = dev_feature(Feature_event_idx);
+    if (event_idx)
+      driver_feature(Feature_event_idx);
+    if (dev_feature(Feature_mrg_rxbuf))
+      driver_feature(Feature_mrg_rxbuf);
+
+    features_ok();
+
+    for (unsigned q = 0; q < 2; ++q)
+      {
+        config_queue(q, &_q[q], Queue_num, _base + q * _ring_size);
+        _q[q].event_index(event_idx);
+      }
+
+    driver_ok();
+
+    Virtqueue *q = &_q[Rx];
+    for (l4_uint16_t d; (d = q->alloc_descriptor()) != Virtqueue::Eoq; )
+      {
+        q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)buf(Rx, d));
+        q->desc(d).len = Buf_size;
+        q->desc(d).flags.raw = 0;
+        q->desc(d).flags.write() = 1;
+        q->enqueue_descriptor(d);
+      }
+    notify(Rx);
+  }
+
+  /// Deliver the guest interrupt to the calling thread.
+  void bind(L4::Cap<L4::Thread> thread)
+  { chksys(guest_irq()->bind_thread(thread, 0), "bind guest irq"); }
+
+  /**
+   * Queue a packet to `dst`, without notifying the switch.
+   *
+   * \return false if all transmit descriptors are in use.
+   */
+  bool queue(unsigned char const *dst)
+  {
+    Virtqueue *q = &_q[Tx];
+    l4_uint16_t d = q->alloc_descriptor();
+    if (d == Virtqueue::Eoq)
+      return false;
+
+    char *b = buf(Tx, d);
+    memset(b, 0, Hdr_size);
+    memcpy(b + Hdr_size, dst, 6);
+    memcpy(b + Hdr_size + 6, mac, 6);
+    q->desc(d).addr = L4virtio::Ptr<void>((l4_addr_t)b);
+    q->desc(d).len = Hdr_size + Pkt_size;
+    q->desc(d).flags.raw = 0;
+    q->enqueue_descriptor(d);
+    return true;
+  }
+
+  /// Reclaim sent packets, return their number.
+  unsigned reclaim()
+  {
+    Virtqueue *q = &_q[Tx];
+    unsigned n = 0;
+    for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq; ++n)
+      q->free_descriptor(d, d);
+    return n;
+  }
+
+  /**
+   * Receive packets and repost their buffers.
+   *
+   * \param src  If not NULL, the source address of the last packet.
+   * \return The number of packets received.
+   */
+  unsigned receive(unsigned char *src = 0)
+  {
+    Virtqueue *q = &_q[Rx];
+    unsigned n = 0;
+    for (l4_uint16_t d; (d = q->find_next_used()) != Virtqueue::Eoq; ++n)
+      {
+        if (src)
+          memcpy(src, buf(Rx, d) + Hdr_size + 6, 6);
+        q->enqueue_descriptor(d);
+      }
+
+    if (n)
+      notify(Rx);
+    return n;
+  }
+
+  /// Notify the switch about new buffers in q, if it wants to know.
+  void notify(unsigned q)
+  {
+    if (!_q[q].notify_host_needed())
+      return;
+
+    host_irq()->trigger();
+    ++kicks;
+  }
+
+  void wait()
+  {
+    l4_ipc_receive(guest_irq().cap(), l4_utcb(), L4_IPC_NEVER);
+    ++irqs;
+  }
+
+  unsigned char mac[6];
+  unsigned long kicks;
+  unsigned long irqs;
+
+private:
+  /// Buffer of descriptor d of queue q.
+  char *buf(unsigned q, l4_uint16_t d) const
+  { return _base + 2 * _ring_size + (q * Queue_num + d) * Buf_size; }
+
+  char *_base;
+  unsigned long _ring_size;
+  Virtqueue _q[2];
+};
+
+static unsigned num_ports;
+static Port *ports[Max_ports];
+static pthread_barrier_t phase;
+static unsigned char const broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+/// Send n packets to dst, return once the switch has taken all of them.
+static void stream(Port *p, unsigned char const *dst, unsigned long n)
+{
+  unsigned long sent = 0, done = 0;
+
+  while (done < n)
+    {
+      unsigned freed = p->reclaim();
+      done += freed;
+
+      unsigned queued = 0;
+      for (; sent < n && p->queue(dst); ++sent)
+        ++queued;
+
+      if (queued)
+        p->notify(Tx);
+      else if (!freed && done < n)
+        p->wait();
+    }
+}
+
+/// Receive n packets, sent packets are reclaimed on the way.
+static void drain(Port *p, unsigned long n, unsigned char *src = 0)
+{
+  unsigned long received = 0;
+
+  while (received < n)
+    {
+      unsigned got = p->receive(src);
+      received += got;
+      if (!got && !p->reclaim())
+        p->wait();
+    }
+}
+
+static void *port_thread(void *arg)
+{
+  unsigned i = (unsigned long)arg;
+  Port *p = ports[i];
+  unsigned char peer[6];
+
+  p->bind(Pthread::L4::cap(pthread_self()));
+
+  // learning: everybody receives the broadcasts of all other ports
+  stream(p, broadcast, 1);
+  drain(p, num_ports - 1);
+  pthread_barrier_wait(&phase);
+
+  // throughput: even ports send to their odd neighbours
+  if (i % 2 == 0)
+    stream(p, ports[i + 1]->mac, Num_pkts);
+  else
+    drain(p, Num_pkts);
+  pthread_barrier_wait(&phase);
+
+  // latency: port0 pings port1
+  if (i == 0)
+    for (unsigned n = 0; n < Num_pings; ++n)
+      {
+        stream(p, ports[1]->mac, 1);
+        drain(p, 1);
+      }
+  else if (i == 1)
+    for (unsigned n = 0; n < Num_pings; ++n)
+      {
+        drain(p, 1, peer);
+        stream(p, peer, 1);
+      }
+  pthread_barrier_wait(&phase);
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  num_ports = argc > 1 ? atoi(argv[1]) : 4;
+  if (num_ports < 2 || num_ports > Max_ports || num_ports % 2)
+    {
+      printf("usage: %s [even number of ports <= %u]\n", argv[0], Max_ports);
+      return 1;
+    }
+
+  try
+    {
+      pthread_t threads[Max_ports];
+      char name[16];
+
+      for (unsigned i = 0; i < num_ports; ++i)
+        {
+          snprintf(name, sizeof(name), "port%u", i);
+          ports[i] = new Port(name, i);
+        }
+
+      pthread_barrier_init(&phase, NULL, num_ports + 1);
+      for (unsigned i = 0; i < num_ports; ++i)
+        if (pthread_create(&threads[i], 0, port_thread, (void *)(unsigned long)i))
+          chksys(-L4_ENOMEM, "create port thread");
+
+      pthread_barrier_wait(&phase);
+      l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+      pthread_barrier_wait(&phase);
+      l4_cpu_time_t us = l4_kip_clock(l4re_kip()) - start;
+      if (!us)
+        us = 1;
+
+      unsigned long total = Num_pkts * (num_ports / 2);
+      printf("%u ports, %u pairs: %lu packets in %llu us, %llu kpkt/s\n",
+             num_ports, num_ports / 2, total, us, total * 1000ULL / us);
+
+      start = l4_kip_clock(l4re_kip());
+      pthread_barrier_wait(&phase);
+      printf("round trip: %llu ns\n",
+             (l4_kip_clock(l4re_kip()) - start) * 1000ULL / Num_pings);
+
+      for (unsigned i = 0; i < num_ports; ++i)
+        {
+          pthread_join(threads[i], 0);
+          printf("  port%u: %lu kicks, %lu irqs\n", i, ports[i]->kicks,
+                 ports[i]->irqs);
+        }
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      printf("error: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
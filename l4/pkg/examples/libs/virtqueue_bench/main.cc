@@ -0,0 +1,239 @@
+/**
+ * \file
+ * \brief Split versus packed virtqueue layout.
+ *
+ * A driver thread on CPU 0 and a device thread on CPU 1 exchange requests
+ * over a virtqueue in shared memory, both polling.  For each layout the
+ * benchmark measures the request rate with a full queue and the round
+ * trip of a single request.  The round trip is dominated by the cache
+ * lines that move between the two CPUs per request: the split layout
+ * touches the descriptor table, the available ring and the used ring, the
+ * packed layout only the descriptor itself.
+ * Usage: ex_virtqueue_bench [requests]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/l4virtio/server/virtio>
+#include <l4/l4virtio/virtqueue>
+#include <l4/re/env>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using L4virtio::Svr::Request_processor;
+
+enum
+{
+  Queue_num = 256,
+  Ring_size = 16 * 1024,
+  Buf_size  = 1500,
+};
+
+static char ring_mem[Ring_size] __attribute__((aligned(4096)));
+static unsigned requests = 1 << 22;
+static unsigned stop;
+
+static l4_cpu_time_t now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+static void pin(unsigned cpu)
+{
+  cpu_set_t s;
+  CPU_ZERO(&s);
+  CPU_SET(cpu, &s);
+  pthread_setaffinity_np(pthread_self(), sizeof(s), &s);
+}
+
+/// Descriptor manager that just reads the descriptors.
+struct Desc_reader
+{
+  void load_desc(L4virtio::Virtqueue::Desc const &, Request_processor const *,
+                 L4virtio::Virtqueue::Desc const **)
+  {
+    printf("unexpected indirect descriptor\n");
+    exit(1);
+  }
+
+  void load_desc(L4virtio::Virtqueue::Desc const &d, Request_processor const *,
+                 l4_uint32_t *len)
+  { *len += d.len; }
+};
+
+/// Driver side with the split layout.
+struct Split_driver
+{
+  L4virtio::Driver::Virtqueue q;
+
+  void init()
+  { q.init_queue(Queue_num, ring_mem); }
+
+  bool add()
+  {
+    l4_uint16_t d = q.alloc_descriptor();
+    if (d == L4virtio::Driver::Virtqueue::Eoq)
+      return false;
+
+    q.desc(d).addr = L4virtio::Ptr<void>(0);
+    q.desc(d).len = Buf_size;
+    q.desc(d).flags.raw = 0;
+    q.enqueue_descriptor(d);
+    return true;
+  }
+
+  bool get()
+  {
+    l4_uint32_t len;
+    l4_uint16_t d = q.find_next_used(&len);
+    if (d == L4virtio::Driver::Virtqueue::Eoq)
+      return false;
+
+    q.free_descriptor(d, d);
+    return true;
+  }
+};
+
+/// Device side with the split layout.
+struct Split_device
+{
+  L4virtio::Svr::Virtqueue q;
+
+  void init(Split_driver *drv)
+  {
+    q.setup(Queue_num, ring_mem, ring_mem + drv->q.avail_offset(),
+            ring_mem + drv->q.used_offset());
+  }
+};
+
+/// Driver side with the packed layout.
+struct Packed_driver
+{
+  L4virtio::Driver::Packed_virtqueue q;
+
+  void init()
+  { q.init_queue(Queue_num, ring_mem); }
+
+  bool add()
+  {
+    L4virtio::Driver::Packed_virtqueue::Buffer b = { 0, Buf_size, false };
+    return q.enqueue(&b, 1) != L4virtio::Driver::Packed_virtqueue::Eoq;
+  }
+
+  bool get()
+  {
+    l4_uint32_t len;
+    return q.find_next_used(&len) != L4virtio::Driver::Packed_virtqueue::Eoq;
+  }
+};
+
+/// Device side with the packed layout.
+struct Packed_device
+{
+  L4virtio::Svr::Packed_virtqueue q;
+
+  void init(Packed_driver *drv)
+  {
+    q.setup(Queue_num, ring_mem, ring_mem + drv->q.driver_event_offset(),
+            ring_mem + drv->q.device_event_offset());
+  }
+};
+
+template<typename DEV>
+static void *device_fn(void *arg)
+{
+  DEV *dev = static_cast<DEV *>(arg);
+  Desc_reader dm;
+  Request_processor p;
+
+  pin(1);
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+    {
+      auto r = dev->q.next_avail();
+      if (!r.valid())
+        continue;
+
+      l4_uint32_t len = 0;
+      p.start(&dm, r, &len);
+      while (p.next(&dm, &len))
+        ;
+      dev->q.consumed(r, len);
+    }
+
+  return 0;
+}
+
+template<typename DRV, typename DEV>
+static void run(char const *name)
+{
+  DRV drv;
+  DEV dev;
+  pthread_t thread;
+
+  memset(ring_mem, 0, sizeof(ring_mem));
+  drv.init();
+  dev.init(&drv);
+
+  __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+  if (pthread_create(&thread, NULL, device_fn<DEV>, &dev))
+    {
+      printf("pthread_create failed\n");
+      exit(1);
+    }
+
+  // keep the queue full
+  unsigned sent = 0, done = 0;
+  l4_cpu_time_t start = now_us();
+  while (done < requests)
+    {
+      while (drv.get())
+        ++done;
+      while (sent < requests && drv.add())
+        ++sent;
+    }
+  l4_cpu_time_t stream = now_us() - start;
+
+  // one request in flight
+  unsigned pings = requests / 16;
+  start = now_us();
+  for (unsigned i = 0; i < pings; ++i)
+    {
+      drv.add();
+      while (!drv.get())
+        ;
+    }
+  l4_cpu_time_t rtt = now_us() - start;
+
+  __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+
+  if (!stream)
+    stream = 1;
+  printf("%-6s: %llu kreq/s, %llu ns/req streaming, %llu ns round trip\n",
+         name, requests * 1000ULL / stream, stream * 1000ULL / requests,
+         rtt * 1000ULL / pings);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1)
+    requests = strtoul(argv[1], NULL, 0);
+
+  if (L4virtio::Packed_virtqueue::total_size(Queue_num) > Ring_size
+      || L4virtio::Virtqueue::total_size(Queue_num) > Ring_size)
+    {
+      printf("ring memory too small\n");
+      return 1;
+    }
+
+  pin(0);
+  run<Split_driver, Split_device>("split");
+  run<Packed_driver, Packed_device>("packed");
+  return 0;
+}
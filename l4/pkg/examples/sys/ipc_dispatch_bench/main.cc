@@ -0,0 +1,117 @@
+/**
+ * \file
+ * \brief Server-side RPC dispatch benchmark.
+ *
+ * Measures the cost of dispatching a message to the op_ function of a
+ * server object, without the IPC itself, for the first, a middle and the
+ * last RPC of an interface with many operations.  One interface uses dense
+ * opcodes, the other sparse ones.
+ * Usage: ex_ipc_dispatch_bench [iterations]
+ */
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include <l4/re/env.h>
+#include <l4/sys/cxx/ipc_epiface>
+#include <l4/sys/kip.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPS(X) \
+  X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  \
+  X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15) \
+  X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23)
+
+#define DENSE_RPC(n)  L4_INLINE_RPC(long, op##n, (l4_umword_t x));
+#define SPARSE_RPC(n) L4_INLINE_RPC_OP(n * 7 + 3, long, op##n, (l4_umword_t x));
+#define SVR_OP(n)     long op_op##n(Rights, l4_umword_t x) { return x + n; }
+
+struct Dense : L4::Kobject_t<Dense, L4::Kobject, 0x46>
+{
+  OPS(DENSE_RPC)
+  typedef L4::Typeid::Rpcs<
+    op0_t,  op1_t,  op2_t,  op3_t,  op4_t,  op5_t,  op6_t,  op7_t,
+    op8_t,  op9_t,  op10_t, op11_t, op12_t, op13_t, op14_t, op15_t,
+    op16_t, op17_t, op18_t, op19_t, op20_t, op21_t, op22_t, op23_t> Rpcs;
+};
+
+struct Sparse : L4::Kobject_t<Sparse, L4::Kobject, 0x47>
+{
+  OPS(SPARSE_RPC)
+  typedef L4::Typeid::Rpcs<
+    op0_t,  op1_t,  op2_t,  op3_t,  op4_t,  op5_t,  op6_t,  op7_t,
+    op8_t,  op9_t,  op10_t, op11_t, op12_t, op13_t, op14_t, op15_t,
+    op16_t, op17_t, op18_t, op19_t, op20_t, op21_t, op22_t, op23_t> Rpcs;
+};
+
+struct Dense_svr : L4::Epiface_t<Dense_svr, Dense>
+{
+  typedef Dense::Rights Rights;
+  OPS(SVR_OP)
+};
+
+struct Sparse_svr : L4::Epiface_t<Sparse_svr, Sparse>
+{
+  typedef Sparse::Rights Rights;
+  OPS(SVR_OP)
+};
+
+static unsigned iterations;
+
+static l4_cpu_time_t now_us()
+{
+  return l4_kip_clock(l4re_kip());
+}
+
+/* Dispatch RPC op to o repeatedly, as the server loop would. */
+static void run(char const *name, L4::Epiface *o, long proto, int op,
+                l4_umword_t expect)
+{
+  l4_utcb_t *utcb = l4_utcb();
+  l4_msg_regs_t *mr = l4_utcb_mr_u(utcb);
+
+  l4_cpu_time_t start = now_us();
+  for (unsigned i = 0; i < iterations; ++i)
+    {
+      mr->mr[0] = op;
+      mr->mr[1] = 1;
+      l4_msgtag_t r = o->dispatch(l4_msgtag(proto, 2, 0, 0),
+                                  L4_CAP_FPAGE_RWS, utcb);
+      if (r.label() != long(expect))
+        {
+          printf("%s: dispatch of opcode %d returned %ld\n",
+                 name, op, r.label());
+          exit(1);
+        }
+    }
+  l4_cpu_time_t d = now_us() - start;
+
+  printf("%-6s opcode %3d: %llu ns per dispatch\n",
+         name, op, d * 1000 / iterations);
+}
+
+int main(int argc, char **argv)
+{
+  iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+  if (!iterations)
+    iterations = 1;
+
+  static Dense_svr dense;
+  static Sparse_svr sparse;
+
+  int const pos[] = { 0, 11, 23 };
+  for (int p : pos)
+    run("dense", &dense, 0x46, p, p + 1);
+
+  for (int p : pos)
+    run("sparse", &sparse, 0x47, p * 7 + 3, p + 1);
+
+  // an unknown opcode goes through the same search
+  run("sparse", &sparse, 0x47, 5, -L4_ENOSYS);
+
+  return 0;
+}
@@ -66,6 +66,8 @@ Namespace::_query(char const *name, unsigned len,
 
       if (partly && iterate)
         ns = L4::cap_cast<Namespace>(target);
+      else if (partly)
+        return _name.length;
       else
         return err;
     }
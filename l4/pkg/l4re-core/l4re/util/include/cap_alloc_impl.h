@@ -25,6 +25,7 @@
 #pragma once
 
 //#define L4RE_STATIC_CAP_ALLOC
+//#define L4RE_COUNTING_CAP_ALLOC
 #if defined(L4RE_STATIC_CAP_ALLOC)
 
 #include <l4/re/util/bitmap_cap_alloc>
@@ -35,7 +36,7 @@ typedef Cap_alloc_base _Cap_alloc;
 
 }}
 
-#else
+#elif defined(L4RE_COUNTING_CAP_ALLOC)
 #include <l4/re/util/counting_cap_alloc>
 
 namespace L4Re { namespace Util {
@@ -43,6 +44,13 @@ namespace L4Re { namespace Util {
 typedef Counting_cap_alloc<L4Re::Util::Counter<unsigned char> > _Cap_alloc;
 
 }}
-#endif
 
+#else
+#include <l4/re/util/mt_cap_alloc>
+
+namespace L4Re { namespace Util {
+
+typedef Mt_cap_alloc _Cap_alloc;
 
+}}
+#endif
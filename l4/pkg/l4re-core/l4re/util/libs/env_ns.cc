@@ -0,0 +1,171 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ *
+ * As a special exception, you may use this file as part of a free software
+ * library without restriction.  Specifically, if other files instantiate
+ * templates or use macros or inline functions from this file, or you compile
+ * this file and link it with other files to produce an executable, this
+ * file does not by itself cause the resulting executable to be covered by
+ * the GNU General Public License.  This exception does not however
+ * invalidate any other reasons why the executable file might be covered by
+ * the GNU General Public License.
+ */
+
+#include <l4/re/util/env_ns>
+#include <l4/re/env>
+#include <l4/re/rm>
+#include <l4/sys/task>
+
+#include <cstring>
+
+namespace {
+
+// zero-initialized, usable before any constructor ran
+L4Re::Util::Env_ns_cache __env_ns_cache;
+
+unsigned long
+name_hash(L4::Cap<void> ns, char const *s, unsigned len)
+{
+  // FNV-1a
+  unsigned long h = 2166136261UL ^ (ns.cap() >> L4_CAP_SHIFT);
+  for (; len; --len, ++s)
+    h = (h ^ (unsigned char)*s) * 16777619UL;
+  return h;
+}
+
+}
+
+namespace L4Re { namespace Util {
+
+Env_ns_cache *
+Env_ns_cache::global()
+{ return &__env_ns_cache; }
+
+l4_umword_t const *
+Env_ns_cache::counter(L4::Cap<L4Re::Namespace> ns, L4Re::Cap_alloc *ca)
+{
+  Watch *slot = 0;
+  for (Watch *w = _watches; w != _watches + Watches; ++w)
+    {
+      if (w->ns == ns.cap())
+        return w->counter;
+      if (!slot && !w->ns)
+        slot = w;
+    }
+
+  if (!slot)
+    return 0;
+
+  // a name space without counter is not asked again
+  slot->ns = ns.cap();
+  slot->counter = 0;
+
+  L4::Cap<L4Re::Dataspace> ds = ca->alloc<L4Re::Dataspace>();
+  if (!ds.is_valid())
+    return 0;
+
+  l4_addr_t offset;
+  char *p = 0;
+  if (ns->watch(ds, &offset) < 0
+      || (offset & ~L4_PAGEMASK) > L4_PAGESIZE - sizeof(l4_umword_t)
+      || L4Re::Env::env()->rm()->attach(&p, L4_PAGESIZE,
+                                        L4Re::Rm::Search_addr
+                                        | L4Re::Rm::Read_only,
+                                        L4::Ipc::make_cap(ds, L4_CAP_FPAGE_RO),
+                                        l4_trunc_page(offset)) < 0)
+    {
+      L4Re::Env::env()->task()->unmap(ds.fpage(), L4_FP_ALL_SPACES);
+      ca->free(ds);
+      return 0;
+    }
+
+  slot->counter = reinterpret_cast<l4_umword_t const *>(
+                    p + (offset & ~L4_PAGEMASK));
+  return slot->counter;
+}
+
+long
+Env_ns_cache::query(L4::Cap<L4Re::Namespace> ns, char const *name,
+                    unsigned len, L4::Cap<void> const &cap, int timeout,
+                    L4Re::Cap_alloc *ca)
+{
+  L4::Cap<L4::Task> task = L4Re::Env::env()->task();
+  Entry *e = &_entries[name_hash(ns, name, len) % Entries];
+  l4_umword_t const *ctr = 0;
+
+  if (len <= Max_name && lock())
+    {
+      ctr = counter(ns, ca);
+      if (ctr && e->ns == ns.cap()
+          && e->len == len && !memcmp(e->name, name, len)
+          && e->generation == __atomic_load_n(ctr, __ATOMIC_ACQUIRE)
+          && task->cap_valid(L4::Cap<void>(e->cap)).label())
+        {
+          // capability mappings are not hierarchical, dropping the cached
+          // capability later does not affect the copy
+          long err = l4_error(task->map(task,
+                                        L4::Cap<void>(e->cap)
+                                          .fpage(L4_CAP_FPAGE_RWS),
+                                        cap.snd_base()));
+          unlock();
+          if (err >= 0)
+            return 0;
+        }
+      else
+        unlock();
+    }
+
+  // the counter is read before the query, a concurrent change thus
+  // invalidates the result
+  l4_umword_t gen = ctr ? __atomic_load_n(ctr, __ATOMIC_ACQUIRE) : 0;
+  long r = ns->query(name, len, cap, timeout, 0, false);
+  if (r > 0)
+    // the rest of the name is resolved by another server
+    return L4::cap_cast<L4Re::Namespace>(cap)->query(name + len - r, r, cap,
+                                                     timeout, 0, true);
+
+  if (r < 0 || !ctr || !lock())
+    return r;
+
+  if (!e->cap)
+    {
+      L4::Cap<void> c = ca->alloc<void>();
+      e->cap = c.is_valid() ? c.cap() : 0;
+    }
+
+  if (e->cap
+      && l4_error(task->map(task, cap.fpage(L4_CAP_FPAGE_RWS),
+                            L4::Cap<void>(e->cap).snd_base())) >= 0)
+    {
+      e->ns = ns.cap();
+      e->generation = gen;
+      e->len = len;
+      memcpy(e->name, name, len);
+    }
+  else
+    e->ns = 0;
+
+  unlock();
+  return r;
+}
+
+void
+Env_ns_cache::flush()
+{
+  while (!lock())
+    ;
+
+  L4::Cap<L4::Task> task = L4Re::Env::env()->task();
+  for (Entry *e = _entries; e != _entries + Entries; ++e)
+    if (e->ns)
+      {
+        e->ns = 0;
+        task->unmap(L4::Cap<void>(e->cap).fpage(), L4_FP_ALL_SPACES);
+      }
+
+  unlock();
+}
+
+}}
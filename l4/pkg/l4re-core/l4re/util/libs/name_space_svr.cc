@@ -22,6 +22,7 @@
 #include <l4/re/namespace>
 
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 
 namespace L4Re { namespace Util { namespace Names {
@@ -40,6 +41,27 @@ Entry::set(Obj const &o)
   obj()->set(o, obj()->flags());
 }
 
+Name_space::~Name_space()
+{
+  unsigned long size;
+  ::free(_index.clear(&size));
+}
+
+void
+Name_space::grow_index()
+{
+  unsigned long size = _index.resize();
+  if (!size)
+    return;
+
+  // without memory the old index, if any, keeps working with longer chains
+  Entry **b = static_cast<Entry **>(calloc(size, sizeof(Entry *)));
+  if (!b)
+    return;
+
+  ::free(_index.rehash(b, size, _tree.begin(), _tree.end(), &size));
+}
+
 Entry *
 Name_space::find_iter(Name const &pname) const
 {
@@ -101,6 +123,7 @@ Name_space::op_query(L4Re::Namespace::Rights,
   else
     part = name.length;
 
+  Name_space *ns = this;
   Entry *n = find(Name(name.data, part));
   if (!n)
     return -L4_ENOENT;
@@ -108,17 +131,38 @@ Name_space::op_query(L4Re::Namespace::Rights,
     return -L4_EAGAIN;
   else
     {
+      // Resolve further components in local name spaces as long as they
+      // exist, the client continues with the rest.
+      while (part < name.length)
+        {
+          Name_space *sub = dynamic_cast<Name_space *>(n->obj()->obj());
+          if (!sub)
+            break;
+
+          char const *start = name.data + part + 1;
+          unsigned long left = name.length - part - 1;
+          sep = (char const*)memchr(start, '/', left);
+          unsigned long len = sep ? (unsigned long)(sep - start) : left;
+          Entry *e = sub->find(Name(start, len));
+          if (!e || !e->obj()->is_valid())
+            break;
+
+          ns = sub;
+          n = e;
+          part += 1 + len;
+        }
+
       if (n->obj()->cap().validate(L4_BASE_TASK_CAP).label() <= 0)
         {
           if (n->obj()->is_local())
-            free_epiface(n->obj()->obj());
+            ns->free_epiface(n->obj()->obj());
           else
-            free_capability(n->obj()->cap());
+            ns->free_capability(n->obj()->cap());
 
           if (n->is_dynamic())
             {
-              remove(n->name());
-              free_dynamic_entry(n);
+              ns->remove(n->name());
+              ns->free_dynamic_entry(n);
             }
           return -L4_ENOENT;
         }
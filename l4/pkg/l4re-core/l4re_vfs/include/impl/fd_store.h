@@ -18,17 +18,47 @@
 #pragma once
 
 #include <l4/l4re_vfs/vfs.h>
+#include <l4/l4re_vfs/backend>
+#include <l4/sys/l4int.h>
 
 namespace L4Re { namespace Core {
 
 using cxx::Ref_ptr;
 
+/**
+ * Table of file descriptors.
+ *
+ * The table has two levels: a fixed directory of pointers to chunks of
+ * Chunk_size descriptors each.  Chunks are allocated on demand and never
+ * freed or moved.  Every chunk has a bitmap of used descriptors, and a
+ * bitmap of full chunks allows alloc() to find the lowest free descriptor
+ * in constant time.  The bitmaps are updated atomically.
+ *
+ * get() takes no lock.  A slot holds a counted reference to its file as a
+ * plain pointer.  Readers announce themselves in one of two reader counts,
+ * selected by the current epoch, before loading a slot.  set() and free()
+ * replace the pointer, flip the epoch and wait until the readers of the
+ * old epoch are gone, so no reader can still take a reference to the old
+ * file.  Only then the old reference is dropped, outside of the writer
+ * lock because its file may do further VFS calls.
+ */
 class Fd_store
 {
 public:
-  enum { MAX_FILES = 50 };
+  enum
+  {
+    Chunk_size = L4_MWORD_BITS,
+    Num_chunks = L4_MWORD_BITS,
+    MAX_FILES  = L4RE_VFS_MAX_FILES,
+  };
 
-  Fd_store() throw() : _fd_hint(0) {}
+  Fd_store() throw() : _full(0), _epoch(0)
+  {
+    _readers[0] = _readers[1] = 0;
+    _chunks[0] = &_first;
+    for (unsigned i = 1; i < Num_chunks; ++i)
+      _chunks[i] = 0;
+  }
 
   int alloc() throw();
   void free(int fd) throw();
@@ -36,8 +66,32 @@ public:
   void set(int fd, Ref_ptr<L4Re::Vfs::File> const &f) throw();
 
 private:
-  int _fd_hint;
-  Ref_ptr<L4Re::Vfs::File> _files[MAX_FILES];
+  struct Chunk
+  {
+    l4_umword_t used;
+    L4Re::Vfs::File *files[Chunk_size];
+
+    Chunk() : used(0)
+    {
+      for (unsigned i = 0; i < Chunk_size; ++i)
+        files[i] = 0;
+    }
+  };
+
+  Chunk *chunk(unsigned idx) const throw()
+  { return __atomic_load_n(&_chunks[idx], __ATOMIC_ACQUIRE); }
+
+  Chunk *get_chunk(unsigned idx) throw();
+  void mark_used(int fd) throw();
+  L4Re::Vfs::File *replace(Chunk *c, int fd, L4Re::Vfs::File *f) throw();
+
+  l4_umword_t _full;
+  /// Serializes set() and free(), get() does not take it.
+  L4Re::Vfs::Be_lock _lock;
+  unsigned _epoch;
+  unsigned _readers[2];
+  Chunk *_chunks[Num_chunks];
+  Chunk _first;
 };
 
 
@@ -45,17 +99,28 @@ inline
 Ref_ptr<L4Re::Vfs::File>
 Fd_store::get(int fd) throw()
 {
+  Ref_ptr<L4Re::Vfs::File> f;
+
   if (fd >= 0 && fd < MAX_FILES)
-    return _files[fd];
+    if (Chunk *c = chunk(fd / Chunk_size))
+      {
+        unsigned e;
+        for (;;)
+          {
+            e = __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST) & 1;
+            __atomic_add_fetch(&_readers[e], 1, __ATOMIC_SEQ_CST);
+            // a writer that flipped the epoch meanwhile does not wait for us
+            if ((__atomic_load_n(&_epoch, __ATOMIC_SEQ_CST) & 1) == e)
+              break;
+            __atomic_sub_fetch(&_readers[e], 1, __ATOMIC_RELEASE);
+          }
 
-  return Ref_ptr<>::Nil;
-}
+        f = cxx::ref_ptr(__atomic_load_n(&c->files[fd % Chunk_size],
+                                         __ATOMIC_SEQ_CST));
+        __atomic_sub_fetch(&_readers[e], 1, __ATOMIC_RELEASE);
+      }
 
-inline
-void
-Fd_store::set(int fd, Ref_ptr<L4Re::Vfs::File> const &f) throw()
-{
-  _files[fd] = f;
+  return f;
 }
 
 }}
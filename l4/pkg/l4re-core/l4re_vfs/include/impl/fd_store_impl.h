@@ -17,30 +17,126 @@
  */
 #include "fd_store.h"
 
+#include <l4/cxx/std_alloc>
+
 namespace L4Re { namespace Core {
 
+Fd_store::Chunk *
+Fd_store::get_chunk(unsigned idx) throw()
+{
+  Chunk *c = chunk(idx);
+  if (c)
+    return c;
+
+  void *m = Vfs_config::malloc(sizeof(Chunk));
+  if (!m)
+    return 0;
+
+  Chunk *n = new (m, cxx::Nothrow()) Chunk();
+  if (__atomic_compare_exchange_n(&_chunks[idx], &c, n, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return n;
+
+  // somebody else was faster
+  n->~Chunk();
+  Vfs_config::free(m);
+  return c;
+}
+
 int
 Fd_store::alloc() throw()
 {
-  for (int i = _fd_hint; i < MAX_FILES; ++i)
+  for (;;)
+    {
+      l4_umword_t full = __atomic_load_n(&_full, __ATOMIC_ACQUIRE);
+      if (!~full)
+        return -1;
+
+      unsigned ci = __builtin_ctzl(~full);
+      Chunk *c = get_chunk(ci);
+      if (!c)
+        return -1;
+
+      l4_umword_t used = __atomic_load_n(&c->used, __ATOMIC_ACQUIRE);
+      if (!~used)
+        {
+          __atomic_fetch_or(&_full, 1UL << ci, __ATOMIC_ACQ_REL);
+          // a concurrent free() may have missed our full bit
+          if (~__atomic_load_n(&c->used, __ATOMIC_ACQUIRE))
+            __atomic_fetch_and(&_full, ~(1UL << ci), __ATOMIC_ACQ_REL);
+          continue;
+        }
+
+      unsigned bit = __builtin_ctzl(~used);
+      if (!__atomic_compare_exchange_n(&c->used, &used, used | (1UL << bit),
+                                       false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE))
+        continue;
+
+      return ci * Chunk_size + bit;
+    }
+}
+
+void
+Fd_store::mark_used(int fd) throw()
+{
+  unsigned ci = fd / Chunk_size;
+  __atomic_fetch_or(&_chunks[ci]->used, 1UL << (fd % Chunk_size),
+                    __ATOMIC_ACQ_REL);
+}
+
+L4Re::Vfs::File *
+Fd_store::replace(Chunk *c, int fd, L4Re::Vfs::File *f) throw()
+{
+  _lock.lock();
+  L4Re::Vfs::File *old = __atomic_exchange_n(&c->files[fd % Chunk_size], f,
+                                             __ATOMIC_SEQ_CST);
+
+  // readers announced in the old epoch may have loaded the old pointer
+  if (old)
     {
-      if (!_files[i])
-	{
-	  _fd_hint = i + 1;
-	  return i;
-	}
+      unsigned e = __atomic_fetch_add(&_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+      while (__atomic_load_n(&_readers[e], __ATOMIC_ACQUIRE))
+        l4_thread_yield();
     }
 
-  return -1;
+  _lock.unlock();
+  return old;
 }
 
 void
 Fd_store::free(int fd) throw()
 {
-  _files[fd] = 0;
-  if (fd < _fd_hint)
-    _fd_hint = fd;
+  unsigned ci = fd / Chunk_size;
+  Chunk *c = chunk(ci);
+
+  // adopt the reference of the slot and drop it at the end
+  Ref_ptr<L4Re::Vfs::File> old(replace(c, fd, 0), true);
+  __atomic_fetch_and(&c->used, ~(1UL << (fd % Chunk_size)), __ATOMIC_ACQ_REL);
+  __atomic_fetch_and(&_full, ~(1UL << ci), __ATOMIC_ACQ_REL);
 }
 
-}}
+void
+Fd_store::set(int fd, Ref_ptr<L4Re::Vfs::File> const &f) throw()
+{
+  if (fd < 0 || fd >= MAX_FILES)
+    return;
+
+  if (!f)
+    {
+      if (chunk(fd / Chunk_size))
+        free(fd);
+      return;
+    }
 
+  Chunk *c = get_chunk(fd / Chunk_size);
+  if (!c)
+    return;
+
+  // the slot owns the reference taken here, see free()
+  f->add_ref();
+  Ref_ptr<L4Re::Vfs::File> old(replace(c, fd, f.get()), true);
+  mark_used(fd);
+}
+
+}}
@@ -20,6 +20,8 @@
 #include <l4/sys/capability>
 #include <l4/sys/vcon>
 #include <l4/sys/semaphore>
+#include <l4/re/util/bulk_channel>
+#include <l4/re/util/log_ring>
 
 #include <l4/l4re_vfs/backend>
 
@@ -31,6 +33,52 @@ private:
   L4::Cap<L4::Vcon> _s;
   L4::Cap<L4::Semaphore>  _irq;
 
+  /**
+   * Input interrupt handling for poll: the interrupt of the vcon is bound
+   * to the semaphore of one waiter for input, _input_waiter, or to _irq if
+   * there is none.  All other waiters are signalled from fill().
+   */
+  L4Re::Vfs::Be_lock _lock;
+  cxx::H_list_t<L4Re::Vfs::Poll_entry> _waiters;
+  L4Re::Vfs::Poll_entry *_input_waiter;
+  L4::Cap<L4::Semaphore> _bound;
+
+  /// Input already read from the vcon but not yet consumed.
+  enum { Rbuf_size = 64 };
+  unsigned _rpos, _rlen;
+  char _rbuf[Rbuf_size];
+
+  /**
+   * Large writes go through a bulk channel if the server supports it,
+   * set up on the first large write.
+   */
+  enum
+  {
+    Bulk_size = 64 << 10,
+    Bulk_chunk = Bulk_size / 4,
+  };
+  enum Chan_state { Chan_unknown, Chan_off, Chan_on };
+  L4Re::Vfs::Be_lock _wlock;
+  Chan_state _bulk_state;
+  L4Re::Util::Bulk_buffer _bulk;
+
+  /**
+   * With VCON_LOG_RING set to "drop" or "lossless" all output goes through
+   * a log ring that the server drains in batches, set up on the first
+   * write.
+   */
+  enum { Log_size = 16 << 10 };
+  Chan_state _log_state;
+  L4Re::Util::Log_ring_producer _log;
+
+  int fill() throw();
+  void bind(L4::Cap<L4::Semaphore> irq) throw();
+  void bind_input_waiter() throw();
+  bool bulk_ready() throw();
+  bool log_ready() throw();
+  size_t bulk_write(const struct iovec *iovec, int iovcnt,
+                    size_t total) throw();
+
 public:
   explicit Vcon_stream(L4::Cap<L4::Vcon> s) throw();
 
@@ -40,6 +88,11 @@ public:
   int get_status_flags() const throw() { return O_RDWR; }
   int set_status_flags(long) throw() { return 0; }
   int ioctl(unsigned long request, va_list args) throw();
+  int fsync() const throw();
+
+  int poll_events(int events) throw();
+  int add_poll_entry(L4Re::Vfs::Poll_entry *e) throw();
+  void remove_poll_entry(L4Re::Vfs::Poll_entry *e) throw();
 
   ~Vcon_stream() throw() {}
   void operator delete (void *) {}
@@ -18,6 +18,7 @@
 
 #include <l4/re/env>
 #include <l4/sys/factory>
+#include <l4/cxx/string>
 
 #include "vcon_stream.h"
 #include "vfs_api.h"
@@ -29,7 +30,9 @@
 
 namespace L4Re { namespace Core {
 Vcon_stream::Vcon_stream(L4::Cap<L4::Vcon> s) throw()
-: Be_file_stream(), _s(s), _irq(cap_alloc()->alloc<L4::Semaphore>())
+: Be_file_stream(), _s(s), _irq(cap_alloc()->alloc<L4::Semaphore>()),
+  _input_waiter(0), _rpos(0), _rlen(0), _bulk_state(Chan_unknown),
+  _log_state(Chan_unknown)
 {
   //printf("VCON: irq cap = %lx\n", _irq.cap());
   int res = l4_error(L4Re::Env::env()->factory()->create(_irq));
@@ -40,6 +43,67 @@ Vcon_stream::Vcon_stream(L4::Cap<L4::Vcon> s) throw()
 
   res = l4_error(_s->bind(0, _irq));
   //printf("VCON: bound irq to con res=%d\n", res);
+  _bound = _irq;
+}
+
+void
+Vcon_stream::bind(L4::Cap<L4::Semaphore> irq) throw()
+{
+  if (irq == _bound)
+    return;
+
+  _s->bind(0, irq);
+  _bound = irq;
+}
+
+static bool
+wants_input(L4Re::Vfs::Poll_entry const *e)
+{ return e->events & (POLLIN | POLLRDNORM); }
+
+/**
+ * Bind the interrupt to the first waiter for input, must hold _lock.
+ */
+void
+Vcon_stream::bind_input_waiter() throw()
+{
+  _input_waiter = 0;
+  for (auto i = _waiters.begin(); i != _waiters.end(); ++i)
+    if (wants_input(*i))
+      {
+        _input_waiter = *i;
+        break;
+      }
+
+  bind(_input_waiter ? _input_waiter->waiter->sem() : _irq);
+}
+
+/**
+ * Make sure there is input in _rbuf, must hold _lock.
+ *
+ * \return >0 if there is input, 0 if not, or <0 on error.
+ */
+int
+Vcon_stream::fill() throw()
+{
+  if (_rpos < _rlen)
+    return 1;
+
+  int ret = _s->read(_rbuf, Rbuf_size);
+  if (ret <= 0)
+    return ret;
+
+  if (ret > Rbuf_size)
+    ret = Rbuf_size;
+
+  _rpos = 0;
+  _rlen = ret;
+
+  // only the input waiter gets the interrupt, pass the news on
+  for (auto i = _waiters.begin(); i != _waiters.end(); ++i)
+    if (*i != _input_waiter)
+      i->notify(POLLIN | POLLRDNORM);
+
+  return 1;
 }
 
 ssize_t
@@ -56,11 +120,18 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) throw()
 
       while (1)
 	{
-	  int ret = _s->read(buf, len);
+	  _lock.lock();
+	  int ret = fill();
+	  if (ret > 0)
+	    {
+	      ret = _rlen - _rpos;
+	      if (ret > (int)len)
+		ret = len;
 
-	  // BS: what is this ??
-	  if (ret > (int)len)
-	    ret = len;
+	      Vfs_config::memcpy(buf, _rbuf + _rpos, ret);
+	      _rpos += ret;
+	    }
+	  _lock.unlock();
 
 	  if (ret < 0)
 	    return ret;
@@ -69,14 +140,10 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) throw()
 	      if (bytes)
 		return bytes;
 
-	      ret = _s->read(buf, len);
+	      ret = L4Re::Vfs::be_wait_for_events(this, POLLIN, _irq);
 	      if (ret < 0)
 		return ret;
-	      else if (ret == 0)
-		{
-		  _irq->down();
-		  continue;
-		}
+	      continue;
 	    }
 
 	  bytes += ret;
@@ -91,6 +158,181 @@ Vcon_stream::readv(const struct iovec *iovec, int iovcnt) throw()
   return bytes;
 }
 
+int
+Vcon_stream::poll_events(int events) throw()
+{
+  int r = events & (POLLOUT | POLLWRNORM);
+  if (events & (POLLIN | POLLRDNORM))
+    {
+      _lock.lock();
+      int ret = fill();
+      _lock.unlock();
+
+      if (ret > 0)
+        r |= events & (POLLIN | POLLRDNORM);
+      else if (ret < 0)
+        r |= POLLERR;
+    }
+
+  return r;
+}
+
+int
+Vcon_stream::add_poll_entry(L4Re::Vfs::Poll_entry *e) throw()
+{
+  // the interrupt does not tell which of the entries of a waiter fired
+  e->direct = true;
+
+  _lock.lock();
+  _waiters.add(e);
+  if (!_input_waiter && wants_input(e))
+    {
+      _input_waiter = e;
+      bind(e->waiter->sem());
+    }
+  _lock.unlock();
+  return 0;
+}
+
+void
+Vcon_stream::remove_poll_entry(L4Re::Vfs::Poll_entry *e) throw()
+{
+  _lock.lock();
+  _waiters.remove(e);
+  // only the input waiter is bound, removing another one needs no IPC
+  if (e == _input_waiter)
+    bind_input_waiter();
+  _lock.unlock();
+}
+
+/**
+ * Set up the bulk channel if not yet tried, must hold _wlock.
+ */
+bool
+Vcon_stream::bulk_ready() throw()
+{
+  if (_bulk_state != Chan_unknown)
+    return _bulk_state == Chan_on;
+
+  _bulk_state = Chan_off;
+
+  L4::Cap<L4Re::Dataspace> ds = cap_alloc()->alloc<L4Re::Dataspace>();
+  if (!ds.is_valid())
+    return false;
+
+  if (_bulk.init(L4::cap_reinterpret_cast<L4Re::Bulk_channel>(_s), ds,
+                 Vfs_config::allocator(), Bulk_size) < 0)
+    {
+      cap_alloc()->free(ds);
+      return false;
+    }
+
+  _bulk_state = Chan_on;
+  return true;
+}
+
+/**
+ * Set up the log ring if requested and not yet tried, must hold _wlock.
+ */
+bool
+Vcon_stream::log_ready() throw()
+{
+  if (_log_state != Chan_unknown)
+    return _log_state == Chan_on;
+
+  _log_state = Chan_off;
+
+  typedef L4Re::Util::Log_ring_producer Log;
+  char const *m = Vfs_config::getenv("VCON_LOG_RING");
+  if (!m)
+    return false;
+
+  Log::Mode mode;
+  if (cxx::String(m) == "drop")
+    mode = Log::Drop;
+  else if (cxx::String(m) == "lossless")
+    mode = Log::Lossless;
+  else
+    return false;
+
+  L4::Cap<L4Re::Dataspace> ds = cap_alloc()->alloc<L4Re::Dataspace>();
+  L4::Cap<L4::Irq> irq = cap_alloc()->alloc<L4::Irq>();
+  if (   ds.is_valid() && irq.is_valid()
+      && _log.init(L4::cap_reinterpret_cast<L4Re::Log_ring>(_s), ds, irq,
+                   Vfs_config::allocator(), Log_size, mode) >= 0)
+    {
+      _log_state = Chan_on;
+      return true;
+    }
+
+  if (ds.is_valid())
+    cap_alloc()->free(ds);
+  if (irq.is_valid())
+    cap_alloc()->free(irq);
+  return false;
+}
+
+/**
+ * Write through the bulk channel, one RPC per Bulk_chunk bytes.
+ *
+ * \return The number of bytes written, the caller writes the rest through
+ *         the UTCB.
+ */
+size_t
+Vcon_stream::bulk_write(const struct iovec *iovec, int iovcnt,
+                        size_t total) throw()
+{
+  size_t done = 0;
+  size_t iov_off = 0;
+
+  while (done < total)
+    {
+      size_t n = total - done;
+      if (n > Bulk_chunk)
+        n = Bulk_chunk;
+
+      _wlock.lock();
+      long offset = bulk_ready() ? _bulk.alloc(n) : -L4_ENOSYS;
+      _wlock.unlock();
+
+      if (offset < 0)
+        break;
+
+      char *d = _bulk.data(offset);
+      for (size_t c = 0; c < n; )
+        {
+          size_t l = iovec->iov_len - iov_off;
+          if (l > n - c)
+            l = n - c;
+
+          Vfs_config::memcpy(d + c, (char const *)iovec->iov_base + iov_off, l);
+          c += l;
+          iov_off += l;
+          if (iov_off == iovec->iov_len)
+            {
+              ++iovec;
+              --iovcnt;
+              iov_off = 0;
+            }
+        }
+
+      long r = _bulk.transfer(L4Re::Bulk_channel::Write, offset, n);
+
+      _wlock.lock();
+      _bulk.complete(offset);
+      if (r < 0)
+        _bulk_state = Chan_off;
+      _wlock.unlock();
+
+      if (r < 0)
+        break;
+
+      done += n;
+    }
+
+  return done;
+}
+
 ssize_t
 Vcon_stream::writev(const struct iovec *iovec, int iovcnt) throw()
 {
@@ -99,11 +341,50 @@ Vcon_stream::writev(const struct iovec *iovec, int iovcnt) throw()
 
   Vfs_config::memcpy(&store, mr, sizeof(store));
 
-  ssize_t written = 0;
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    total += iovec[i].iov_len;
+
+  size_t skip = 0;
+  if (_log_state != Chan_off)
+    {
+      _wlock.lock();
+      if (log_ready())
+        for (int i = 0; i < iovcnt; ++i)
+          {
+            long r = _log.write((char const *)iovec[i].iov_base,
+                                iovec[i].iov_len);
+            if (r > 0)
+              skip += r;
+
+            // the server is gone, the rest goes through the UTCB
+            if (r < 0 || (size_t)r != iovec[i].iov_len)
+              {
+                _log_state = Chan_off;
+                break;
+              }
+          }
+      _wlock.unlock();
+
+      if (skip == total)
+        {
+          Vfs_config::memcpy(mr, &store, sizeof(store));
+          return total;
+        }
+    }
+
+  // small writes fit into one message anyway
+  if (!skip && total > L4_VCON_WRITE_SIZE && _bulk_state != Chan_off)
+    skip = bulk_write(iovec, iovcnt, total);
+
+  for (; iovcnt && skip >= iovec->iov_len; ++iovec, --iovcnt)
+    skip -= iovec->iov_len;
+
   while (iovcnt)
     {
-      size_t sl = iovec->iov_len;
-      char const *b = (char const *)iovec->iov_base;
+      size_t sl = iovec->iov_len - skip;
+      char const *b = (char const *)iovec->iov_base + skip;
+      skip = 0;
 
       for (; sl > L4_VCON_WRITE_SIZE
            ; sl -= L4_VCON_WRITE_SIZE, b += L4_VCON_WRITE_SIZE)
@@ -111,13 +392,26 @@ Vcon_stream::writev(const struct iovec *iovec, int iovcnt) throw()
 
       _s->send(b, sl);
 
-      written += iovec->iov_len;
-
       ++iovec;
       --iovcnt;
     }
   Vfs_config::memcpy(mr, &store, sizeof(store));
-  return written;
+  return total;
+}
+
+int
+Vcon_stream::fsync() const throw()
+{
+  if (_log_state != Chan_on)
+    return 0;
+
+  l4_msg_regs_t store;
+  l4_msg_regs_t *mr = l4_utcb_mr();
+
+  Vfs_config::memcpy(&store, mr, sizeof(store));
+  long r = _log.flush();
+  Vfs_config::memcpy(mr, &store, sizeof(store));
+  return r < 0 ? -EIO : 0;
 }
 
 int
@@ -99,7 +99,8 @@ private:
 
 public:
   Vfs()
-  : _early_oom(true), _root_mount(), _root(L4Re::Env::env())
+  : _early_oom(true), _root_mount(), _root(L4Re::Env::env()),
+    _num_poll_sems(0)
   {
     _root_mount.add_ref();
     _root.add_ref();
@@ -150,6 +151,9 @@ public:
   void *malloc(size_t size) noexcept { return Vfs_config::malloc(size); }
   void free(void *m) noexcept { Vfs_config::free(m); }
 
+  L4::Cap<L4::Semaphore> alloc_poll_sem() noexcept;
+  void free_poll_sem(L4::Cap<L4::Semaphore> sem) noexcept;
+
 private:
   Root_mount_tree _root_mount;
   L4Re::Core::Env_dir _root;
@@ -174,6 +178,12 @@ private:
   l4_addr_t _anon_offset;
   L4::Cap<L4Re::Dataspace> _anon_ds;
 
+  /// Cache of idle semaphores for Poll_waiter objects.
+  enum { Max_poll_sems = 16 };
+  L4Re::Vfs::Be_lock _poll_sem_lock;
+  unsigned _num_poll_sems;
+  L4::Cap<L4::Semaphore> _poll_sems[Max_poll_sems];
+
   int alloc_ds(unsigned long size, L4::Cap<L4Re::Dataspace> *ds);
   int alloc_anon_mem(l4_umword_t size, L4::Cap<L4Re::Dataspace> *ds,
                      l4_addr_t *offset);
@@ -370,6 +380,51 @@ Vfs::cap_alloc() throw()
   return L4Re::Core::cap_alloc();
 }
 
+L4::Cap<L4::Semaphore>
+Vfs::alloc_poll_sem() noexcept
+{
+  _poll_sem_lock.lock();
+  if (_num_poll_sems)
+    {
+      L4::Cap<L4::Semaphore> s = _poll_sems[--_num_poll_sems];
+      _poll_sem_lock.unlock();
+      return s;
+    }
+  _poll_sem_lock.unlock();
+
+  L4::Cap<L4::Semaphore> s = L4Re::Core::cap_alloc()->alloc<L4::Semaphore>();
+  if (!s.is_valid())
+    return s;
+
+  if (l4_error(L4Re::Env::env()->factory()->create(s)) < 0)
+    {
+      L4Re::Core::cap_alloc()->free(s);
+      return L4::Cap<L4::Semaphore>::Invalid;
+    }
+
+  return s;
+}
+
+void
+Vfs::free_poll_sem(L4::Cap<L4::Semaphore> sem) noexcept
+{
+  // consume notifications that arrived after the waiter stopped waiting
+  while (!l4_ipc_error(sem->down(L4_IPC_BOTH_TIMEOUT_0), l4_utcb()))
+    ;
+
+  _poll_sem_lock.lock();
+  if (_num_poll_sems < Max_poll_sems)
+    {
+      _poll_sems[_num_poll_sems++] = sem;
+      _poll_sem_lock.unlock();
+      return;
+    }
+  _poll_sem_lock.unlock();
+
+  L4Re::Env::env()->task()->unmap(sem.fpage(), L4_FP_ALL_SPACES);
+  L4Re::Core::cap_alloc()->free(sem);
+}
+
 
 
 #define GET_FILE_DBG(fd, err) \
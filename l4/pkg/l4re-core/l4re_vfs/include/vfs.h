@@ -19,6 +19,7 @@
 #pragma once
 
 #include <l4/sys/compiler.h>
+#include <l4/sys/l4int.h>
 
 #include <unistd.h>
 #include <stdarg.h>
@@ -28,16 +29,22 @@
 #include <sys/socket.h>
 #include <utime.h>
 #include <errno.h>
+#include <poll.h>
 
 #ifndef AT_FDCWD
 # define AT_FDCWD -100
 #endif
 
+/** Size of the file descriptor table, see L4Re::Core::Fd_store. */
+#define L4RE_VFS_MAX_FILES (L4_MWORD_BITS * L4_MWORD_BITS)
+
 #ifdef __cplusplus
 
 #include <l4/sys/capability>
+#include <l4/sys/semaphore>
 #include <l4/re/cap_alloc>
 #include <l4/re/dataspace>
+#include <l4/cxx/hlist>
 #include <l4/cxx/ref_ptr>
 #include <cstdlib>
 #include <cstring>
@@ -50,6 +57,100 @@ namespace Vfs {
 
 class Mount_tree;
 class File;
+class Poll_entry;
+
+/**
+ * \brief A thread waiting for events on one or more open files.
+ *
+ * A waiter is registered at each file it is interested in with a
+ * Poll_entry (see Generic_file::add_poll_entry()).  Files signal the
+ * waiter by calling Poll_entry::notify(), files that get their events from
+ * an interrupt-like source (such as an L4::Vcon) may instead bind sem()
+ * directly to that source.  Notifications only mean that events may be
+ * pending, the waiter always has to check with Generic_file::poll_events().
+ */
+class Poll_waiter
+{
+public:
+  /**
+   * \brief Create a waiter.
+   * \param sem  Semaphore the waiter blocks on, usually obtained with
+   *             App_api::alloc_poll_sem().
+   */
+  explicit Poll_waiter(L4::Cap<L4::Semaphore> sem) throw() : _sem(sem) {}
+
+  /// The semaphore the waiter blocks on.
+  L4::Cap<L4::Semaphore> sem() const throw() { return _sem; }
+
+  /**
+   * \brief Signal the waiter.
+   * \param e  The entry that fired.
+   *
+   * Called by files, possibly in the context of another thread and with
+   * internal locks of the file held.  Must therefore never block.
+   */
+  virtual void notify(Poll_entry *e) throw()
+  {
+    (void)e;
+    _sem->up();
+  }
+
+  /**
+   * \brief Block until notified.
+   * \param timeout  Timeout for blocking, the receive part is significant.
+   * \return 0 when notified, -ETIMEDOUT, or -EINTR.
+   */
+  int wait(l4_timeout_t timeout = L4_IPC_NEVER) throw()
+  {
+    l4_msgtag_t t = _sem->down(timeout);
+    switch (l4_ipc_error(t, l4_utcb()))
+      {
+      case 0: return 0;
+      case L4_IPC_RETIMEOUT: return -ETIMEDOUT;
+      default: return -EINTR;
+      }
+  }
+
+  virtual ~Poll_waiter() throw() {}
+
+private:
+  L4::Cap<L4::Semaphore> _sem;
+};
+
+/**
+ * \brief Registration of a Poll_waiter at an open file.
+ *
+ * The entry is owned by the waiter and must stay valid until it is removed
+ * from the file again with Generic_file::remove_poll_entry().
+ */
+class Poll_entry : public cxx::H_list_item_t<Poll_entry>
+{
+public:
+  /**
+   * \param waiter  The waiter to signal.
+   * \param events  The events (`POLLIN`, `POLLOUT`, ...) of interest,
+   *                `POLLERR` and `POLLHUP` are always of interest.
+   */
+  Poll_entry(Poll_waiter *waiter, int events) throw()
+  : waiter(waiter), events(events), direct(false)
+  {}
+
+  /// Signal the waiter if any of \a revents is of interest.
+  void notify(int revents) throw()
+  {
+    if (revents & (events | POLLERR | POLLHUP))
+      waiter->notify(this);
+  }
+
+  Poll_waiter *waiter;
+  int events;
+  /**
+   * Set by the file if it binds the semaphore of the waiter directly to
+   * its event source.  The waiter cannot tell which of its direct entries
+   * fired and must re-check all of them after each wake-up.
+   */
+  bool direct;
+};
 
 /**
  * \brief The common interface for an open POSIX file.
@@ -125,6 +226,38 @@ public:
   virtual int utime(const struct utimbuf *) throw() = 0;
   virtual int utimes(const struct timeval [2]) throw() = 0;
   virtual ssize_t readlink(char *, size_t) = 0;
+
+  /**
+   * \brief Get the pending I/O events of the file.
+   *
+   * Backend for POSIX poll, select and the epoll family.
+   *
+   * \param events  The events (`POLLIN`, `POLLOUT`, ...) the caller is
+   *                interested in.
+   * \return The pending subset of \a events, plus `POLLERR` or `POLLHUP`
+   *         if applicable.
+   */
+  virtual int poll_events(int events) throw() = 0;
+
+  /**
+   * \brief Register for notification about new events.
+   *
+   * After successful registration the file signals \a e (see
+   * Poll_entry) whenever any of the requested events may have become
+   * pending.  Events already pending at registration time are not
+   * signalled, so callers must check with poll_events() after registering.
+   *
+   * \return 0 on success, or -EPERM if the file does not support
+   *         notifications because its readiness never changes.
+   */
+  virtual int add_poll_entry(Poll_entry *e) throw() = 0;
+
+  /**
+   * \brief Cancel a registration done with add_poll_entry().
+   *
+   * When this function returns the file does not access \a e any more.
+   */
+  virtual void remove_poll_entry(Poll_entry *e) throw() = 0;
 };
 
 inline
@@ -453,8 +586,11 @@ public:
   int openat(const char *path, int flags, mode_t mode,
              cxx::Ref_ptr<File> *f) throw();
 
-  void add_ref() throw() { ++_ref_cnt; }
-  int remove_ref() throw() { return --_ref_cnt; }
+  // atomic, Fd_store::get() takes references without a lock
+  void add_ref() throw()
+  { __atomic_add_fetch(&_ref_cnt, 1, __ATOMIC_RELAXED); }
+  int remove_ref() throw()
+  { return __atomic_sub_fetch(&_ref_cnt, 1, __ATOMIC_ACQ_REL); }
 
   virtual ~File() throw() = 0;
 
@@ -1047,6 +1183,22 @@ public:
   virtual Cap_alloc *cap_alloc() throw() = 0;
   virtual void *malloc(size_t) noexcept = 0;
   virtual void free(void *m) noexcept = 0;
+
+  /**
+   * \brief Get a semaphore for a Poll_waiter.
+   *
+   * \return A semaphore with a counter of zero, or an invalid capability
+   *         if no semaphore could be allocated.
+   */
+  virtual L4::Cap<L4::Semaphore> alloc_poll_sem() noexcept = 0;
+
+  /**
+   * \brief Return a semaphore obtained with alloc_poll_sem().
+   *
+   * The semaphore must not be bound to any event source any more.
+   */
+  virtual void free_poll_sem(L4::Cap<L4::Semaphore> sem) noexcept = 0;
+
   virtual ~App_api() = 0;
 };
 
@@ -26,6 +26,7 @@ using L4Re::Util::cap_alloc;
 using ::memcpy;
 using ::malloc;
 using ::free;
+using ::getenv;
 
 inline
 L4::Cap<L4Re::Mem_alloc> allocator()
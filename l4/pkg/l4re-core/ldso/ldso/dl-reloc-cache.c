@@ -0,0 +1,381 @@
+/*
+ * Relocation cache for shared libraries, included by ldso.c.
+ *
+ * After relocation, the writable segment of a shared library only depends
+ * on the loaded modules, their load addresses and the binding mode.  Another
+ * program that loads the same modules at the same addresses thus ends up
+ * with the same image.  If the program has a name space "ldso_cache" among
+ * its initial capabilities, the loader publishes the image of every library
+ * there after relocating it, and later programs copy the image instead of
+ * processing the relocations again.
+ *
+ * The key of an image is a 128 bit digest over the binding mode and, for
+ * every loaded module, its name, load address, dynamic section and identity.
+ * The identity is the GNU build ID if the module has one, otherwise the
+ * contents of its loaded segments before relocation.  Modules with equal
+ * dynamic sections may still define different symbol values, e.g., for
+ * COPY relocated data, so the dynamic section alone does not identify them.
+ *
+ * The RELRO pages of the image are read-only after relocation, they are
+ * mapped from the published dataspace and are thus shared by all programs
+ * using the cache.  A page that differs from the published one, e.g., a GOT
+ * page with a pointer into the loader's heap, stays private.
+ *
+ * Published images are used without further checks, all programs sharing a
+ * cache name space must trust each other.
+ */
+
+#define RELOC_CACHE_NS "ldso_cache"
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/* Digest of the loaded modules, all 0 if the cache is off. */
+static unsigned long long _dl_reloc_cache_digest[2];
+
+/*
+ * Two independent 64 bit lanes: FNV-1a and a rotate-xor-multiply hash with
+ * the golden ratio as multiplier.
+ */
+static void
+_dl_reloc_cache_hash(unsigned long long *h, void const *p, unsigned long len)
+{
+  unsigned char const *s = p;
+  unsigned long long a = h[0], b = h[1];
+
+  for (; len; --len, ++s)
+    {
+      a = (a ^ *s) * 1099511628211ULL;
+      b = (((b << 5) | (b >> 59)) ^ *s) * 0x9e3779b97f4a7c15ULL;
+    }
+
+  h[0] = a;
+  h[1] = b;
+}
+
+/* Hash the GNU build ID of t, returns 0 if t has none. */
+static int
+_dl_reloc_cache_build_id(struct elf_resolve *t, unsigned long long *h)
+{
+  ElfW(Phdr) *p = t->ppnt;
+  unsigned long i;
+
+  for (i = 0; i < t->n_phent; ++i, ++p)
+    {
+      char const *n, *e;
+      unsigned long a;
+
+      if (p->p_type != PT_NOTE)
+        continue;
+
+      a = p->p_align > 4 ? 8 : 4;
+      n = (char const *)DL_RELOC_ADDR(t->loadaddr, p->p_vaddr);
+      e = n + p->p_filesz;
+      while (e - n >= (long)sizeof(ElfW(Nhdr)))
+        {
+          ElfW(Nhdr) const *nh = (ElfW(Nhdr) const *)n;
+          char const *name = n + sizeof(*nh);
+          char const *desc = name + ((nh->n_namesz + a - 1) & ~(a - 1));
+
+          n = desc + ((nh->n_descsz + a - 1) & ~(a - 1));
+          if (n > e || n < desc)
+            break;
+
+          if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4
+              && nh->n_descsz && !_dl_memcmp(name, "GNU", 4))
+            {
+              _dl_reloc_cache_hash(h, desc, nh->n_descsz);
+              return 1;
+            }
+        }
+    }
+
+  return 0;
+}
+
+/*
+ * Hash the loaded segments of t that still have their file contents, i.e.,
+ * everything but the dynamic section, which the loader already modified and
+ * which is hashed separately.  The loader's own writable segment is skipped,
+ * it is in use.
+ */
+static void
+_dl_reloc_cache_contents(struct elf_resolve *t, unsigned long long *h)
+{
+  ElfW(Phdr) *p = t->ppnt;
+  char const *dyn = (char const *)t->dynamic_addr;
+  unsigned long i;
+  ElfW(Dyn) *d;
+
+  for (d = t->dynamic_addr; d->d_tag != DT_NULL; ++d)
+    ;
+
+  for (i = 0; i < t->n_phent; ++i, ++p)
+    {
+      char const *s, *e;
+
+      if (p->p_type != PT_LOAD)
+        continue;
+      if ((p->p_flags & PF_W) && t->libtype == program_interpreter)
+        continue;
+
+      s = (char const *)DL_RELOC_ADDR(t->loadaddr, p->p_vaddr);
+      e = s + p->p_filesz;
+      if (dyn >= s && dyn < e)
+        {
+          _dl_reloc_cache_hash(h, s, dyn - s);
+          s = (char const *)(d + 1);
+        }
+      if (s < e)
+        _dl_reloc_cache_hash(h, s, e - s);
+    }
+}
+
+/*
+ * Enable the cache for the relocation of the initially loaded modules,
+ * must be called after all of them are loaded.
+ */
+static void
+_dl_reloc_cache_begin(int now)
+{
+  struct elf_resolve *t;
+  ElfW(Dyn) *d;
+  unsigned long long h[2] = { 14695981039346656037ULL, 0x6c64736f63616368ULL };
+
+  _dl_reloc_cache_digest[0] = _dl_reloc_cache_digest[1] = 0;
+#ifdef __mips__
+  /* the GOT setup relocates the local GOT entries, it cannot be repeated */
+  return;
+#endif
+  if (!_dl_env_cap(RELOC_CACHE_NS))
+    return;
+
+  _dl_reloc_cache_hash(h, &now, sizeof(now));
+  for (t = _dl_loaded_modules; t; t = t->next)
+    {
+      ElfW(Addr) base = DL_LOADADDR_BASE(t->loadaddr);
+
+      _dl_reloc_cache_hash(h, t->libname, _dl_strlen(t->libname) + 1);
+      _dl_reloc_cache_hash(h, &base, sizeof(base));
+      for (d = t->dynamic_addr; d->d_tag != DT_NULL; ++d)
+        ;
+      _dl_reloc_cache_hash(h, t->dynamic_addr,
+                           (char *)d - (char *)t->dynamic_addr);
+      if (!_dl_reloc_cache_build_id(t, h))
+        _dl_reloc_cache_contents(t, h);
+    }
+
+  _dl_reloc_cache_digest[0] = h[0] | 1;
+  _dl_reloc_cache_digest[1] = h[1];
+}
+
+static void
+_dl_reloc_cache_end(void)
+{
+  _dl_reloc_cache_digest[0] = _dl_reloc_cache_digest[1] = 0;
+}
+
+/* Page range of the only writable segment of a library. */
+static int
+_dl_reloc_cache_segment(struct elf_resolve *t, ElfW(Addr) *start,
+                        ElfW(Addr) *end)
+{
+  ElfW(Phdr) *p = t->ppnt, *w = NULL;
+  unsigned long i;
+
+  for (i = 0; i < t->n_phent; ++i, ++p)
+    if (p->p_type == PT_LOAD && (p->p_flags & PF_W))
+      {
+        if (w)
+          return 0;
+        w = p;
+      }
+
+  if (!w)
+    return 0;
+
+  *start = DL_RELOC_ADDR(t->loadaddr, w->p_vaddr) & PAGE_ALIGN;
+  *end = (DL_RELOC_ADDR(t->loadaddr, w->p_vaddr + w->p_memsz) + ADDR_ALIGN)
+         & PAGE_ALIGN;
+  return 1;
+}
+
+static char *
+_dl_reloc_cache_hex(char *p, unsigned long v)
+{
+  int s;
+
+  for (s = sizeof(v) * 8 - 4; s > 0 && !(v >> s); s -= 4)
+    ;
+  for (; s >= 0; s -= 4)
+    *p++ = "0123456789abcdef"[(v >> s) & 0xf];
+  return p;
+}
+
+/* All 16 digits of a 64 bit value. */
+static char *
+_dl_reloc_cache_hex64(char *p, unsigned long long v)
+{
+  int s;
+
+  for (s = 60; s >= 0; s -= 4)
+    *p++ = "0123456789abcdef"[(v >> s) & 0xf];
+  return p;
+}
+
+/* Path of the image of t: <ns>/<basename>@<load address>-<digest> */
+static void
+_dl_reloc_cache_path(struct elf_resolve *t, char *buf, unsigned long size)
+{
+  char const *n = _dl_get_last_path_component(t->libname);
+  unsigned long len = _dl_strlen(n);
+  unsigned long max = size - sizeof(RELOC_CACHE_NS) - (1 + 2 * sizeof(long))
+                      - (1 + 2 * 16) - 1;
+  char *p = buf;
+
+  if (len > max)
+    len = max;
+
+  _dl_memcpy(p, RELOC_CACHE_NS "/", sizeof(RELOC_CACHE_NS));
+  p += sizeof(RELOC_CACHE_NS);
+  _dl_memcpy(p, n, len);
+  p += len;
+  *p++ = '@';
+  p = _dl_reloc_cache_hex(p, DL_LOADADDR_BASE(t->loadaddr));
+  *p++ = '-';
+  p = _dl_reloc_cache_hex64(p, _dl_reloc_cache_digest[0]);
+  p = _dl_reloc_cache_hex64(p, _dl_reloc_cache_digest[1]);
+  *p = 0;
+}
+
+/*
+ * Map the RELRO pages of t from the image in fd where they are equal to the
+ * private ones, and give the private pages back.
+ */
+static void
+_dl_reloc_cache_share(struct elf_resolve *t, int fd, char const *img,
+                      ElfW(Addr) start, ElfW(Addr) end)
+{
+  ElfW(Addr) rs, re, a, b;
+
+  if (!t->relro_size)
+    return;
+
+  /* same range as _dl_protect_relro() */
+  rs = DL_RELOC_ADDR(t->loadaddr, t->relro_addr) & PAGE_ALIGN;
+  re = (DL_RELOC_ADDR(t->loadaddr, t->relro_addr) + t->relro_size)
+       & PAGE_ALIGN;
+  if (rs < start || re > end)
+    return;
+
+  for (a = rs; a < re; a = b)
+    {
+      if (_dl_memcmp((void *)a, img + (a - start), _dl_pagesize))
+        {
+          b = a + _dl_pagesize;
+          continue;
+        }
+
+      for (b = a + _dl_pagesize; b < re; b += _dl_pagesize)
+        if (_dl_memcmp((void *)b, img + (b - start), _dl_pagesize))
+          break;
+
+      _dl_discard((void *)a, b - a);
+      if (_dl_mmap_check_error(_dl_mmap((void *)a, b - a, PROT_READ,
+                                        MAP_SHARED | MAP_FIXED, fd,
+                                        a - start)))
+        {
+          _dl_dprintf(2, "%s: cannot map relocation cache\n", t->libname);
+          _dl_exit(1);
+        }
+    }
+
+  _dl_if_debug_dprint("relocation cache: %s shares %x bytes\n", t->libname,
+                      re - rs);
+}
+
+/*
+ * Relocate t from the cache.
+ *
+ * \retval 1   t is relocated.
+ * \retval 0   t is not in the cache, publish it after the relocation.
+ * \retval -1  t cannot be cached.
+ */
+static int
+_dl_reloc_cache_load(struct elf_resolve *t, int now)
+{
+  ElfW(Addr) start, end;
+  char path[128];
+  struct stat st;
+  char *img;
+  int fd;
+
+  if (!_dl_reloc_cache_digest[0] || t->libtype != elf_lib
+      || (t->init_flag & RELOCS_DONE) || t->dynamic_info[DT_TEXTREL]
+      || !_dl_reloc_cache_segment(t, &start, &end))
+    return -1;
+
+  _dl_reloc_cache_path(t, path, sizeof(path));
+  fd = _dl_open(path, O_RDONLY, 0);
+  if (fd < 0)
+    return 0;
+
+  img = MAP_FAILED;
+  if (_dl_fstat(fd, &st) >= 0 && (ElfW(Addr))st.st_size == end - start)
+    img = _dl_mmap(NULL, end - start, PROT_READ, MAP_SHARED, fd, 0);
+
+  if (_dl_mmap_check_error(img))
+    {
+      _dl_close(fd);
+      return -1;
+    }
+
+  _dl_memcpy((void *)start, img, end - start);
+
+  /* the GOT refers to this process' module record */
+  elf_machine_setup(t->loadaddr, t->dynamic_info, t,
+                    !(t->rtld_flags & RTLD_NOW));
+  if (t->dynamic_info[DT_BIND_NOW])
+    now = RTLD_NOW;
+  t->rtld_flags |= now;
+  t->init_flag |= RELOCS_DONE | JMP_RELOCS_DONE;
+
+  _dl_if_debug_dprint("relocation cache: %s from %s\n", t->libname, path);
+  _dl_reloc_cache_share(t, fd, img, start, end);
+
+  _dl_munmap(img, end - start);
+  _dl_close(fd);
+  return 1;
+}
+
+/* Publish the image of t after its relocation. */
+static void
+_dl_reloc_cache_store(struct elf_resolve *t)
+{
+  ElfW(Addr) start, end;
+  char path[128];
+  char *img;
+  int fd;
+
+  if (!_dl_reloc_cache_segment(t, &start, &end))
+    return;
+
+  _dl_reloc_cache_path(t, path, sizeof(path));
+  if (_dl_publish(RELOC_CACHE_NS, path + sizeof(RELOC_CACHE_NS),
+                  (void const *)start, end - start) < 0)
+    return;
+
+  fd = _dl_open(path, O_RDONLY, 0);
+  if (fd < 0)
+    return;
+
+  img = _dl_mmap(NULL, end - start, PROT_READ, MAP_SHARED, fd, 0);
+  if (!_dl_mmap_check_error(img))
+    {
+      _dl_reloc_cache_share(t, fd, img, start, end);
+      _dl_munmap(img, end - start);
+    }
+
+  _dl_close(fd);
+}
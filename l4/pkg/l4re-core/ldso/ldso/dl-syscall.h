@@ -35,6 +35,9 @@ L4RE_CALL(int _dl_close(int fd));
 L4RE_CALL(int _dl_read(int fd, void *buf, size_t len));
 L4RE_CALL(int _dl_write(int fd, char const *str, size_t len));
 L4RE_CALL(void *_dl_mmap(void *start, size_t len, int prot, int flags, int fd, off_t offset));
+L4RE_CALL(int _dl_env_cap(char const *name));
+L4RE_CALL(int _dl_publish(char const *ns, char const *name, void const *data, size_t len));
+L4RE_CALL(int _dl_discard(void *start, size_t len));
 
 
 static inline int
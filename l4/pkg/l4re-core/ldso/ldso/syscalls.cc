@@ -2,6 +2,12 @@
 #include <l4/l4re_vfs/vfs.h>
 #include <l4/sys/kdebug.h>
 #include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/namespace>
+#include <l4/re/rm>
+#include <l4/re/util/bitmap_cap_alloc>
+
+#include <string.h>
 
 using namespace L4Re::Vfs;
 using cxx::Ref_ptr;
@@ -13,6 +19,16 @@ extern "C" attribute_hidden call
 extern "C" attribute_hidden int _dl_open(char const *path, int flags, int mode);
 extern "C" attribute_hidden int _dl_close(int fd);
 extern "C" attribute_hidden L4Re::Vfs::Ops *__rtld_l4re_env_posix_vfs_ops;
+extern "C" attribute_hidden void *__rtld_l4re_global_env;
+
+namespace Vfs_config {
+  extern L4Re::Util::Cap_alloc_base &cap_alloc;
+}
+
+static inline
+L4Re::Env const *
+_dl_env()
+{ return reinterpret_cast<L4Re::Env const *>(__rtld_l4re_global_env); }
 
 #define L4RE_VFS __rtld_l4re_env_posix_vfs_ops
 
@@ -166,3 +182,72 @@ L4RE_CALL(void *_dl_mmap(void *start, size_t len, int prot, int flags, int fd, o
   else
     return MAP_FAILED;
 }
+
+
+L4RE_CALL(int _dl_env_cap(char const *name))
+{
+  return _dl_env()->get_cap<void>(name).is_valid();
+}
+
+/*
+ * Register a read-only copy of `data` in the name space `ns` of the
+ * environment.
+ */
+L4RE_CALL(int _dl_publish(char const *ns, char const *name, void const *data, size_t len))
+{
+  L4Re::Env const *e = _dl_env();
+  L4::Cap<L4Re::Namespace> n = e->get_cap<L4Re::Namespace>(ns);
+  if (!n.is_valid())
+    return -ENOENT;
+
+  L4::Cap<L4Re::Dataspace> ds = Vfs_config::cap_alloc.alloc<L4Re::Dataspace>();
+  if (!ds.is_valid())
+    return -ENOMEM;
+
+  char *a = 0;
+  long err = e->mem_alloc()->alloc(len, ds);
+  if (err >= 0)
+    err = e->rm()->attach(&a, len,
+                          L4Re::Rm::Search_addr | L4Re::Rm::Eager_map,
+                          L4::Ipc::make_cap_rw(ds));
+  if (err >= 0)
+    {
+      memcpy(a, data, len);
+      e->rm()->detach(a, 0);
+      err = n->register_obj(name, L4::Ipc::make_cap(ds, L4_CAP_FPAGE_RO),
+                            L4Re::Namespace::Ro);
+    }
+
+  if (err < 0)
+    {
+      e->task()->unmap(ds.fpage(), L4_FP_ALL_SPACES);
+      Vfs_config::cap_alloc.free(ds);
+      return err;
+    }
+
+  // the slot stays allocated, unmapping it would also revoke the entry
+  return 0;
+}
+
+/*
+ * Give the memory behind a private mapping back, the mapping must be
+ * replaced before it is used again.
+ */
+L4RE_CALL(int _dl_discard(void *start, size_t len))
+{
+  l4_addr_t a = (l4_addr_t)start;
+  unsigned long size = len;
+  l4_addr_t offset;
+  unsigned flags;
+  L4::Cap<L4Re::Dataspace> ds;
+
+  int err = _dl_env()->rm()->find(&a, &size, &offset, &flags, &ds);
+  if (err < 0)
+    return err;
+
+  if (a > (l4_addr_t)start || a + size < (l4_addr_t)start + len
+      || !ds.is_valid())
+    return -EINVAL;
+
+  return ds->clear(offset + ((l4_addr_t)start - a), len);
+}
@@ -85,6 +85,9 @@ namespace Vfs_config {
   inline void *malloc(size_t size) { return _dl_malloc(size); }
   inline void free(void *p) { _dl_free(p); }
 
+  // the loader's own output does not use the log ring
+  inline char const *getenv(char const *) { return 0; }
+
 }
 
 
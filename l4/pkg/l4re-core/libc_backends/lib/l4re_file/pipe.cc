@@ -0,0 +1,337 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+
+/*
+ * Pipes within one application, e.g., for the self-pipe trick of event
+ * loops or between threads.  Both ends support poll and friends.
+ */
+
+#include <l4/l4re_vfs/backend>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <new>
+
+using namespace L4Re::Vfs;
+using cxx::Ref_ptr;
+
+namespace {
+
+/// The buffer shared by the two ends of a pipe.
+class Pipe_buffer
+{
+public:
+  enum { Size = 16384 };
+
+  Pipe_buffer()
+  : rd(0), wr(0), reader_closed(false), writer_closed(false), _refs(2)
+  {}
+
+  static Pipe_buffer *create()
+  {
+    void *m = vfs_ops->malloc(sizeof(Pipe_buffer));
+    return m ? new (m) Pipe_buffer() : 0;
+  }
+
+  void release()
+  {
+    if (__atomic_sub_fetch(&_refs, 1, __ATOMIC_ACQ_REL) == 0)
+      {
+        this->~Pipe_buffer();
+        vfs_ops->free(this);
+      }
+  }
+
+  /// Number of bytes in the buffer, must hold lock.
+  unsigned used() const { return wr - rd; }
+  /// Number of free bytes in the buffer, must hold lock.
+  unsigned space() const { return Size - used(); }
+
+  /// Copy out up to \a len bytes, must hold lock.
+  unsigned get(char *buf, unsigned len)
+  {
+    if (len > used())
+      len = used();
+
+    for (unsigned done = 0; done < len; )
+      {
+        unsigned o = (rd + done) % Size;
+        unsigned c = len - done;
+        if (c > Size - o)
+          c = Size - o;
+        memcpy(buf + done, data + o, c);
+        done += c;
+      }
+
+    rd += len;
+    return len;
+  }
+
+  /// Copy in up to \a len bytes, must hold lock.
+  unsigned put(char const *buf, unsigned len)
+  {
+    if (len > space())
+      len = space();
+
+    for (unsigned done = 0; done < len; )
+      {
+        unsigned o = (wr + done) % Size;
+        unsigned c = len - done;
+        if (c > Size - o)
+          c = Size - o;
+        memcpy(data + o, buf + done, c);
+        done += c;
+      }
+
+    wr += len;
+    return len;
+  }
+
+  Be_lock lock;
+  unsigned rd, wr;
+  bool reader_closed;
+  bool writer_closed;
+  Be_poll_list readers;
+  Be_poll_list writers;
+
+private:
+  int _refs;
+  char data[Size];
+};
+
+class Pipe_end : public Be_file_stream
+{
+public:
+  Pipe_end(Pipe_buffer *p, bool write, int flags) throw()
+  : _p(p), _write(write), _flags(flags)
+  {}
+
+  ~Pipe_end() throw()
+  {
+    _p->lock.lock();
+    if (_write)
+      _p->writer_closed = true;
+    else
+      _p->reader_closed = true;
+    _p->lock.unlock();
+
+    if (_write)
+      _p->readers.notify(POLLHUP);
+    else
+      _p->writers.notify(POLLERR);
+
+    _p->release();
+  }
+
+  ssize_t readv(const struct iovec *iov, int iovcnt) throw();
+  ssize_t writev(const struct iovec *iov, int iovcnt) throw();
+
+  int fstat64(struct stat64 *buf) const throw()
+  {
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = S_IFIFO | 0600;
+    buf->st_blksize = PIPE_BUF;
+    return 0;
+  }
+
+  int get_status_flags() const throw()
+  { return (_write ? O_WRONLY : O_RDONLY) | (_flags & O_NONBLOCK); }
+
+  int set_status_flags(long flags) throw()
+  {
+    _flags = (_flags & ~O_NONBLOCK) | (flags & O_NONBLOCK);
+    return 0;
+  }
+
+  int poll_events(int events) throw();
+
+  int add_poll_entry(Poll_entry *e) throw()
+  {
+    (_write ? _p->writers : _p->readers).add(e);
+    return 0;
+  }
+
+  void remove_poll_entry(Poll_entry *e) throw()
+  { (_write ? _p->writers : _p->readers).remove(e); }
+
+private:
+  Pipe_buffer *_p;
+  bool _write;
+  int _flags;
+};
+
+int
+Pipe_end::poll_events(int events) throw()
+{
+  int r = 0;
+  _p->lock.lock();
+  if (_write)
+    {
+      if (_p->reader_closed)
+        r |= POLLERR;
+      else if (_p->space() >= PIPE_BUF)
+        r |= events & (POLLOUT | POLLWRNORM);
+    }
+  else
+    {
+      if (_p->used())
+        r |= events & (POLLIN | POLLRDNORM);
+      if (_p->writer_closed)
+        r |= POLLHUP;
+    }
+  _p->lock.unlock();
+  return r;
+}
+
+ssize_t
+Pipe_end::readv(const struct iovec *iov, int iovcnt) throw()
+{
+  if (_write)
+    return -EBADF;
+
+  for (;;)
+    {
+      ssize_t bytes = 0;
+      bool eof;
+
+      _p->lock.lock();
+      for (int i = 0; i < iovcnt && _p->used(); ++i)
+        bytes += _p->get((char *)iov[i].iov_base, iov[i].iov_len);
+      eof = _p->writer_closed;
+      _p->lock.unlock();
+
+      if (bytes)
+        {
+          _p->writers.notify(POLLOUT);
+          return bytes;
+        }
+
+      if (eof)
+        return 0;
+
+      if (_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+      int r = be_wait_for_events(this, POLLIN);
+      if (r < 0)
+        return r;
+    }
+}
+
+ssize_t
+Pipe_end::writev(const struct iovec *iov, int iovcnt) throw()
+{
+  if (!_write)
+    return -EBADF;
+
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    total += iov[i].iov_len;
+
+  ssize_t written = 0;
+  int i = 0;
+  size_t off = 0;
+
+  for (;;)
+    {
+      bool broken;
+
+      _p->lock.lock();
+      broken = _p->reader_closed;
+      // writes of up to PIPE_BUF bytes are atomic
+      if (!broken && (total > PIPE_BUF || _p->space() >= total))
+        for (; i < iovcnt && _p->space(); off = 0, ++i)
+          {
+            char const *b = (char const *)iov[i].iov_base + off;
+            unsigned n = _p->put(b, iov[i].iov_len - off);
+            written += n;
+            off += n;
+            if (off < iov[i].iov_len)
+              break;
+          }
+      _p->lock.unlock();
+
+      if (written)
+        _p->readers.notify(POLLIN);
+
+      if (broken)
+        return written ? written : -EPIPE;
+
+      if ((size_t)written == total)
+        return written;
+
+      if (_flags & O_NONBLOCK)
+        return written ? written : -EAGAIN;
+
+      int r = be_wait_for_events(this, POLLOUT);
+      if (r < 0)
+        return written ? written : r;
+    }
+}
+
+}
+
+int pipe2(int pipefd[2], int flags) L4_NOTHROW
+{
+  if (flags & ~(O_NONBLOCK | O_CLOEXEC))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  Pipe_buffer *p = Pipe_buffer::create();
+  if (!p)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  Ref_ptr<Pipe_end> rd(new Pipe_end(p, false, flags));
+  if (!rd)
+    {
+      p->~Pipe_buffer();
+      vfs_ops->free(p);
+      errno = ENOMEM;
+      return -1;
+    }
+
+  Ref_ptr<Pipe_end> wr(new Pipe_end(p, true, flags));
+  if (!wr)
+    {
+      // the read end drops one reference, this one the other
+      p->release();
+      errno = ENOMEM;
+      return -1;
+    }
+
+  int rfd = vfs_ops->alloc_fd(rd);
+  if (rfd < 0)
+    {
+      errno = -rfd;
+      return -1;
+    }
+
+  int wfd = vfs_ops->alloc_fd(wr);
+  if (wfd < 0)
+    {
+      vfs_ops->free_fd(rfd);
+      errno = -wfd;
+      return -1;
+    }
+
+  pipefd[0] = rfd;
+  pipefd[1] = wfd;
+  return 0;
+}
+
+int pipe(int pipefd[2]) L4_NOTHROW
+{
+  return pipe2(pipefd, 0);
+}
@@ -0,0 +1,803 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+
+/*
+ * poll, select and epoll on top of the readiness interface of
+ * L4Re::Vfs::File.
+ *
+ * A call that has to block registers a Poll_entry at every file and sleeps
+ * on a single semaphore, files signal the semaphore when their state
+ * changes.  Nothing is polled in a loop.  An epoll instance keeps its
+ * registrations across calls and additionally keeps the signalled entries
+ * on a ready list, so epoll_wait() only looks at files with new events.
+ */
+
+#include <features.h>
+
+#include <l4/re/env>
+#include <l4/sys/kip.h>
+#include <l4/util/util.h>
+#include <l4/l4re_vfs/backend>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <new>
+
+using namespace L4Re::Vfs;
+using cxx::Ref_ptr;
+
+namespace {
+
+/// Absolute deadline of a waiting call, derived from the KIP clock.
+class Deadline
+{
+public:
+  /// \param us  Relative timeout in microseconds, <0 means forever.
+  explicit Deadline(long long us)
+  : _never(us < 0), _end(_never ? 0 : now() + us)
+  {}
+
+  bool never() const { return _never; }
+
+  /// Remaining time as IPC timeout, or L4_IPC_BOTH_TIMEOUT_0 if expired.
+  l4_timeout_t timeout() const
+  {
+    if (_never)
+      return L4_IPC_NEVER;
+
+    l4_cpu_time_t t = now();
+    if (t >= _end)
+      return L4_IPC_BOTH_TIMEOUT_0;
+
+    // longer timeouts are split up by the callers waiting in a loop
+    l4_cpu_time_t rem = _end - t;
+    if (rem > 1000000000)
+      rem = 1000000000;
+
+    return l4_timeout(L4_IPC_TIMEOUT_0, l4util_micros2l4to(rem));
+  }
+
+  bool expired() const
+  { return !_never && now() >= _end; }
+
+private:
+  static l4_cpu_time_t now()
+  { return l4_kip_clock(l4re_kip()); }
+
+  bool _never;
+  l4_cpu_time_t _end;
+};
+
+/**
+ * Block on \a w until notified or \a d expires.
+ *
+ * \return 0 when notified, -ETIMEDOUT, or -EINTR.
+ */
+int wait_until(Poll_waiter *w, Deadline const &d)
+{
+  for (;;)
+    {
+      if (d.expired())
+        return -ETIMEDOUT;
+
+      int r = w->wait(d.timeout());
+      if (r != -ETIMEDOUT || d.never())
+        return r;
+    }
+}
+
+struct Poll_slot
+{
+  Ref_ptr<File> file;
+  Poll_entry entry;
+  bool registered;
+
+  Poll_slot(Poll_waiter *w, int events)
+  : entry(w, events), registered(false)
+  {}
+};
+
+enum
+{
+  Poll_always = POLLERR | POLLHUP | POLLNVAL,
+  Poll_stack_slots = 16,
+};
+
+/**
+ * Check all descriptors of \a fds once, set revents.
+ *
+ * \return The number of descriptors with events.
+ */
+int check_fds(struct pollfd *fds, nfds_t nfds, Poll_slot *slots)
+{
+  int n = 0;
+  for (nfds_t i = 0; i < nfds; ++i)
+    {
+      fds[i].revents = 0;
+      if (fds[i].fd < 0)
+        continue;
+
+      Ref_ptr<File> f = slots ? slots[i].file : vfs_ops->get_file(fds[i].fd);
+      if (!f)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = f->poll_events(fds[i].events) & (fds[i].events | Poll_always);
+
+      if (fds[i].revents)
+        ++n;
+    }
+
+  return n;
+}
+
+int do_poll(struct pollfd *fds, nfds_t nfds, Deadline const &d)
+{
+  // fast path: something is ready already or the caller does not wait
+  int n = check_fds(fds, nfds, 0);
+  if (n || (!d.never() && d.expired()))
+    return n;
+
+  L4::Cap<L4::Semaphore> sem = vfs_ops->alloc_poll_sem();
+  if (!sem.is_valid())
+    return -ENOMEM;
+
+  Poll_waiter w(sem);
+
+  char stack_slots[Poll_stack_slots * sizeof(Poll_slot)]
+    __attribute__((aligned(__alignof__(Poll_slot))));
+  Poll_slot *slots = reinterpret_cast<Poll_slot *>(stack_slots);
+  if (nfds > Poll_stack_slots)
+    slots = static_cast<Poll_slot *>(malloc(nfds * sizeof(Poll_slot)));
+
+  if (!slots)
+    {
+      vfs_ops->free_poll_sem(sem);
+      return -ENOMEM;
+    }
+
+  for (nfds_t i = 0; i < nfds; ++i)
+    {
+      Poll_slot *s = new (&slots[i]) Poll_slot(&w, fds[i].events);
+      if (fds[i].fd < 0)
+        continue;
+
+      s->file = vfs_ops->get_file(fds[i].fd);
+      if (s->file)
+        s->registered = s->file->add_poll_entry(&s->entry) == 0;
+    }
+
+  // events that happened before registration are not signalled
+  while (!(n = check_fds(fds, nfds, slots)))
+    {
+      int r = wait_until(&w, d);
+      if (r == -ETIMEDOUT)
+        break;
+      if (r < 0)
+        {
+          n = r;
+          break;
+        }
+    }
+
+  for (nfds_t i = 0; i < nfds; ++i)
+    {
+      if (slots[i].registered)
+        slots[i].file->remove_poll_entry(&slots[i].entry);
+      slots[i].~Poll_slot();
+    }
+
+  if (nfds > Poll_stack_slots)
+    free(slots);
+
+  vfs_ops->free_poll_sem(sem);
+  return n;
+}
+
+long long timespec_to_us(struct timespec const *t)
+{
+  if (!t)
+    return -1;
+  return (long long)t->tv_sec * 1000000 + (t->tv_nsec + 999) / 1000;
+}
+
+long long timeval_to_us(struct timeval const *t)
+{
+  if (!t)
+    return -1;
+  return (long long)t->tv_sec * 1000000 + t->tv_usec;
+}
+
+int do_select(int nfds, fd_set *readfds, fd_set *writefds,
+              fd_set *exceptfds, long long timeout_us)
+{
+  if (nfds < 0 || nfds > FD_SETSIZE)
+    return -EINVAL;
+
+  unsigned n = 0;
+  for (int fd = 0; fd < nfds; ++fd)
+    if (   (readfds && FD_ISSET(fd, readfds))
+        || (writefds && FD_ISSET(fd, writefds))
+        || (exceptfds && FD_ISSET(fd, exceptfds)))
+      ++n;
+
+  struct pollfd stack_fds[Poll_stack_slots];
+  struct pollfd *fds = stack_fds;
+  if (n > Poll_stack_slots)
+    fds = static_cast<struct pollfd *>(malloc(n * sizeof(struct pollfd)));
+
+  if (!fds)
+    return -ENOMEM;
+
+  n = 0;
+  for (int fd = 0; fd < nfds; ++fd)
+    {
+      short events = 0;
+      if (readfds && FD_ISSET(fd, readfds))
+        events |= POLLIN;
+      if (writefds && FD_ISSET(fd, writefds))
+        events |= POLLOUT;
+      if (exceptfds && FD_ISSET(fd, exceptfds))
+        events |= POLLPRI;
+      if (!events)
+        continue;
+
+      fds[n].fd = fd;
+      fds[n].events = events;
+      ++n;
+    }
+
+  int r = do_poll(fds, n, Deadline(timeout_us));
+  if (r >= 0)
+    {
+      if (readfds)
+        FD_ZERO(readfds);
+      if (writefds)
+        FD_ZERO(writefds);
+      if (exceptfds)
+        FD_ZERO(exceptfds);
+
+      r = 0;
+      for (unsigned i = 0; i < n; ++i)
+        {
+          short rev = fds[i].revents;
+          if (rev & POLLNVAL)
+            {
+              r = -EBADF;
+              break;
+            }
+
+          if ((fds[i].events & POLLIN) && (rev & (POLLIN | POLLHUP | POLLERR)))
+            {
+              FD_SET(fds[i].fd, readfds);
+              ++r;
+            }
+          if ((fds[i].events & POLLOUT) && (rev & (POLLOUT | POLLERR)))
+            {
+              FD_SET(fds[i].fd, writefds);
+              ++r;
+            }
+          if ((fds[i].events & POLLPRI) && (rev & POLLPRI))
+            {
+              FD_SET(fds[i].fd, exceptfds);
+              ++r;
+            }
+        }
+    }
+
+  if (fds != stack_fds)
+    free(fds);
+
+  return r;
+}
+
+
+/**
+ * An epoll instance.
+ *
+ * Registered files are kept in a table indexed by file descriptor.  The
+ * instance owns one semaphore and is the waiter of all its entries: a
+ * notification puts the entry on the ready list and signals the
+ * semaphore.  Level-triggered entries stay on the ready list as long as
+ * they report events.
+ *
+ * \note Unlike on Linux, closing a file descriptor does not remove it from
+ *       the instance, use EPOLL_CTL_DEL before close().
+ */
+class Epoll_file : public Be_file
+{
+public:
+  explicit Epoll_file(L4::Cap<L4::Semaphore> sem) throw()
+  : _waiter(this, sem), _items(0), _num_items(0), _ready(0)
+  {}
+
+  ~Epoll_file() throw();
+
+  int ctl(int op, int fd, struct epoll_event *event) throw();
+  int wait(struct epoll_event *events, int maxevents,
+           Deadline const &d) throw();
+
+  int poll_events(int events) throw()
+  {
+    return _ready ? events & (POLLIN | POLLRDNORM) : 0;
+  }
+
+  int add_poll_entry(Poll_entry *e) throw()
+  {
+    _pollers.add(e);
+    return 0;
+  }
+
+  void remove_poll_entry(Poll_entry *e) throw()
+  { _pollers.remove(e); }
+
+  int fstat64(struct stat64 *buf) const throw()
+  {
+    memset(buf, 0, sizeof(*buf));
+    buf->st_mode = 0600;
+    return 0;
+  }
+
+private:
+  struct Item : Poll_entry
+  {
+    Item(Poll_waiter *w, int fd, Ref_ptr<File> const &file,
+         struct epoll_event const &ev)
+    : Poll_entry(w, ev.events & ~(EPOLLET | EPOLLONESHOT)),
+      fd(fd), file(file), ev(ev), next_ready(0), ready(false),
+      disabled(false)
+    {}
+
+    int fd;
+    Ref_ptr<File> file;
+    struct epoll_event ev;
+    Item *next_ready;
+    bool ready;
+    bool disabled;
+  };
+
+  /// Direct entries get no notify(), they are kept on a separate list.
+  struct Direct_link : cxx::H_list_item_t<Direct_link>
+  {
+    Item *item;
+  };
+
+  struct Waiter : Poll_waiter
+  {
+    Waiter(Epoll_file *ep, L4::Cap<L4::Semaphore> sem)
+    : Poll_waiter(sem), ep(ep)
+    {}
+
+    void notify(Poll_entry *e) throw()
+    {
+      ep->make_ready(static_cast<Item *>(e));
+      Poll_waiter::notify(e);
+    }
+
+    Epoll_file *ep;
+  };
+
+  /// Put \a i on the ready list, may be called from any thread.
+  void make_ready(Item *i) throw()
+  {
+    _ready_lock.lock();
+    bool was_empty = !_ready;
+    if (!i->ready)
+      {
+        i->ready = true;
+        i->next_ready = _ready;
+        _ready = i;
+      }
+    _ready_lock.unlock();
+
+    if (was_empty)
+      _pollers.notify(POLLIN);
+  }
+
+  Item *take_ready() throw()
+  {
+    _ready_lock.lock();
+    Item *r = _ready;
+    _ready = 0;
+    for (Item *i = r; i; i = i->next_ready)
+      i->ready = false;
+    _ready_lock.unlock();
+    return r;
+  }
+
+  void unlink_ready(Item *item) throw()
+  {
+    _ready_lock.lock();
+    if (item->ready)
+      {
+        Item **p = &_ready;
+        while (*p != item)
+          p = &(*p)->next_ready;
+        *p = item->next_ready;
+        item->ready = false;
+      }
+    _ready_lock.unlock();
+  }
+
+  int report(Item *i, struct epoll_event *events, int maxevents, int n) throw();
+  void destroy_item(Item *i) throw();
+
+  Waiter _waiter;
+
+  /// Serializes epoll_ctl() and the item processing in epoll_wait().
+  Be_lock _ctl_lock;
+  Item **_items;
+  int _num_items;
+
+  Be_lock _ready_lock;
+  Item *_ready;
+  cxx::H_list_t<Direct_link> _direct;
+
+  /// Waiters polling on the epoll instance itself.
+  Be_poll_list _pollers;
+};
+
+Epoll_file::~Epoll_file() throw()
+{
+  for (int fd = 0; fd < _num_items; ++fd)
+    if (_items[fd])
+      destroy_item(_items[fd]);
+
+  free(_items);
+  vfs_ops->free_poll_sem(_waiter.sem());
+}
+
+void
+Epoll_file::destroy_item(Item *i) throw()
+{
+  i->file->remove_poll_entry(i);
+  unlink_ready(i);
+  if (i->direct)
+    {
+      for (auto d = _direct.begin(); d != _direct.end(); ++d)
+        if (d->item == i)
+          {
+            Direct_link *l = *d;
+            _direct.remove(l);
+            delete l;
+            break;
+          }
+    }
+
+  _items[i->fd] = 0;
+  delete i;
+}
+
+int
+Epoll_file::ctl(int op, int fd, struct epoll_event *event) throw()
+{
+  if (op != EPOLL_CTL_DEL && !event)
+    return -EFAULT;
+
+  Ref_ptr<File> file = vfs_ops->get_file(fd);
+  if (!file)
+    return -EBADF;
+
+  if (file.get() == this)
+    return -EINVAL;
+
+  _ctl_lock.lock();
+  Item *item = fd < _num_items ? _items[fd] : 0;
+  int r = 0;
+
+  switch (op)
+    {
+    case EPOLL_CTL_ADD:
+      if (item)
+        {
+          r = -EEXIST;
+          break;
+        }
+
+      if (fd >= _num_items)
+        {
+          int n = _num_items ? _num_items : 64;
+          while (n <= fd)
+            n *= 2;
+
+          Item **x = static_cast<Item **>(realloc(_items, n * sizeof(Item *)));
+          if (!x)
+            {
+              r = -ENOMEM;
+              break;
+            }
+
+          memset(x + _num_items, 0, (n - _num_items) * sizeof(Item *));
+          _items = x;
+          _num_items = n;
+        }
+
+      item = new (std::nothrow) Item(&_waiter, fd, file, *event);
+      if (!item)
+        {
+          r = -ENOMEM;
+          break;
+        }
+
+      r = file->add_poll_entry(item);
+      if (r < 0)
+        {
+          delete item;
+          break;
+        }
+
+      if (item->direct)
+        {
+          Direct_link *l = new (std::nothrow) Direct_link();
+          if (!l)
+            {
+              file->remove_poll_entry(item);
+              delete item;
+              r = -ENOMEM;
+              break;
+            }
+          l->item = item;
+          _direct.add(l);
+        }
+
+      _items[fd] = item;
+      // report events that are pending already
+      make_ready(item);
+      break;
+
+    case EPOLL_CTL_MOD:
+      if (!item)
+        {
+          r = -ENOENT;
+          break;
+        }
+
+      item->ev = *event;
+      item->events = event->events & ~(EPOLLET | EPOLLONESHOT);
+      item->disabled = false;
+      make_ready(item);
+      break;
+
+    case EPOLL_CTL_DEL:
+      if (!item)
+        {
+          r = -ENOENT;
+          break;
+        }
+
+      destroy_item(item);
+      break;
+
+    default:
+      r = -EINVAL;
+      break;
+    }
+
+  _ctl_lock.unlock();
+  return r;
+}
+
+/**
+ * Check \a i and add its events to \a events.
+ *
+ * \return The new number of events.
+ */
+int
+Epoll_file::report(Item *i, struct epoll_event *events, int maxevents,
+                   int n) throw()
+{
+  if (i->disabled)
+    return n;
+
+  int rev = i->file->poll_events(i->events) & (i->events | POLLERR | POLLHUP);
+  if (!rev)
+    return n;
+
+  if (n >= maxevents)
+    {
+      // no room, keep it for the next call
+      make_ready(i);
+      return n;
+    }
+
+  events[n].events = rev;
+  events[n].data = i->ev.data;
+
+  if (i->ev.events & EPOLLONESHOT)
+    i->disabled = true;
+  else if (!(i->ev.events & EPOLLET))
+    make_ready(i);
+
+  return n + 1;
+}
+
+int
+Epoll_file::wait(struct epoll_event *events, int maxevents,
+                 Deadline const &d) throw()
+{
+  if (maxevents <= 0)
+    return -EINVAL;
+
+  for (;;)
+    {
+      int n = 0;
+
+      _ctl_lock.lock();
+      Item *next;
+      for (Item *i = take_ready(); i; i = next)
+        {
+          next = i->next_ready;
+          n = report(i, events, maxevents, n);
+        }
+
+      for (auto l = _direct.begin(); l != _direct.end(); ++l)
+        if (!l->item->ready)
+          n = report(l->item, events, maxevents, n);
+      _ctl_lock.unlock();
+
+      if (n)
+        return n;
+
+      int r = wait_until(&_waiter, d);
+      if (r == -ETIMEDOUT)
+        return 0;
+      if (r < 0)
+        return r;
+    }
+}
+
+Ref_ptr<Epoll_file> get_epoll(int epfd, int *err)
+{
+  Ref_ptr<File> f = vfs_ops->get_file(epfd);
+  if (!f)
+    {
+      *err = EBADF;
+      return Ref_ptr<Epoll_file>();
+    }
+
+  Epoll_file *ep = dynamic_cast<Epoll_file *>(f.get());
+  if (!ep)
+    {
+      *err = EINVAL;
+      return Ref_ptr<Epoll_file>();
+    }
+
+  return cxx::ref_ptr(ep);
+}
+
+}
+
+#define ERRNO_RET(r) do { \
+  if ((r) < 0) \
+    {          \
+      errno = -(r); \
+      return -1; \
+    } } while (0)
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+  int r = do_poll(fds, nfds, Deadline(timeout < 0 ? -1 : timeout * 1000LL));
+  ERRNO_RET(r);
+  return r;
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+          const sigset_t *sigmask)
+{
+  // there are no asynchronous signals to block
+  (void)sigmask;
+  int r = do_poll(fds, nfds, Deadline(timespec_to_us(timeout)));
+  ERRNO_RET(r);
+  return r;
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds,
+           fd_set *exceptfds, struct timeval *timeout)
+{
+  int r = do_select(nfds, readfds, writefds, exceptfds,
+                    timeval_to_us(timeout));
+  ERRNO_RET(r);
+  return r;
+}
+
+int pselect(int nfds, fd_set *readfds, fd_set *writefds,
+            fd_set *exceptfds, const struct timespec *timeout,
+            const sigset_t *sigmask)
+{
+  (void)sigmask;
+  int r = do_select(nfds, readfds, writefds, exceptfds,
+                    timespec_to_us(timeout));
+  ERRNO_RET(r);
+  return r;
+}
+
+int epoll_create1(int flags) __THROW
+{
+  if (flags & ~EPOLL_CLOEXEC)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  L4::Cap<L4::Semaphore> sem = vfs_ops->alloc_poll_sem();
+  if (!sem.is_valid())
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  Ref_ptr<Epoll_file> ep(new Epoll_file(sem));
+  if (!ep)
+    {
+      vfs_ops->free_poll_sem(sem);
+      errno = ENOMEM;
+      return -1;
+    }
+
+  int fd = vfs_ops->alloc_fd(ep);
+  if (fd < 0)
+    {
+      errno = -fd;
+      return -1;
+    }
+
+  return fd;
+}
+
+int epoll_create(int size) __THROW
+{
+  if (size <= 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) __THROW
+{
+  int err;
+  Ref_ptr<Epoll_file> ep = get_epoll(epfd, &err);
+  if (!ep)
+    {
+      errno = err;
+      return -1;
+    }
+
+  int r = ep->ctl(op, fd, event);
+  ERRNO_RET(r);
+  return 0;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout)
+{
+  int err;
+  Ref_ptr<Epoll_file> ep = get_epoll(epfd, &err);
+  if (!ep)
+    {
+      errno = err;
+      return -1;
+    }
+
+  int r = ep->wait(events, maxevents,
+                   Deadline(timeout < 0 ? -1 : timeout * 1000LL));
+  ERRNO_RET(r);
+  return r;
+}
+
+int epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
+                int timeout, const sigset_t *sigmask)
+{
+  (void)sigmask;
+  return epoll_wait(epfd, events, maxevents, timeout);
+}
@@ -0,0 +1,752 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+
+/*
+ * Thread-caching malloc.
+ *
+ * Requests of up to MAX_SMALL bytes are rounded up to one of NUM_CLASSES
+ * size classes.  Objects of a class are carved from SPAN_SIZE spans, and
+ * every thread keeps a cache of free objects per class that it refills from
+ * and drains to the per-class central lists in batches.  The common
+ * malloc/free path therefore takes no lock at all.  Spans come from large
+ * anonymous areas that are reserved once and populated by the memory
+ * allocator on demand, so growing the heap rarely involves the region
+ * manager.  Larger requests get a mapping of their own; recently freed
+ * large mappings are kept for reuse.
+ *
+ * Programs select this allocator by adding libc_be_malloc_tc to their
+ * REQUIRES_LIBS, which links it in front of the libc allocator.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <l4/sys/compiler.h>
+#include <l4/sys/consts.h>
+
+/* The allocator also serves programs not linked against libpthread. */
+#pragma weak pthread_mutex_lock
+#pragma weak pthread_mutex_unlock
+#pragma weak pthread_key_create
+#pragma weak pthread_setspecific
+
+enum
+{
+  MIN_ALIGN           = 16,
+  SPAN_SHIFT          = 16,
+  SPAN_SIZE           = 1 << SPAN_SHIFT,
+  MAX_SMALL           = 32 << 10,
+  NUM_CLASSES         = 44,
+  AREA_SIZE           = 32 << 20,
+  AREA_SPANS          = AREA_SIZE / SPAN_SIZE,
+  MAX_AREAS           = 64,
+  TCACHE_CLASS_BYTES  = 32 << 10,  ///< Bytes a thread caches per class
+  TCACHE_CLASS_MAX    = 128,       ///< Objects a thread caches per class
+  LARGE_CACHE_ENTRIES = 8,
+  LARGE_CACHE_BYTES   = 16 << 20,
+  LARGE_MAGIC         = 0x4c617267,
+};
+
+/* 16-byte steps up to 256 bytes, then four classes per power of two. */
+static const unsigned class_size[NUM_CLASSES] =
+{
+     16,    32,    48,    64,    80,    96,   112,   128,
+    144,   160,   176,   192,   208,   224,   240,   256,
+    320,   384,   448,   512,   640,   768,   896,  1024,
+   1280,  1536,  1792,  2048,  2560,  3072,  3584,  4096,
+   5120,  6144,  7168,  8192, 10240, 12288, 14336, 16384,
+  20480, 24576, 28672, 32768,
+};
+
+static inline unsigned size_class(size_t size)
+{
+  unsigned long s, b;
+
+  if (size <= 256)
+    return size ? (size - 1) / 16 : 0;
+
+  s = size - 1;
+  b = sizeof(unsigned long) * 8 - 1 - __builtin_clzl(s);
+  return 16 + (b - 8) * 4 + ((s >> (b - 2)) & 3);
+}
+
+struct span
+{
+  void *free;                /* Returned objects */
+  struct span *next, *prev;  /* Partial list of the class / free spans */
+  char *start;
+  unsigned short cls;
+  unsigned short used;       /* Objects currently handed out */
+  unsigned short carved;     /* Objects ever handed out */
+  unsigned short total;
+  unsigned char listed;      /* On the partial list of its class */
+};
+
+struct area
+{
+  char *base;
+  struct span *spans;        /* Descriptors, kept in the first span(s) */
+  unsigned next_span;        /* Never used spans start here */
+};
+
+struct central
+{
+  pthread_mutex_t lock;
+  struct span *partial;      /* Spans with free or uncarved objects */
+};
+
+struct tcache_bin
+{
+  void *head;
+  unsigned short count;
+  unsigned short max;
+};
+
+struct tcache
+{
+  struct tcache_bin bins[NUM_CLASSES];
+  int active;
+};
+
+struct large_hdr
+{
+  void *base;
+  size_t map_size;
+  size_t usable;
+  size_t magic;
+};
+
+struct large_entry
+{
+  void *base;
+  size_t size;
+};
+
+static struct area areas[MAX_AREAS];
+static unsigned num_areas;
+static struct span *free_spans;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct central central[NUM_CLASSES] =
+  { [0 ... NUM_CLASSES - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL } };
+
+static struct large_entry large_cache[LARGE_CACHE_ENTRIES];
+static size_t large_cached_bytes;
+static size_t large_mapped_bytes;
+static unsigned large_mappings;
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t tcache_key;
+static int tcache_key_state;
+static __thread struct tcache tcache;
+
+static inline void lock(pthread_mutex_t *m)
+{
+  if (pthread_mutex_lock)
+    pthread_mutex_lock(m);
+}
+
+static inline void unlock(pthread_mutex_t *m)
+{
+  if (pthread_mutex_unlock)
+    pthread_mutex_unlock(m);
+}
+
+static inline void push(void **head, void *obj)
+{
+  *(void **)obj = *head;
+  *head = obj;
+}
+
+static inline void *pop(void **head)
+{
+  void *obj = *head;
+  *head = *(void **)obj;
+  return obj;
+}
+
+static struct span *span_of(void const *p)
+{
+  unsigned n = __atomic_load_n(&num_areas, __ATOMIC_ACQUIRE);
+
+  for (unsigned i = 0; i < n; ++i)
+    {
+      uintptr_t off = (uintptr_t)p - (uintptr_t)areas[i].base;
+      if (off < AREA_SIZE)
+        return &areas[i].spans[off >> SPAN_SHIFT];
+    }
+
+  return NULL;
+}
+
+/* Must hold heap_lock. */
+static int add_area(void)
+{
+  enum
+  {
+    Meta_spans = (AREA_SPANS * sizeof(struct span) + SPAN_SIZE - 1)
+                 / SPAN_SIZE
+  };
+  struct area *a;
+  void *m;
+
+  if (num_areas >= MAX_AREAS)
+    return -ENOMEM;
+
+  m = mmap(NULL, AREA_SIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED)
+    return -ENOMEM;
+
+  a = &areas[num_areas];
+  a->base = m;
+  a->spans = m;
+  a->next_span = Meta_spans;
+  __atomic_store_n(&num_areas, num_areas + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static struct span *alloc_span(unsigned cls)
+{
+  struct span *s;
+
+  lock(&heap_lock);
+  if ((s = free_spans))
+    free_spans = s->next;
+  else
+    {
+      struct area *a = num_areas ? &areas[num_areas - 1] : NULL;
+      if ((!a || a->next_span >= AREA_SPANS) && add_area() == 0)
+        a = &areas[num_areas - 1];
+
+      if (a && a->next_span < AREA_SPANS)
+        {
+          s = &a->spans[a->next_span];
+          s->start = a->base + ((size_t)a->next_span << SPAN_SHIFT);
+          ++a->next_span;
+        }
+    }
+  unlock(&heap_lock);
+
+  if (!s)
+    return NULL;
+
+  s->free = NULL;
+  s->next = s->prev = NULL;
+  s->cls = cls;
+  s->used = 0;
+  s->carved = 0;
+  s->total = SPAN_SIZE / class_size[cls];
+  s->listed = 0;
+  return s;
+}
+
+static void release_span(struct span *s)
+{
+  lock(&heap_lock);
+  s->next = free_spans;
+  free_spans = s;
+  unlock(&heap_lock);
+}
+
+/* Must hold the central lock of the span's class. */
+static void link_partial(struct central *c, struct span *s)
+{
+  s->prev = NULL;
+  s->next = c->partial;
+  if (c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+  s->listed = 1;
+}
+
+static void unlink_partial(struct central *c, struct span *s)
+{
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if (s->next)
+    s->next->prev = s->prev;
+  s->listed = 0;
+}
+
+/* Move up to n objects of class cls to the list at *head. */
+static unsigned central_fetch(unsigned cls, unsigned n, void **head)
+{
+  struct central *c = &central[cls];
+  unsigned size = class_size[cls];
+  unsigned got = 0;
+
+  lock(&c->lock);
+  while (got < n)
+    {
+      struct span *s = c->partial;
+      if (!s)
+        {
+          if (!(s = alloc_span(cls)))
+            break;
+          link_partial(c, s);
+        }
+
+      while (got < n && s->free)
+        {
+          push(head, pop(&s->free));
+          ++s->used;
+          ++got;
+        }
+
+      while (got < n && s->carved < s->total)
+        {
+          push(head, s->start + (size_t)s->carved++ * size);
+          ++s->used;
+          ++got;
+        }
+
+      if (!s->free && s->carved == s->total)
+        unlink_partial(c, s);
+    }
+  unlock(&c->lock);
+
+  return got;
+}
+
+/* Return n objects of class cls from the list at *head. */
+static void central_release(unsigned cls, unsigned n, void **head)
+{
+  struct central *c = &central[cls];
+
+  lock(&c->lock);
+  while (n--)
+    {
+      void *obj = pop(head);
+      struct span *s = span_of(obj);
+
+      push(&s->free, obj);
+      --s->used;
+      if (!s->listed)
+        link_partial(c, s);
+
+      /* Keep one span per class around to avoid thrashing. */
+      if (s->used == 0 && (s->prev || s->next))
+        {
+          unlink_partial(c, s);
+          release_span(s);
+        }
+    }
+  unlock(&c->lock);
+}
+
+static void tcache_destroy(void *arg)
+{
+  struct tcache *tc = arg;
+
+  for (unsigned cls = 0; cls < NUM_CLASSES; ++cls)
+    {
+      struct tcache_bin *b = &tc->bins[cls];
+      if (b->count)
+        central_release(cls, b->count, &b->head);
+      b->count = 0;
+    }
+
+  /* Allocations from later destructors set the cache up again. */
+  tc->active = 0;
+}
+
+static __attribute__((noinline)) void tcache_init(struct tcache *tc)
+{
+  for (unsigned cls = 0; cls < NUM_CLASSES; ++cls)
+    {
+      unsigned max = TCACHE_CLASS_BYTES / class_size[cls];
+      tc->bins[cls].max = max < 2 ? 2 : max > TCACHE_CLASS_MAX
+                                        ? TCACHE_CLASS_MAX : max;
+    }
+
+  /* Set before pthread_setspecific, which may allocate itself. */
+  tc->active = 1;
+
+  if (!pthread_key_create)
+    return;
+
+  lock(&heap_lock);
+  if (!tcache_key_state)
+    tcache_key_state = pthread_key_create(&tcache_key, tcache_destroy)
+                       ? -1 : 1;
+  unlock(&heap_lock);
+
+  if (tcache_key_state > 0)
+    pthread_setspecific(tcache_key, tc);
+}
+
+static __attribute__((noinline)) void *tcache_refill(struct tcache *tc, unsigned cls)
+{
+  struct tcache_bin *b = &tc->bins[cls];
+
+  if (!tc->active)
+    tcache_init(tc);
+
+  if (!b->head)
+    b->count = central_fetch(cls, b->max / 2, &b->head);
+
+  if (!b->head)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  --b->count;
+  return pop(&b->head);
+}
+
+static inline void *small_alloc(unsigned cls)
+{
+  struct tcache_bin *b = &tcache.bins[cls];
+
+  if (L4_LIKELY(b->head != NULL))
+    {
+      --b->count;
+      return pop(&b->head);
+    }
+
+  return tcache_refill(&tcache, cls);
+}
+
+static inline void small_free(void *p, struct span *s)
+{
+  struct tcache *tc = &tcache;
+  struct tcache_bin *b = &tc->bins[s->cls];
+
+  if (L4_UNLIKELY(!tc->active))
+    tcache_init(tc);
+
+  push(&b->head, p);
+  if (L4_UNLIKELY(++b->count > b->max))
+    {
+      unsigned n = b->count / 2;
+      central_release(s->cls, n, &b->head);
+      b->count -= n;
+    }
+}
+
+static void *large_cache_take(size_t size, size_t *map_size)
+{
+  struct large_entry *best = NULL;
+
+  lock(&large_lock);
+  for (unsigned i = 0; i < LARGE_CACHE_ENTRIES; ++i)
+    {
+      struct large_entry *e = &large_cache[i];
+      if (e->base && e->size >= size && e->size - size <= size / 2
+          && (!best || e->size < best->size))
+        best = e;
+    }
+
+  if (best)
+    {
+      void *base = best->base;
+      *map_size = best->size;
+      large_cached_bytes -= best->size;
+      best->base = NULL;
+      unlock(&large_lock);
+      return base;
+    }
+  unlock(&large_lock);
+
+  return NULL;
+}
+
+static int large_cache_put(void *base, size_t map_size)
+{
+  int done = 0;
+
+  lock(&large_lock);
+  if (large_cached_bytes + map_size <= LARGE_CACHE_BYTES)
+    for (unsigned i = 0; i < LARGE_CACHE_ENTRIES; ++i)
+      if (!large_cache[i].base)
+        {
+          large_cache[i].base = base;
+          large_cache[i].size = map_size;
+          large_cached_bytes += map_size;
+          done = 1;
+          break;
+        }
+  unlock(&large_lock);
+
+  return done;
+}
+
+static void *large_alloc(size_t size, size_t align, int zero)
+{
+  size_t map_size, need;
+  struct large_hdr *h;
+  int reused = 1;
+  char *base, *p;
+
+  if (size > SIZE_MAX / 2 || align > SIZE_MAX / 4)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  need = size + ((sizeof(struct large_hdr) + align - 1) & ~(align - 1));
+  if (align > L4_PAGESIZE)
+    need += align - L4_PAGESIZE;
+  need = l4_round_page(need);
+
+  if (!(base = large_cache_take(need, &map_size)))
+    {
+      base = mmap(NULL, need, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED)
+        {
+          errno = ENOMEM;
+          return NULL;
+        }
+
+      map_size = need;
+      reused = 0;
+
+      lock(&large_lock);
+      large_mapped_bytes += map_size;
+      ++large_mappings;
+      unlock(&large_lock);
+    }
+
+  p = (char *)(((uintptr_t)base + sizeof(struct large_hdr) + align - 1)
+               & ~(uintptr_t)(align - 1));
+  h = (struct large_hdr *)p - 1;
+  h->base = base;
+  h->map_size = map_size;
+  h->usable = base + map_size - p;
+  h->magic = LARGE_MAGIC;
+
+  /* Fresh anonymous memory is already zero. */
+  if (zero && reused)
+    memset(p, 0, size);
+
+  return p;
+}
+
+static void large_free(void *p)
+{
+  struct large_hdr *h = (struct large_hdr *)p - 1;
+  void *base = h->base;
+  size_t map_size = h->map_size;
+
+  if (L4_UNLIKELY(h->magic != LARGE_MAGIC))
+    return;
+
+  h->magic = 0;
+  if (large_cache_put(base, map_size))
+    return;
+
+  lock(&large_lock);
+  large_mapped_bytes -= map_size;
+  --large_mappings;
+  unlock(&large_lock);
+  munmap(base, map_size);
+}
+
+static size_t usable_size(void *p)
+{
+  struct span *s = span_of(p);
+
+  if (s)
+    return class_size[s->cls];
+
+  return ((struct large_hdr *)p - 1)->usable;
+}
+
+void *malloc(size_t size)
+{
+  if (L4_LIKELY(size <= MAX_SMALL))
+    return small_alloc(size_class(size));
+
+  return large_alloc(size, MIN_ALIGN, 0);
+}
+
+void free(void *p)
+{
+  struct span *s;
+
+  if (!p)
+    return;
+
+  if (L4_LIKELY((s = span_of(p)) != NULL))
+    small_free(p, s);
+  else
+    large_free(p);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  size_t bytes;
+  void *p;
+
+  if (__builtin_mul_overflow(n, size, &bytes))
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  if (bytes > MAX_SMALL)
+    return large_alloc(bytes, MIN_ALIGN, 1);
+
+  if ((p = small_alloc(size_class(bytes))))
+    memset(p, 0, bytes);
+
+  return p;
+}
+
+void *realloc(void *p, size_t size)
+{
+  size_t old;
+  void *n;
+
+  if (!p)
+    return malloc(size);
+
+  if (!size)
+    {
+      free(p);
+      return NULL;
+    }
+
+  old = usable_size(p);
+  if (size <= old && size > old / 2)
+    return p;
+
+  if (!(n = malloc(size)))
+    return NULL;
+
+  memcpy(n, p, size < old ? size : old);
+  free(p);
+  return n;
+}
+
+void *memalign(size_t align, size_t size)
+{
+  if (align <= MIN_ALIGN)
+    return malloc(size);
+
+  if (align & (align - 1))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  /* Spans are page aligned, so objects of classes that are a multiple of
+     the alignment are aligned as well. */
+  if (align <= L4_PAGESIZE && size <= MAX_SMALL - align)
+    {
+      unsigned cls = size_class((size + align - 1) & ~(align - 1));
+      while (class_size[cls] & (align - 1))
+        ++cls;
+      return small_alloc(cls);
+    }
+
+  return large_alloc(size, align, 0);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+  void *p;
+
+  if (align % sizeof(void *) || align & (align - 1) || !align)
+    return EINVAL;
+
+  if (!(p = memalign(align, size)))
+    return ENOMEM;
+
+  *memptr = p;
+  return 0;
+}
+
+void *valloc(size_t size)
+{
+  return memalign(L4_PAGESIZE, size);
+}
+
+/* Interfaces of the standard allocator, also provided here so that a
+   static link never pulls in the libc allocator. */
+
+int malloc_trim(size_t pad)
+{
+  int released = 0;
+  (void)pad;
+
+  lock(&large_lock);
+  for (unsigned i = 0; i < LARGE_CACHE_ENTRIES; ++i)
+    if (large_cache[i].base)
+      {
+        munmap(large_cache[i].base, large_cache[i].size);
+        large_mapped_bytes -= large_cache[i].size;
+        --large_mappings;
+        large_cache[i].base = NULL;
+        released = 1;
+      }
+  large_cached_bytes = 0;
+  unlock(&large_lock);
+
+  return released;
+}
+
+/* struct mallinfo only has int fields, larger values saturate. */
+static int mallinfo_clamp(size_t v)
+{
+  return v > INT_MAX ? INT_MAX : (int)v;
+}
+
+struct mallinfo mallinfo(void)
+{
+  struct mallinfo mi;
+  size_t arena = 0;
+
+  memset(&mi, 0, sizeof(mi));
+
+  lock(&heap_lock);
+  for (unsigned i = 0; i < num_areas; ++i)
+    arena += (size_t)areas[i].next_span << SPAN_SHIFT;
+  unlock(&heap_lock);
+  mi.arena = mallinfo_clamp(arena);
+
+  lock(&large_lock);
+  mi.hblks = mallinfo_clamp(large_mappings);
+  mi.hblkhd = mallinfo_clamp(large_mapped_bytes);
+  mi.keepcost = mallinfo_clamp(large_cached_bytes);
+  unlock(&large_lock);
+
+  return mi;
+}
+
+void malloc_stats(FILE *file)
+{
+  struct mallinfo mi = mallinfo();
+
+  if (!file)
+    file = stderr;
+
+  fprintf(file,
+          "span memory:      %10d bytes in %u areas\n"
+          "large mappings:   %10d bytes in %d mappings\n"
+          "large cache:      %10d bytes\n",
+          mi.arena, num_areas, mi.hblkhd, mi.hblks, mi.keepcost);
+}
+
+int mallopt(int param, int value)
+{
+  (void)param;
+  (void)value;
+  return 0;
+}
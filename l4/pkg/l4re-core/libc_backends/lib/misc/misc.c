@@ -185,15 +185,6 @@ mode_t umask(mode_t mask)
   return 0;
 }
 
-int pipe(int pipefd[2])
-{
-  printf("Unimplemented: %s()\n", __func__);
-  printf("    Caller %p\n", __builtin_return_address(0));
-  (void)pipefd;
-  errno = EINVAL;
-  return -1;
-}
-
 #include <sys/wait.h>
 pid_t waitpid(pid_t pid, int *status, int options)
 {
@@ -344,9 +335,17 @@ pid_t wait3(int *status, int options, struct rusage *rusage)
 
 
 #include <sys/types.h>
+#include <l4/l4re_vfs/vfs.h>
 
 int getrlimit(__rlimit_resource_t resource, struct rlimit *rlim)
 {
+  if (resource == RLIMIT_NOFILE)
+    {
+      rlim->rlim_cur = L4RE_VFS_MAX_FILES;
+      rlim->rlim_max = L4RE_VFS_MAX_FILES;
+      return 0;
+    }
+
   printf("Unimplemented: %s(%d, %p)\n", __func__, resource, rlim);
   errno = EINVAL;
   return -1;
@@ -354,6 +353,18 @@ int getrlimit(__rlimit_resource_t resource, struct rlimit *rlim)
 
 int setrlimit(__rlimit_resource_t resource, const struct rlimit *rlim)
 {
+  if (resource == RLIMIT_NOFILE)
+    {
+      /* The table grows on demand, lower limits are not enforced. */
+      if (rlim->rlim_cur > rlim->rlim_max
+          || rlim->rlim_max > L4RE_VFS_MAX_FILES)
+        {
+          errno = EPERM;
+          return -1;
+        }
+      return 0;
+    }
+
   printf("Unimplemented: %s(%d, %p)\n", __func__,
          resource, rlim);
   errno = EINVAL;
@@ -363,6 +374,17 @@ int setrlimit(__rlimit_resource_t resource, const struct rlimit *rlim)
 #ifdef __USE_LARGEFILE64
 int setrlimit64(__rlimit_resource_t resource, const struct rlimit64 *rlim)
 {
+  if (resource == RLIMIT_NOFILE)
+    {
+      struct rlimit r = { rlim->rlim_cur, rlim->rlim_max };
+      if (r.rlim_cur != rlim->rlim_cur || r.rlim_max != rlim->rlim_max)
+        {
+          errno = EPERM;
+          return -1;
+        }
+      return setrlimit(resource, &r);
+    }
+
   printf("Unimplemented: %s(%d, %p)\n", __func__,
          resource, rlim);
   errno = EINVAL;
@@ -12,6 +12,7 @@
 #include "globals.h"
 #include "string.h"
 #include "server_obj.h"
+#include "dataspace_static.h"
 
 #include <l4/cxx/l4iostream>
 #include <l4/cxx/minmax>
@@ -88,9 +89,79 @@ Entry::set_cap_copy(L4::Cap<L4::Kobject> cap)
 }
 
 
+/**
+ * Generation counter shared by all name spaces, see L4Re::Namespace::watch().
+ *
+ * A query may resolve names through several name spaces, so a change to
+ * any of them changes the counter.
+ */
+static l4_umword_t *generation;
+static Moe::Dataspace_static *generation_ds;
+
+void
+Name_space::changed()
+{
+  if (generation)
+    __atomic_store_n(generation, *generation + 1, __ATOMIC_RELEASE);
+}
+
+enum
+{
+  /// Largest bucket array taken from the quota's malloc, see Malloc_container.
+  Small_buckets = 1024,
+};
+
+void
+Name_space::grow_index()
+{
+  unsigned long size = _index.resize();
+  if (!size)
+    return;
+
+  // without memory the old index, if any, keeps working with longer chains
+  unsigned long bytes = size * sizeof(Entry *);
+  void *b = 0;
+  if (bytes <= Small_buckets)
+    b = qalloc()->alloc(bytes, sizeof(Entry *));
+  else
+    {
+      try
+        {
+          b = qalloc()->alloc_pages(bytes, L4_PAGESIZE);
+        }
+      catch (L4::Out_of_memory const &)
+        {}
+    }
+
+  if (!b)
+    return;
+
+  memset(b, 0, bytes);
+  Entry **o = _index.rehash(static_cast<Entry **>(b), size,
+                            _tree.begin(), _tree.end(), &size);
+  if (!o)
+    return;
+
+  bytes = size * sizeof(Entry *);
+  if (bytes <= Small_buckets)
+    qalloc()->free(o);
+  else
+    qalloc()->free_pages(o, bytes);
+}
+
 Name_space::~Name_space()
 {
+  unsigned long size;
+  if (Entry **b = _index.clear(&size))
+    {
+      if (size * sizeof(Entry *) <= Small_buckets)
+        qalloc()->free(b);
+      else
+        qalloc()->free_pages(b, size * sizeof(Entry *));
+    }
+
   _tree.remove_all([](Entry *e) { delete e; });
+  changed();
 }
 
 Entry *
@@ -242,18 +313,40 @@ Name_space::op_query(L4Re::Namespace::Rights,
   else
     part = name.length;
 
+  Name_space *ns = this;
   Entry *n = find(Entry::Name(name.data, part));
   if (!n)
     return -L4_ENOENT;
   if (!n->is_valid())
     return -L4_EAGAIN;
 
+  // Resolve further components in our own name spaces as long as they
+  // exist, the client continues with the rest.
+  while (part < name.length)
+    {
+      auto *sub = n->is_local() ? dynamic_cast<Name_space *>(n->obj()) : 0;
+      if (!sub)
+        break;
+
+      char const *start = name.data + part + 1;
+      unsigned long left = name.length - part - 1;
+      sep = (char const *)memchr(start, '/', left);
+      unsigned long len = sep ? (unsigned long)(sep - start) : left;
+      Entry *e = sub->find(Entry::Name(start, len));
+      if (!e || !e->is_valid())
+        break;
+
+      ns = sub;
+      n = e;
+      part += 1 + len;
+    }
+
   if (n->cap().validate(L4_BASE_TASK_CAP).label() <= 0)
     {
       if (n->is_dynamic())
         {
           cxx::unique_ptr<Entry> old(n);
-          remove(n->name());
+          ns->remove(n->name());
         }
       return -L4_ENOENT;
     }
@@ -283,6 +376,25 @@ Name_space::op_query(L4Re::Namespace::Rights,
   return result;
 }
 
+int
+Name_space::op_watch(L4Re::Namespace::Rights,
+                     L4::Ipc::Cap<L4Re::Dataspace> &ds, l4_addr_t &offset)
+{
+  if (!generation_ds)
+    {
+      void *p = Moe_alloc::allocator()->alloc_pages(L4_PAGESIZE, L4_PAGESIZE);
+      memset(p, 0, L4_PAGESIZE);
+      generation_ds = new Moe::Dataspace_static(p, L4_PAGESIZE,
+                                               Dataspace::Read_only);
+      object_pool.cap_alloc()->alloc(generation_ds);
+      generation = static_cast<l4_umword_t *>(p);
+    }
+
+  ds = L4::Ipc::Cap<L4Re::Dataspace>(generation_ds->obj_cap(),
+                                     L4_CAP_FPAGE_RO);
+  offset = 0;
+  return L4_EOK;
+}
 
 void
 Name_space::dump(bool rec, int indent) const
@@ -57,6 +57,7 @@ private:
   typedef cxx::Weak_ref<Moe::Server_object> Weak_ref;
   Name _name;
   unsigned _flags;
+  Entry *_hnext = 0;
   union
   {
     l4_cap_idx_t _cap;
@@ -143,17 +144,43 @@ class Name_space :
 {
   friend class Entry;
   typedef cxx::Avl_tree<Entry, Entry_get_key, Entry_key_compare> Tree;
+  typedef L4Re::Util::Names::Hash_index<Entry, Entry_get_key,
+                                        &Entry::_hnext> Index;
   typedef L4::Ipc::Array_in_buf<char, unsigned long> Name_buffer;
   Tree _tree;
+  Index _index;
 
   Entry *find(Entry::Name const &name) const
-  { return _tree.find_node(name); }
+  {
+    if (_index.active())
+      return _index.find(name.start(), name.len());
+    return _tree.find_node(name);
+  }
 
   Entry *remove(Entry::Name const &name)
-  { return _tree.remove(name); }
+  {
+    Entry *e = _tree.remove(name);
+    if (e)
+      {
+        _index.remove(e);
+        changed();
+      }
+    return e;
+  }
 
   bool insert(Entry *e)
-  { return _tree.insert(e).second; }
+  {
+    if (!_tree.insert(e).second)
+      return false;
+
+    _index.insert(e);
+    grow_index();
+    changed();
+    return true;
+  }
+
+  void grow_index();
+  static void changed();
 
   Entry *check_existing(Name_buffer const &name, unsigned flags);
 
@@ -181,6 +208,9 @@ public:
 
   int op_unlink(L4Re::Namespace::Rights r, Name_buffer const &name);
 
+  int op_watch(L4Re::Namespace::Rights, L4::Ipc::Cap<L4Re::Dataspace> &ds,
+               l4_addr_t &offset);
+
   // internally used to register bootfs files, name spaces...
   template <typename T>
   int register_obj(Entry::Name const &name, unsigned long flags, T cap)
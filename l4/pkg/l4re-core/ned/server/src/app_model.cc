@@ -8,13 +8,76 @@
  */
 
 #include "app_model.h"
+#include "launcher.h"
 
 #include <l4/re/error_helper>
 #include <l4/re/util/env_ns>
+#include <l4/sys/kip.h>
+
+#include <pthread.h>
+#include <cstdlib>
+#include <cstring>
 
 using L4Re::chksys;
 using L4Re::chkcap;
 
+namespace {
+
+/// A name resolved in advance by App_model::prefetch().
+struct Prefetch : Ned::Launch_job
+{
+  Prefetch(char const *name, Prefetch *next)
+  : name(strdup(name)), next(next) {}
+
+  void run()
+  {
+    L4Re::Util::Env_ns ens;
+    ds = ens.query<L4Re::Dataspace>(name);
+  }
+
+  char *name;
+  App_model::Const_dataspace ds;
+  Prefetch *next;
+};
+
+pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+Prefetch *prefetched;
+unsigned num_prefetched;
+
+Prefetch *
+find_prefetched(char const *name)
+{
+  pthread_mutex_lock(&prefetch_lock);
+  Prefetch *p = prefetched;
+  while (p && strcmp(p->name, name))
+    p = p->next;
+  pthread_mutex_unlock(&prefetch_lock);
+  return p;
+}
+
+}
+
+void
+App_model::prefetch(char const *name)
+{
+  if (find_prefetched(name))
+    return;
+
+  pthread_mutex_lock(&prefetch_lock);
+  if (num_prefetched >= Max_prefetched)
+    {
+      pthread_mutex_unlock(&prefetch_lock);
+      return;
+    }
+
+  Prefetch *p = new Prefetch(name, prefetched);
+  prefetched = p;
+  ++num_prefetched;
+  pthread_mutex_unlock(&prefetch_lock);
+
+  Ned::Launcher::launcher()->submit(p);
+}
+
 App_model::Dataspace
 App_model::alloc_ds(unsigned long size) const
 {
@@ -28,8 +91,24 @@ App_model::alloc_ds(unsigned long size) const
 App_model::Const_dataspace
 App_model::open_file(char const *name)
 {
-  L4Re::Util::Env_ns ens;
-  return L4Re::chkcap(ens.query<L4Re::Dataspace>(name), name, 0);
+  l4_cpu_time_t start = l4_kip_clock(l4re_kip());
+  Const_dataspace ds;
+
+  if (Prefetch *p = find_prefetched(name))
+    {
+      Ned::Launcher::launcher()->wait(p);
+      ds = p->ds;
+    }
+
+  // not prefetched or the prefetch failed, which reports no error
+  if (!ds.is_valid())
+    {
+      L4Re::Util::Env_ns ens;
+      ds = L4Re::chkcap(ens.query<L4Re::Dataspace>(name), name, 0);
+    }
+
+  resolve_us += l4_kip_clock(l4re_kip()) - start;
+  return ds;
 }
 
 void
@@ -97,7 +176,7 @@ App_model::local_detach_ds(l4_addr_t addr, unsigned long /*size*/) const
 
 
 App_model::App_model()
-: _task(0)
+: _task(0), resolve_us(0)
 {
   // set default values for utcb area, values may be changed by loader
   _info.utcbs_start     = Utcb_area_start;
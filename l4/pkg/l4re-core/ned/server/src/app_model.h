@@ -65,11 +65,26 @@ struct App_model : public Ldr::Base_app_model<Stack>
 #endif
   App_task *_task;
 
+  /// Time spent resolving file names, in microseconds.
+  l4_cpu_time_t resolve_us;
+
   explicit App_model();
 
   Dataspace alloc_ds(unsigned long size) const;
 
-  static Const_dataspace open_file(char const *name);
+  Const_dataspace open_file(char const *name);
+
+  /**
+   * Resolve \a name in the background.
+   *
+   * open_file() uses the result instead of resolving the name again.  A
+   * prefetched name is resolved only once and its dataspace is kept for
+   * the lifetime of ned, use it for the few files that every start needs,
+   * e.g., `rom/l4re`.  At most Max_prefetched names are kept, further
+   * requests are ignored.
+   */
+  enum { Max_prefetched = 8 };
+  static void prefetch(char const *name);
 
   virtual l4_cap_idx_t push_initial_caps(l4_cap_idx_t start) = 0;
   virtual void map_initial_caps(L4::Cap<L4::Task> task, l4_cap_idx_t start) = 0;
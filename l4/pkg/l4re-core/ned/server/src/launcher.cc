@@ -0,0 +1,110 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#include "launcher.h"
+#include "debug.h"
+
+#include <l4/re/env>
+#include <l4/sys/scheduler>
+
+namespace Ned {
+
+Launcher *
+Launcher::launcher()
+{
+  static Launcher l;
+  return &l;
+}
+
+Launcher::Launcher() : _head(0), _tail(&_head)
+{
+  pthread_mutex_init(&_lock, NULL);
+  pthread_cond_init(&_queued, NULL);
+  pthread_cond_init(&_finished, NULL);
+
+  l4_umword_t cpu_max;
+  l4_sched_cpu_set_t cpus = l4_sched_cpu_set(0, 0);
+  unsigned n = 0;
+  if (l4_error(L4Re::Env::env()->scheduler()->info(&cpu_max, &cpus)) >= 0)
+    n = __builtin_popcountl(cpus.map);
+
+  // at least two, loading is IPC bound and overlaps on one CPU as well
+  if (n < 2)
+    n = 2;
+  if (n > Max_threads)
+    n = Max_threads;
+
+  for (unsigned i = 0; i < n; ++i)
+    {
+      pthread_t t;
+      if (pthread_create(&t, NULL, &worker, this))
+        {
+          Err().printf("could not start launcher thread %u\n", i);
+          break;
+        }
+    }
+}
+
+void *
+Launcher::worker(void *a)
+{
+  reinterpret_cast<Launcher *>(a)->loop();
+  return 0;
+}
+
+void
+Launcher::loop()
+{
+  pthread_mutex_lock(&_lock);
+  for (;;)
+    {
+      while (!_head)
+        pthread_cond_wait(&_queued, &_lock);
+
+      Launch_job *j = _head;
+      _head = j->_next;
+      if (!_head)
+        _tail = &_head;
+
+      pthread_mutex_unlock(&_lock);
+      j->run();
+      pthread_mutex_lock(&_lock);
+
+      j->_done = true;
+      pthread_cond_broadcast(&_finished);
+    }
+}
+
+void
+Launcher::submit(Launch_job *j)
+{
+  pthread_mutex_lock(&_lock);
+  j->_next = 0;
+  j->_done = false;
+  *_tail = j;
+  _tail = &j->_next;
+  pthread_cond_signal(&_queued);
+  pthread_mutex_unlock(&_lock);
+}
+
+void
+Launcher::wait(Launch_job *j)
+{
+  pthread_mutex_lock(&_lock);
+  while (!j->_done)
+    pthread_cond_wait(&_finished, &_lock);
+  pthread_mutex_unlock(&_lock);
+}
+
+bool
+Launcher::done(Launch_job *j)
+{
+  pthread_mutex_lock(&_lock);
+  bool d = j->_done;
+  pthread_mutex_unlock(&_lock);
+  return d;
+}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <pthread.h>
+
+namespace Ned {
+
+/**
+ * Work item for the launcher threads, e.g., loading one application.
+ */
+class Launch_job
+{
+public:
+  Launch_job() : _next(0), _done(false) {}
+  virtual ~Launch_job() {}
+
+  /// Do the work, called by a launcher thread.
+  virtual void run() = 0;
+
+private:
+  friend class Launcher;
+  Launch_job *_next;
+  bool _done;
+};
+
+/**
+ * Pool of threads that run Launch_jobs concurrently.
+ *
+ * Loading an application mostly waits for other servers: the name space to
+ * resolve the binary, the memory allocator and the region map of the new
+ * task.  Several loads thus overlap well even on a single CPU.
+ */
+class Launcher
+{
+public:
+  enum { Max_threads = 8 };
+
+  /// The launcher, its threads are started on first use.
+  static Launcher *launcher();
+
+  /// Queue \a j, it runs on the next idle launcher thread.
+  void submit(Launch_job *j);
+
+  /// Wait until \a j was run.
+  void wait(Launch_job *j);
+
+  /// Check whether \a j was run.
+  bool done(Launch_job *j);
+
+private:
+  Launcher();
+  void loop();
+  static void *worker(void *);
+
+  pthread_mutex_t _lock;
+  pthread_cond_t _queued;
+  pthread_cond_t _finished;
+  Launch_job *_head;
+  Launch_job **_tail;
+};
+
+}
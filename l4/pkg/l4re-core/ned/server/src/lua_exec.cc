@@ -13,8 +13,14 @@
 
 #include <l4/cxx/auto_ptr>
 #include <l4/cxx/ref_ptr>
+#include <l4/cxx/unique_ptr>
 #include <l4/libloader/elf>
 #include <l4/util/bitops.h>
+#include <l4/sys/kip.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -23,6 +29,7 @@
 #include <pthread-l4.h>
 #include "lua.h"
 #include "lua_cap.h"
+#include "launcher.h"
 #include "server.h"
 
 using L4Re::chksys;
@@ -60,6 +67,21 @@ Observer::op_wait(Obs_iface::Rights, l4_cap_idx_t thread, l4_addr_t task)
 class Am : public Rmt_app_model
 {
 private:
+  /// Snapshot of a capability from the `caps` table.
+  struct Initial_cap
+  {
+    char *name;
+    l4_fpage_t fpage;
+    unsigned long ext_rights;
+  };
+
+  /// Snapshot of a string argument, may contain 0 bytes.
+  struct String
+  {
+    char *s;
+    size_t len;
+  };
+
   lua_State *_lua;
   int _argc;
   int _env_idx;
@@ -68,6 +90,48 @@ private:
 
   L4::Cap<L4::Factory> _rm_fab;
 
+  // The configuration is copied from the Lua stack before the launch, so
+  // that the launch can run on a launcher thread.  The Lua values whose
+  // capabilities are mapped to the new task stay referenced by _anchor
+  // until the launch is done.
+  int _anchor;
+  int _anchored;
+  char *_kernel;
+  Initial_cap *_caps;
+  unsigned _num_caps;
+  String *_args;
+  unsigned _num_args;
+  String *_env;  ///< Pairs of key and value.
+  unsigned _num_env;
+
+  static char *copy(char const *s, size_t len)
+  {
+    char *c = static_cast<char *>(malloc(len + 1));
+    if (!c)
+      throw L4::Out_of_memory();
+    memcpy(c, s, len);
+    c[len] = 0;
+    return c;
+  }
+
+  template<typename T>
+  static T *grow(T *a, unsigned n)
+  {
+    a = static_cast<T *>(realloc(a, (n + 1) * sizeof(T)));
+    if (!a)
+      throw L4::Out_of_memory();
+    return a;
+  }
+
+  /// Keep the value on top of the stack alive until the launch is done.
+  void anchor()
+  {
+    lua_rawgeti(_lua, LUA_REGISTRYINDEX, _anchor);
+    lua_pushvalue(_lua, -2);
+    lua_rawseti(_lua, -2, ++_anchored);
+    lua_pop(_lua, 1);
+  }
+
   l4_umword_t _cfg_integer(char const *f, l4_umword_t def = 0)
   {
     l4_umword_t r = def;
@@ -92,24 +156,12 @@ private:
       {
 	Cap *c = Lua::check_cap(_lua, -1);
 	*r = c->cap<void>().fpage(c->rights());
+	anchor();
       }
     lua_pop(_lua, 1);
   }
 
-public:
-
-  explicit Am(lua_State *l)
-  : Rmt_app_model(), _lua(l), _argc(lua_gettop(l)), _env_idx(0), _cfg_idx(1),
-    _arg_idx(2)
-  {
-    if (_argc > 2 && lua_type(_lua, _argc) == LUA_TTABLE)
-      _env_idx = _argc;
-
-    if (_env_idx)
-      --_argc;
-  }
-
-  l4_cap_idx_t push_initial_caps(l4_cap_idx_t start)
+  void snapshot_caps()
   {
     lua_getfield(_lua, _cfg_idx, "caps");
     int tab = lua_gettop(_lua);
@@ -117,7 +169,7 @@ public:
     if (lua_isnil(_lua, tab))
       {
 	lua_pop(_lua, 1);
-        return start;
+        return;
       }
 
     lua_pushnil(_lua);
@@ -134,66 +186,122 @@ public:
 
 	if (!lua_isnil(_lua, -1) && lua_touserdata(_lua, -1))
 	  {
-	    Lua::check_cap(_lua, -1);
-	    _stack.push(l4re_env_cap_entry_t(r, get_initial_cap(r, &start)));
+	    Cap *c = Lua::check_cap(_lua, -1);
+	    _caps = grow(_caps, _num_caps);
+	    Initial_cap *e = &_caps[_num_caps];
+	    e->name = copy(r, strlen(r));
+	    e->fpage = c->cap<void>().fpage(c->rights());
+	    e->ext_rights = c->ext_rights();
+	    ++_num_caps;
+	    anchor();
 	  }
 	lua_pop(_lua, 1);
       }
     lua_pop(_lua, 1);
-    return start;
   }
 
-  void map_initial_caps(L4::Cap<L4::Task> task, l4_cap_idx_t start)
+  void snapshot_strings()
   {
-    lua_getfield(_lua, _cfg_idx, "caps");
-    int tab = lua_gettop(_lua);
-
-    if (lua_isnil(_lua, tab))
+    for (int i = _arg_idx; i <= _argc; ++i)
       {
-	lua_pop(_lua, 1);
-        return;
+        if (lua_isnil(_lua, i))
+          continue;
+
+	size_t l;
+	char const *r = luaL_checklstring(_lua, i, &l);
+	_args = grow(_args, _num_args);
+	_args[_num_args].s = copy(r, l);
+	_args[_num_args].len = l;
+	++_num_args;
       }
 
+    if (!_env_idx)
+      return;
+
     lua_pushnil(_lua);
-    while (lua_next(_lua, tab))
+    while (lua_next(_lua, _env_idx))
       {
-	char const *r = luaL_checkstring(_lua, -2);
-	while (lua_isfunction(_lua, -1))
-	  {
-	    lua_pushvalue(_lua, tab);
-	    lua_call(_lua, 1, 1);
-	  }
+	size_t kl;
+	char const *k = luaL_checklstring(_lua, -2, &kl);
+	size_t vl;
+	char const *v = luaL_checklstring(_lua, -1, &vl);
 
-	if (!lua_isnil(_lua, -1) && lua_touserdata(_lua, -1))
-	  {
-	    Cap *c = Lua::check_cap(_lua, -1);
-	    auto idx = get_initial_cap(r, &start);
-	    chksys(task->map(L4Re::This_task,
-	                     c->cap<void>().fpage(c->rights()),
-	                     L4::Cap<void>(idx).snd_base() | c->ext_rights()));
-	  }
+	_env = grow(_env, _num_env + 1);
+	_env[_num_env].s = copy(k, kl);
+	_env[_num_env].len = kl;
+	_env[_num_env + 1].s = copy(v, vl);
+	_env[_num_env + 1].len = vl;
+	_num_env += 2;
 	lua_pop(_lua, 1);
       }
-    lua_pop(_lua, 1);
   }
 
-  void launch_loader()
+public:
+
+  explicit Am(lua_State *l)
+  : Rmt_app_model(), _lua(l), _argc(lua_gettop(l)), _env_idx(0), _cfg_idx(1),
+    _arg_idx(2), _anchored(0), _kernel(0), _caps(0), _num_caps(0), _args(0),
+    _num_args(0), _env(0), _num_env(0)
   {
-    char const *kernel = "rom/l4re";
-    lua_getfield(_lua, _cfg_idx, "l4re_loader");
-    if (lua_isstring(_lua, -1))
-      kernel = lua_tostring(_lua, -1);
+    if (_argc > 2 && lua_type(_lua, _argc) == LUA_TTABLE)
+      _env_idx = _argc;
 
+    if (_env_idx)
+      --_argc;
+
+    lua_newtable(_lua);
+    _anchor = luaL_ref(_lua, LUA_REGISTRYINDEX);
+  }
+
+  /// Must be destroyed by the Lua thread.
+  ~Am() throw()
+  {
+    luaL_unref(_lua, LUA_REGISTRYINDEX, _anchor);
+    free(_kernel);
+    for (unsigned i = 0; i < _num_caps; ++i)
+      free(_caps[i].name);
+    free(_caps);
+    for (unsigned i = 0; i < _num_args; ++i)
+      free(_args[i].s);
+    free(_args);
+    for (unsigned i = 0; i < _num_env; ++i)
+      free(_env[i].s);
+    free(_env);
+  }
+
+  /// Name of the program, for diagnostics.
+  char const *name() const
+  { return _num_args ? _args[0].s : "<unnamed>"; }
+
+  l4_cap_idx_t push_initial_caps(l4_cap_idx_t start)
+  {
+    for (unsigned i = 0; i < _num_caps; ++i)
+      _stack.push(l4re_env_cap_entry_t(_caps[i].name,
+                                       get_initial_cap(_caps[i].name, &start)));
+    return start;
+  }
+
+  void map_initial_caps(L4::Cap<L4::Task> task, l4_cap_idx_t start)
+  {
+    for (unsigned i = 0; i < _num_caps; ++i)
+      {
+        auto idx = get_initial_cap(_caps[i].name, &start);
+        chksys(task->map(L4Re::This_task, _caps[i].fpage,
+                         L4::Cap<void>(idx).snd_base() | _caps[i].ext_rights));
+      }
+  }
+
+  void launch_loader()
+  {
     typedef Ldr::Elf_loader<Am, Dbg> Loader;
 
     Dbg ldr(Dbg::Loader, "ldr");
     Loader _l;
 
-    _l.launch(this, kernel, ldr);
-
-    lua_pop(_lua, 1);
+    _l.launch(this, _kernel, ldr);
   }
 
+  /// Copy the configuration from the Lua stack.
   void parse_cfg()
   {
     prog_info()->mem_alloc = L4Re::Env::env()->mem_alloc().fpage();
@@ -205,6 +313,15 @@ public:
     prog_info()->ldr_flags = 0;
     prog_info()->l4re_dbg = 0;
 
+    char const *kernel = "rom/l4re";
+    lua_getfield(_lua, _cfg_idx, "l4re_loader");
+    if (lua_isstring(_lua, -1))
+      kernel = lua_tostring(_lua, -1);
+    _kernel = copy(kernel, strlen(kernel));
+    lua_pop(_lua, 1);
+
+    snapshot_strings();
+
     if (!_cfg_idx)
       return;
 
@@ -219,6 +336,17 @@ public:
     l4_fpage_t fab = prog_info()->mem_alloc;
     _cfg_cap("rm_fab", &fab);
     _rm_fab = L4::Cap<L4::Factory>(fab.raw);
+
+    snapshot_caps();
+  }
+
+  /// Whether the configuration asks for a launch in the background.
+  bool async() const
+  {
+    lua_getfield(_lua, _cfg_idx, "async");
+    bool a = lua_toboolean(_lua, -1);
+    lua_pop(_lua, 1);
+    return a;
   }
 
   L4::Cap<L4::Factory> rm_fab() const { return _rm_fab; }
@@ -228,14 +356,9 @@ public:
   void push_argv_strings()
   {
     argv.a0 = 0;
-    for (int i = _arg_idx; i <= _argc; ++i)
+    for (unsigned i = 0; i < _num_args; ++i)
       {
-        if (lua_isnil(_lua, i))
-          continue;
-
-	size_t l;
-	char const *r = luaL_checklstring(_lua, i, &l);
-	argv.al = _stack.push_str(r, l);
+	argv.al = _stack.push_str(_args[i].s, _args[i].len);
 	if (argv.a0 == 0)
 	  argv.a0 = argv.al;
       }
@@ -243,40 +366,121 @@ public:
 
   void push_env_strings()
   {
-    if (!_env_idx)
-      return;
-
-    lua_pushnil(_lua);
-    bool _f = true;
-    while (lua_next(_lua, _env_idx))
+    for (unsigned i = 0; i < _num_env; i += 2)
       {
-	size_t kl;
-	char const *k = luaL_checklstring(_lua, -2, &kl);
-	size_t vl;
-	char const *v = luaL_checklstring(_lua, -1, &vl);
-
-	_stack.push_str(v, vl);
+	_stack.push_str(_env[i + 1].s, _env[i + 1].len);
 	_stack.push('=');
-	envp.al = _stack.push_object(k, kl);
-	if (_f)
-	  {
-	    envp.a0 = envp.al;
-	    _f = false;
-	  }
-	lua_pop(_lua, 1);
+	envp.al = _stack.push_object(_env[i].s, _env[i].len);
+	if (i == 0)
+	  envp.a0 = envp.al;
       }
   }
 };
 
+typedef cxx::Ref_ptr<App_task> App_ptr;
+
+/**
+ * Loading of one application, on a launcher thread or by exec() itself.
+ */
+class Launch : public Ned::Launch_job
+{
+public:
+  Launch(Am *am, App_ptr const &task)
+  : _am(am), _task(task), _failed(false),
+    _submitted(l4_kip_clock(l4re_kip())), _started(0), _finished(0),
+    _resolve(0)
+  { _error[0] = 0; }
+
+  ~Launch() { delete _am; }
+
+  /// Release the configuration after the launch, in the Lua thread.
+  void drop_model()
+  {
+    delete _am;
+    _am = 0;
+    _task = 0;
+  }
+
+  void run()
+  {
+    _started = l4_kip_clock(l4re_kip());
+    try
+      {
+        _am->launch_loader();
+      }
+    catch (L4::Runtime_error const &e)
+      {
+        snprintf(_error, sizeof(_error), "%s (%s: %ld)",
+                 e.str(), e.extra_str(), e.err_no());
+        _failed = true;
+      }
+    _finished = l4_kip_clock(l4re_kip());
+    _resolve = _am->resolve_us;
+
+    Dbg(Dbg::Boot).printf("%s: queued %llu us, resolve %llu us, "
+                          "load %llu us, total %llu us\n", _am->name(),
+                          queued_us(), resolve_us(), load_us(), total_us());
+  }
+
+  bool failed() const { return _failed; }
+  char const *error() const { return _error; }
+
+  l4_cpu_time_t queued_us() const { return _started - _submitted; }
+  l4_cpu_time_t resolve_us() const { return _resolve; }
+  l4_cpu_time_t load_us() const { return _finished - _started - _resolve; }
+  l4_cpu_time_t total_us() const { return _finished - _submitted; }
+
+private:
+  Am *_am;
+  App_ptr _task;
+  bool _failed;
+  char _error[120];
+  l4_cpu_time_t _submitted, _started, _finished, _resolve;
+};
 
 static char const *const APP_TASK_TYPE = "L4_NED_APP_TASK";
-typedef cxx::Ref_ptr<App_task> App_ptr;
+
+/// Lua object for a task.
+struct App_handle
+{
+  App_ptr task;
+  Launch *launch;
+  bool settled;
+
+  App_handle(App_ptr const &t, Launch *l)
+  : task(t), launch(l), settled(false) {}
+};
+
+/**
+ * Wait for a launch in the background to complete.
+ *
+ * A task that failed to launch is dropped.
+ */
+static void
+settle(App_handle *h)
+{
+  if (!h->launch || h->settled)
+    return;
+
+  Ned::Launcher::launcher()->wait(h->launch);
+  h->launch->drop_model();
+  if (h->launch->failed())
+    h->task = 0;
+  h->settled = true;
+}
+
+static
+App_handle *check_handle(lua_State *l, int i)
+{
+  return (App_handle*)luaL_checkudata(l, i, APP_TASK_TYPE);
+}
 
 static
 App_ptr &check_at(lua_State *l, int i)
 {
-  App_ptr *t = (App_ptr*)luaL_checkudata(l, i, APP_TASK_TYPE);
-  return *t;
+  App_handle *h = check_handle(l, i);
+  settle(h);
+  return h->task;
 }
 
 static int __task_state(lua_State *l)
@@ -363,10 +567,52 @@ static int __task_kill(lua_State *l)
   return 1;
 }
 
+static int __task_launched(lua_State *l)
+{
+  App_handle *h = check_handle(l, 1);
+  settle(h);
+
+  if (h->launch && h->launch->failed())
+    {
+      lua_pushnil(l);
+      lua_pushstring(l, h->launch->error());
+      return 2;
+    }
+
+  lua_pushboolean(l, 1);
+  return 1;
+}
+
+static int __task_start_time(lua_State *l)
+{
+  App_handle *h = check_handle(l, 1);
+  settle(h);
+
+  if (!h->launch)
+    {
+      lua_pushnil(l);
+      return 1;
+    }
+
+  lua_createtable(l, 0, 4);
+  lua_pushinteger(l, h->launch->queued_us());
+  lua_setfield(l, -2, "queued");
+  lua_pushinteger(l, h->launch->resolve_us());
+  lua_setfield(l, -2, "resolve");
+  lua_pushinteger(l, h->launch->load_us());
+  lua_setfield(l, -2, "load");
+  lua_pushinteger(l, h->launch->total_us());
+  lua_setfield(l, -2, "total");
+  return 1;
+}
+
 static int __task_gc(lua_State *l)
 {
-  App_ptr &t = check_at(l, 1);
-  t = 0; // drop reference to task
+  App_handle *h = check_handle(l, 1);
+  settle(h);
+  h->task = 0; // drop reference to task
+  delete h->launch;
+  h->launch = 0;
   return 0;
 }
 
@@ -399,18 +645,26 @@ static const luaL_Reg _task_ops[] = {
     { "exit_code", __task_exit_code },
     { "wait", __task_wait },
     { "kill", __task_kill },
+    { "launched", __task_launched },
+    { "start_time", __task_start_time },
     { NULL, NULL }
 };
 
 
+/*
+ * exec(cfg, args...): start a program.  With `cfg.async` set the program is
+ * loaded by a launcher thread and exec() returns right away, task:launched()
+ * waits for the result.
+ */
 static int exec(lua_State *l)
 {
   try {
 
-  Am am(l);
-  am.parse_cfg();
+  cxx::unique_ptr<Am> am(new Am(l));
+  am->parse_cfg();
+  bool async = am->async();
 
-  App_ptr app_task(new App_task(Ned::server->registry(), am.rm_fab()));
+  App_ptr app_task(new App_task(Ned::server->registry(), am->rm_fab()));
 
   if (!app_task)
     {
@@ -419,18 +673,32 @@ static int exec(lua_State *l)
     }
 
 
-  am.set_task(app_task.get());
+  am->set_task(app_task.get());
 
   app_task->running();
 
-  am.launch_loader();
-
-  App_ptr *at = new (lua_newuserdata(l, sizeof(App_ptr))) App_ptr();
-  *at = app_task;
+  Launch *launch = new Launch(am.release(), app_task);
+  App_handle *h = new (lua_newuserdata(l, sizeof(App_handle)))
+    App_handle(app_task, launch);
 
   luaL_newmetatable(l, APP_TASK_TYPE);
   lua_setmetatable(l, -2);
 
+  if (async)
+    {
+      Ned::Launcher::launcher()->submit(launch);
+      return 1;
+    }
+
+  launch->run();
+  launch->drop_model();
+  h->settled = true;
+  if (launch->failed())
+    {
+      h->task = 0;
+      luaL_error(l, "could not create process: %s", launch->error());
+    }
+
   return 1;
   } catch (L4::Runtime_error const &e) {
     luaL_error(l, "could not create process: %s (%s: %d)", e.str(), e.extra_str(), e.err_no());
@@ -438,6 +706,12 @@ static int exec(lua_State *l)
 
   return 0;
 }
+
+static int prefetch(lua_State *l)
+{
+  App_model::prefetch(luaL_checkstring(l, 1));
+  return 0;
+}
 #if 0
 void do_some_exc_tests()
 {
@@ -471,6 +745,7 @@ public:
     static const luaL_Reg _ops[] =
     {
       { "exec", exec },
+      { "prefetch", prefetch },
       { NULL, NULL }
     };
     Lua::lua_require_module(l, "L4");
@@ -14,6 +14,8 @@
 #include <l4/re/namespace>
 #include <l4/re/util/cap_alloc>
 #include <l4/re/env>
+#include <l4/sys/kip.h>
+#include <l4/util/util.h>
 
 #include "lua_cap.h"
 
@@ -82,6 +84,60 @@ __query(lua_State *l)
   return 1;
 }
 
+/*
+ * ns:wait(name [, timeout_ms [, rights]]): wait until `name` is registered
+ * and resolves to an object, returns the object or nil on timeout.  Without
+ * a timeout it waits forever.
+ */
+static int
+__wait(lua_State *l)
+{
+  Cap *_ns = Lua::check_cap(l, 1);
+  size_t len;
+  char const *s = luaL_checklstring(l, 2, &len);
+  lua_Integer timeout = luaL_optinteger(l, 3, -1);
+  L4_cap_fpage_rights rights
+    = (L4_cap_fpage_rights)luaL_optinteger(l, 4, L4_FPAGE_RO);
+
+  L4::Cap<L4Re::Namespace> ns(_ns->cap<L4Re::Namespace>().get());
+
+  L4Re::Util::Auto_cap<void>::Cap obj = L4Re::Util::cap_alloc.alloc<void>();
+  if (!obj.is_valid())
+    luaL_error(l, "out of caps");
+
+  l4_cpu_time_t deadline = l4_kip_clock(l4re_kip()) + timeout * 1000;
+  unsigned delay = 1;
+  int r;
+  for (;;)
+    {
+      r = ns->query(s, len, obj.get(), L4Re::Namespace::To_non_blocking);
+      if (r != -L4_ENOENT && r != -L4_EAGAIN)
+        break;
+
+      if (timeout >= 0 && l4_kip_clock(l4re_kip()) >= deadline)
+        break;
+
+      // the entry shows up when its server is ready, poll with backoff
+      l4_sleep(delay);
+      if (delay < 16)
+        delay *= 2;
+    }
+
+  if (r == -L4_ENOENT || r == -L4_EAGAIN)
+    {
+      lua_pushnil(l);
+      return 1;
+    }
+
+  if (r < 0)
+    luaL_error(l, "runtime error %s (%d)\n", l4sys_errtostr(r), r);
+
+  Lua::Cap *no = Lua::push_void_cap(l);
+  no->set(obj.release());
+  no->set_rights(rights);
+  return 1;
+}
+
 static int
 __register(lua_State *l)
 {
@@ -137,6 +193,7 @@ struct Ns_model
     {
       { "q", __query },
       { "query", __query },
+      { "wait", __wait },
       { "__register", __register },
       { NULL, NULL }
     };
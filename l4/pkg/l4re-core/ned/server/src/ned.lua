@@ -1,6 +1,7 @@
 -- vim:set ft=lua:
 local require = require
 local pairs = pairs
+local ipairs = ipairs
 local setmetatable = setmetatable
 local getmetatable = getmetatable
 local error = error
@@ -296,6 +297,72 @@ function Loader:start(env, cmd, posix_env)
   return self:startv(env, self.split_args(cmd, posix_env));
 end
 
+-- Start a set of applications concurrently.
+--  apps: table of name = { cmd = ..., env = ..., posix_env = ...,
+--                          after = { names of applications to wait for },
+--                          wait = { ns, name [, timeout_ms] } }
+-- An application starts once all applications in 'after' are loaded and
+-- their 'wait' capability appeared in their name space.  Returns a table
+-- of name = task.
+function Loader:start_all(apps)
+  Class.check(self, Loader);
+
+  -- every application needs it, the binaries are loaded only once anyway
+  prefetch("rom/l4re");
+
+  local tasks, ready, pending = {}, {}, {};
+  local left = 0;
+  for _ in pairs(apps) do
+    left = left + 1;
+  end
+
+  local function startable(a)
+    for _, d in ipairs(a.after or {}) do
+      if not apps[d] then
+        error("start_all: unknown dependency '" .. d .. "'", 3);
+      end
+      if not ready[d] then
+        return false;
+      end
+    end
+    return true;
+  end
+
+  while left > 0 do
+    for n, a in pairs(apps) do
+      if not tasks[n] and startable(a) then
+        local env = {};
+        for k, v in pairs(a.env or {}) do
+          env[k] = v;
+        end
+        env.async = true;
+        tasks[n] = self:start(env, a.cmd, a.posix_env);
+        pending[#pending + 1] = n;
+      end
+    end
+
+    if #pending == 0 then
+      error("start_all: dependency cycle", 2);
+    end
+
+    local n = table.remove(pending, 1);
+    local ok, err = tasks[n]:launched();
+    if not ok then
+      error("start_all: could not start '" .. n .. "': " .. err, 2);
+    end
+
+    local w = apps[n].wait;
+    if w and not w[1]:wait(w[2], w[3] or -1) then
+      error("start_all: '" .. n .. "' did not provide '" .. w[2] .. "'", 2);
+    end
+
+    ready[n] = true;
+    left = left - 1;
+  end
+
+  return tasks;
+end
+
 default_loader = Loader.new({factory = Env.factory, mem = Env.mem_alloc});
 
 return _ENV
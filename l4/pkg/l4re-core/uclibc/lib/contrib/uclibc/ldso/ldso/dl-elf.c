@@ -941,6 +941,9 @@ int _dl_fixup(struct dyn_elf *rpnt, struct r_scope_elem *scope, int now_flag)
 	struct elf_resolve *tpnt;
 	ElfW(Word) reloc_size, relative_count;
 	ElfW(Addr) reloc_addr;
+#if !defined(NOT_FOR_L4) && defined(IS_IN_rtld)
+	int cached;
+#endif
 
 	if (rpnt->next)
 		goof = _dl_fixup(rpnt->next, scope, now_flag);
@@ -948,6 +951,12 @@ int _dl_fixup(struct dyn_elf *rpnt, struct r_scope_elem *scope, int now_flag)
 		return goof;
 	tpnt = rpnt->dyn;
 
+#if !defined(NOT_FOR_L4) && defined(IS_IN_rtld)
+	cached = _dl_reloc_cache_load(tpnt, now_flag);
+	if (cached > 0)
+		return goof;
+#endif
+
 	if (!(tpnt->init_flag & RELOCS_DONE))
 		_dl_if_debug_dprint("relocation processing: %s\n", tpnt->libname);
 
@@ -999,6 +1008,11 @@ int _dl_fixup(struct dyn_elf *rpnt, struct r_scope_elem *scope, int now_flag)
 		tpnt->init_flag |= JMP_RELOCS_DONE;
 	}
 
+#if !defined(NOT_FOR_L4) && defined(IS_IN_rtld)
+	if (!cached && !goof)
+		_dl_reloc_cache_store(tpnt);
+#endif
+
 #if 0
 /* _dl_add_to_slotinfo is called by init_tls() for initial DSO
    or by dlopen() for dynamically loaded DSO. */
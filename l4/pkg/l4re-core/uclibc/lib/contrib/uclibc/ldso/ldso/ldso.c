@@ -87,6 +87,9 @@ const char *_dl_progname = UCLIBC_LDSO;      /* The name of the executable being
 #include "dl-startup.c"
 #include "dl-symbols.c"
 #include "dl-array.c"
+#ifndef NOT_FOR_L4
+#include "dl-reloc-cache.c"
+#endif
 
 /*
  * This stub function is used by some debuggers.  The idea is that they
@@ -1382,9 +1385,15 @@ of this helper program; chances are you did not intend to run this program.\n\
 	 * indicate fixups to the GOT tables.  We need to do this in reverse
 	 * order so that COPY directives work correctly.
 	 */
+#ifndef NOT_FOR_L4
+	_dl_reloc_cache_begin(unlazy);
+#endif
 	if (_dl_symbol_tables)
 		if (_dl_fixup(_dl_symbol_tables, global_scope, unlazy))
 			_dl_exit(-1);
+#ifndef NOT_FOR_L4
+	_dl_reloc_cache_end();
+#endif
 
 	for (tpnt = _dl_loaded_modules; tpnt; tpnt = tpnt->next) {
 		if (tpnt->relro_size)
@@ -66,10 +66,10 @@ typedef long __pthread_cond_align_t;
 
 typedef struct
 {
-  struct _pthread_fastlock __c_lock; /* Protect against concurrent access */
-  _pthread_descr __c_waiting;        /* Threads waiting on this condition */
+  struct _pthread_fastlock __c_lock; /* __status: wake-up sequence number */
+  void *__c_mutex;                   /* Mutex used by the current waiters */
   char __padding[48 - sizeof (struct _pthread_fastlock)
-		 - sizeof (_pthread_descr) - sizeof (__pthread_cond_align_t)];
+		 - sizeof (void *) - sizeof (__pthread_cond_align_t)];
   __pthread_cond_align_t __align;
 } pthread_cond_t;
 
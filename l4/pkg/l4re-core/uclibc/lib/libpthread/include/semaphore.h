@@ -31,7 +31,9 @@ typedef struct pthread *_pthread_descr;
 /* System specific semaphore definition.  */
 typedef struct
 {
-  struct _pthread_fastlock __sem_lock;
+  struct _pthread_fastlock __sem_lock; /* __status: value of the semaphore */
+  /* Unused since the value lives in __sem_lock, kept so that sem_t keeps
+     its size and layout for existing binaries. */
   int __sem_value;
   _pthread_descr __sem_waiting;
 } sem_t;
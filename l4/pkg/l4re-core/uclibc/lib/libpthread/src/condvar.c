@@ -16,13 +16,19 @@
 /* Condition variables */
 
 #include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <sys/time.h>
 #include "pthread.h"
 #include "internals.h"
 #include "spinlock.h"
-#include "queue.h"
-#include "restart.h"
+#include "futex.h"
+
+/* __c_lock.__status is a sequence number advanced by every signal and
+   broadcast; waiters block on it as a futex word (see futex.h).  Signalling
+   a condition variable nobody waits on never enters the kernel, and
+   pthread_cond_broadcast wakes only one waiter and moves all the others
+   over to the mutex, instead of letting them all race for it. */
 
 int
 attribute_hidden
@@ -30,7 +36,7 @@ __pthread_cond_init(pthread_cond_t *cond,
                         const pthread_condattr_t *cond_attr)
 {
   __pthread_init_lock(&cond->__c_lock);
-  cond->__c_waiting = NULL;
+  cond->__c_mutex = NULL;
   return 0;
 }
 strong_alias (__pthread_cond_init, pthread_cond_init)
@@ -39,35 +45,19 @@ int
 attribute_hidden
 __pthread_cond_destroy(pthread_cond_t *cond)
 {
-  if (cond->__c_waiting != NULL) return EBUSY;
+  if (__pthread_futex_has_waiters(&cond->__c_lock.__status)) return EBUSY;
   return 0;
 }
 strong_alias (__pthread_cond_destroy, pthread_cond_destroy)
 
-/* Function called by pthread_cancel to remove the thread from
-   waiting on a condition variable queue. */
-
-static int cond_extricate_func(void *obj, pthread_descr th)
-{
-  __volatile__ pthread_descr self = thread_self();
-  pthread_cond_t *cond = obj;
-  int did_remove = 0;
-
-  __pthread_lock(&cond->__c_lock, self);
-  did_remove = remove_from_queue(&cond->__c_waiting, th);
-  __pthread_unlock(&cond->__c_lock);
-
-  return did_remove;
-}
-
-int
-attribute_hidden
-__pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+static int
+pthread_cond_wait_common(pthread_cond_t *cond, pthread_mutex_t *mutex,
+			 const struct timespec *abstime)
 {
   __volatile__ pthread_descr self = thread_self();
   pthread_extricate_if extr;
-  int already_canceled = 0;
-  int spurious_wakeup_count;
+  long seq;
+  int res;
 
   /* Check whether the mutex is locked and owned by this thread.  */
   if (mutex->__m_kind != PTHREAD_MUTEX_TIMED_NP
@@ -77,188 +67,71 @@ __pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
 
   /* Set up extrication interface */
   extr.pu_object = cond;
-  extr.pu_extricate_func = cond_extricate_func;
+  extr.pu_extricate_func = __pthread_futex_extricate_func;
 
   /* Register extrication interface */
-  THREAD_SETMEM(self, p_condvar_avail, 0);
   __pthread_set_own_extricate_if(self, &extr);
 
-  /* Atomically enqueue thread for waiting, but only if it is not
-     canceled. If the thread is canceled, then it will fall through the
-     suspend call below, and then call pthread_exit without
-     having to worry about whether it is still on the condition variable queue.
-     This depends on pthread_cancel setting p_canceled before calling the
-     extricate function. */
-
-  __pthread_lock(&cond->__c_lock, self);
-  if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
-    enqueue(&cond->__c_waiting, self);
-  else
-    already_canceled = 1;
-  __pthread_unlock(&cond->__c_lock);
-
-  if (already_canceled) {
-    __pthread_set_own_extricate_if(self, 0);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
-  }
+  /* Any signal after this point changes the sequence number and thus
+     either prevents us from blocking or wakes us up.  If the thread is
+     already canceled, __pthread_futex_wait does not block at all. */
+  seq = cond->__c_lock.__status;
+  READ_MEMORY_BARRIER();
+  cond->__c_mutex = mutex;
 
   pthread_mutex_unlock(mutex);
 
-  spurious_wakeup_count = 0;
-  while (1)
-    {
-      suspend(self);
-      if (THREAD_GETMEM(self, p_condvar_avail) == 0
-	  && (THREAD_GETMEM(self, p_woken_by_cancel) == 0
-	      || THREAD_GETMEM(self, p_cancelstate) != PTHREAD_CANCEL_ENABLE))
-	{
-	  /* Count resumes that don't belong to us. */
-	  spurious_wakeup_count++;
-	  continue;
-	}
-      break;
-    }
+  res = __pthread_futex_wait(&cond->__c_lock.__status, seq, self, abstime, 1);
 
   __pthread_set_own_extricate_if(self, 0);
 
   /* Check for cancellation again, to provide correct cancellation
      point behavior */
 
-  if (THREAD_GETMEM(self, p_woken_by_cancel)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
+  if (res == EINTR) {
     THREAD_SETMEM(self, p_woken_by_cancel, 0);
-    pthread_mutex_lock(mutex);
+    __pthread_mutex_cond_lock(mutex, self);
     __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
   }
 
-  /* Put back any resumes we caught that don't belong to us. */
-  while (spurious_wakeup_count--)
-    restart(self);
-
-  pthread_mutex_lock(mutex);
-  return 0;
+  __pthread_mutex_cond_lock(mutex, self);
+  return res == ETIMEDOUT ? ETIMEDOUT : 0;
 }
-strong_alias (__pthread_cond_wait, pthread_cond_wait)
 
-static int
-pthread_cond_timedwait_relative(pthread_cond_t *cond,
-				pthread_mutex_t *mutex,
-				const struct timespec * abstime)
+int
+attribute_hidden
+__pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
 {
-  __volatile__ pthread_descr self = thread_self();
-  int already_canceled = 0;
-  pthread_extricate_if extr;
-  int spurious_wakeup_count;
-
-  /* Check whether the mutex is locked and owned by this thread.  */
-  if (mutex->__m_kind != PTHREAD_MUTEX_TIMED_NP
-      && mutex->__m_kind != PTHREAD_MUTEX_ADAPTIVE_NP
-      && mutex->__m_owner != self)
-    return EINVAL;
-
-  /* Set up extrication interface */
-  extr.pu_object = cond;
-  extr.pu_extricate_func = cond_extricate_func;
-
-  /* Register extrication interface */
-  THREAD_SETMEM(self, p_condvar_avail, 0);
-  __pthread_set_own_extricate_if(self, &extr);
-
-  /* Enqueue to wait on the condition and check for cancellation. */
-  __pthread_lock(&cond->__c_lock, self);
-  if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
-    enqueue(&cond->__c_waiting, self);
-  else
-    already_canceled = 1;
-  __pthread_unlock(&cond->__c_lock);
-
-  if (already_canceled) {
-    __pthread_set_own_extricate_if(self, 0);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
-  }
-
-  pthread_mutex_unlock(mutex);
-
-  spurious_wakeup_count = 0;
-  while (1)
-    {
-      if (!timedsuspend(self, abstime)) {
-	int was_on_queue;
-
-	/* __pthread_lock will queue back any spurious restarts that
-	   may happen to it. */
-
-	__pthread_lock(&cond->__c_lock, self);
-	was_on_queue = remove_from_queue(&cond->__c_waiting, self);
-	__pthread_unlock(&cond->__c_lock);
-
-	if (was_on_queue) {
-	  __pthread_set_own_extricate_if(self, 0);
-	  pthread_mutex_lock(mutex);
-	  return ETIMEDOUT;
-	}
-
-	/* Eat the outstanding restart() from the signaller */
-	suspend(self);
-      }
-
-      if (THREAD_GETMEM(self, p_condvar_avail) == 0
-	  && (THREAD_GETMEM(self, p_woken_by_cancel) == 0
-	      || THREAD_GETMEM(self, p_cancelstate) != PTHREAD_CANCEL_ENABLE))
-	{
-	  /* Count resumes that don't belong to us. */
-	  spurious_wakeup_count++;
-	  continue;
-	}
-      break;
-    }
-
-  __pthread_set_own_extricate_if(self, 0);
-
-  /* The remaining logic is the same as in other cancellable waits,
-     such as pthread_join sem_wait or pthread_cond wait. */
-
-  if (THREAD_GETMEM(self, p_woken_by_cancel)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
-    THREAD_SETMEM(self, p_woken_by_cancel, 0);
-    pthread_mutex_lock(mutex);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
-  }
-
-  /* Put back any resumes we caught that don't belong to us. */
-  while (spurious_wakeup_count--)
-    restart(self);
-
-  pthread_mutex_lock(mutex);
-  return 0;
+  return pthread_cond_wait_common(cond, mutex, NULL);
 }
+strong_alias (__pthread_cond_wait, pthread_cond_wait)
 
 int
 attribute_hidden
 __pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
 			     const struct timespec * abstime)
 {
-  /* Indirect call through pointer! */
-  return pthread_cond_timedwait_relative(cond, mutex, abstime);
+  return pthread_cond_wait_common(cond, mutex, abstime);
 }
 strong_alias (__pthread_cond_timedwait, pthread_cond_timedwait)
 
+static __inline__ void pthread_cond_advance(pthread_cond_t *cond)
+{
+  long seq;
+
+  WRITE_MEMORY_BARRIER();
+  do
+    seq = cond->__c_lock.__status;
+  while (!compare_and_swap(&cond->__c_lock.__status, seq, seq + 1,
+			   &cond->__c_lock.__spinlock));
+}
+
 int
 attribute_hidden
 __pthread_cond_signal(pthread_cond_t *cond)
 {
-  pthread_descr th;
-
-  __pthread_lock(&cond->__c_lock, NULL);
-  th = dequeue(&cond->__c_waiting);
-  __pthread_unlock(&cond->__c_lock);
-  if (th != NULL) {
-    th->p_condvar_avail = 1;
-    WRITE_MEMORY_BARRIER();
-    restart(th);
-  }
+  pthread_cond_advance(cond);
+  __pthread_futex_wake(&cond->__c_lock.__status, 1);
   return 0;
 }
 strong_alias (__pthread_cond_signal, pthread_cond_signal)
@@ -267,19 +140,16 @@ int
 attribute_hidden
 __pthread_cond_broadcast(pthread_cond_t *cond)
 {
-  pthread_descr tosignal, th;
-
-  __pthread_lock(&cond->__c_lock, NULL);
-  /* Copy the current state of the waiting queue and empty it */
-  tosignal = cond->__c_waiting;
-  cond->__c_waiting = NULL;
-  __pthread_unlock(&cond->__c_lock);
-  /* Now signal each process in the queue */
-  while ((th = dequeue(&tosignal)) != NULL) {
-    th->p_condvar_avail = 1;
-    WRITE_MEMORY_BARRIER();
-    restart(th);
-  }
+  pthread_mutex_t *mutex = cond->__c_mutex;
+
+  pthread_cond_advance(cond);
+  /* Wake one thread, it relocks the mutex in the contended state and
+     hands it on to the others when unlocking. */
+  if (mutex != NULL)
+    __pthread_futex_requeue(&cond->__c_lock.__status, 1,
+			    &mutex->__m_lock.__status);
+  else
+    __pthread_futex_wake(&cond->__c_lock.__status, INT_MAX);
   return 0;
 }
 strong_alias (__pthread_cond_broadcast, pthread_cond_broadcast)
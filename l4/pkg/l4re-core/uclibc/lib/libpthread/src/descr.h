@@ -162,8 +162,6 @@ struct pthread
   struct pthread_atomic p_resume_count; /* number of times restart() was
 					   called on thread */
   char p_woken_by_cancel;       /* cancellation performed wakeup */
-  char p_condvar_avail;		/* flag if conditional variable became avail */
-  char p_sem_avail;             /* flag if semaphore became available */
   pthread_extricate_if *p_extricate; /* See above */
   pthread_readlock_info *p_readlock_list;  /* List of readlock info structs */
   pthread_readlock_info *p_readlock_free;  /* Free list of structs */
@@ -174,6 +172,8 @@ struct pthread
 #endif
   size_t p_alloca_cutoff;	/* Maximum size which should be allocated
 				   using alloca() instead of malloc().  */
+  long *p_futex_addr;		/* futex word the thread is blocked on */
+  char p_futex_woken;		/* woken by __pthread_futex_wake() */
   /* New elements must be added at the end.  */
 } __attribute__ ((aligned (TCB_ALIGNMENT)));
 
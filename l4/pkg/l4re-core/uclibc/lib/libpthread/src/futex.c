@@ -0,0 +1,378 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ */
+
+/* User-level wait/wake service ("futexes")
+
+   Threads blocking on a word are kept in one of a fixed number of wait
+   queues, selected by hashing the address of the word.  Like all other
+   LinuxThreads waiting queues they are linked through p_nextwaiting and
+   sorted by priority, so single wake-ups go to the highest-priority waiter.
+   Blocking still uses the per-thread semaphore (suspend()/restart()), but
+   only threads that actually have to wait enter the kernel: uncontended
+   operations never touch the wait queues, and a wake-up on a bucket
+   without waiters does not even take the bucket lock.  */
+
+#include <errno.h>
+#include <limits.h>
+#include "pthread.h"
+#include "internals.h"
+#include "spinlock.h"
+#include "restart.h"
+#include "queue.h"
+#include "futex.h"
+
+/* Full barrier ordering the store that announces a waiter (or a new value
+   of the futex word) against the following load on the other side.  */
+#define FUTEX_FULL_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+enum { FUTEX_HASH_BITS = 6, FUTEX_HASH_SIZE = 1 << FUTEX_HASH_BITS };
+
+struct futex_bucket
+{
+  struct _pthread_fastlock lock;  /* Protects the fields below */
+  pthread_descr waiting;          /* Blocked threads, see queue.h */
+  long nwaiting;                  /* Length of waiting, read without lock */
+};
+
+static struct futex_bucket futex_table[FUTEX_HASH_SIZE];
+
+static __inline__ struct futex_bucket *futex_bucket(long *addr)
+{
+  unsigned long a = (unsigned long)addr / sizeof(long);
+  a ^= a >> FUTEX_HASH_BITS;
+  a ^= a >> (2 * FUTEX_HASH_BITS);
+  return &futex_table[a & (FUTEX_HASH_SIZE - 1)];
+}
+
+/* Remove TH from the wait queue of B.  Must hold B->lock. */
+static __inline__ void futex_dequeue(struct futex_bucket *b, pthread_descr th)
+{
+  remove_from_queue(&b->waiting, th);
+  th->p_futex_addr = NULL;
+  --b->nwaiting;
+}
+
+static int futex_canceled(pthread_descr self)
+{
+  return THREAD_GETMEM(self, p_canceled)
+         && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE;
+}
+
+int __pthread_futex_wait(long *addr, long val, pthread_descr self,
+                         const struct timespec *abstime, int cancellable)
+{
+  struct futex_bucket *b = futex_bucket(addr);
+  int spurious_wakeup_count = 0;
+  int res = 0;
+
+  if (self == NULL)
+    self = thread_self();
+
+  __pthread_lock(&b->lock, self);
+  ++b->nwaiting;
+  FUTEX_FULL_BARRIER();
+  if (*(volatile long *)addr != val)
+    {
+      --b->nwaiting;
+      __pthread_unlock(&b->lock);
+      return EWOULDBLOCK;
+    }
+
+  THREAD_SETMEM(self, p_futex_woken, 0);
+  THREAD_SETMEM(self, p_futex_addr, addr);
+  /* pthread_cancel() sets p_canceled before it looks at p_futex_addr in
+     __pthread_futex_unqueue(), so one of us sees the other's store. */
+  FUTEX_FULL_BARRIER();
+  if (cancellable && futex_canceled(self))
+    {
+      THREAD_SETMEM(self, p_futex_addr, NULL);
+      --b->nwaiting;
+      __pthread_unlock(&b->lock);
+      return EINTR;
+    }
+  enqueue(&b->waiting, self);
+  __pthread_unlock(&b->lock);
+
+  while (1)
+    {
+      if (abstime == NULL)
+        suspend(self);
+      else if (!timedsuspend(self, abstime))
+        {
+          if (__pthread_futex_unqueue(self))
+            {
+              res = ETIMEDOUT;
+              break;
+            }
+
+          /* Eat the outstanding restart() from the waker */
+          suspend(self);
+        }
+
+      if (THREAD_GETMEM(self, p_futex_woken))
+        break;
+
+      if (cancellable && THREAD_GETMEM(self, p_woken_by_cancel)
+          && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE)
+        {
+          res = EINTR;
+          break;
+        }
+
+      /* Count resumes that don't belong to us. */
+      spurious_wakeup_count++;
+    }
+
+  /* Put back any resumes we caught that don't belong to us. */
+  while (spurious_wakeup_count--)
+    restart(self);
+
+  READ_MEMORY_BARRIER();
+  return res;
+}
+
+/* Restart all threads on the list WOKEN (linked through p_nextwaiting).
+   Done outside of the bucket lock so that woken threads do not immediately
+   contend on it. */
+static void futex_restart_list(pthread_descr woken)
+{
+  pthread_descr th;
+
+  while ((th = woken) != NULL)
+    {
+      woken = th->p_nextwaiting;
+      th->p_nextwaiting = NULL;
+      WRITE_MEMORY_BARRIER();
+      th->p_futex_woken = 1;
+      WRITE_MEMORY_BARRIER();
+      restart(th);
+    }
+}
+
+/* Move up to NR threads blocked on ADDR from B to the list at *TAIL.
+   Must hold B->lock. */
+static int futex_collect(struct futex_bucket *b, long *addr, int nr,
+                         pthread_descr **tail)
+{
+  pthread_descr *q = &b->waiting;
+  pthread_descr th;
+  int n = 0;
+
+  while (n < nr && (th = *q) != NULL)
+    {
+      if (th->p_futex_addr != addr)
+        {
+          q = &th->p_nextwaiting;
+          continue;
+        }
+
+      *q = th->p_nextwaiting;
+      th->p_nextwaiting = NULL;
+      th->p_futex_addr = NULL;
+      --b->nwaiting;
+      **tail = th;
+      *tail = &th->p_nextwaiting;
+      ++n;
+    }
+
+  return n;
+}
+
+int __pthread_futex_wake(long *addr, int nr)
+{
+  struct futex_bucket *b = futex_bucket(addr);
+  pthread_descr woken = NULL, *tail = &woken;
+  int n;
+
+  FUTEX_FULL_BARRIER();
+  if (*(volatile long *)&b->nwaiting == 0)
+    return 0;
+
+  __pthread_lock(&b->lock, NULL);
+  n = futex_collect(b, addr, nr, &tail);
+  __pthread_unlock(&b->lock);
+
+  futex_restart_list(woken);
+  return n;
+}
+
+int __pthread_futex_requeue(long *addr, int nr_wake, long *addr2)
+{
+  struct futex_bucket *b = futex_bucket(addr);
+  struct futex_bucket *b2 = futex_bucket(addr2);
+  pthread_descr woken = NULL, *tail = &woken;
+  pthread_descr *q, th;
+  int n;
+
+  FUTEX_FULL_BARRIER();
+  if (*(volatile long *)&b->nwaiting == 0)
+    return 0;
+
+  /* Lock the buckets in a fixed order to avoid deadlocks */
+  if (b2 < b)
+    __pthread_lock(&b2->lock, NULL);
+  __pthread_lock(&b->lock, NULL);
+  if (b2 > b)
+    __pthread_lock(&b2->lock, NULL);
+
+  n = futex_collect(b, addr, nr_wake, &tail);
+
+  for (q = &b->waiting; (th = *q) != NULL; )
+    {
+      if (th->p_futex_addr != addr)
+        {
+          q = &th->p_nextwaiting;
+          continue;
+        }
+
+      if (b == b2)
+        {
+          th->p_futex_addr = addr2;
+          q = &th->p_nextwaiting;
+          continue;
+        }
+
+      *q = th->p_nextwaiting;
+      th->p_nextwaiting = NULL;
+      --b->nwaiting;
+      th->p_futex_addr = addr2;
+      ++b2->nwaiting;
+      enqueue(&b2->waiting, th);
+    }
+
+  if (b2 != b)
+    __pthread_unlock(&b2->lock);
+  __pthread_unlock(&b->lock);
+
+  futex_restart_list(woken);
+  return n;
+}
+
+int __pthread_futex_unqueue(pthread_descr th)
+{
+  /* Pairs with the barrier in __pthread_futex_wait(), see there. */
+  FUTEX_FULL_BARRIER();
+
+  while (1)
+    {
+      long *addr = *(long * volatile *)&th->p_futex_addr;
+      struct futex_bucket *b;
+
+      if (addr == NULL)
+        return 0;
+
+      b = futex_bucket(addr);
+      __pthread_lock(&b->lock, NULL);
+      /* The thread may have been requeued meanwhile. */
+      if (th->p_futex_addr == addr)
+        {
+          futex_dequeue(b, th);
+          __pthread_unlock(&b->lock);
+          return 1;
+        }
+      __pthread_unlock(&b->lock);
+    }
+}
+
+int __pthread_futex_extricate_func(void *obj, pthread_descr th)
+{
+  (void)obj;
+  return __pthread_futex_unqueue(th);
+}
+
+int __pthread_futex_has_waiters(long *addr)
+{
+  struct futex_bucket *b = futex_bucket(addr);
+  pthread_descr th;
+  int found = 0;
+
+  __pthread_lock(&b->lock, NULL);
+  for (th = b->waiting; th != NULL && !found; th = th->p_nextwaiting)
+    found = th->p_futex_addr == addr;
+  __pthread_unlock(&b->lock);
+
+  return found;
+}
+
+/* Locks on top of the futexes */
+
+static __inline__ long futex_lock_exchange(struct _pthread_fastlock *lock,
+                                           long val)
+{
+  long old;
+
+  do
+    old = lock->__status;
+  while (!compare_and_swap(&lock->__status, old, val, &lock->__spinlock));
+
+  return old;
+}
+
+/* Slow path of __pthread_futex_lock() and friends.  CONTENDED forces the
+   lock into the "maybe waiters" state right away, which is needed by
+   threads that were requeued to the lock from a condition variable.
+   Returns 0 on timeout. */
+int __pthread_futex_lock_slow(struct _pthread_fastlock *lock,
+                              pthread_descr self,
+                              const struct timespec *abstime,
+                              int contended)
+{
+#if defined HAS_COMPARE_AND_SWAP && !defined TEST_FOR_COMPARE_AND_SWAP
+  /* On SMP, try spinning to get the lock.  The lock holder is likely to be
+     running, and waiting a bit is much cheaper than blocking.  Like the
+     adaptive fastlock, keep an estimate of the useful spin count in the
+     otherwise unused __spinlock field.  */
+  if (!contended && __pthread_smp_kernel)
+    {
+      int max_count = lock->__spinlock * 2 + 10;
+      int spin_count;
+
+      if (max_count > MAX_ADAPTIVE_SPIN_COUNT)
+        max_count = MAX_ADAPTIVE_SPIN_COUNT;
+
+      for (spin_count = 0; spin_count < max_count; spin_count++)
+        {
+          if (lock->__status == 0
+              && __compare_and_swap(&lock->__status, 0, 1))
+            {
+              lock->__spinlock += (spin_count - lock->__spinlock) / 8;
+              READ_MEMORY_BARRIER();
+              return 1;
+            }
+#ifdef BUSY_WAIT_NOP
+          BUSY_WAIT_NOP;
+#endif
+          __asm__ __volatile__ ("" : "=m" (lock->__status)
+                                   : "m" (lock->__status));
+        }
+
+      lock->__spinlock += (spin_count - lock->__spinlock) / 8;
+    }
+#endif
+
+  /* Announce that there is a waiter and block until the lock is
+     released. */
+  while (futex_lock_exchange(lock, 2) != 0)
+    if (__pthread_futex_wait(&lock->__status, 2, self, abstime, 0)
+        == ETIMEDOUT)
+      return 0;
+
+  READ_MEMORY_BARRIER();
+  return 1;
+}
+
+void __pthread_futex_unlock_slow(struct _pthread_fastlock *lock)
+{
+  /* There may be waiters, release the lock and wake one of them. */
+  futex_lock_exchange(lock, 0);
+  __pthread_futex_wake(&lock->__status, 1);
+}
@@ -0,0 +1,92 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ */
+
+/* User-level wait/wake service ("futexes") and the locks built on it */
+
+#pragma once
+
+#include <errno.h>
+#include <time.h>
+
+__BEGIN_DECLS
+
+/* Block the calling thread as long as *addr == val.  Returns 0 when woken by
+   __pthread_futex_wake(), EWOULDBLOCK if *addr != val, ETIMEDOUT if
+   ABSTIME (may be NULL) passed, and, if CANCELLABLE, EINTR if the thread was
+   canceled before or while blocking.  Spurious wake-ups are possible. */
+extern int __pthread_futex_wait(long *addr, long val, pthread_descr self,
+                                const struct timespec *abstime,
+                                int cancellable);
+
+/* Wake up to NR threads blocked on ADDR, highest priority first.  Returns
+   the number of threads woken. */
+extern int __pthread_futex_wake(long *addr, int nr);
+
+/* Wake up to NR_WAKE threads blocked on ADDR and move all others over to
+   wait on ADDR2 instead.  Returns the number of threads woken. */
+extern int __pthread_futex_requeue(long *addr, int nr_wake, long *addr2);
+
+/* Remove TH from the futex it is blocked on.  Returns 1 if TH was removed
+   and must be restarted by the caller, 0 if it was not blocked.  Used by
+   extrication functions for cancellation. */
+extern int __pthread_futex_unqueue(pthread_descr th);
+
+/* Extrication function (see pthread_extricate_if) for cancellable futex
+   waits, OBJ is unused. */
+extern int __pthread_futex_extricate_func(void *obj, pthread_descr th);
+
+/* Return nonzero if any thread is blocked on ADDR. */
+extern int __pthread_futex_has_waiters(long *addr);
+
+/* Locks on the __status word of a _pthread_fastlock:
+   0 = free, 1 = taken, 2 = taken and threads may be blocked on it.
+   Contended lock operations spin adaptively on SMP before blocking. */
+extern int __pthread_futex_lock_slow(struct _pthread_fastlock *lock,
+                                     pthread_descr self,
+                                     const struct timespec *abstime,
+                                     int contended);
+extern void __pthread_futex_unlock_slow(struct _pthread_fastlock *lock);
+
+static __inline__ void
+__pthread_futex_lock(struct _pthread_fastlock *lock, pthread_descr self)
+{
+  if (!compare_and_swap(&lock->__status, 0, 1, &lock->__spinlock))
+    __pthread_futex_lock_slow(lock, self, NULL, 0);
+}
+
+/* Returns 0 on timeout. */
+static __inline__ int
+__pthread_futex_timedlock(struct _pthread_fastlock *lock, pthread_descr self,
+                          const struct timespec *abstime)
+{
+  if (compare_and_swap(&lock->__status, 0, 1, &lock->__spinlock))
+    return 1;
+  return __pthread_futex_lock_slow(lock, self, abstime, 0);
+}
+
+static __inline__ int
+__pthread_futex_trylock(struct _pthread_fastlock *lock)
+{
+  return compare_and_swap(&lock->__status, 0, 1, &lock->__spinlock)
+         ? 0 : EBUSY;
+}
+
+static __inline__ void
+__pthread_futex_unlock(struct _pthread_fastlock *lock)
+{
+  WRITE_MEMORY_BARRIER();
+  if (!compare_and_swap_with_release_semantics(&lock->__status, 1, 0,
+                                               &lock->__spinlock))
+    __pthread_futex_unlock_slow(lock);
+}
+
+__END_DECLS
@@ -313,6 +313,11 @@ extern int __pthread_initialize_manager (void);
 extern void __pthread_message (const char * fmt, ...);
 extern int __pthread_manager (void *reqfd);
 extern int __pthread_start_manager (pthread_descr mgr) L4_HIDDEN;
+extern int __pthread_create_direct (pthread_t *thread,
+                                    const pthread_attr_t *attr,
+                                    void * (*start_routine)(void *),
+                                    void *arg) L4_HIDDEN;
+extern void __pthread_free_direct (pthread_t th_id) L4_HIDDEN;
 extern int __pthread_manager_event (void *reqfd);
 extern void __pthread_manager_sighandler (int sig);
 extern void __pthread_reset_main_thread (void);
@@ -378,6 +383,8 @@ extern int __pthread_mutex_destroy (pthread_mutex_t *__mutex);
 extern int __pthread_mutex_lock (pthread_mutex_t *__mutex);
 extern int __pthread_mutex_trylock (pthread_mutex_t *__mutex);
 extern int __pthread_mutex_unlock (pthread_mutex_t *__mutex);
+extern void __pthread_mutex_cond_lock (pthread_mutex_t *__mutex,
+				       pthread_descr __self);
 
 extern int __pthread_cond_init (pthread_cond_t *cond,
 				const pthread_condattr_t *cond_attr);
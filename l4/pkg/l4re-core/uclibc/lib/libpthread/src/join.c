@@ -113,6 +113,7 @@ int pthread_join(pthread_t thread_id, void ** thread_return)
   pthread_descr th;
   pthread_extricate_if extr;
   int already_canceled = 0;
+  int free_direct;
 
   /* Set up extrication interface */
   extr.pu_object = handle;
@@ -163,9 +164,15 @@ int pthread_join(pthread_t thread_id, void ** thread_return)
   }
   /* Get return value */
   if (thread_return != NULL) *thread_return = th->p_retval;
+  /* A thread that terminated while we were joining it went to sleep without
+     notifying the manager, and one that the manager already marked as
+     exited will not notify it anymore: free such threads right here. */
+  free_direct = th->p_joining == self || th->p_exited;
   __pthread_unlock(handle_to_lock(handle));
+  if (free_direct)
+    __pthread_free_direct(thread_id);
   /* Send notification to thread manager */
-  if (__pthread_manager_request >= 0) {
+  else if (__pthread_manager_request >= 0) {
     request.req_thread = self;
     request.req_kind = REQ_FREE;
     request.req_args.free.thread_id = thread_id;
@@ -176,7 +183,7 @@ int pthread_join(pthread_t thread_id, void ** thread_return)
 
 int pthread_detach(pthread_t thread_id)
 {
-  int terminated;
+  int terminated, exited;
   struct pthread_request request;
   pthread_handle handle = thread_handle(thread_id);
   pthread_descr th;
@@ -200,9 +207,13 @@ int pthread_detach(pthread_t thread_id)
   /* Mark as detached */
   th->p_detached = 1;
   terminated = th->p_terminated;
+  exited = th->p_exited;
   __pthread_unlock(handle_to_lock(handle));
+  /* If the manager already processed the exit, reclaim resources here */
+  if (exited)
+    __pthread_free_direct(thread_id);
   /* If already terminated, notify thread manager to reclaim resources */
-  if (terminated && __pthread_manager_request >= 0) {
+  else if (terminated && __pthread_manager_request >= 0) {
     request.req_thread = thread_self();
     request.req_kind = REQ_FREE;
     request.req_args.free.thread_id = thread_id;
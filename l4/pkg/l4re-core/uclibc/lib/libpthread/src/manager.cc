@@ -108,6 +108,31 @@ static void pthread_for_each_thread(void *arg,
 
 static int pthread_exited(pthread_descr th);
 
+/* Lock protecting the list of live threads, the free UTCB list and the
+   stack cache.  It is taken by the manager and by threads that create or
+   free threads directly without a manager round-trip. */
+
+static struct _pthread_fastlock pthread_mgr_lock;
+
+#ifdef USE_L4RE_FOR_STACK
+/* Stacks (including their guard areas) of freed threads, kept for reuse by
+   later thread creations.  This saves the memory allocator and region
+   manager round-trips for allocating, attaching and detaching the stack
+   dataspace.  Protected by pthread_mgr_lock. */
+
+enum { PTHREAD_STACK_CACHE_ENTRIES = 32 };
+
+struct pthread_cached_stack
+{
+  char *guardaddr;
+  size_t guardsize;
+  size_t stacksize;
+};
+
+static struct pthread_cached_stack stack_cache[PTHREAD_STACK_CACHE_ENTRIES];
+static unsigned stack_cache_used;
+#endif
+
 /* The server thread managing requests for thread creation and termination */
 
 int
@@ -161,15 +186,19 @@ __pthread_manager(void *arg)
       switch(request.req_kind)
 	{
 	case REQ_CREATE:
+	  __pthread_lock(&pthread_mgr_lock, self);
 	  request.req_thread->p_retcode =
 	    pthread_handle_create((pthread_t *) &request.req_thread->p_retval,
 		request.req_args.create.attr,
 		request.req_args.create.fn,
 		request.req_args.create.arg);
+	  __pthread_unlock(&pthread_mgr_lock);
 	  do_reply = 1;
 	  break;
 	case REQ_FREE:
+	  __pthread_lock(&pthread_mgr_lock, self);
 	  pthread_handle_free(request.req_args.free.thread_id);
+	  __pthread_unlock(&pthread_mgr_lock);
 	  break;
 	case REQ_PROCESS_EXIT:
 	  pthread_handle_exit(request.req_thread,
@@ -183,6 +212,7 @@ __pthread_manager(void *arg)
              not do REQ_KICK. */
           //l4/pthread_reap_children();
 
+	  __pthread_lock(&pthread_mgr_lock, self);
 	  if (__pthread_main_thread->p_nextlive == __pthread_main_thread) {
 	      restart(__pthread_main_thread);
 	      /* The main thread will now call exit() which will trigger an
@@ -190,6 +220,7 @@ __pthread_manager(void *arg)
 		 to the thread manager. In case you are wondering how the
 		 manager terminates from its loop here. */
 	  }
+	  __pthread_unlock(&pthread_mgr_lock);
 	  break;
 	case REQ_POST:
 	  sem_post((sem_t*)request.req_args.post);
@@ -209,13 +240,16 @@ __pthread_manager(void *arg)
 	     threads right away, avoiding a potential delay at shutdown. */
 	  break;
 	case REQ_FOR_EACH_THREAD:
+	  __pthread_lock(&pthread_mgr_lock, self);
 	  pthread_for_each_thread(request.req_args.for_each.arg,
 	      request.req_args.for_each.fn);
+	  __pthread_unlock(&pthread_mgr_lock);
           restart(request.req_thread);
 	  do_reply = 1;
 	  break;
         case REQ_THREAD_EXIT:
             {
+              __pthread_lock(&pthread_mgr_lock, self);
               if (!pthread_exited(request.req_thread))
                 {
                   auto th = request.req_thread;
@@ -230,6 +264,7 @@ __pthread_manager(void *arg)
                   L4Re::Env::env()->task()->delete_obj(
                     L4::Cap<void>(th->p_th_cap));
                 }
+              __pthread_unlock(&pthread_mgr_lock);
             }
           break;
 	}
@@ -365,6 +400,75 @@ static int pthread_l4_free_stack(void *stack_addr, void *guardaddr)
 
   return e->rm()->free_area((l4_addr_t)guardaddr);
 }
+
+static int pthread_l4_alloc_stack(size_t stacksize, size_t guardsize,
+                                  void **map_addr)
+{
+  L4Re::Env const *e = L4Re::Env::env();
+  long err;
+
+  for (unsigned i = stack_cache_used; i > 0; --i)
+    {
+      struct pthread_cached_stack *c = &stack_cache[i - 1];
+      if (c->stacksize != stacksize || c->guardsize != guardsize)
+        continue;
+
+      *map_addr = c->guardaddr;
+      *c = stack_cache[--stack_cache_used];
+      return 0;
+    }
+
+  *map_addr = 0;
+  if (e->rm()->reserve_area(map_addr, stacksize + guardsize,
+                            L4Re::Rm::Search_addr) < 0)
+    return -1;
+
+  L4::Cap<L4Re::Dataspace> ds = L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>();
+  if (!ds.is_valid())
+    {
+      e->rm()->free_area(l4_addr_t(*map_addr));
+      return -1;
+    }
+
+  err = e->mem_alloc()->alloc(stacksize, ds);
+
+  if (err < 0)
+    {
+      L4Re::Util::cap_alloc.free(ds);
+      e->rm()->free_area(l4_addr_t(*map_addr));
+      return -1;
+    }
+
+  char *stack_bottom = (char *)*map_addr + guardsize;
+  err = e->rm()->attach(&stack_bottom, stacksize, L4Re::Rm::In_area,
+                        L4::Ipc::make_cap_rw(ds), 0);
+
+  if (err < 0)
+    {
+      L4Re::Util::cap_alloc.free(ds, L4Re::This_task);
+      e->rm()->free_area(l4_addr_t(*map_addr));
+      return -1;
+    }
+
+  return 0;
+}
+
+/* Put a no longer used stack into the stack cache, or free it if the cache
+   is full. */
+static int pthread_l4_release_stack(char *guardaddr, size_t guardsize,
+                                    size_t stacksize)
+{
+  if (stack_cache_used < PTHREAD_STACK_CACHE_ENTRIES)
+    {
+      struct pthread_cached_stack *c = &stack_cache[stack_cache_used++];
+      c->guardaddr = guardaddr;
+      c->guardsize = guardsize;
+      c->stacksize = stacksize;
+      return 0;
+    }
+
+  return pthread_l4_free_stack(guardaddr + guardsize, guardaddr);
+}
 #endif
 
 static int pthread_allocate_stack(const pthread_attr_t *attr,
@@ -450,39 +554,11 @@ static int pthread_allocate_stack(const pthread_attr_t *attr,
 	}
 
 #ifdef USE_L4RE_FOR_STACK
-      map_addr = 0;
-      L4Re::Env const *e = L4Re::Env::env();
-      long err;
-
-      if (e->rm()->reserve_area(&map_addr, stacksize + guardsize,
-	                        L4Re::Rm::Search_addr) < 0)
+      if (pthread_l4_alloc_stack(stacksize, guardsize, &map_addr) < 0)
 	return -1;
 
       guardaddr = (char*)map_addr;
-
-      L4::Cap<L4Re::Dataspace> ds = L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>();
-      if (!ds.is_valid())
-	return -1;
-
-      err = e->mem_alloc()->alloc(stacksize, ds);
-
-      if (err < 0)
-	{
-	  L4Re::Util::cap_alloc.free(ds);
-	  e->rm()->free_area(l4_addr_t(map_addr));
-	  return -1;
-	}
-
       new_thread_bottom = (char *) map_addr + guardsize;
-      err = e->rm()->attach(&new_thread_bottom, stacksize, L4Re::Rm::In_area,
-                            L4::Ipc::make_cap_rw(ds), 0);
-
-      if (err < 0)
-	{
-	  L4Re::Util::cap_alloc.free(ds, L4Re::This_task);
-	  e->rm()->free_area(l4_addr_t(map_addr));
-	  return -1;
-	}
 #else
       map_addr = mmap(NULL, stacksize + guardsize,
                       PROT_READ | PROT_WRITE | PROT_EXEC,
@@ -502,6 +578,8 @@ static int pthread_allocate_stack(const pthread_attr_t *attr,
       new_thread = ((pthread_descr) (new_thread_bottom + stacksize));
 #else
       new_thread = ((pthread_descr) (new_thread_bottom + stacksize)) - 1;
+      /* A stack from the stack cache still holds the old descriptor.  */
+      memset (new_thread, '\0', sizeof (*new_thread));
 #endif
     }
   *out_new_thread = (char *) new_thread;
@@ -772,7 +850,7 @@ static int pthread_handle_create(pthread_t *thread, const pthread_attr_t *attr,
       /* Raise priority of thread manager if needed */
       __pthread_manager_adjust_prio(prio);
     }
-  else if (manager_thread->p_sched_policy > 3)
+  else if (manager_thread && manager_thread->p_sched_policy > 3)
     {
       /* Default scheduling required, but thread manager runs in realtime
          scheduling: switch new thread to SCHED_OTHER policy */
@@ -814,7 +892,7 @@ static int pthread_handle_create(pthread_t *thread, const pthread_attr_t *attr,
 # endif
 #else
 #ifdef USE_L4RE_FOR_STACK
-        if (pthread_l4_free_stack(new_thread_bottom, guardaddr))
+        if (pthread_l4_release_stack(guardaddr, guardsize, stksize))
           fprintf(stderr, "ERROR: failed to free stack\n");
 #else
 # ifdef USE_TLS
@@ -902,9 +980,9 @@ static void pthread_free(pthread_descr th)
       /* Guardaddr is always set, even if guardsize is 0.  This allows
 	 us to compute everything else.  */
 # ifdef USE_TLS
-      //l4/size_t stacksize = th->p_stackaddr - guardaddr - guardsize;
+      size_t stacksize = th->p_stackaddr - guardaddr - guardsize;
 # else
-      //l4/size_t stacksize = (char *)(th+1) - guardaddr - guardsize;
+      size_t stacksize = (char *)(th+1) - guardaddr - guardsize;
 # endif
 # ifdef NEED_SEPARATE_REGISTER_STACK
       /* Take account of the register stack, which is below guardaddr.  */
@@ -913,7 +991,7 @@ static void pthread_free(pthread_descr th)
 # endif
 #endif
 #ifdef USE_L4RE_FOR_STACK
-      pthread_l4_free_stack(guardaddr + guardsize, guardaddr);
+      pthread_l4_release_stack(guardaddr, guardsize, stacksize);
 #else
       munmap(guardaddr, stacksize + guardsize);
 #endif
@@ -980,6 +1058,33 @@ static void pthread_handle_free(pthread_t th_id)
     pthread_free(th);
 }
 
+/* Thread creation and freeing without a round-trip to the thread manager.
+   The caller allocates the stack and UTCB and sets up the new L4 thread
+   itself, serialized against the manager by pthread_mgr_lock only.  */
+
+int __pthread_create_direct(pthread_t *thread, const pthread_attr_t *attr,
+                            void * (*start_routine)(void *), void *arg)
+{
+  int err;
+
+  __pthread_lock(&pthread_mgr_lock, NULL);
+  err = pthread_handle_create(thread, attr, start_routine, arg);
+  __pthread_unlock(&pthread_mgr_lock);
+
+  return err;
+}
+
+/* Must only be called for threads that will not send a REQ_THREAD_EXIT
+   anymore, i.e. the manager already marked them as exited or they
+   terminated while being joined.  */
+
+void __pthread_free_direct(pthread_t th_id)
+{
+  __pthread_lock(&pthread_mgr_lock, NULL);
+  pthread_handle_free(th_id);
+  __pthread_unlock(&pthread_mgr_lock);
+}
+
 /* Send a signal to all running threads */
 
 #if 0
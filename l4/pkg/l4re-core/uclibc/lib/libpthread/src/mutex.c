@@ -24,8 +24,7 @@
 #include "pthread.h"
 #include "internals.h"
 #include "spinlock.h"
-#include "queue.h"
-#include "restart.h"
+#include "futex.h"
 
 int
 attribute_hidden
@@ -48,9 +47,6 @@ __pthread_mutex_destroy(pthread_mutex_t * mutex)
   switch (mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
   case PTHREAD_MUTEX_RECURSIVE_NP:
-    if ((mutex->__m_lock.__status & 1) != 0)
-      return EBUSY;
-    return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
   case PTHREAD_MUTEX_TIMED_NP:
     if (mutex->__m_lock.__status != 0)
@@ -62,6 +58,10 @@ __pthread_mutex_destroy(pthread_mutex_t * mutex)
 }
 strong_alias (__pthread_mutex_destroy, pthread_mutex_destroy)
 
+/* All mutex kinds use the futex lock on __m_lock.__status (see futex.h):
+   locking and unlocking an uncontended mutex is a single compare-and-swap,
+   and only threads that actually have to wait block in the kernel. */
+
 int
 attribute_hidden
 __pthread_mutex_trylock(pthread_mutex_t * mutex)
@@ -71,7 +71,8 @@ __pthread_mutex_trylock(pthread_mutex_t * mutex)
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    retcode = __pthread_trylock(&mutex->__m_lock);
+  case PTHREAD_MUTEX_TIMED_NP:
+    retcode = __pthread_futex_trylock(&mutex->__m_lock);
     return retcode;
   case PTHREAD_MUTEX_RECURSIVE_NP:
     self = thread_self();
@@ -79,21 +80,18 @@ __pthread_mutex_trylock(pthread_mutex_t * mutex)
       mutex->__m_count++;
       return 0;
     }
-    retcode = __pthread_trylock(&mutex->__m_lock);
+    retcode = __pthread_futex_trylock(&mutex->__m_lock);
     if (retcode == 0) {
       mutex->__m_owner = self;
       mutex->__m_count = 0;
     }
     return retcode;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
-    retcode = __pthread_alt_trylock(&mutex->__m_lock);
+    retcode = __pthread_futex_trylock(&mutex->__m_lock);
     if (retcode == 0) {
       mutex->__m_owner = thread_self();
     }
     return retcode;
-  case PTHREAD_MUTEX_TIMED_NP:
-    retcode = __pthread_alt_trylock(&mutex->__m_lock);
-    return retcode;
   default:
     return EINVAL;
   }
@@ -108,7 +106,8 @@ __pthread_mutex_lock(pthread_mutex_t * mutex)
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_lock(&mutex->__m_lock, NULL);
+  case PTHREAD_MUTEX_TIMED_NP:
+    __pthread_futex_lock(&mutex->__m_lock, NULL);
     return 0;
   case PTHREAD_MUTEX_RECURSIVE_NP:
     self = thread_self();
@@ -116,19 +115,16 @@ __pthread_mutex_lock(pthread_mutex_t * mutex)
       mutex->__m_count++;
       return 0;
     }
-    __pthread_lock(&mutex->__m_lock, self);
+    __pthread_futex_lock(&mutex->__m_lock, self);
     mutex->__m_owner = self;
     mutex->__m_count = 0;
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
     self = thread_self();
     if (mutex->__m_owner == self) return EDEADLK;
-    __pthread_alt_lock(&mutex->__m_lock, self);
+    __pthread_futex_lock(&mutex->__m_lock, self);
     mutex->__m_owner = self;
     return 0;
-  case PTHREAD_MUTEX_TIMED_NP:
-    __pthread_alt_lock(&mutex->__m_lock, NULL);
-    return 0;
   default:
     return EINVAL;
   }
@@ -143,7 +139,6 @@ __pthread_mutex_timedlock (pthread_mutex_t *mutex,
 			       const struct timespec *abstime)
 {
   pthread_descr self;
-  int res;
 
   if (__builtin_expect (abstime->tv_nsec, 0) < 0
       || __builtin_expect (abstime->tv_nsec, 0) >= 1000000000)
@@ -151,45 +146,65 @@ __pthread_mutex_timedlock (pthread_mutex_t *mutex,
 
   switch(mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_lock(&mutex->__m_lock, NULL);
-    return 0;
+  case PTHREAD_MUTEX_TIMED_NP:
+    return (__pthread_futex_timedlock(&mutex->__m_lock, NULL, abstime)
+	    ? 0 : ETIMEDOUT);
   case PTHREAD_MUTEX_RECURSIVE_NP:
     self = thread_self();
     if (mutex->__m_owner == self) {
       mutex->__m_count++;
       return 0;
     }
-    __pthread_lock(&mutex->__m_lock, self);
+    if (!__pthread_futex_timedlock(&mutex->__m_lock, self, abstime))
+      return ETIMEDOUT;
     mutex->__m_owner = self;
     mutex->__m_count = 0;
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
     self = thread_self();
     if (mutex->__m_owner == self) return EDEADLK;
-    res = __pthread_alt_timedlock(&mutex->__m_lock, self, abstime);
-    if (res != 0)
-      {
-	mutex->__m_owner = self;
-	return 0;
-      }
-    return ETIMEDOUT;
-  case PTHREAD_MUTEX_TIMED_NP:
-    /* Only this type supports timed out lock. */
-    return (__pthread_alt_timedlock(&mutex->__m_lock, NULL, abstime)
-	    ? 0 : ETIMEDOUT);
+    if (!__pthread_futex_timedlock(&mutex->__m_lock, self, abstime))
+      return ETIMEDOUT;
+    mutex->__m_owner = self;
+    return 0;
   default:
     return EINVAL;
   }
 }
 strong_alias (__pthread_mutex_timedlock, pthread_mutex_timedlock)
 
+/* Relock MUTEX after waiting on a condition variable.  Threads may have
+   been moved from the condition variable to the mutex by
+   pthread_cond_broadcast, so the lock must be left in the contended state
+   to make sure they get woken up again. */
+
+void
+attribute_hidden
+__pthread_mutex_cond_lock(pthread_mutex_t * mutex, pthread_descr self)
+{
+  __pthread_futex_lock_slow(&mutex->__m_lock, self, NULL, 1);
+
+  switch(mutex->__m_kind) {
+  case PTHREAD_MUTEX_RECURSIVE_NP:
+    mutex->__m_owner = self;
+    mutex->__m_count = 0;
+    break;
+  case PTHREAD_MUTEX_ERRORCHECK_NP:
+    mutex->__m_owner = self;
+    break;
+  default:
+    break;
+  }
+}
+
 int
 attribute_hidden
 __pthread_mutex_unlock(pthread_mutex_t * mutex)
 {
   switch (mutex->__m_kind) {
   case PTHREAD_MUTEX_ADAPTIVE_NP:
-    __pthread_unlock(&mutex->__m_lock);
+  case PTHREAD_MUTEX_TIMED_NP:
+    __pthread_futex_unlock(&mutex->__m_lock);
     return 0;
   case PTHREAD_MUTEX_RECURSIVE_NP:
     if (mutex->__m_owner != thread_self())
@@ -199,16 +214,13 @@ __pthread_mutex_unlock(pthread_mutex_t * mutex)
       return 0;
     }
     mutex->__m_owner = NULL;
-    __pthread_unlock(&mutex->__m_lock);
+    __pthread_futex_unlock(&mutex->__m_lock);
     return 0;
   case PTHREAD_MUTEX_ERRORCHECK_NP:
     if (mutex->__m_owner != thread_self() || mutex->__m_lock.__status == 0)
       return EPERM;
     mutex->__m_owner = NULL;
-    __pthread_alt_unlock(&mutex->__m_lock);
-    return 0;
-  case PTHREAD_MUTEX_TIMED_NP:
-    __pthread_alt_unlock(&mutex->__m_lock);
+    __pthread_futex_unlock(&mutex->__m_lock);
     return 0;
   default:
     return EINVAL;
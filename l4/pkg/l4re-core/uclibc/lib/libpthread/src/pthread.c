@@ -893,29 +893,34 @@ attribute_hidden
 __pthread_create(pthread_t *thread, const pthread_attr_t *attr,
 			 void * (*start_routine)(void *), void *arg)
 {
-  pthread_descr self = thread_self();
-  struct pthread_request request;
   int retval;
   if (__builtin_expect (l4_is_invalid_cap(__pthread_manager_request), 0)) {
     if (__pthread_initialize_manager() < 0)
       return EAGAIN;
   }
+#ifdef NOT_FOR_L4
+  pthread_descr self = thread_self();
+  struct pthread_request request;
   request.req_thread = self;
   request.req_kind = REQ_CREATE;
   request.req_args.create.attr = attr;
   request.req_args.create.fn = start_routine;
   request.req_args.create.arg = arg;
-#ifdef NOT_FOR_L4
   sigprocmask(SIG_SETMASK, NULL, &request.req_args.create.mask);
   TEMP_FAILURE_RETRY(write_not_cancel(__pthread_manager_request,
 				      (char *) &request, sizeof(request)));
   suspend(self);
-#else
-  __pthread_send_manager_rq(&request, 1);
-#endif
   retval = THREAD_GETMEM(self, p_retcode);
   if (__builtin_expect (retval, 0) == 0)
     *thread = (pthread_t) THREAD_GETMEM(self, p_retval);
+#else
+  /* The manager is still needed for thread exit, but the new thread is
+     set up directly by the calling thread. */
+  pthread_t new_thread;
+  retval = __pthread_create_direct(&new_thread, attr, start_routine, arg);
+  if (__builtin_expect (retval, 0) == 0)
+    *thread = new_thread;
+#endif
   return retval;
 }
 strong_alias (__pthread_create, pthread_create)
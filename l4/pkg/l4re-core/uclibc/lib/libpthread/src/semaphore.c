@@ -20,7 +20,11 @@
 #include "internals.h"
 #include "spinlock.h"
 #include "restart.h"
-#include "queue.h"
+#include "futex.h"
+
+/* The value of the semaphore lives in __sem_lock.__status, which also
+   serves as the futex word waiters block on.  sem_wait and sem_post are
+   thus a single compare-and-swap unless a thread actually has to block. */
 
 int sem_init(sem_t *sem, int pshared, unsigned int value)
 {
@@ -33,160 +37,113 @@ int sem_init(sem_t *sem, int pshared, unsigned int value)
     return -1;
   }
   __pthread_init_lock(&sem->__sem_lock);
-  sem->__sem_value = value;
+  sem->__sem_lock.__status = value;
+  sem->__sem_value = 0;
   sem->__sem_waiting = NULL;
   return 0;
 }
 
-/* Function called by pthread_cancel to remove the thread from
-   waiting inside sem_wait. */
+/* Try to decrement the semaphore without blocking.  Returns 0 on success
+   and EAGAIN if the value is zero. */
 
-static int new_sem_extricate_func(void *obj, pthread_descr th)
+static __inline__ int sem_try_decrement(sem_t *sem)
 {
-  __volatile__ pthread_descr self = thread_self();
-  sem_t *sem = obj;
-  int did_remove = 0;
+  long value;
 
-  __pthread_lock(&sem->__sem_lock, self);
-  did_remove = remove_from_queue(&sem->__sem_waiting, th);
-  __pthread_unlock(&sem->__sem_lock);
+  while ((value = sem->__sem_lock.__status) > 0)
+    if (compare_and_swap(&sem->__sem_lock.__status, value, value - 1,
+                         &sem->__sem_lock.__spinlock)) {
+      READ_MEMORY_BARRIER();
+      return 0;
+    }
 
-  return did_remove;
+  return EAGAIN;
 }
 
-int sem_wait(sem_t * sem)
+/* Block until the semaphore could be decremented.  Returns 0 or
+   ETIMEDOUT, does not return if the thread gets canceled. */
+
+static int sem_wait_slow(sem_t *sem, const struct timespec *abstime)
 {
   __volatile__ pthread_descr self = thread_self();
   pthread_extricate_if extr;
-  int already_canceled = 0;
-  int spurious_wakeup_count;
+  int res = 0;
 
   /* Set up extrication interface */
   extr.pu_object = sem;
-  extr.pu_extricate_func = new_sem_extricate_func;
+  extr.pu_extricate_func = __pthread_futex_extricate_func;
 
-  __pthread_lock(&sem->__sem_lock, self);
-  if (sem->__sem_value > 0) {
-    sem->__sem_value--;
-    __pthread_unlock(&sem->__sem_lock);
-    return 0;
-  }
   /* Register extrication interface */
-  THREAD_SETMEM(self, p_sem_avail, 0);
   __pthread_set_own_extricate_if(self, &extr);
-  /* Enqueue only if not already cancelled. */
-  if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
-    enqueue(&sem->__sem_waiting, self);
-  else
-    already_canceled = 1;
-  __pthread_unlock(&sem->__sem_lock);
-
-  if (already_canceled) {
-    __pthread_set_own_extricate_if(self, 0);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
-  }
 
-  /* Wait for sem_post or cancellation, or fall through if already canceled */
-  spurious_wakeup_count = 0;
-  while (1)
-    {
-      suspend(self);
-      if (THREAD_GETMEM(self, p_sem_avail) == 0
-	  && (THREAD_GETMEM(self, p_woken_by_cancel) == 0
-	      || THREAD_GETMEM(self, p_cancelstate) != PTHREAD_CANCEL_ENABLE))
-	{
-	  /* Count resumes that don't belong to us. */
-	  spurious_wakeup_count++;
-	  continue;
-	}
+  while (sem_try_decrement(sem) != 0) {
+    res = __pthread_futex_wait(&sem->__sem_lock.__status, 0, self, abstime, 1);
+    if (res == ETIMEDOUT || res == EINTR)
       break;
-    }
+    res = 0;
+  }
+
   __pthread_set_own_extricate_if(self, 0);
 
   /* Terminate only if the wakeup came from cancellation. */
   /* Otherwise ignore cancellation because we got the semaphore. */
 
-  if (THREAD_GETMEM(self, p_woken_by_cancel)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
+  if (res == EINTR) {
     THREAD_SETMEM(self, p_woken_by_cancel, 0);
     __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
   }
+
+  return res;
+}
+
+int sem_wait(sem_t * sem)
+{
+  if (sem_try_decrement(sem) == 0)
+    return 0;
+
+  sem_wait_slow(sem, NULL);
   /* We got the semaphore */
   return 0;
 }
 
 int sem_trywait(sem_t * sem)
 {
-  int retval;
-
-  __pthread_lock(&sem->__sem_lock, NULL);
-  if (sem->__sem_value == 0) {
+  if (sem_try_decrement(sem) != 0) {
     __set_errno(EAGAIN);
-    retval = -1;
-  } else {
-    sem->__sem_value--;
-    retval = 0;
+    return -1;
   }
-  __pthread_unlock(&sem->__sem_lock);
-  return retval;
+  return 0;
 }
 
 int sem_post(sem_t * sem)
 {
-  pthread_descr self = thread_self();
-  pthread_descr th;
-#if 0 // AW11
-  struct pthread_request request;
-  if (THREAD_GETMEM(self, p_in_sighandler) == NULL)
-#endif
-  {
-    __pthread_lock(&sem->__sem_lock, self);
-    if (sem->__sem_waiting == NULL) {
-      if (sem->__sem_value >= SEM_VALUE_MAX) {
-        /* Overflow */
-        __set_errno(ERANGE);
-        __pthread_unlock(&sem->__sem_lock);
-        return -1;
-      }
-      sem->__sem_value++;
-      __pthread_unlock(&sem->__sem_lock);
-    } else {
-      th = dequeue(&sem->__sem_waiting);
-      __pthread_unlock(&sem->__sem_lock);
-      th->p_sem_avail = 1;
-      WRITE_MEMORY_BARRIER();
-      restart(th);
-    }
-  }
-#if 0 // AW11
-  else {
-    /* If we're in signal handler, delegate post operation to
-       the thread manager. */
-    if (__pthread_manager_request < 0) {
-      if (__pthread_initialize_manager() < 0) {
-        __set_errno(EAGAIN);
-        return -1;
-      }
+  long value;
+
+  WRITE_MEMORY_BARRIER();
+  do {
+    value = sem->__sem_lock.__status;
+    if (value >= SEM_VALUE_MAX) {
+      /* Overflow */
+      __set_errno(ERANGE);
+      return -1;
     }
-    request.req_kind = REQ_POST;
-    request.req_args.post = sem;
-    TEMP_FAILURE_RETRY(write_not_cancel(__pthread_manager_request,
-					(char *) &request, sizeof(request)));
-  }
-#endif
+  } while (!compare_and_swap(&sem->__sem_lock.__status, value, value + 1,
+                             &sem->__sem_lock.__spinlock));
+
+  /* Cheap if nobody is blocked, see __pthread_futex_wake(). */
+  __pthread_futex_wake(&sem->__sem_lock.__status, 1);
   return 0;
 }
 
 int sem_getvalue(sem_t * sem, int * sval)
 {
-  *sval = sem->__sem_value;
+  *sval = sem->__sem_lock.__status;
   return 0;
 }
 
 int sem_destroy(sem_t * sem)
 {
-  if (sem->__sem_waiting != NULL) {
+  if (__pthread_futex_has_waiters(&sem->__sem_lock.__status)) {
     __set_errno (EBUSY);
     return -1;
   }
@@ -213,90 +170,21 @@ int sem_unlink(const char *name)
 
 int sem_timedwait(sem_t *sem, const struct timespec *abstime)
 {
-  pthread_descr self = thread_self();
-  pthread_extricate_if extr;
-  int already_canceled = 0;
-  int spurious_wakeup_count;
-
-  __pthread_lock(&sem->__sem_lock, self);
-  if (sem->__sem_value > 0) {
-    --sem->__sem_value;
-    __pthread_unlock(&sem->__sem_lock);
+  if (sem_try_decrement(sem) == 0)
     return 0;
-  }
 
   if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000) {
     /* The standard requires that if the function would block and the
        time value is illegal, the function returns with an error.  */
-    __pthread_unlock(&sem->__sem_lock);
     __set_errno (EINVAL);
     return -1;
   }
 
-  /* Set up extrication interface */
-  extr.pu_object = sem;
-  extr.pu_extricate_func = new_sem_extricate_func;
-
-  /* Register extrication interface */
-  THREAD_SETMEM(self, p_sem_avail, 0);
-  __pthread_set_own_extricate_if(self, &extr);
-  /* Enqueue only if not already cancelled. */
-  if (!(THREAD_GETMEM(self, p_canceled)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE))
-    enqueue(&sem->__sem_waiting, self);
-  else
-    already_canceled = 1;
-  __pthread_unlock(&sem->__sem_lock);
-
-  if (already_canceled) {
-    __pthread_set_own_extricate_if(self, 0);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
+  if (sem_wait_slow(sem, abstime) == ETIMEDOUT) {
+    __set_errno (ETIMEDOUT);
+    return -1;
   }
 
-  spurious_wakeup_count = 0;
-  while (1)
-    {
-      if (timedsuspend(self, abstime) == 0) {
-	int was_on_queue;
-
-	/* __pthread_lock will queue back any spurious restarts that
-	   may happen to it. */
-
-	__pthread_lock(&sem->__sem_lock, self);
-	was_on_queue = remove_from_queue(&sem->__sem_waiting, self);
-	__pthread_unlock(&sem->__sem_lock);
-
-	if (was_on_queue) {
-	  __pthread_set_own_extricate_if(self, 0);
-	  __set_errno (ETIMEDOUT);
-	  return -1;
-	}
-
-	/* Eat the outstanding restart() from the signaller */
-	suspend(self);
-      }
-
-      if (THREAD_GETMEM(self, p_sem_avail) == 0
-	  && (THREAD_GETMEM(self, p_woken_by_cancel) == 0
-	      || THREAD_GETMEM(self, p_cancelstate) != PTHREAD_CANCEL_ENABLE))
-	{
-	  /* Count resumes that don't belong to us. */
-	  spurious_wakeup_count++;
-	  continue;
-	}
-      break;
-    }
-
- __pthread_set_own_extricate_if(self, 0);
-
-  /* Terminate only if the wakeup came from cancellation. */
-  /* Otherwise ignore cancellation because we got the semaphore. */
-
-  if (THREAD_GETMEM(self, p_woken_by_cancel)
-      && THREAD_GETMEM(self, p_cancelstate) == PTHREAD_CANCEL_ENABLE) {
-    THREAD_SETMEM(self, p_woken_by_cancel, 0);
-    __pthread_do_exit(PTHREAD_CANCELED, CURRENT_STACK_FRAME);
-  }
   /* We got the semaphore */
   return 0;
 }
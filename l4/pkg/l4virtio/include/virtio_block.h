@@ -34,8 +34,15 @@ enum L4virtio_block_operations
   L4VIRTIO_BLOCK_T_OUT    = 1,  /**<  Write to device */
   L4VIRTIO_BLOCK_T_FLUSH  = 4,  /**<  Flush data to disk */
   L4VIRTIO_BLOCK_T_GET_ID = 8,  /**<  Get device ID */
+  L4VIRTIO_BLOCK_T_DISCARD = 11, /**<  Discard a range of sectors */
+  L4VIRTIO_BLOCK_T_WRITE_ZEROES = 13, /**<  Write zeroes to a range of sectors */
 };
 
+/**
+ * Length of the device ID returned by L4VIRTIO_BLOCK_T_GET_ID.
+ */
+enum { L4VIRTIO_BLOCK_ID_BYTES = 20 };
+
 /**
  * Status of a finished block request.
  */
@@ -56,6 +63,17 @@ typedef struct l4virtio_block_header_t
   l4_uint64_t sector; /**<  First sector to read/write */
 } l4virtio_block_header_t;
 
+/**
+ * Segment of a discard or write zeroes request, the data of such a request
+ * is an array of segments.
+ */
+typedef struct l4virtio_block_discard_t
+{
+  l4_uint64_t sector;      /**<  First sector of the range */
+  l4_uint32_t num_sectors; /**<  Number of sectors in the range */
+  l4_uint32_t flags;       /**<  Bit 0: unmap (write zeroes only) */
+} l4virtio_block_discard_t;
+
 
 /**
  * Device configuration for block devices.
@@ -83,6 +101,22 @@ typedef struct l4virtio_block_config_t
     /**  Suggested optimal (i.e. maximum) I/O size in blocks */
     l4_uint32_t opt_io_size;
   } topology;
+  l4_uint8_t writeback;   /**<  Writeback mode of the cache (config_wce) */
+  l4_uint8_t unused0;
+  l4_uint16_t num_queues; /**<  Number of request queues (mq) */
+  /**  Maximum number of sectors in one discard segment */
+  l4_uint32_t max_discard_sectors;
+  /**  Maximum number of segments in one discard request */
+  l4_uint32_t max_discard_seg;
+  /**  Alignment of discard segments in sectors */
+  l4_uint32_t discard_sector_alignment;
+  /**  Maximum number of sectors in one write zeroes segment */
+  l4_uint32_t max_write_zeroes_sectors;
+  /**  Maximum number of segments in one write zeroes request */
+  l4_uint32_t max_write_zeroes_seg;
+  /**  Whether write zeroes may deallocate the sectors */
+  l4_uint8_t write_zeroes_may_unmap;
+  l4_uint8_t unused1[3];
 } l4virtio_block_config_t;
 
 /**\}*/
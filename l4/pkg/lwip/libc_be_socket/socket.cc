@@ -73,11 +73,16 @@ private:
   void *_lastdata;
   unsigned _lastoffset;
 
+  L4Re::Vfs::Be_poll_list _poll;
+
   static void event_callback(netconn *conn, netconn_evt evt, u16_t len) throw();
+  static Socket_file *from_conn(netconn *conn) throw();
 public:
   Socket_file(netconn *conn = 0) throw()
-  : _conn(conn), _rcvevent(0), _sendevent(0), _errevent(0),
-    _lastdata(NULL), _lastoffset(0)
+  : _conn(conn), _rcvevent(0),
+    // only TCP sockets have to wait for a connection before sending
+    _sendevent(conn && NETCONNTYPE_GROUP(netconn_type(conn)) != NETCONN_TCP),
+    _errevent(0), _lastdata(NULL), _lastoffset(0)
   {}
 
   ~Socket_file() throw()
@@ -110,6 +115,16 @@ public:
   ssize_t readv(const struct iovec *vec, int iovcnt) throw();
   ssize_t writev(const struct iovec *vec, int iovcnt) throw();
 
+  int poll_events(int events) throw();
+  int add_poll_entry(L4Re::Vfs::Poll_entry *e) throw()
+  {
+    _poll.add(e);
+    return 0;
+  }
+
+  void remove_poll_entry(L4Re::Vfs::Poll_entry *e) throw()
+  { _poll.remove(e); }
+
 private:
   bool match_connection_type(sockaddr const *addr)
   {
@@ -213,20 +228,63 @@ static std::mutex conn_lock;
 
 /**
  * Callback registered in the netconn layer for each socket-netconn.
- * Processes recvevent (data available) and wakes up tasks waiting for select.
+ * Processes recvevent (data available) and wakes up tasks waiting for
+ * poll, select or epoll.
  */
 void
 Socket_file::event_callback(netconn *conn, netconn_evt evt, u16_t len) throw()
 {
   (void)len;
-  using cxx::Ref_ptr;
-
-  Socket_file *sock;
 
   /* Get socket */
   if (!conn)
     return;
 
+  Socket_file *sock = from_conn(conn);
+  if (!sock)
+    return;
+
+  int revents = 0;
+  {
+    std::unique_lock<decltype(sock->_lock)> guard(sock->_lock);
+
+    /* Set event as required */
+    switch (evt) {
+      case NETCONN_EVT_RCVPLUS:
+        ++sock->_rcvevent;
+        revents = POLLIN;
+        break;
+      case NETCONN_EVT_RCVMINUS:
+        --sock->_rcvevent;
+        break;
+      case NETCONN_EVT_SENDPLUS:
+        sock->_sendevent = 1;
+        revents = POLLOUT;
+        break;
+      case NETCONN_EVT_SENDMINUS:
+        sock->_sendevent = 0;
+        break;
+      case NETCONN_EVT_ERROR:
+        sock->_errevent = 1;
+        revents = POLLERR;
+        break;
+      default:
+        LWIP_ASSERT("unknown event", 0);
+        break;
+    }
+  }
+
+  /* Wake up tasks waiting in poll, select or epoll */
+  if (revents)
+    sock->_poll.notify(revents);
+}
+
+/**
+ * Get the Socket_file of a netconn, creating it if necessary.
+ */
+Socket_file *
+Socket_file::from_conn(netconn *conn) throw()
+{
   if (!conn->priv)
     {
       std::unique_lock<std::mutex> guard(conn_lock);
@@ -237,34 +295,23 @@ Socket_file::event_callback(netconn *conn, netconn_evt evt, u16_t len) throw()
         }
     }
 
-  sock = static_cast<Socket_file*>(conn->priv);
-  if (!sock)
-    return;
+  return static_cast<Socket_file*>(conn->priv);
+}
 
+int
+Socket_file::poll_events(int events) throw()
+{
+  int r = 0;
+  std::unique_lock<decltype(_lock)> guard(_lock);
 
-  std::unique_lock<decltype(sock->_lock)> guard(sock->_lock);
+  if (_lastdata || _rcvevent > 0)
+    r |= events & (POLLIN | POLLRDNORM);
+  if (_sendevent)
+    r |= events & (POLLOUT | POLLWRNORM);
+  if (_errevent)
+    r |= POLLERR;
 
-  /* Set event as required */
-  switch (evt) {
-    case NETCONN_EVT_RCVPLUS:
-      ++sock->_rcvevent;
-      break;
-    case NETCONN_EVT_RCVMINUS:
-      --sock->_rcvevent;
-      break;
-    case NETCONN_EVT_SENDPLUS:
-      sock->_sendevent = 1;
-      break;
-    case NETCONN_EVT_SENDMINUS:
-      sock->_sendevent = 0;
-      break;
-    case NETCONN_EVT_ERROR:
-      sock->_errevent = 1;
-      break;
-    default:
-      LWIP_ASSERT("unknown event", 0);
-      break;
-  }
+  return r;
 }
 
 
@@ -302,7 +349,8 @@ Socket_file::socket(int domain, int type, int protocol) throw()
       return Ref_ptr<>::Nil;
     }
 
-  Ref_ptr<Socket_file> s(new Socket_file(conn));
+  // the event callback may have created the socket object already
+  Ref_ptr<Socket_file> s(from_conn(conn));
   if (!s)
     {
       netconn_delete(conn);
@@ -329,18 +377,12 @@ Socket_file::accept(sockaddr *addr, socklen_t *len) throw()
       return -err_to_errno(err);
     }
 
-  cxx::Ref_ptr<Socket_file> newsock;
-  if (!newconn->priv)
-    {
-      std::unique_lock<std::mutex> guard(conn_lock);
-      if (!newconn->priv)
-        {
-          Socket_file *sock = new Socket_file(newconn);
-          newconn->priv = sock;
-        }
-    }
-
-  newsock = cxx::ref_ptr(static_cast<Socket_file*>(newconn->priv));
+  cxx::Ref_ptr<Socket_file> newsock = cxx::ref_ptr(from_conn(newconn));
+  {
+    // an accepted connection is ready for sending
+    std::unique_lock<decltype(newsock->_lock)> guard(newsock->_lock);
+    newsock->_sendevent = 1;
+  }
 
 
   /* Prevent automatic window updates, we do this on our own! */
@@ -0,0 +1,437 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+#pragma once
+
+#include <l4/shmc/shmc.h>
+#include <l4/sys/compiler.h>
+
+#include <string.h>
+
+__BEGIN_DECLS
+
+/**
+ * \defgroup api_l4shm_ring L4SHM-based lock-free ring
+ *
+ * A bounded queue of fixed-size slots in an SHM chunk that works without
+ * locks for a single producer and a single consumer (SPSC) as well as for
+ * multiple producers and/or consumers (MPSC, MPMC).
+ *
+ * Every slot carries a sequence number that tells whether it is free or
+ * filled for the current lap of the ring, see l4shmc_ring_slot_t.  The
+ * producer and consumer positions, the slots and the notification flags
+ * live in separate cache lines, so producer and consumer only exchange
+ * the cache lines of the slots they hand over.
+ *
+ * Both sides work in batches: l4shmc_ring_reserve() claims up to n slots,
+ * l4shmc_ring_publish() hands them to the consumer with one notification,
+ * and l4shmc_ring_peek() and l4shmc_ring_release() do the same on the
+ * consumer side.
+ *
+ * Notifications are suppressed unless the other side sleeps: a consumer
+ * that finds the ring empty announces this in the ring before blocking in
+ * l4shmc_ring_wait_data(), and only then does the producer trigger the
+ * "<name>_rx" signal, similar to the event index of virtio.  The same holds
+ * for a producer blocking on a full ring and the "<name>_tx" signal.  A
+ * signal is bound to one thread, with multiple producers or consumers only
+ * the attached thread may block, the others have to poll.
+ *
+ * One side creates the ring with l4shmc_ring_create(), the other side
+ * attaches to it with l4shmc_ring_attach().
+ */
+
+/**
+ * \defgroup api_l4shm_ring_producer Producer
+ * \ingroup api_l4shm_ring
+ *
+ * \defgroup api_l4shm_ring_consumer Consumer
+ * \ingroup api_l4shm_ring
+ *
+ * \defgroup api_l4shm_ring_internal Internal
+ * \ingroup api_l4shm_ring
+ */
+
+enum
+{
+	L4SHMC_RING_CACHELINE = 64,
+	L4SHMC_RING_MAGIC     = 0x676e6952, ///< "Ring"
+
+	L4SHMC_RING_MP        = 1, ///< multiple producers
+	L4SHMC_RING_MC        = 2, ///< multiple consumers
+};
+
+/**
+ * Slot of a ring.
+ *
+ * For position p of the ring, the sequence number of its slot is p while
+ * the slot is free, p + 1 once it is filled and p + number of slots after
+ * it was consumed, i.e., when it is free for the next lap.
+ *
+ * \ingroup api_l4shm_ring_internal
+ */
+typedef struct
+{
+	l4_uint32_t seq;     ///< sequence number
+	l4_uint32_t len;     ///< length of the payload
+	char data[];         ///< payload
+} l4shmc_ring_slot_t;
+
+/**
+ * Head of a ring, shared by producers and consumers.
+ *
+ * \ingroup api_l4shm_ring_internal
+ */
+typedef struct
+{
+	l4_uint32_t magic;
+	l4_uint32_t flags;       ///< L4SHMC_RING_MP, L4SHMC_RING_MC
+	l4_uint32_t num_slots;   ///< number of slots, power of two
+	l4_uint32_t stride;      ///< distance of slots in bytes
+	char _pad0[L4SHMC_RING_CACHELINE - 4 * sizeof(l4_uint32_t)];
+	l4_uint32_t head;        ///< next position to fill
+	char _pad1[L4SHMC_RING_CACHELINE - sizeof(l4_uint32_t)];
+	l4_uint32_t tail;        ///< next position to consume
+	char _pad2[L4SHMC_RING_CACHELINE - sizeof(l4_uint32_t)];
+	l4_uint32_t rx_waiting;  ///< a consumer sleeps on the rx signal
+	l4_uint32_t tx_waiting;  ///< a producer sleeps on the tx signal
+	char _pad3[L4SHMC_RING_CACHELINE - 2 * sizeof(l4_uint32_t)];
+	char slots[];            ///< slots, each stride bytes
+} l4shmc_ring_head_t;
+
+/**
+ * Ring, local to one address space.
+ *
+ * \ingroup api_l4shm_ring_internal
+ */
+typedef struct
+{
+	l4shmc_ring_head_t *_head;  ///< ring head in the SHM chunk
+	l4_uint32_t      _mask;     ///< number of slots - 1
+	l4_uint32_t      _stride;   ///< distance of slots in bytes
+	l4_uint32_t      _flags;    ///< L4SHMC_RING_MP, L4SHMC_RING_MC
+	l4shmc_chunk_t   _chunk;    ///< chunk descriptor
+	l4shmc_signal_t  _rx;       ///< "rx" signal - triggered when data is produced
+	l4shmc_signal_t  _tx;       ///< "tx" signal - triggered when space is freed
+} l4shmc_ring_t;
+
+/******************
+ * Initialization *
+ ******************/
+
+/**
+ * Create a ring in a new SHMC chunk together with its signals.
+ *
+ * \pre area has been attached using l4shmc_attach().
+ *
+ * \param ring       pointer to ring struct
+ * \param area       pointer to SHMC area
+ * \param name       name of the chunk and base name of the signals,
+ *                   at most 12 characters
+ * \param num_slots  number of slots, a power of two
+ * \param slot_size  maximum payload of a slot in bytes
+ * \param flags      L4SHMC_RING_MP and/or L4SHMC_RING_MC
+ *
+ * Slots are padded to whole cache lines.
+ *
+ * \return 0 on success, error otherwise
+ */
+L4_CV int l4shmc_ring_create(l4shmc_ring_t *ring, l4shmc_area_t *area,
+                             char const *name, unsigned num_slots,
+                             unsigned slot_size, unsigned flags);
+
+/**
+ * Attach to a ring created by l4shmc_ring_create().
+ *
+ * \param ring        pointer to ring struct
+ * \param area        pointer to SHMC area
+ * \param name        name of the ring
+ * \param timeout_ms  time to wait for the ring to appear
+ *
+ * \return 0 on success, error otherwise
+ */
+L4_CV int l4shmc_ring_attach(l4shmc_ring_t *ring, l4shmc_area_t *area,
+                             char const *name, l4_umword_t timeout_ms);
+
+/**
+ * Attach a producer thread to the "tx" signal of a ring.
+ *
+ * Needed for l4shmc_ring_wait_space(), at most one thread per ring.
+ *
+ * \return 0 on success, error otherwise
+ * \ingroup api_l4shm_ring_producer
+ */
+L4_CV int l4shmc_ring_attach_producer(l4shmc_ring_t *ring,
+                                      l4_cap_idx_t thread);
+
+/**
+ * Attach a consumer thread to the "rx" signal of a ring.
+ *
+ * Needed for l4shmc_ring_wait_data(), at most one thread per ring.
+ *
+ * \return 0 on success, error otherwise
+ * \ingroup api_l4shm_ring_consumer
+ */
+L4_CV int l4shmc_ring_attach_consumer(l4shmc_ring_t *ring,
+                                      l4_cap_idx_t thread);
+
+/**
+ * Get slot of a ring position.
+ *
+ * \ingroup api_l4shm_ring_internal
+ */
+L4_INLINE l4shmc_ring_slot_t *
+l4shmc_ring_slot(l4shmc_ring_t *ring, l4_uint32_t pos)
+{
+	return (l4shmc_ring_slot_t *)(ring->_head->slots
+	                              + (pos & ring->_mask) * ring->_stride);
+}
+
+/**
+ * Get maximum payload of a slot.
+ */
+L4_INLINE unsigned
+l4shmc_ring_slot_size(l4shmc_ring_t const *ring)
+{
+	return ring->_stride - sizeof(l4shmc_ring_slot_t);
+}
+
+/**
+ * Claim a run of slots whose sequence numbers are pos + i + off.
+ *
+ * \param shared  shared position, head or tail
+ * \param multi   whether other threads claim from the same position
+ * \param off     1 to claim filled slots, 0 to claim free slots
+ * \param n       maximum number of slots
+ * \param pos_p   returns the position of the first slot
+ *
+ * \ingroup api_l4shm_ring_internal
+ */
+L4_INLINE unsigned
+l4shmc_ring_claim(l4shmc_ring_t *ring, l4_uint32_t *shared, int multi,
+                  l4_uint32_t off, unsigned n, l4_uint32_t *pos_p)
+{
+	l4_uint32_t pos = __atomic_load_n(shared, __ATOMIC_RELAXED);
+
+	if (n > ring->_mask + 1)
+		n = ring->_mask + 1;
+
+	for (;;)
+	{
+		unsigned m = 0;
+		l4_int32_t dif = 0;
+
+		for (; m < n; ++m)
+		{
+			l4_uint32_t seq = __atomic_load_n(&l4shmc_ring_slot(ring, pos + m)->seq,
+			                                  __ATOMIC_ACQUIRE);
+			dif = (l4_int32_t)(seq - (pos + m + off));
+			if (dif)
+				break;
+		}
+
+		if (!m)
+		{
+			/* someone else took the slot at pos in the meantime */
+			if (multi && dif > 0)
+			{
+				pos = __atomic_load_n(shared, __ATOMIC_RELAXED);
+				continue;
+			}
+			return 0;
+		}
+
+		if (!multi)
+		{
+			__atomic_store_n(shared, pos + m, __ATOMIC_RELAXED);
+			*pos_p = pos;
+			return m;
+		}
+
+		if (__atomic_compare_exchange_n(shared, &pos, pos + m, 1,
+		                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			*pos_p = pos;
+			return m;
+		}
+	}
+}
+
+/***************************
+ *      RING PRODUCER      *
+ ***************************/
+
+/**
+ * Reserve up to n free slots.
+ *
+ * \param ring   pointer to ring struct
+ * \param n      number of slots wanted
+ * \param pos_p  returns the position of the first reserved slot
+ *
+ * \return number of reserved slots, 0 if the ring is full
+ *
+ * The slots are l4shmc_ring_slot(ring, pos + i) for i < return value,
+ * fill in data and len and hand them to the consumer with
+ * l4shmc_ring_publish().
+ *
+ * \ingroup api_l4shm_ring_producer
+ */
+L4_INLINE unsigned
+l4shmc_ring_reserve(l4shmc_ring_t *ring, unsigned n, l4_uint32_t *pos_p)
+{
+	return l4shmc_ring_claim(ring, &ring->_head->head,
+	                         ring->_flags & L4SHMC_RING_MP, 0, n, pos_p);
+}
+
+/**
+ * Hand reserved slots to the consumer.
+ *
+ * Triggers the "rx" signal only if the consumer sleeps.
+ *
+ * \ingroup api_l4shm_ring_producer
+ */
+L4_INLINE void
+l4shmc_ring_publish(l4shmc_ring_t *ring, l4_uint32_t pos, unsigned n)
+{
+	l4shmc_ring_head_t *h = ring->_head;
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		__atomic_store_n(&l4shmc_ring_slot(ring, pos + i)->seq, pos + i + 1,
+		                 __ATOMIC_RELEASE);
+
+	/* pairs with the fence in l4shmc_ring_wait_data() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&h->rx_waiting, __ATOMIC_RELAXED)
+	    && __atomic_exchange_n(&h->rx_waiting, 0, __ATOMIC_RELAXED))
+		l4shmc_trigger(&ring->_rx);
+}
+
+/**
+ * Copy a packet into the ring.
+ *
+ * \return 0 on success, -L4_EAGAIN if the ring is full, -L4_EINVAL if
+ *         the packet does not fit into a slot
+ *
+ * \ingroup api_l4shm_ring_producer
+ */
+L4_INLINE int
+l4shmc_ring_put(l4shmc_ring_t *ring, void const *data, unsigned len)
+{
+	l4shmc_ring_slot_t *s;
+	l4_uint32_t pos;
+
+	if (len > l4shmc_ring_slot_size(ring))
+		return -L4_EINVAL;
+
+	if (!l4shmc_ring_reserve(ring, 1, &pos))
+		return -L4_EAGAIN;
+
+	s = l4shmc_ring_slot(ring, pos);
+	memcpy(s->data, data, len);
+	s->len = len;
+	l4shmc_ring_publish(ring, pos, 1);
+	return 0;
+}
+
+/**
+ * Wait until the ring has a free slot.
+ *
+ * \pre The calling thread is attached with l4shmc_ring_attach_producer().
+ *
+ * \return 0 if there is a free slot, error otherwise
+ *
+ * \ingroup api_l4shm_ring_producer
+ */
+L4_CV long l4shmc_ring_wait_space(l4shmc_ring_t *ring, l4_timeout_t timeout);
+
+/***************************
+ *      RING CONSUMER      *
+ ***************************/
+
+/**
+ * Take up to n filled slots.
+ *
+ * \param ring   pointer to ring struct
+ * \param n      number of slots wanted
+ * \param pos_p  returns the position of the first slot
+ *
+ * \return number of slots taken, 0 if the ring is empty
+ *
+ * The slots are l4shmc_ring_slot(ring, pos + i) for i < return value,
+ * give them back with l4shmc_ring_release() after use.
+ *
+ * \ingroup api_l4shm_ring_consumer
+ */
+L4_INLINE unsigned
+l4shmc_ring_peek(l4shmc_ring_t *ring, unsigned n, l4_uint32_t *pos_p)
+{
+	return l4shmc_ring_claim(ring, &ring->_head->tail,
+	                         ring->_flags & L4SHMC_RING_MC, 1, n, pos_p);
+}
+
+/**
+ * Give consumed slots back to the producers.
+ *
+ * Triggers the "tx" signal only if a producer sleeps.
+ *
+ * \ingroup api_l4shm_ring_consumer
+ */
+L4_INLINE void
+l4shmc_ring_release(l4shmc_ring_t *ring, l4_uint32_t pos, unsigned n)
+{
+	l4shmc_ring_head_t *h = ring->_head;
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		__atomic_store_n(&l4shmc_ring_slot(ring, pos + i)->seq,
+		                 pos + i + ring->_mask + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in l4shmc_ring_wait_space() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&h->tx_waiting, __ATOMIC_RELAXED)
+	    && __atomic_exchange_n(&h->tx_waiting, 0, __ATOMIC_RELAXED))
+		l4shmc_trigger(&ring->_tx);
+}
+
+/**
+ * Copy a packet out of the ring.
+ *
+ * \param ring  pointer to ring struct
+ * \param buf   destination buffer
+ * \param size  size of buf, longer packets are truncated
+ *
+ * \return length of the packet, -L4_EAGAIN if the ring is empty
+ *
+ * \ingroup api_l4shm_ring_consumer
+ */
+L4_INLINE int
+l4shmc_ring_get(l4shmc_ring_t *ring, void *buf, unsigned size)
+{
+	l4shmc_ring_slot_t *s;
+	l4_uint32_t pos;
+	unsigned len;
+
+	if (!l4shmc_ring_peek(ring, 1, &pos))
+		return -L4_EAGAIN;
+
+	s = l4shmc_ring_slot(ring, pos);
+	len = s->len;
+	memcpy(buf, s->data, len < size ? len : size);
+	l4shmc_ring_release(ring, pos, 1);
+	return len;
+}
+
+/**
+ * Wait until the ring has a filled slot.
+ *
+ * \pre The calling thread is attached with l4shmc_ring_attach_consumer().
+ *
+ * \return 0 if there is a filled slot, error otherwise
+ *
+ * \ingroup api_l4shm_ring_consumer
+ */
+L4_CV long l4shmc_ring_wait_data(l4shmc_ring_t *ring, l4_timeout_t timeout);
+
+__END_DECLS
@@ -0,0 +1,216 @@
+/*
+ * This file is part of TUD:OS and distributed under the terms of the
+ * GNU Lesser General Public License 2.1.
+ * Please see the COPYING-LGPL-2.1 file for details.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <l4/shmc/shmc.h>
+#include <l4/shmc/ring.h>
+#include <l4/re/env.h>
+#include <l4/sys/rcv_endpoint.h>
+#include <l4/sys/kip.h>
+#include <l4/util/util.h>
+
+static void
+l4shmc_ring_signame(char *b, char const *name, char const *suffix)
+{
+	snprintf(b, L4SHMC_SIGNAL_NAME_STRINGLEN, "%s%s", name, suffix);
+}
+
+/* The ring head starts at the first cache line of the chunk payload, the
+ * area is page aligned in all address spaces. */
+static l4shmc_ring_head_t *
+l4shmc_ring_head(l4shmc_chunk_t *chunk)
+{
+	l4_addr_t a = (l4_addr_t)l4shmc_chunk_ptr(chunk);
+	return (l4shmc_ring_head_t *)((a + L4SHMC_RING_CACHELINE - 1)
+	                              & ~(l4_addr_t)(L4SHMC_RING_CACHELINE - 1));
+}
+
+static unsigned long
+l4shmc_ring_size(unsigned num_slots, unsigned stride)
+{
+	return L4SHMC_RING_CACHELINE + sizeof(l4shmc_ring_head_t)
+	       + (unsigned long)num_slots * stride;
+}
+
+static void
+l4shmc_ring_setup(l4shmc_ring_t *ring, l4shmc_ring_head_t *head)
+{
+	ring->_head   = head;
+	ring->_mask   = head->num_slots - 1;
+	ring->_stride = head->stride;
+	ring->_flags  = head->flags;
+}
+
+L4_CV int
+l4shmc_ring_create(l4shmc_ring_t *ring, l4shmc_area_t *area,
+                   char const *name, unsigned num_slots,
+                   unsigned slot_size, unsigned flags)
+{
+	char b[L4SHMC_SIGNAL_NAME_STRINGLEN];
+	l4shmc_ring_head_t *h;
+	unsigned stride, i;
+	int err;
+
+	if (strlen(name) + 3 > L4SHMC_SIGNAL_NAME_SIZE
+	    || num_slots < 2 || (num_slots & (num_slots - 1))
+	    || (flags & ~(L4SHMC_RING_MP | L4SHMC_RING_MC)))
+		return -L4_EINVAL;
+
+	stride = (sizeof(l4shmc_ring_slot_t) + slot_size
+	          + L4SHMC_RING_CACHELINE - 1) & ~(L4SHMC_RING_CACHELINE - 1);
+	if (stride < slot_size
+	    || l4shmc_ring_size(num_slots, stride) / stride < num_slots)
+		return -L4_EINVAL;
+
+	err = l4shmc_add_chunk(area, name, l4shmc_ring_size(num_slots, stride),
+	                       &ring->_chunk);
+	if (err)
+		return err;
+
+	l4shmc_ring_signame(b, name, "_rx");
+	if ((err = l4shmc_add_signal(area, b, &ring->_rx)))
+		return err;
+
+	l4shmc_ring_signame(b, name, "_tx");
+	if ((err = l4shmc_add_signal(area, b, &ring->_tx)))
+		return err;
+
+	h = l4shmc_ring_head(&ring->_chunk);
+	memset(h, 0, sizeof(*h));
+	h->flags     = flags;
+	h->num_slots = num_slots;
+	h->stride    = stride;
+	l4shmc_ring_setup(ring, h);
+
+	for (i = 0; i < num_slots; ++i)
+		l4shmc_ring_slot(ring, i)->seq = i;
+
+	/* l4shmc_ring_attach() waits for the magic */
+	__atomic_store_n(&h->magic, L4SHMC_RING_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+L4_CV int
+l4shmc_ring_attach(l4shmc_ring_t *ring, l4shmc_area_t *area,
+                   char const *name, l4_umword_t timeout_ms)
+{
+	l4_kernel_clock_t try_until = l4_kip_clock(l4re_kip()) + timeout_ms * 1000;
+	char b[L4SHMC_SIGNAL_NAME_STRINGLEN];
+	l4shmc_ring_head_t *h;
+	int err;
+
+	if (strlen(name) + 3 > L4SHMC_SIGNAL_NAME_SIZE)
+		return -L4_EINVAL;
+
+	err = l4shmc_get_chunk_to(area, name, timeout_ms, &ring->_chunk);
+	if (err)
+		return err;
+
+	h = l4shmc_ring_head(&ring->_chunk);
+	while (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != L4SHMC_RING_MAGIC)
+	{
+		if (l4_kip_clock(l4re_kip()) >= try_until)
+			return -L4_ENOENT;
+		l4_sleep(1);
+	}
+
+	/* do not trust the other side with the geometry */
+	if (h->num_slots < 2 || (h->num_slots & (h->num_slots - 1))
+	    || h->stride < sizeof(l4shmc_ring_slot_t)
+	    || (h->stride & (L4SHMC_RING_CACHELINE - 1))
+	    || l4shmc_ring_size(h->num_slots, h->stride)
+	       > (unsigned long)l4shmc_chunk_capacity(&ring->_chunk)
+	    || l4shmc_ring_size(h->num_slots, h->stride) / h->stride < h->num_slots)
+		return -L4_EINVAL;
+
+	l4shmc_ring_signame(b, name, "_rx");
+	if ((err = l4shmc_get_signal_to(area, b, timeout_ms, &ring->_rx)))
+		return err;
+
+	l4shmc_ring_signame(b, name, "_tx");
+	if ((err = l4shmc_get_signal_to(area, b, timeout_ms, &ring->_tx)))
+		return err;
+
+	l4shmc_ring_setup(ring, h);
+	return 0;
+}
+
+static int
+l4shmc_ring_attach_signal(l4shmc_signal_t *s, l4_cap_idx_t thread)
+{
+	return l4_error(l4_rcv_ep_bind_thread(s->_sigcap, thread, (l4_umword_t)s));
+}
+
+L4_CV int
+l4shmc_ring_attach_producer(l4shmc_ring_t *ring, l4_cap_idx_t thread)
+{
+	return l4shmc_ring_attach_signal(&ring->_tx, thread);
+}
+
+L4_CV int
+l4shmc_ring_attach_consumer(l4shmc_ring_t *ring, l4_cap_idx_t thread)
+{
+	return l4shmc_ring_attach_signal(&ring->_rx, thread);
+}
+
+/* Whether the slot at the shared position has the sequence number pos + off. */
+static int
+l4shmc_ring_ready(l4shmc_ring_t *ring, l4_uint32_t *shared, l4_uint32_t off)
+{
+	l4_uint32_t pos = __atomic_load_n(shared, __ATOMIC_RELAXED);
+	return __atomic_load_n(&l4shmc_ring_slot(ring, pos)->seq, __ATOMIC_ACQUIRE)
+	       == pos + off;
+}
+
+/*
+ * Sleep on s until the slot at the shared position becomes ready.  The
+ * waiting flag is set before the last check, so the other side, which
+ * checks the flag after updating a slot, either sees it or we see the
+ * slot.  A stale trigger only causes another round.
+ */
+static long
+l4shmc_ring_wait(l4shmc_ring_t *ring, l4_uint32_t *shared, l4_uint32_t off,
+                 l4_uint32_t *waiting, l4shmc_signal_t *s, l4_timeout_t timeout)
+{
+	long r;
+
+	for (;;)
+	{
+		if (l4shmc_ring_ready(ring, shared, off))
+			return 0;
+
+		__atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (l4shmc_ring_ready(ring, shared, off))
+		{
+			__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+			return 0;
+		}
+
+		if ((r = l4shmc_wait_signal_to(s, timeout)))
+		{
+			__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+			return r;
+		}
+	}
+}
+
+L4_CV long
+l4shmc_ring_wait_space(l4shmc_ring_t *ring, l4_timeout_t timeout)
+{
+	l4shmc_ring_head_t *h = ring->_head;
+	return l4shmc_ring_wait(ring, &h->head, 0, &h->tx_waiting, &ring->_tx,
+	                        timeout);
+}
+
+L4_CV long
+l4shmc_ring_wait_data(l4shmc_ring_t *ring, l4_timeout_t timeout)
+{
+	l4shmc_ring_head_t *h = ring->_head;
+	return l4shmc_ring_wait(ring, &h->tail, 1, &h->rx_waiting, &ring->_rx,
+	                        timeout);
+}
@@ -82,6 +82,10 @@ public:
                 L4::Ipc::Array_ref<char const, unsigned long> const &)
   { return -L4_EPERM; }
 
+  int op_watch(L4Re::Namespace::Rights, L4::Ipc::Cap<L4Re::Dataspace> &,
+               l4_addr_t &)
+  { return -L4_ENOSYS; }
+
 private:
   enum
   {
@@ -54,6 +54,28 @@ function start_virtio_switch(ports, prio, cpus)
   return svr;
 end
 
+-- Allocate guest RAM as contiguous, pinned memory. Prefer superpages so
+-- that the guest runs on large second-stage mappings and fall back to
+-- small pages if the allocator cannot provide them. 'factory' may be a
+-- memory allocator restricted to the memory of a single NUMA node.
+function new_ram(size_mb, align, superpages, factory)
+  local fab   = factory or L4.Env.user_factory;
+  local size  = size_mb * 1024 * 1024;
+  local flags = 0x3; -- Continuous | Pinned, 0x4 adds Super_pages
+
+  if superpages then
+    local ok, ds = pcall(function()
+      return fab:create(L4.Proto.Dataspace, size, 0x7, align);
+    end);
+    if ok and ds then
+      return ds:m("rws");
+    end
+    print("vmm: no superpages for guest RAM, using small pages");
+  end
+
+  return fab:create(L4.Proto.Dataspace, size, flags, align):m("rws");
+end
+
 function start_vm(options)
   local nr      = options.id;
   local size_mb = options.mem or 16;
@@ -65,7 +87,7 @@ function start_vm(options)
   local align   = 10;
   if L4.Info.arch() == "arm" then
     align = 28;
-  elseif L4.Info.arch() == "arm64" then
+  elseif L4.Info.arch() == "arm64" or L4.Info.arch() == "amd64" then
     align = 21;
   end
   align = options.mem_align or align;
@@ -99,9 +121,17 @@ function start_vm(options)
   local caps = {
     net  = vnet;
     vbus = vbus;
-    ram  = L4.Env.user_factory:create(L4.Proto.Dataspace, size_mb * 1024 * 1024, 0x3, align):m("rws");
+    ram  = options.ram or new_ram(size_mb, align,
+                                  options.mem_superpages ~= false,
+                                  options.mem_factory);
   };
 
+  if options.ext_caps then
+    for k, v in pairs(options.ext_caps) do
+      caps[k] = v;
+    end
+  end
+
   if options.mon ~= false then
     caps["mon"] = l.log_fab:create(L4.Proto.Log, "mon" .. nr, "g");
   end
@@ -125,4 +155,64 @@ function start_vm(options)
   return l:startv(opts, "rom/uvmm", table.unpack(cmdline));
 end
 
+local function boot_image_options(options, ram, caps, arg)
+  local opts = {};
+  for k, v in pairs(options) do
+    opts[k] = v;
+  end
+
+  opts.ram = ram;
+  opts.ext_caps = caps;
+  opts.ext_args = { arg };
+  if options.ext_args then
+    for _, v in ipairs(options.ext_args) do
+      opts.ext_args[#opts.ext_args + 1] = v;
+    end
+  end
+
+  return opts;
+end
+
+-- Load kernel, device tree and ramdisk into guest RAM once and return
+-- what VMs started with start_vm_from_boot_image() need: the loaded RAM
+-- and the boot state. The loading VM exits right before the guest would
+-- start.
+-- This is not a snapshot of a running VM. No vCPU or device state is
+-- kept, every VM boots the guest from its entry point; only the image
+-- loading is skipped and the RAM pages the guest does not write are
+-- shared. The RAM is non-contiguous because moe only shares pages
+-- copy-on-write between such dataspaces. Therefore 'ram_base' must be set
+-- on architectures that map RAM at its host-physical address by default.
+function prepare_boot_image(options)
+  local size_mb = options.mem or 16;
+  local img = {
+    mem   = size_mb;
+    ram   = L4.Env.user_factory:create(L4.Proto.Dataspace,
+                                       size_mb * 1024 * 1024):m("rws");
+    state = L4.Env.user_factory:create(L4.Proto.Dataspace, 4096):m("rw");
+  };
+
+  local vm = start_vm(boot_image_options(options, img.ram,
+                                         { boot_state = img.state },
+                                         "--prepare-boot-image"));
+  if vm:wait() ~= 0 then
+    error("uvmm: could not prepare the boot image");
+  end
+
+  return img;
+end
+
+-- Boot a VM from an image prepared by prepare_boot_image(). The VM must
+-- use the same kernel command line and device tree as the preparing VM.
+function start_vm_from_boot_image(img, options)
+  local ram = L4.Env.user_factory:create(L4.Proto.Dataspace,
+                                         img.mem * 1024 * 1024):m("rws");
+  local opts = boot_image_options(options, ram,
+                                  { boot_image = img.ram:m("r"),
+                                    boot_state = img.state:m("r") },
+                                  "--use-boot-image");
+  opts.mem = img.mem;
+  return start_vm(opts);
+end
+
 return _ENV
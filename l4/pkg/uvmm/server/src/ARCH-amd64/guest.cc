@@ -29,6 +29,8 @@ Guest::create_instance()
 {
   trace().printf("creating instance\n");
   guest.construct();
+  guest->exit_stats()->set_reason_names(
+    str_exit_reason, sizeof(str_exit_reason) / sizeof(str_exit_reason[0]));
   return guest;
 }
 
@@ -154,6 +156,15 @@ Guest::handle_cpuid(l4_vcpu_regs_t *regs)
   unsigned int a,b,c,d;
   auto rax = regs->ax;
 
+  if (_kvm_clock && _kvm_clock->cpuid(rax, &a, &b, &c, &d))
+    {
+      regs->ax = a;
+      regs->bx = b;
+      regs->cx = c;
+      regs->dx = d;
+      return Jump_instr;
+    }
+
   asm("cpuid"
       : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
       : "0"(rax), "2"(regs->cx));
@@ -190,9 +201,14 @@ Guest::handle_cpuid(l4_vcpu_regs_t *regs)
              | Ecx_smx_bit
 // if xsave is filtered out, CR4 bit not set, busybox userland will fail
 //             | Ecx_xsave_bit
-             | Ecx_hypervisor_bit
             );
 
+      // the hypervisor leaves are only provided for the paravirtual clock
+      if (_kvm_clock)
+        c |= Ecx_hypervisor_bit;
+      else
+        c &= ~Ecx_hypervisor_bit;
+
       d &= ~(Edx_mtrr_bit);
       break;
 
@@ -227,6 +243,16 @@ Guest::handle_cpuid(l4_vcpu_regs_t *regs)
   return Jump_instr;
 }
 
+void
+Guest::show_state_interrupts(FILE *f, Vcpu_ptr vcpu)
+{
+  fprintf(f, "vCPU %u:\n", vcpu.get_vcpu_id());
+  current_lapic(vcpu)->show_timer_stats(f);
+  if (_kvm_clock)
+    fprintf(f, "  kvmclock in use by %u vCPU(s)\n",
+            _kvm_clock->active_vcpus());
+}
+
 int
 Guest::handle_vm_call(l4_vcpu_regs_t *regs)
 {
@@ -256,6 +282,9 @@ Guest::handle_exit_vmx(Vmm::Vcpu_ptr vcpu)
               vms->vmx_read(L4VCPU_VMCS_EXIT_REASON),
               vms->vmx_read(L4VCPU_VMCS_EXIT_QUALIFICATION));
 
+  if (reason != Exit::Ept_violation)
+    process_coalesced_mmio(vcpu);
+
   enum Apic_access_exit_qualifications
   {
     Page_offset_length = 12,
@@ -338,10 +367,27 @@ Guest::handle_exit_vmx(Vmm::Vcpu_ptr vcpu)
       return vms->handle_cr_access(regs);
 
     case Exit::Exec_rdmsr:
-      return vms->handle_exec_rmsr(regs, current_lapic(vcpu));
+      {
+        l4_uint64_t value;
+        if (_kvm_clock
+            && _kvm_clock->read_msr(regs->cx, &value, vcpu.get_vcpu_id()))
+          {
+            regs->ax = (l4_uint32_t)value;
+            regs->dx = (l4_uint32_t)(value >> 32);
+            return Jump_instr;
+          }
+        return vms->handle_exec_rmsr(regs, current_lapic(vcpu));
+      }
 
     case Exit::Exec_wrmsr:
-      return vms->handle_exec_wmsr(regs, current_lapic(vcpu));
+      {
+        l4_uint64_t value = (l4_uint64_t(regs->ax) & 0xFFFFFFFF)
+                            | (l4_uint64_t(regs->dx) << 32);
+        if (_kvm_clock
+            && _kvm_clock->write_msr(regs->cx, value, vcpu.get_vcpu_id()))
+          return Jump_instr;
+        return vms->handle_exec_wmsr(regs, current_lapic(vcpu));
+      }
 
     case Exit::Virtualized_eoi:
       Dbg().printf("INFO: EOI virtualized for vector 0x%llx\n",
@@ -420,7 +466,12 @@ Guest::run_vmx(cxx::Ref_ptr<Cpu_dev> const &cpu_dev)
         {
           if (tag.has_error())
             Dbg().printf("tag has error, but used as ack\n");
+          Exit_stats::Vcpu *st = _exit_stats.vcpu(vcpu.get_vcpu_id());
+          l4_uint64_t start = st ? tick_count() : 0;
+          process_coalesced_mmio(vcpu);
           process_pending_ipc(vcpu, l4_utcb());
+          if (st)
+            st->account(Exit_stats::Reason_ipc, start, vm->ip());
         }
       else if (e)
         {
@@ -431,7 +482,17 @@ Guest::run_vmx(cxx::Ref_ptr<Cpu_dev> const &cpu_dev)
         }
       else
         {
+          Exit_stats::Vcpu *st = _exit_stats.vcpu(vcpu.get_vcpu_id());
+          l4_uint64_t start = st ? tick_count() : 0;
           int ret = handle_exit_vmx(vcpu);
+          if (st)
+            {
+              auto reason = vm->exit_reason();
+              st->account(static_cast<unsigned>(reason), start, vm->ip(),
+                          reason == Vmx_state::Exit::Ept_violation
+                          ? vm->vmx_read(L4VCPU_VMCS_GUEST_PHYSICAL_ADDRESS)
+                          : vm->vmx_read(L4VCPU_VMCS_EXIT_QUALIFICATION));
+            }
           if (ret < 0)
             {
               trace().printf("Failure in VMM %i\n", ret);
@@ -460,6 +521,8 @@ Guest::run_vmx(cxx::Ref_ptr<Cpu_dev> const &cpu_dev)
                   vcpu->r.si, vcpu->r.di, vm->ip());
 
               vm->inject_interrupt(irq);
+              if (Exit_stats::Vcpu *st = _exit_stats.vcpu(vcpu.get_vcpu_id()))
+                st->count_event(Exit_stats::Reason_irq_inject);
             }
         }
       else
@@ -17,6 +17,7 @@
 #include "cpu_dev_array.h"
 #include "generic_guest.h"
 #include "io_device.h"
+#include "kvm_clock.h"
 #include "mem_access.h"
 #include "timer.h"
 #include "vcpu_ptr.h"
@@ -40,7 +41,7 @@ public:
 
   void setup_device_tree(Vdev::Device_tree) {}
 
-  void show_state_interrupts(FILE *, Vcpu_ptr) {}
+  void show_state_interrupts(FILE *f, Vcpu_ptr vcpu);
 
   void register_io_device(cxx::Ref_ptr<Io_device> const &dev, l4_addr_t start,
                           l4_size_t sz);
@@ -53,6 +54,14 @@ public:
   L4virtio::Ptr<void> load_linux_kernel(Ram_ds *ram, char const *kernel,
                                         l4_addr_t *entry);
 
+  /**
+   * State computed by load_linux_kernel() that is not part of guest RAM.
+   *
+   * Saved with a prepared boot image, restored by the VMs using it.
+   */
+  l4_uint32_t boot_flags() const { return 0; }
+  void set_boot_flags(l4_uint32_t) {}
+
   void prepare_linux_run(Vcpu_ptr vcpu, l4_addr_t entry, Ram_ds *ram,
                          char const *kernel, char const *cmd_line,
                          l4_addr_t dt_boot_addr);
@@ -70,6 +79,9 @@ public:
   Gic::Virt_lapic *current_lapic(Vmm::Vcpu_ptr vcpu)
   { assert(_apics); return _apics->lapic(vcpu.get_vcpu_id()); }
 
+  void set_kvm_clock(cxx::Ref_ptr<Vdev::Kvm_clock> const &clock)
+  { _kvm_clock = clock; }
+
   int handle_cpuid(l4_vcpu_regs_t *regs);
   int handle_vm_call(l4_vcpu_regs_t *regs);
   int handle_io_access(unsigned port, bool is_in, Mem_access::Width op_width,
@@ -91,6 +103,7 @@ private:
   Guest_print_buffer _hypcall_print;
   Pt_walker _ptw;
   cxx::Ref_ptr<Gic::Apic_array> _apics;
+  cxx::Ref_ptr<Vdev::Kvm_clock> _kvm_clock;
 };
 
 } // namespace Vmm
@@ -0,0 +1,206 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/sys/kip.h>
+#include <l4/util/rdtsc.h>
+
+#include <time.h>
+
+#include "debug.h"
+#include "device_factory.h"
+#include "guest.h"
+#include "kvm_clock.h"
+
+namespace Vdev {
+
+/**
+ * Compute `mul` and `shift` so that ns = (ticks << shift) * mul >> 32
+ * (a negative shift shifts right) for a counter running at `base_hz`.
+ */
+static void
+time_scale(l4_uint64_t scaled_hz, l4_uint64_t base_hz,
+           l4_int8_t *shift, l4_uint32_t *mul)
+{
+  l4_int32_t s = 0;
+  l4_uint64_t tps64 = base_hz;
+  l4_uint64_t scaled64 = scaled_hz;
+
+  while (tps64 > scaled64 * 2 || (tps64 & 0xffffffff00000000ULL))
+    {
+      tps64 >>= 1;
+      --s;
+    }
+
+  l4_uint32_t tps32 = tps64;
+  while (tps32 <= scaled64 || (scaled64 & 0xffffffff00000000ULL))
+    {
+      if ((scaled64 & 0xffffffff00000000ULL) || (tps32 & 0x80000000))
+        scaled64 >>= 1;
+      else
+        tps32 <<= 1;
+      ++s;
+    }
+
+  *shift = s;
+  *mul = (scaled64 << 32) / tps32;
+}
+
+Kvm_clock::Kvm_clock(cxx::Ref_ptr<Vmm::Ram_ds> const &ram)
+: _ram(ram), _tsc_base(l4_rdtsc())
+{
+  l4_uint64_t tsc_hz = l4re_kip()->frequency_cpu * 1000ULL;
+  if (!tsc_hz)
+    L4Re::chksys(-L4_EINVAL, "kvm-clock: unknown TSC frequency");
+
+  time_scale(1000000000ULL, tsc_hz, &_tsc_shift, &_tsc_mul);
+  Dbg(Dbg::Dev, Dbg::Info, "kvmclock")
+    .printf("TSC %llu kHz, mul 0x%x, shift %d\n", tsc_hz / 1000, _tsc_mul,
+            _tsc_shift);
+}
+
+l4_uint64_t
+Kvm_clock::system_time(l4_uint64_t tsc) const
+{
+  l4_uint64_t delta = tsc - _tsc_base;
+  if (_tsc_shift < 0)
+    delta >>= -_tsc_shift;
+  else
+    delta <<= _tsc_shift;
+
+  return ((unsigned __int128)delta * _tsc_mul) >> 32;
+}
+
+bool
+Kvm_clock::cpuid(l4_umword_t leaf, unsigned *a, unsigned *b, unsigned *c,
+                 unsigned *d) const
+{
+  switch (leaf)
+    {
+    case Cpuid_signature:
+      *a = Cpuid_features;
+      *b = 0x4b4d564b; // "KVMK"
+      *c = 0x564b4d56; // "VMKV"
+      *d = 0x0000004d; // "M\0\0\0"
+      return true;
+
+    case Cpuid_features:
+      *a = Feature_clocksource2 | Feature_stable_bit;
+      *b = *c = *d = 0;
+      return true;
+    }
+
+  return false;
+}
+
+bool
+Kvm_clock::read_msr(unsigned msr, l4_uint64_t *value, unsigned vcpu) const
+{
+  switch (msr)
+    {
+    case Msr_wall_clock:
+      *value = _wall_clock_msr;
+      return true;
+    case Msr_system_time:
+      *value = _system_time_msr[vcpu];
+      return true;
+    }
+
+  return false;
+}
+
+bool
+Kvm_clock::write_msr(unsigned msr, l4_uint64_t value, unsigned vcpu)
+{
+  switch (msr)
+    {
+    case Msr_wall_clock:
+      {
+        // writing the address requests an update of the structure
+        _wall_clock_msr = value;
+        Wall_clock *wc = guest_ptr<Wall_clock>(value);
+        if (!wc)
+          return true;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        l4_uint64_t boot = now.tv_sec * 1000000000ULL + now.tv_nsec
+                           - system_time(l4_rdtsc());
+
+        wc->version = (wc->version + 1) | 1;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        wc->sec = boot / 1000000000ULL;
+        wc->nsec = boot % 1000000000ULL;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        ++wc->version;
+        return true;
+      }
+
+    case Msr_system_time:
+      {
+        // bit 0 enables the clock, the rest is the address
+        _system_time_msr[vcpu] = value;
+        if (!(value & 1))
+          return true;
+
+        Vcpu_time_info *ti = guest_ptr<Vcpu_time_info>(value & ~1ULL);
+        if (!ti)
+          {
+            _system_time_msr[vcpu] = 0;
+            return true;
+          }
+
+        // With a stable TSC the values never change, the guest computes
+        // the time relative to the creation of the clock.
+        ti->version = (ti->version + 1) | 1;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        ti->tsc_timestamp = _tsc_base;
+        ti->system_time = 0;
+        ti->tsc_to_system_mul = _tsc_mul;
+        ti->tsc_shift = _tsc_shift;
+        ti->flags = Pvclock_tsc_stable;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        ++ti->version;
+
+        Dbg(Dbg::Dev, Dbg::Info, "kvmclock")
+          .printf("vCPU %u: time info @ 0x%llx\n", vcpu, value & ~1ULL);
+        return true;
+      }
+    }
+
+  return false;
+}
+
+unsigned
+Kvm_clock::active_vcpus() const
+{
+  unsigned n = 0;
+  for (auto v : _system_time_msr)
+    if (v & 1)
+      ++n;
+
+  return n;
+}
+
+} // namespace Vdev
+
+namespace {
+
+struct F : Vdev::Factory
+{
+  cxx::Ref_ptr<Vdev::Device> create(Vdev::Device_lookup const *devs,
+                                    Vdev::Dt_node const &) override
+  {
+    auto dev = Vdev::make_device<Vdev::Kvm_clock>(devs->ram());
+    devs->vmm()->set_kvm_clock(dev);
+    return dev;
+  }
+}; // struct F
+
+static F f;
+static Vdev::Device_type t = {"kvm-clock", nullptr, &f};
+
+} // namespace
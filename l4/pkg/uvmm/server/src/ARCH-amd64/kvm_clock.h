@@ -0,0 +1,103 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/cxx/ref_ptr>
+#include <l4/sys/l4int.h>
+
+#include "cpu_dev_array.h"
+#include "device.h"
+#include "ram_ds.h"
+
+namespace Vdev {
+
+/**
+ * kvmclock-compatible paravirtual clock.
+ *
+ * The guest finds the clock through the KVM CPUID leaves and registers a
+ * per-vCPU time info structure and a wall clock structure in its RAM via
+ * MSRs.  Both are filled once, afterwards the guest computes the time from
+ * its TSC without leaving the VM.  Requires an invariant TSC that is not
+ * offset for the guest.
+ */
+class Kvm_clock : public Vdev::Device
+{
+  /// struct pvclock_vcpu_time_info
+  struct Vcpu_time_info
+  {
+    l4_uint32_t version;
+    l4_uint32_t pad0;
+    l4_uint64_t tsc_timestamp;
+    l4_uint64_t system_time;
+    l4_uint32_t tsc_to_system_mul;
+    l4_int8_t tsc_shift;
+    l4_uint8_t flags;
+    l4_uint8_t pad[2];
+  } __attribute__((packed));
+
+  /// struct pvclock_wall_clock
+  struct Wall_clock
+  {
+    l4_uint32_t version;
+    l4_uint32_t sec;
+    l4_uint32_t nsec;
+  } __attribute__((packed));
+
+public:
+  enum : unsigned
+  {
+    Cpuid_signature = 0x40000000,
+    Cpuid_features  = 0x40000001,
+
+    Msr_wall_clock  = 0x4b564d00,
+    Msr_system_time = 0x4b564d01,
+
+    Feature_clocksource2 = 1U << 3,
+    Feature_stable_bit   = 1U << 24,
+
+    Pvclock_tsc_stable = 1,
+  };
+
+  explicit Kvm_clock(cxx::Ref_ptr<Vmm::Ram_ds> const &ram);
+
+  void init_device(Device_lookup const *, Dt_node const &) override {}
+
+  /**
+   * Emulate the KVM CPUID leaves.
+   *
+   * \return True if `leaf` is a KVM leaf and the registers were set.
+   */
+  bool cpuid(l4_umword_t leaf, unsigned *a, unsigned *b, unsigned *c,
+             unsigned *d) const;
+
+  bool read_msr(unsigned msr, l4_uint64_t *value, unsigned vcpu) const;
+  bool write_msr(unsigned msr, l4_uint64_t value, unsigned vcpu);
+
+  /// Number of vCPUs that read the time from their time info page.
+  unsigned active_vcpus() const;
+
+private:
+  template <typename T>
+  T *guest_ptr(l4_uint64_t addr) const
+  {
+    if (addr < _ram->vm_start()
+        || addr + sizeof(T) > _ram->vm_start() + _ram->size())
+      return nullptr;
+
+    return _ram->access(L4virtio::Ptr<T>(addr));
+  }
+
+  /// Nanoseconds since the clock was created.
+  l4_uint64_t system_time(l4_uint64_t tsc) const;
+
+  cxx::Ref_ptr<Vmm::Ram_ds> _ram;
+  l4_uint64_t _tsc_base;
+  l4_uint32_t _tsc_mul;
+  l4_int8_t _tsc_shift;
+  l4_uint64_t _wall_clock_msr = 0;
+  l4_uint64_t _system_time_msr[Vmm::Cpu_dev_array::Max_cpus] = { 0 };
+};
+
+} // namespace Vdev
@@ -8,7 +8,9 @@
 
 #include <l4/re/env>
 #include <l4/re/error_helper>
+#include <l4/sys/kip.h>
 #include <l4/util/rdtsc.h>
+#include <pthread-l4.h>
 
 #include <climits>
 
@@ -25,15 +27,21 @@ using L4Re::chksys;
 
 Virt_lapic::Virt_lapic(unsigned id, l4_addr_t baseaddr)
 : _lapic_irq(chkcap(L4Re::Util::cap_alloc.alloc<L4::Irq>())),
+  _deadline_irq(chkcap(L4Re::Util::cap_alloc.alloc<L4::Irq>())),
   _lapic_memory_address(baseaddr),
   _lapic_x2_id(id),
   _lapic_version(Lapic_version),
+  _tsc_deadline(0),
   _x2apic_enabled(false)
 {
   Dbg().printf("Virt_lapic ctor\n");
 
   chksys(L4Re::Env::env()->factory()->create(_lapic_irq.get()),
          "Create APIC IRQ.");
+  chksys(L4Re::Env::env()->factory()->create(_deadline_irq.get()),
+         "Create APIC deadline IRQ.");
+
+  _deadline_thread = std::thread(&Virt_lapic::deadline_loop, this);
 }
 
 void
@@ -91,40 +99,76 @@ Virt_lapic::dt_get_interrupt(Vdev::Dt_node const &, int)
 }
 
 void
-Virt_lapic::tick()
+Virt_lapic::deadline_loop()
 {
-  enum
-  {
-    TSC_deadline = 0x40000,
-    Mask = 0x10000,
-    Periodic_deadline = 0x20000,
-    Timer_vector_mask = 0xff,
-    Int_pending_bit = 0x1 << 12,
-  };
+  char name[16];
+  snprintf(name, sizeof(name), "lapic%u timer", _lapic_x2_id);
+  l4_debugger_set_object_name(pthread_l4_cap(pthread_self()), name);
 
-  std::lock_guard<std::mutex> lock(_tmr_mutex);
+  chksys(_deadline_irq->bind_thread(Pthread::L4::cap(pthread_self()), 0),
+         "Bind APIC deadline IRQ.");
 
-  if (0)
-    {
-      static unsigned cnt = 0;
-      if ((++cnt % 100) == 0)
-        Dbg()
-          .printf("VAPIC: Tick TSC DL ? %s : %llx, now: %llx, timer reg: %x\n",
-                  (_regs.timer & TSC_deadline) ? "yes" : "no", _tsc_deadline,
-                  l4_rdtsc(), _regs.timer);
-    }
+  l4_kernel_info_t *kip = l4re_kip();
+  l4_utcb_t *utcb = l4_utcb();
 
-  if (_regs.timer & TSC_deadline)
+  for (;;)
     {
-      if (_tsc_deadline > 0 && _tsc_deadline <= l4_rdtsc())
-        {
-          if (!(_regs.timer & Mask))
-              irq_trigger(_regs.timer & Timer_vector_mask);
+      l4_timeout_t to = L4_IPC_NEVER;
 
-          _tsc_deadline = 0;
+        {
+          std::lock_guard<std::mutex> lock(_tmr_mutex);
+
+          _armed_deadline = 0;
+          if ((_regs.timer & TSC_deadline) && _tsc_deadline > 0)
+            {
+              l4_uint64_t now = l4_rdtsc();
+              if (_tsc_deadline <= now)
+                {
+                  if (!(_regs.timer & Mask))
+                    irq_trigger(_regs.timer & Timer_vector_mask);
+
+                  _tsc_deadline = 0;
+                  ++_timer_stats.expired;
+                }
+              else
+                {
+                  // round up, waking early only costs another round
+                  l4_uint64_t us = ((_tsc_deadline - now) * 1000
+                                    + kip->frequency_cpu - 1)
+                                   / kip->frequency_cpu;
+                  l4_rcv_timeout(l4_timeout_abs_u(l4_kip_clock(kip) + us + 1,
+                                                  8, utcb), &to);
+                  _armed_deadline = _tsc_deadline;
+                }
+            }
         }
+
+      l4_ipc_receive(_deadline_irq.cap(), utcb, to);
     }
-  else if (_regs.tmr_cur > 0)
+}
+
+void
+Virt_lapic::show_timer_stats(FILE *f)
+{
+  std::lock_guard<std::mutex> lock(_tmr_mutex);
+  Timer_stats const &st = _timer_stats;
+
+  fprintf(f, "  TSC deadline: %lu writes, %lu expired, %lu host timer "
+             "updates, %lu avoided\n",
+          st.deadline_writes, st.expired, st.rearms,
+          st.deadline_writes - st.rearms);
+}
+
+void
+Virt_lapic::tick()
+{
+  std::lock_guard<std::mutex> lock(_tmr_mutex);
+
+  // TSC deadline mode is served by deadline_loop()
+  if (_regs.timer & TSC_deadline)
+    return;
+
+  if (_regs.tmr_cur > 0)
     {
       if (--_regs.tmr_cur == 0)
         {
@@ -266,6 +310,14 @@ Virt_lapic::write_msr(unsigned msr, l4_uint64_t value)
       {
         std::lock_guard<std::mutex> lock(_tmr_mutex);
         _tsc_deadline = value;
+        ++_timer_stats.deadline_writes;
+
+        // only an earlier deadline needs a new host timeout
+        if (value && (!_armed_deadline || value < _armed_deadline))
+          {
+            ++_timer_stats.rearms;
+            _deadline_irq->trigger();
+          }
 
         if (0)
           Dbg()
@@ -286,7 +338,14 @@ Virt_lapic::write_msr(unsigned msr, l4_uint64_t value)
     case 0x828: _regs.esr = 0; break;
     case 0x82f: _regs.cmci = value; break;
     case 0x830: _regs.icr = value; break;
-    case 0x832: _regs.timer = value; break;
+    case 0x832:
+      {
+        std::lock_guard<std::mutex> lock(_tmr_mutex);
+        _regs.timer = value;
+        if ((value & TSC_deadline) && _tsc_deadline)
+          _deadline_irq->trigger();
+        break;
+      }
     case 0x833: _regs.therm = value; break;
     case 0x834: _regs.perf = value; break;
     case 0x835: _regs.lint[0] = value; break;
@@ -7,7 +7,9 @@
  */
 #pragma once
 
+#include <cstdio>
 #include <mutex>
+#include <thread>
 #include <tuple>
 
 #include <l4/re/dataspace>
@@ -68,6 +70,8 @@ class Virt_lapic : public Vdev::Timer, public Ic
 
    l4_addr_t apic_base() const { return _lapic_memory_address; }
 
+   void show_timer_stats(FILE *f);
+
  private:
    struct LAPIC_registers
    {
@@ -91,7 +95,29 @@ class Virt_lapic : public Vdev::Timer, public Ic
      l4_uint32_t tmr_div;
     };
 
+   /**
+    * Deliver the TSC deadline timer.
+    *
+    * Sleeps with a single host timeout until the earliest deadline the
+    * guest programmed.  Moving the deadline back only wakes the thread
+    * through _deadline_irq if the new deadline is earlier than the armed
+    * one, later deadlines are picked up when the armed one expires.
+    */
+   void deadline_loop();
+
+   /// Statistics of the TSC deadline timer.
+   struct Timer_stats
+   {
+     unsigned long deadline_writes = 0; ///< Writes to IA32_TSC_DEADLINE.
+     unsigned long rearms = 0;          ///< Writes that woke the timer thread.
+     unsigned long expired = 0;         ///< Deadlines that expired.
+   };
+
    Auto_cap<L4::Irq>::Cap _lapic_irq; /// IRQ to notify VCPU
+   Auto_cap<L4::Irq>::Cap _deadline_irq; /// IRQ to wake deadline_loop()
+   std::thread _deadline_thread;
+   l4_uint64_t _armed_deadline = 0;
+   Timer_stats _timer_stats;
    l4_addr_t _lapic_memory_address;
    unsigned _lapic_x2_id;
    unsigned _lapic_version;
@@ -108,6 +134,14 @@ class Virt_lapic : public Vdev::Timer, public Ic
      Xapic_mode_local_apic_id_shift = 24,
      Lapic_version = 0x60010, /// 10 = integrated APIC, 6 = max LVT entries - 1
    };
+
+   enum Timer_lvt : unsigned
+   {
+     TSC_deadline = 0x40000,
+     Mask = 0x10000,
+     Periodic_deadline = 0x20000,
+     Timer_vector_mask = 0xff,
+   };
 }; // class Virt_lapic
 
 #include "mmio_device.h"
@@ -138,6 +138,9 @@ Guest::handle_entry(Vcpu_ptr vcpu)
                    vcpu.get_vcpu_id(), vcpu->r.ip, vcpu->r.cause, cause,
                    s->guest_ctl_0);
 
+  if (cause < 1 || cause > 3)
+    process_coalesced_mmio(vcpu);
+
   switch (cause)
     {
     case 0:
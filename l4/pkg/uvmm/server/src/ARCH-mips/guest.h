@@ -49,6 +49,14 @@ public:
 
   L4virtio::Ptr<void> load_linux_kernel(Ram_ds *ram, char const *kernel, l4_addr_t *entry);
 
+  /**
+   * State computed by load_linux_kernel() that is not part of guest RAM.
+   *
+   * Saved with a prepared boot image, restored by the VMs using it.
+   */
+  l4_uint32_t boot_flags() const { return 0; }
+  void set_boot_flags(l4_uint32_t) {}
+
   void prepare_linux_run(Vcpu_ptr vcpu, l4_addr_t entry,
                          Ram_ds *ram, char const *kernel,
                          char const *cmd_line, l4_addr_t dt_boot_addr);
@@ -38,6 +38,14 @@ public:
   L4virtio::Ptr<void> load_linux_kernel(Ram_ds *ram, char const *kernel,
                                         l4_addr_t *entry);
 
+  /**
+   * State computed by load_linux_kernel() that is not part of guest RAM.
+   *
+   * Saved with a prepared boot image, restored by the VMs using it.
+   */
+  l4_uint32_t boot_flags() const { return guest_64bit; }
+  void set_boot_flags(l4_uint32_t flags) { guest_64bit = flags & 1; }
+
   void prepare_vcpu_startup(Vcpu_ptr vcpu, l4_addr_t entry) const;
 
   void prepare_linux_run(Vcpu_ptr vcpu, l4_addr_t entry,
@@ -26,6 +26,8 @@ __thread unsigned vmm_current_cpu_id;
 
 typedef void (*Entry)(Vmm::Vcpu_ptr vcpu);
 
+static void install_exit_accounting();
+
 namespace Vmm {
 
 Guest::Guest()
@@ -299,6 +301,9 @@ void
 Guest::run(cxx::Ref_ptr<Cpu_dev_array> cpus)
 {
   _cpus = cpus;
+  if (_exit_stats.enabled())
+    install_exit_accounting();
+
   for (auto cpu: *cpus.get())
     {
       if (!cpu)
@@ -531,6 +536,7 @@ void
 Vmm::Guest::handle_wfx(Vcpu_ptr vcpu)
 {
   vcpu->r.ip += 2 << vcpu.hsr().il();
+  process_coalesced_mmio(vcpu);
   if (vcpu.hsr().wfe_trapped()) // WFE
     return;
 
@@ -567,6 +573,7 @@ guest_wfx(Vcpu_ptr vcpu)
 void
 Vmm::Guest::handle_ppi(Vcpu_ptr vcpu)
 {
+  process_coalesced_mmio(vcpu);
   switch (vcpu.hsr().svc_imm())
     {
     case 0: // VGIC IRQ
@@ -587,6 +594,7 @@ guest_ppi(Vcpu_ptr vcpu)
 
 static void guest_irq(Vcpu_ptr vcpu)
 {
+  guest->process_coalesced_mmio(vcpu);
   guest->handle_ipc(vcpu->i.tag, vcpu->i.label, l4_utcb());
 }
 
@@ -712,3 +720,105 @@ Entry vcpu_entries[64] =
   [0x3e] = guest_unknown_fault,
   [0x3f] = guest_irq
 };
+
+static char const *const exit_names[64] =
+{
+  [0x00] = "Unknown",
+  [0x01] = "WFI/WFE",
+  [0x02] = nullptr,
+  [0x03] = "MCR/MRC CP15",
+  [0x04] = "MCRR/MRRC CP15",
+  [0x05] = "MCR/MRC CP14",
+  [0x06] = "LDC/STC CP14",
+  [0x07] = "SIMD/FP access",
+  [0x08] = "MRC CP10",
+  [0x09] = nullptr,
+  [0x0a] = nullptr,
+  [0x0b] = nullptr,
+  [0x0c] = "MRRC CP14",
+  [0x0d] = nullptr,
+  [0x0e] = "Illegal state",
+  [0x0f] = nullptr,
+  [0x10] = nullptr,
+  [0x11] = "SVC (AArch32)",
+  [0x12] = "HVC (AArch32)",
+  [0x13] = "SMC (AArch32)",
+  [0x14] = nullptr,
+  [0x15] = "SVC (AArch64)",
+  [0x16] = "HVC (AArch64)",
+  [0x17] = "SMC (AArch64)",
+  [0x18] = "MSR/MRS (AArch64)",
+  [0x19] = nullptr,
+  [0x1a] = nullptr,
+  [0x1b] = nullptr,
+  [0x1c] = nullptr,
+  [0x1d] = nullptr,
+  [0x1e] = nullptr,
+  [0x1f] = nullptr,
+  [0x20] = "Instruction abort",
+  [0x21] = nullptr,
+  [0x22] = "PC alignment",
+  [0x23] = nullptr,
+  [0x24] = "Data abort (MMIO)",
+  [0x25] = nullptr,
+  [0x26] = "SP alignment",
+  [0x27] = nullptr,
+  [0x28] = nullptr,
+  [0x29] = nullptr,
+  [0x2a] = nullptr,
+  [0x2b] = nullptr,
+  [0x2c] = nullptr,
+  [0x2d] = nullptr,
+  [0x2e] = nullptr,
+  [0x2f] = nullptr,
+  [0x30] = nullptr,
+  [0x31] = nullptr,
+  [0x32] = nullptr,
+  [0x33] = nullptr,
+  [0x34] = nullptr,
+  [0x35] = nullptr,
+  [0x36] = nullptr,
+  [0x37] = nullptr,
+  [0x38] = nullptr,
+  [0x39] = nullptr,
+  [0x3a] = nullptr,
+  [0x3b] = nullptr,
+  [0x3c] = nullptr,
+  [0x3d] = "Virtual PPI",
+  [0x3e] = nullptr,
+  [0x3f] = "IPC/host IRQ"
+};
+
+/// The original handlers while exits are accounted.
+static Entry exit_handlers[64];
+
+static void
+accounted_exit(Vcpu_ptr vcpu)
+{
+  unsigned ec = vcpu.hsr().ec();
+  Exit_stats::Vcpu *st = guest->exit_stats()->vcpu(vmm_current_cpu_id);
+  l4_uint64_t start = tick_count();
+  l4_addr_t ip = vcpu->r.ip;
+  l4_addr_t pfa = vcpu->r.pfa;
+
+  exit_handlers[ec](vcpu);
+
+  st->account(ec, start, ip, (ec == 0x20 || ec == 0x24) ? pfa : vcpu->r.err);
+}
+
+/**
+ * Route all exits through accounted_exit().
+ *
+ * The entry code dispatches through vcpu_entries directly, so without
+ * accounting the exit path stays untouched.
+ */
+static void
+install_exit_accounting()
+{
+  guest->exit_stats()->set_reason_names(exit_names, 64);
+  for (unsigned i = 0; i < 64; ++i)
+    {
+      exit_handlers[i] = vcpu_entries[i];
+      vcpu_entries[i] = accounted_exit;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/re/dataspace>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/rm>
+#include <l4/sys/l4int.h>
+
+#include "debug.h"
+#include "ram_ds.h"
+
+namespace Vmm {
+
+/**
+ * Loaded boot image shared by VMs that boot the same guest.
+ *
+ * One VM loads kernel, device tree and ramdisk into its RAM and exits
+ * right before the guest executes its first instruction. Further VMs start
+ * from a copy-on-write copy of that RAM and only need the few values that
+ * were computed while loading.
+ *
+ * This is not a snapshot of a running VM: no vCPU or device state is
+ * saved. Every VM sets up its devices and the boot vCPU from the device
+ * tree in the copied RAM and boots the guest from its entry point. What
+ * is saved is the image loading, and the RAM pages the guest does not
+ * write stay shared.
+ */
+class Boot_image
+{
+public:
+  struct State
+  {
+    enum : l4_uint32_t
+    {
+      Magic   = 0x75766d62, // "uvmb"
+      Version = 1,
+    };
+
+    l4_uint32_t magic;
+    l4_uint32_t version;
+    l4_uint64_t ram_start;
+    l4_uint64_t ram_size;
+    l4_uint64_t entry;
+    l4_uint64_t dt_addr;    ///< Guest physical, 0 if there is no device tree
+    l4_uint32_t boot_flags; ///< See Guest::boot_flags()
+  };
+
+  /**
+   * Attach the dataspace holding the boot state.
+   *
+   * \param ds       Dataspace shared between all VMs using the image.
+   * \param prepare  True for the VM that loads the image and writes the
+   *                 boot state. The others only need read access.
+   */
+  Boot_image(L4::Cap<L4Re::Dataspace> ds, bool prepare)
+  {
+    L4Re::chksys(L4Re::Env::env()->rm()->attach(
+                   &_state, sizeof(State),
+                   L4Re::Rm::Search_addr
+                   | (prepare ? 0 : L4Re::Rm::Read_only),
+                   L4::Ipc::make_cap(ds, prepare ? L4_CAP_FPAGE_RW
+                                                 : L4_CAP_FPAGE_RO)),
+                 "Attach boot state dataspace");
+  }
+
+  /**
+   * Record the boot state after loading the image.
+   */
+  void save(Ram_ds const *ram, l4_addr_t entry, l4_addr_t dt_addr,
+            l4_uint32_t boot_flags)
+  {
+    _state->ram_start = ram->vm_start();
+    _state->ram_size = ram->size();
+    _state->entry = entry;
+    _state->dt_addr = dt_addr;
+    _state->boot_flags = boot_flags;
+    _state->version = State::Version;
+    __atomic_store_n(&_state->magic, State::Magic, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Get the boot state for a VM started from the image.
+   *
+   * Fails if the image was not completely loaded or if the RAM of the VM
+   * does not match the RAM the image was loaded into.
+   */
+  State const &load(Ram_ds const *ram) const
+  {
+    if (__atomic_load_n(&_state->magic, __ATOMIC_ACQUIRE) != State::Magic
+        || _state->version != State::Version)
+      L4Re::chksys(-L4_EINVAL, "Boot image was not prepared");
+
+    if (_state->ram_start != ram->vm_start()
+        || _state->ram_size != ram->size())
+      L4Re::chksys(-L4_EINVAL, "RAM of VM differs from boot image RAM");
+
+    return *_state.get();
+  }
+
+private:
+  L4Re::Rm::Auto_region<State *> _state;
+};
+
+} // namespace
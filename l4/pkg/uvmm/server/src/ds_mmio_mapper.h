@@ -41,7 +41,20 @@ class Ds_handler : public Vmm::Mmio_device
                    vcpu.pf_write() ? L4Re::Dataspace::Map_rw : 0,
                    pfa, min, max, vm_task);
 #else
-    unsigned char ps = get_page_shift(pfa, min, max, offset, _local_start);
+    unsigned char ps;
+    if (_cow)
+      {
+        // Map single pages that are present locally. A write fault breaks
+        // the sharing of exactly one page with the backing dataspace.
+        ps = L4_PAGESHIFT;
+        void *page = (void *)l4_trunc_page(_local_start + offset);
+        if (vcpu.pf_write())
+          l4_touch_rw(page, L4_PAGESIZE);
+        else
+          l4_touch_ro(page, L4_PAGESIZE);
+      }
+    else
+      ps = get_page_shift(pfa, min, max, offset, _local_start);
 
     // TODO Need to make sure that memory is locally mapped.
     res = L4Re::chksys(vm_task->map(L4Re::This_task,
@@ -50,6 +63,7 @@ class Ds_handler : public Vmm::Mmio_device
                                              vcpu.pf_write()
                                                ? L4_FPAGE_RWX : L4_FPAGE_RX),
                                     l4_trunc_size(pfa, ps)));
+    __atomic_add_fetch(&_map_count[ps], 1, __ATOMIC_RELAXED);
 #endif
 
     if (res < 0)
@@ -75,6 +89,9 @@ class Ds_handler : public Vmm::Mmio_device
   }
 
   l4_addr_t _local_start;
+  bool _cow = false;
+  /// Number of fpages mapped into the VM, indexed by page shift.
+  unsigned long _map_count[sizeof(l4_addr_t) * 8] = { 0 };
 
 public:
   explicit Ds_handler(L4::Cap<L4Re::Dataspace> ds,
@@ -105,4 +122,68 @@ public:
   }
 
   l4_addr_t local_start() const { return _local_start; }
+
+  /**
+   * Map memory page by page and only as far as it was accessed.
+   *
+   * Required if the dataspace shares pages copy-on-write with another
+   * dataspace, so that the sharing is kept for pages the guest never
+   * writes to.
+   */
+  void set_copy_on_write(bool cow) { _cow = cow; }
+
+  /**
+   * Map the complete region into the VM using the largest possible pages.
+   *
+   * Avoids taking a page fault for every page of guest RAM and gives the
+   * kernel the chance to use large second-stage pages right from the start.
+   *
+   * \param vm_task  Capability to the guest memory.
+   * \param start    Guest-physical address of start of the region.
+   * \param end      Guest-physical address of end of the region.
+   */
+  void map_eager(L4::Cap<L4::Task> vm_task, l4_addr_t start, l4_addr_t end)
+  {
+#ifndef MAP_OTHER
+    for (l4_addr_t addr = start; addr < end;)
+      {
+        l4_addr_t offset = addr - start;
+        unsigned char ps = get_page_shift(addr, start, end, offset,
+                                          _local_start);
+        l4_addr_t page = l4_trunc_size(addr, ps);
+        L4Re::chksys(vm_task->map(L4Re::This_task,
+                                  l4_fpage(_local_start + (page - start), ps,
+                                           L4_FPAGE_RWX),
+                                  page),
+                     "Map guest RAM");
+        ++_map_count[ps];
+        addr = page + (1UL << ps);
+      }
+#else
+    (void)vm_task; (void)start; (void)end;
+#endif
+  }
+
+  /**
+   * List the number of mappings into the VM for each page size.
+   */
+  char const *map_info(char *buf, size_t size) const override
+  {
+    int pos = 0;
+    buf[0] = '\0';
+    for (unsigned ps = 0;
+         ps < sizeof(_map_count) / sizeof(_map_count[0]) && pos < (int)size;
+         ++ps)
+      {
+        if (!_map_count[ps])
+          continue;
+
+        unsigned shift = ps >= 30 ? 30 : ps >= 20 ? 20 : 10;
+        pos += snprintf(buf + pos, size - pos, "%s%lux%lu%c", pos ? " " : "",
+                        _map_count[ps], 1UL << (ps - shift),
+                        "KMG"[shift / 10 - 1]);
+      }
+
+    return buf;
+  }
 };
@@ -0,0 +1,180 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+
+#include <cstring>
+
+#include "debug.h"
+#include "exit_stats.h"
+
+namespace Vmm {
+
+enum : unsigned
+{
+  Vcpu_offset = (sizeof(Exit_stats::Header) + 63) & ~63U
+};
+
+void
+Exit_stats::enable(bool trace)
+{
+  if (_vcpus)
+    return;
+
+  auto *e = L4Re::Env::env();
+  l4_size_t size = Vcpu_offset + Cpu_dev_array::Max_cpus * sizeof(Vcpu);
+
+  // A host tool may provide the dataspace to sample the statistics.
+  L4::Cap<L4Re::Dataspace> ds = e->get_cap<L4Re::Dataspace>("exit_stats");
+  if (!ds)
+    {
+      _ds = L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>(),
+                         "exit statistics dataspace cap");
+      L4Re::chksys(e->mem_alloc()->alloc(size, _ds.get()),
+                   "Allocate exit statistics");
+      ds = _ds.get();
+    }
+  else if (ds->size() < size)
+    L4Re::chksys(-L4_EINVAL, "exit_stats dataspace too small");
+
+  L4Re::chksys(e->rm()->attach(&_hdr, size,
+                               L4Re::Rm::Search_addr | L4Re::Rm::Eager_map,
+                               L4::Ipc::make_cap_rw(ds)),
+               "Attach exit statistics");
+
+  Header *h = _hdr.get();
+  memset(h, 0, size);
+  h->version = Header::Version;
+  h->num_vcpus = Cpu_dev_array::Max_cpus;
+  h->num_reasons = Num_reasons;
+  h->hist_buckets = Hist_buckets;
+  h->trace_entries = Trace_entries;
+  h->vcpu_offset = Vcpu_offset;
+  h->vcpu_size = sizeof(Vcpu);
+  for (unsigned i = 0; i < Num_reasons; ++i)
+    name(i, h->names[i], Name_size);
+
+  Vcpu *vcpus = reinterpret_cast<Vcpu *>(reinterpret_cast<char *>(h)
+                                         + Vcpu_offset);
+  for (unsigned i = 0; i < Cpu_dev_array::Max_cpus; ++i)
+    vcpus[i].tracing = trace;
+
+  __atomic_store_n(&h->magic, Header::Magic, __ATOMIC_RELEASE);
+  _vcpus = vcpus;
+
+  Dbg(Dbg::Core, Dbg::Info, "stats")
+    .printf("Exit statistics enabled (%zu bytes%s)\n", size,
+            trace ? ", with trace" : "");
+}
+
+void
+Exit_stats::set_reason_names(char const *const *names, unsigned num)
+{
+  _names = names;
+  _num_names = num;
+
+  if (_vcpus)
+    for (unsigned i = 0; i < Num_reasons; ++i)
+      name(i, _hdr->names[i], Name_size);
+}
+
+char const *
+Exit_stats::name(unsigned reason, char *buf, size_t size) const
+{
+  if (reason < _num_names && _names[reason] && _names[reason][0])
+    snprintf(buf, size, "%s", _names[reason]);
+  else if (reason == Reason_ipc)
+    snprintf(buf, size, "IPC/host IRQ");
+  else if (reason == Reason_irq_inject)
+    snprintf(buf, size, "IRQ injection");
+  else
+    snprintf(buf, size, "reason 0x%x", reason);
+
+  return buf;
+}
+
+void
+Exit_stats::show(FILE *f) const
+{
+  if (!_vcpus)
+    {
+      fprintf(f, "Exit statistics disabled, use --exit-stats\n");
+      return;
+    }
+
+  for (unsigned c = 0; c < Cpu_dev_array::Max_cpus; ++c)
+    {
+      Vcpu const *v = &_vcpus[c];
+      bool header = false;
+
+      for (unsigned r = 0; r < Num_reasons; ++r)
+        {
+          l4_uint64_t cnt = __atomic_load_n(&v->count[r], __ATOMIC_RELAXED);
+          if (!cnt)
+            continue;
+
+          if (!header)
+            {
+              fprintf(f, "vCPU %u:\n  %-32s %12s %10s  %s\n", c, "reason",
+                      "exits", "avg ticks", "log2 histogram (first..last)");
+              header = true;
+            }
+
+          char buf[Name_size];
+          l4_uint64_t t = __atomic_load_n(&v->ticks[r], __ATOMIC_RELAXED);
+          fprintf(f, "  %-32s %12llu %10llu ", name(r, buf, sizeof(buf)),
+                  cnt, t / cnt);
+
+          unsigned first = Hist_buckets, last = 0;
+          for (unsigned b = 0; b < Hist_buckets; ++b)
+            if (v->hist[r][b])
+              {
+                if (first == Hist_buckets)
+                  first = b;
+                last = b;
+              }
+
+          if (first < Hist_buckets)
+            {
+              fprintf(f, " [2^%u]", first);
+              for (unsigned b = first; b <= last; ++b)
+                fprintf(f, " %u", v->hist[r][b]);
+            }
+          fprintf(f, "\n");
+        }
+    }
+}
+
+void
+Exit_stats::show_trace(FILE *f) const
+{
+  if (!_vcpus || !_vcpus[0].tracing)
+    {
+      fprintf(f, "Exit trace disabled, use --exit-trace\n");
+      return;
+    }
+
+  for (unsigned c = 0; c < Cpu_dev_array::Max_cpus; ++c)
+    {
+      Vcpu const *v = &_vcpus[c];
+      l4_uint64_t pos = __atomic_load_n(&v->trace_pos, __ATOMIC_ACQUIRE);
+      if (!pos)
+        continue;
+
+      fprintf(f, "vCPU %u: %llu exits traced\n", c, pos);
+      l4_uint64_t i = pos > Trace_entries ? pos - Trace_entries : 0;
+      for (; i < pos; ++i)
+        {
+          Trace_entry const *e = &v->trace[i % Trace_entries];
+          char buf[Name_size];
+          fprintf(f, "  %16llu %-32s ip=%llx info=%llx %llu ticks\n",
+                  e->timestamp, name(e->reason, buf, sizeof(buf)), e->ip,
+                  e->info, e->ticks);
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,171 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+#include <l4/re/util/cap_alloc>
+#include <l4/sys/l4int.h>
+
+#include <cstdio>
+
+#include "cpu_dev_array.h"
+#include "tick_counter.h"
+
+namespace Vmm {
+
+/**
+ * Per-vCPU accounting of VM exits.
+ *
+ * Counts the exits per exit reason, sums up the time uvmm spent handling
+ * them (in tick_count() units) and keeps a log2 histogram of the handling
+ * times. Optionally the most recent exits of each vCPU are recorded in a
+ * trace ring.
+ *
+ * All data lives in a single dataspace with the layout described by
+ * Header and Vcpu. If uvmm finds an "exit_stats" capability, that
+ * dataspace is used, so that a host tool can sample the statistics while
+ * the VM is running. Each vCPU only writes to its own area.
+ *
+ * When accounting is disabled, vcpu() returns nullptr and the exit paths
+ * only pay for that check.
+ */
+class Exit_stats
+{
+public:
+  enum : unsigned
+  {
+    /// Exit reasons reserved for the architecture (VMX reason, ARM EC).
+    Arch_reasons      = 80,
+    /// Exit to handle an IPC or host interrupt.
+    Reason_ipc        = Arch_reasons,
+    /// Interrupt injected into the guest before resuming.
+    Reason_irq_inject,
+    Num_reasons,
+
+    Hist_buckets      = 32,
+    Trace_entries     = 256,
+    Name_size         = 32,
+  };
+
+  struct Trace_entry
+  {
+    l4_uint64_t timestamp;   ///< tick_count() when the exit was handled
+    l4_uint64_t ticks;       ///< Time spent handling the exit
+    l4_uint64_t ip;          ///< Guest instruction pointer
+    l4_uint64_t info;        ///< Reason specific, e.g. the fault address
+    l4_uint32_t reason;
+    l4_uint32_t pad;
+  };
+
+  struct Vcpu
+  {
+    l4_uint64_t count[Num_reasons];
+    l4_uint64_t ticks[Num_reasons];
+    /// Bucket b counts handling times in [2^(b-1), 2^b) ticks.
+    l4_uint32_t hist[Num_reasons][Hist_buckets];
+    l4_uint32_t tracing;
+    l4_uint32_t pad;
+    /// Number of trace entries ever written, the ring wraps around.
+    l4_uint64_t trace_pos;
+    Trace_entry trace[Trace_entries];
+
+    /**
+     * Account one exit.
+     *
+     * \param reason  Exit reason, smaller than Num_reasons.
+     * \param start   tick_count() before the exit was handled.
+     * \param ip      Guest instruction pointer.
+     * \param info    Additional information for the trace.
+     */
+    void account(unsigned reason, l4_uint64_t start, l4_uint64_t ip,
+                 l4_uint64_t info = 0)
+    {
+      if (reason >= Num_reasons)
+        return;
+
+      l4_uint64_t now = tick_count();
+      l4_uint64_t t = now - start;
+      unsigned b = t ? 64 - __builtin_clzll(t) : 0;
+      if (b >= Hist_buckets)
+        b = Hist_buckets - 1;
+
+      ++count[reason];
+      ticks[reason] += t;
+      ++hist[reason][b];
+
+      if (!tracing)
+        return;
+
+      Trace_entry *e = &trace[trace_pos % Trace_entries];
+      e->timestamp = start;
+      e->ticks = t;
+      e->ip = ip;
+      e->info = info;
+      e->reason = reason;
+      __atomic_store_n(&trace_pos, trace_pos + 1, __ATOMIC_RELEASE);
+    }
+
+    /// Count an event that is not timed, e.g. an injected interrupt.
+    void count_event(unsigned reason)
+    { ++count[reason]; }
+  };
+
+  struct Header
+  {
+    enum : l4_uint32_t
+    {
+      Magic   = 0x75766d78, // "uvmx"
+      Version = 1,
+    };
+
+    l4_uint32_t magic;
+    l4_uint32_t version;
+    l4_uint32_t num_vcpus;
+    l4_uint32_t num_reasons;
+    l4_uint32_t hist_buckets;
+    l4_uint32_t trace_entries;
+    l4_uint32_t vcpu_offset;   ///< Offset of the first Vcpu area
+    l4_uint32_t vcpu_size;     ///< Size of one Vcpu area
+    char names[Num_reasons][Name_size];
+  };
+
+  /**
+   * Allocate the statistics and start accounting.
+   *
+   * \param trace  Also record the most recent exits of each vCPU.
+   */
+  void enable(bool trace);
+
+  bool enabled() const { return _vcpus; }
+
+  /// Get the statistics of a vCPU, nullptr if accounting is disabled.
+  Vcpu *vcpu(unsigned id) const
+  { return _vcpus ? &_vcpus[id] : nullptr; }
+
+  /**
+   * Set the names of the architectural exit reasons.
+   *
+   * \param names  Array with `num` names, may contain nullptr entries.
+   */
+  void set_reason_names(char const *const *names, unsigned num);
+
+  /// Print counters and average handling times per vCPU and reason.
+  void show(FILE *f) const;
+
+  /// Print the recorded trace of all vCPUs, oldest entries first.
+  void show_trace(FILE *f) const;
+
+private:
+  char const *name(unsigned reason, char *buf, size_t size) const;
+
+  L4Re::Util::Auto_cap<L4Re::Dataspace>::Cap _ds;
+  L4Re::Rm::Auto_region<Header *> _hdr;
+  Vcpu *_vcpus = nullptr;
+  char const *const *_names = nullptr;
+  unsigned _num_names = 0;
+};
+
+} // namespace
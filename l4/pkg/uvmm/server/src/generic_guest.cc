@@ -83,6 +83,33 @@ Generic_guest::add_mmio_device(Region const &region,
   _memmap[region] = dev;
 }
 
+void
+Generic_guest::show_mmio_stats(FILE *f) const
+{
+  fprintf(f, "%-21s %-24s %12s %12s %10s\n",
+          "region", "device", "exits", "coalesced", "avg ticks");
+  for (auto const &m : _memmap)
+    {
+      Vmm::Mmio_device::Stats const &st = m.second->mmio_stats;
+      l4_uint64_t exits = __atomic_load_n(&st.exits, __ATOMIC_RELAXED);
+      l4_uint64_t coalesced = __atomic_load_n(&st.coalesced, __ATOMIC_RELAXED);
+      l4_uint64_t ticks = __atomic_load_n(&st.ticks, __ATOMIC_RELAXED);
+      if (!exits && !coalesced)
+        continue;
+
+      char buf[25];
+      fprintf(f, "%08lx-%08lx %-24s %12llu %12llu %10llu\n",
+              m.first.start, m.first.end,
+              m.second->dev_info(buf, sizeof(buf)), exits, coalesced,
+              ticks / (exits + coalesced));
+    }
+
+  char buf[80];
+  for (auto const &m : _memmap)
+    if (m.second->map_info(buf, sizeof(buf)) && buf[0])
+      fprintf(f, "%08lx-%08lx mapped: %s\n", m.first.start, m.first.end, buf);
+}
+
 void
 Generic_guest::register_mmio_device(cxx::Ref_ptr<Vmm::Mmio_device> &&dev,
                                     Vdev::Dt_node const &node, size_t index)
@@ -13,13 +13,16 @@
 #include <l4/re/util/object_registry>
 #include <l4/l4virtio/l4virtio>
 
+#include "cpu_dev_array.h"
 #include "debug.h"
 #include "ds_mmio_mapper.h"
+#include "exit_stats.h"
 #include "ram_ds.h"
 #include "vm_memmap.h"
 #include "pm.h"
 #include "vbus_event.h"
 #include "consts.h"
+#include "tick_counter.h"
 
 #include <cstdio>
 
@@ -33,6 +36,12 @@ public:
 
   L4Re::Util::Object_registry *registry() { return &_registry; }
 
+  /// Capability of the task holding the guest memory.
+  L4::Cap<L4::Task> vm_task() const { return _task.get(); }
+
+  /// Per-vCPU exit accounting, see Exit_stats.
+  Exit_stats *exit_stats() { return &_exit_stats; }
+
   void set_fallback_mmio_ds(L4::Cap<L4Re::Dataspace> ds)
   { _mmio_fallback = ds; }
 
@@ -59,12 +68,39 @@ public:
 
   int handle_mmio(l4_addr_t pfa, Vcpu_ptr vcpu)
   {
-    Vm_mem::const_iterator f = _memmap.find(pfa);
+    Mmio_cache *c = &_mmio_cache[vcpu.get_vcpu_id()];
+    Vm_mem::value_type const *m = c->lookup(pfa, _memmap);
+
+    if (m)
+      {
+        Vmm::Mmio_device *dev = m->second.get();
+        l4_addr_t offset = pfa - m->first.start;
+
+        if (_coalesce_mmio && dev->coalesce_write(offset))
+          {
+            auto insn = vcpu.decode_mmio();
+            if (insn.access == Mem_access::Store)
+              {
+                if (c->ring_full())
+                  process_coalesced_mmio(vcpu);
+                c->push(dev, offset, insn.width, insn.value);
+                dev->mmio_stats.add(&dev->mmio_stats.coalesced, 1);
+                return Jump_instr;
+              }
+          }
+
+        // everything else is synchronous and sees all earlier writes
+        process_coalesced_mmio(vcpu);
+
+        l4_uint64_t start = tick_count();
+        int ret = dev->access(pfa, offset, vcpu, _task.get(),
+                              m->first.start, m->first.end);
+        dev->mmio_stats.add(&dev->mmio_stats.ticks, tick_count() - start);
+        dev->mmio_stats.add(&dev->mmio_stats.exits, 1);
+        return ret;
+      }
 
-    if (f != _memmap.end())
-      return f->second->access(pfa, pfa - f->first.start,
-                               vcpu, _task.get(),
-                               f->first.start, f->first.end);
+    process_coalesced_mmio(vcpu);
 
     if (!_mmio_fallback)
        return -L4_EFAULT;
@@ -127,6 +163,41 @@ public:
   void add_mmio_device(Region const &region,
                        cxx::Ref_ptr<Vmm::Mmio_device> &&dev);
 
+  /**
+   * Enable deferring of MMIO writes the devices allow to be deferred.
+   *
+   * See Mmio_device::coalesce_write().
+   */
+  void use_coalesced_mmio(bool coalesce)
+  { _coalesce_mmio = coalesce; }
+
+  /**
+   * Apply the deferred MMIO writes of a vCPU.
+   *
+   * Needs to be called by the vCPU itself on every exit that is not an
+   * MMIO access, before the exit is handled.
+   */
+  void process_coalesced_mmio(Vcpu_ptr vcpu)
+  {
+    Mmio_cache *c = &_mmio_cache[vcpu.get_vcpu_id()];
+    if (L4_LIKELY(!c->ring_fill))
+      return;
+
+    unsigned id = vcpu.get_vcpu_id();
+    for (unsigned i = 0; i < c->ring_fill; ++i)
+      {
+        Mmio_write const &w = c->ring[i];
+        l4_uint64_t start = tick_count();
+        w.dev->write_coalesced(w.offset, w.width, w.value, id);
+        w.dev->mmio_stats.add(&w.dev->mmio_stats.ticks, tick_count() - start);
+      }
+
+    c->ring_fill = 0;
+  }
+
+  /// Print the exit statistics of all MMIO devices.
+  void show_mmio_stats(FILE *f) const;
+
 protected:
   void process_pending_ipc(Vcpu_ptr vcpu, l4_utcb_t *utcb)
   {
@@ -149,9 +220,86 @@ protected:
   static Dbg trace()
   { return Dbg(Dbg::Core, Dbg::Trace); }
 
+  /// MMIO write deferred by use_coalesced_mmio().
+  struct Mmio_write
+  {
+    Vmm::Mmio_device *dev;
+    l4_addr_t offset;
+    l4_umword_t value;
+    char width;
+  };
+
+  /**
+   * Per-vCPU state of MMIO exit handling.
+   *
+   * Lookups first check the region hit last, then a direct-mapped table
+   * indexed by guest page, and only then search the memory map.  Entries
+   * remember the generation of the memory map they were taken from.
+   */
+  struct Mmio_cache
+  {
+    enum { Pages = 64, Ring_size = 32 };
+
+    struct Entry
+    {
+      unsigned long generation = 0;
+      l4_addr_t page = 0;
+      Vm_mem::value_type const *mem = nullptr;
+    };
+
+    Vm_mem::value_type const *lookup(l4_addr_t pfa, Vm_mem const &memmap)
+    {
+      unsigned long gen = memmap.generation();
+
+      if (last.generation == gen
+          && last.mem->first.start <= pfa && pfa <= last.mem->first.end)
+        return last.mem;
+
+      l4_addr_t page = l4_trunc_page(pfa);
+      Entry *e = &pages[(page >> L4_PAGESHIFT) % Pages];
+      if (e->generation != gen || e->page != page)
+        {
+          Vm_mem::const_iterator f = memmap.find(pfa);
+          if (f == memmap.end())
+            return nullptr;
+
+          // only cache pages that are completely covered by the region
+          if (f->first.start > page
+              || f->first.end < page + L4_PAGESIZE - 1)
+            {
+              last.generation = gen;
+              last.mem = &*f;
+              return last.mem;
+            }
+
+          e->generation = gen;
+          e->page = page;
+          e->mem = &*f;
+        }
+
+      last = *e;
+      return e->mem;
+    }
+
+    bool ring_full() const
+    { return ring_fill == Ring_size; }
+
+    void push(Vmm::Mmio_device *dev, l4_addr_t offset, char width,
+              l4_umword_t value)
+    { ring[ring_fill++] = Mmio_write{dev, offset, value, width}; }
+
+    Entry last;
+    Entry pages[Pages];
+    Mmio_write ring[Ring_size];
+    unsigned ring_fill = 0;
+  };
+
   L4Re::Util::Br_manager _bm;
   L4Re::Util::Object_registry _registry;
   Vm_mem _memmap;
+  Mmio_cache _mmio_cache[Cpu_dev_array::Max_cpus];
+  bool _coalesce_mmio = false;
+  Exit_stats _exit_stats;
   L4Re::Util::Auto_cap<L4::Task>::Cap _task;
   Pm _pm;
   Vbus_event _vbus_event;
@@ -25,9 +25,11 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include <l4/cxx/unique_ptr>
 #include <l4/re/env>
 #include <l4/sys/cache.h>
 
+#include "boot_image.h"
 #include "debug.h"
 #include "device_tree.h"
 #include "device_factory.h"
@@ -209,6 +211,11 @@ static int run(int argc, char *argv[])
 
   int use_wakeup_inhibitor = 0;
   int use_mmio_fallback = 0;
+  int use_coalesced_mmio = 0;
+  int prepare_boot_image = 0;
+  int use_boot_image = 0;
+  int use_exit_stats = 0;
+  int use_exit_trace = 0;
   char const *const options = "+k:d:p:r:c:b:vqD:";
   struct option const loptions[] =
     {
@@ -219,6 +226,11 @@ static int run(int argc, char *argv[])
       { "cmdline",  1, NULL, 'c' },
       { "rambase",  1, NULL, 'b' },
       { "mmio-fallback", 0, &use_mmio_fallback, 1 },
+      { "coalesce-mmio", 0, &use_coalesced_mmio, 1 },
+      { "prepare-boot-image", 0, &prepare_boot_image, 1 },
+      { "use-boot-image", 0, &use_boot_image, 1 },
+      { "exit-stats", 0, &use_exit_stats, 1 },
+      { "exit-trace", 0, &use_exit_trace, 1 },
       { "debug",    1, NULL, 'D' },
       { "verbose",  0, NULL, 'v' },
       { "quiet",    0, NULL, 'q' },
@@ -273,35 +285,76 @@ static int run(int argc, char *argv[])
 
   warn.printf("Hello out there.\n");
 
-  vm_instance.create_default_devices(rambase);
+  if (prepare_boot_image && use_boot_image)
+    L4Re::chksys(-L4_EINVAL,
+                 "A VM cannot prepare and use a boot image at once");
+
+  L4Re::Env const *e = L4Re::Env::env();
+  L4::Cap<L4Re::Dataspace> image_ram;
+  cxx::unique_ptr<Vmm::Boot_image> boot_image;
+  if (prepare_boot_image || use_boot_image)
+    boot_image = cxx::make_unique<Vmm::Boot_image>(
+      L4Re::chkcap(e->get_cap<L4Re::Dataspace>("boot_state"),
+                   "boot state dataspace cap", -L4_ENOENT),
+      prepare_boot_image);
+  if (use_boot_image)
+    image_ram = L4Re::chkcap(e->get_cap<L4Re::Dataspace>("boot_image"),
+                             "boot image RAM dataspace cap", -L4_ENOENT);
+
+  vm_instance.create_default_devices(rambase, image_ram);
   auto mon = create_monitor();
 
   auto *vmm = vm_instance.vmm();
   auto *ram = vm_instance.ram().get();
 
   vmm->use_wakeup_inhibitor(use_wakeup_inhibitor);
+  vmm->use_coalesced_mmio(use_coalesced_mmio);
+  if (use_exit_stats || use_exit_trace)
+    vmm->exit_stats()->enable(use_exit_trace);
   if (use_mmio_fallback)
     vmm->set_fallback_mmio_ds(vm_instance.vbus()->io_ds());
 
   Vdev::Device_tree dt(nullptr);
   L4virtio::Ptr<void> dt_addr(0);
   l4_addr_t entry;
-  info.printf("Loading kernel...\n");
-  auto next_free_addr = vmm->load_linux_kernel(ram, kernel_image, &entry);
+  L4virtio::Ptr<void> next_free_addr(0);
+  bool have_dt = device_tree != nullptr;
 
-  if (device_tree)
+  if (use_boot_image)
     {
-      info.printf("Loading device tree...\n");
-      dt_addr = next_free_addr;
-      dt = load_device_tree_at(ram, device_tree, dt_addr, dtb_padding);
-      // assume /choosen and /memory is present at this point
+      // Kernel, device tree and ramdisk are already in the copied RAM.
+      auto const &state = boot_image->load(ram);
+      info.printf("Booting from shared boot image...\n");
+      entry = state.entry;
+      vmm->set_boot_flags(state.boot_flags);
+      dt_addr = L4virtio::Ptr<void>(state.dt_addr);
+      if (state.dt_addr)
+        dt = Vdev::Device_tree(ram->access(dt_addr));
+      have_dt = state.dt_addr != 0;
+      ram_disk = nullptr;
+    }
+  else
+    {
+      info.printf("Loading kernel...\n");
+      next_free_addr = vmm->load_linux_kernel(ram, kernel_image, &entry);
 
-      if (cmd_line)
+      if (device_tree)
         {
-          auto node = dt.path_offset("/chosen");
-          node.setprop_string("bootargs", cmd_line);
+          info.printf("Loading device tree...\n");
+          dt_addr = next_free_addr;
+          dt = load_device_tree_at(ram, device_tree, dt_addr, dtb_padding);
+          // assume /choosen and /memory is present at this point
+
+          if (cmd_line)
+            {
+              auto node = dt.path_offset("/chosen");
+              node.setprop_string("bootargs", cmd_line);
+            }
         }
+    }
 
+  if (have_dt)
+    {
       ram->setup_device_tree(dt);
       vmm->setup_device_tree(dt);
 
@@ -337,7 +390,7 @@ static int run(int argc, char *argv[])
       auto rd_start = next_free_addr;
       next_free_addr = ram->load_file(ram_disk, rd_start, &rd_size);
 
-      if (device_tree && rd_size > 0)
+      if (have_dt && rd_size > 0)
         {
           auto node = dt.path_offset("/chosen");
           node.set_prop_address("linux,initrd-start", rd_start.get());
@@ -352,7 +405,7 @@ static int run(int argc, char *argv[])
                   rd_size);
     }
 
-  l4_addr_t dt_boot_addr = device_tree ? ram->boot_addr(dt_addr) : 0;
+  l4_addr_t dt_boot_addr = have_dt ? ram->boot_addr(dt_addr) : 0;
   vmm->prepare_linux_run(vm_instance.cpus()->vcpu(0), entry, ram, kernel_image,
                          cmd_line, dt_boot_addr);
 
@@ -360,9 +413,11 @@ static int run(int argc, char *argv[])
   // of the binary and the RAM disk. The VM paging code, however, expects
   // the entire RAM to be present. Touch the RAM region again, now that
   // setup has finished to remap the missing parts.
-  ram->touch_rw();
+  // RAM copied from a boot image is mapped on demand to keep pages shared.
+  if (!use_boot_image)
+    ram->touch_rw();
 
-  if (device_tree)
+  if (have_dt)
     {
       l4_addr_t ds_start =
           reinterpret_cast<l4_addr_t>(ram->access(dt_addr));
@@ -372,6 +427,14 @@ static int run(int argc, char *argv[])
                   ds_start, ds_end, dt_addr.get());
     }
 
+  if (prepare_boot_image)
+    {
+      boot_image->save(ram, entry, have_dt ? dt_addr.get() : 0,
+                       vmm->boot_flags());
+      info.printf("Boot image prepared.\n");
+      return 0;
+    }
+
   vmm->run(vm_instance.cpus());
 
   Err().printf("ERROR: we must never reach this....\n");
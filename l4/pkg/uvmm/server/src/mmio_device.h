@@ -39,6 +39,31 @@ struct Mmio_device : public virtual Vdev::Dev_ref
     return _mergable(other, start_other, start_this);
   };
 
+  /// Largest page size used for mapping memory into the VM.
+  enum : char
+  {
+    Max_page_shift = sizeof(l4_addr_t) == 8 ? 30 : L4_SUPERPAGESHIFT
+  };
+
+  /**
+   * Check whether a page of the given size containing address is inside
+   * a region
+   *
+   * \param addr     address to check
+   * \param start    start of region.
+   * \param end      end of region; do not check end of region if end is zero.
+   * \param shift    log_2 of the page size.
+   * \return true if there is a page containing the address
+   *                 inside the region
+   */
+  inline bool page_in_range(l4_addr_t addr, l4_addr_t start, l4_addr_t end,
+                            char shift)
+  {
+    auto page = l4_trunc_size(addr, shift);
+    return    (start <= page)
+           && (!end || ((page + (1UL << shift) - 1) <= end));
+  }
+
   /**
    * Check whether a superpage containing address is inside a region
    *
@@ -49,12 +74,7 @@ struct Mmio_device : public virtual Vdev::Dev_ref
    *                 inside the region
    */
   inline bool sp_in_range(l4_addr_t addr, l4_addr_t start, l4_addr_t end)
-
-  {
-    auto superpage = l4_trunc_size(addr, L4_SUPERPAGESHIFT);
-    return    (start <= superpage)
-           && (!end || ((superpage + L4_SUPERPAGESIZE - 1) <= end));
-  }
+  { return page_in_range(addr, start, end, L4_SUPERPAGESHIFT); }
 
   /**
    * Calculate log_2(pagesize) for a location in a region
@@ -65,8 +85,8 @@ struct Mmio_device : public virtual Vdev::Dev_ref
    * \param offset   Accessed address relative to the beginning of the region.
    * \param l_start  Local address of start of memory region.
    * \param l_end    Local address of end of memory region, default 0.
-   * \return largest possible pageshift (currently either L4_PAGESHIFT
-   *                 or L4_SUPERPAGESHIFT)
+   * \return largest possible pageshift, L4_PAGESHIFT if no superpage fits
+   *         and at most Max_page_shift
    */
   inline char get_page_shift(l4_addr_t addr, l4_addr_t start, l4_addr_t end,
                                  l4_addr_t offset, l4_addr_t l_start,
@@ -81,7 +101,16 @@ struct Mmio_device : public virtual Vdev::Dev_ref
     if ((start & (L4_SUPERPAGESIZE - 1)) != (l_start & (L4_SUPERPAGESIZE - 1)))
       return L4_PAGESHIFT;
 
-    return L4_SUPERPAGESHIFT;
+    // Grow the page as long as it fits into both regions. The kernel
+    // splits the fpage into the page sizes supported by the hardware.
+    char ps = L4_SUPERPAGESHIFT;
+    while (ps < Max_page_shift
+           && !((start ^ l_start) & ((1UL << (ps + 1)) - 1))
+           && page_in_range(addr, start, end, ps + 1)
+           && page_in_range(l_start + offset, l_start, l_end, ps + 1))
+      ++ps;
+
+    return ps;
   }
 
   /**
@@ -112,6 +141,57 @@ struct Mmio_device : public virtual Vdev::Dev_ref
     return buf;
   };
 
+  /**
+   * Describe the memory mapped into the VM for this region.
+   *
+   * \return nullptr if the device does not map memory into the VM.
+   */
+  virtual char const *map_info(char *, size_t) const
+  { return nullptr; }
+
+  /**
+   * Check whether writes to a register may be deferred.
+   *
+   * \param offset  Register offset relative to the device's memory region.
+   *
+   * Deferred writes are queued per vCPU and applied with write_coalesced()
+   * before the next synchronous exit of that vCPU, see
+   * Generic_guest::use_coalesced_mmio().  Only registers whose writes need
+   * no immediate reaction, like doorbells, should be deferred.
+   */
+  virtual bool coalesce_write(l4_addr_t offset) const
+  {
+    (void)offset;
+    return false;
+  }
+
+  /**
+   * Apply a deferred write, see coalesce_write().
+   *
+   * \param offset  Register offset relative to the device's memory region.
+   * \param width   Width of the access (see Vmm::Mem_access::Width).
+   * \param value   Value written.
+   * \param cpu_id  vCPU that did the write.
+   */
+  virtual void write_coalesced(l4_addr_t offset, char width,
+                               l4_umword_t value, unsigned cpu_id)
+  {
+    (void)offset; (void)width; (void)value; (void)cpu_id;
+  }
+
+  /// Exit statistics, see Generic_guest::show_mmio_stats().
+  struct Stats
+  {
+    l4_uint64_t exits = 0;     ///< Synchronously handled accesses.
+    l4_uint64_t coalesced = 0; ///< Deferred writes.
+    l4_uint64_t ticks = 0;     ///< Time spent in the device, see tick_count().
+
+    void add(l4_uint64_t *ctr, l4_uint64_t v)
+    { __atomic_add_fetch(ctr, v, __ATOMIC_RELAXED); }
+  };
+
+  Stats mmio_stats;
+
 private:
   virtual bool _mergable(cxx::Ref_ptr<Mmio_device> /* other */,
                          l4_addr_t /* start_other */,
@@ -167,6 +247,10 @@ struct Mmio_device_t : Mmio_device
     return Jump_instr;
   }
 
+  void write_coalesced(l4_addr_t offset, char width, l4_umword_t value,
+                       unsigned cpu_id)
+  { dev()->write(offset, width, value, cpu_id); }
+
 private:
   DEV *dev()
   { return static_cast<DEV *>(this); }
@@ -219,6 +303,10 @@ struct Ro_ds_mapper_t : Mmio_device
     return Jump_instr;
   }
 
+  void write_coalesced(l4_addr_t offset, char width, l4_umword_t value,
+                       unsigned cpu_id)
+  { dev()->write(offset, width, value, cpu_id); }
+
   /**
    * Emulate a read access by accessing the dataspace backing the
    * MMIO region.
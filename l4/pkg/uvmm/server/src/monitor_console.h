@@ -81,6 +81,18 @@ public:
                       _devices->vmm()->show_state_interrupts(_f, cpus->vcpu(i));
                   break;
                 }
+              case 'm':
+                fputc('\n', _f);
+                _devices->vmm()->show_mmio_stats(_f);
+                break;
+              case 'e':
+                fputc('\n', _f);
+                _devices->vmm()->exit_stats()->show(_f);
+                break;
+              case 't':
+                fputc('\n', _f);
+                _devices->vmm()->exit_stats()->show_trace(_f);
+                break;
               case '\r':
               case '\b':
                 print_prompt = false;
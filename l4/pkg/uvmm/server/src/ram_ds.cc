@@ -40,7 +40,7 @@ private:
 namespace Vmm {
 
 Ram_ds::Ram_ds(L4::Cap<L4Re::Dataspace> ram, l4_addr_t vm_base,
-               l4_addr_t boot_offset)
+               l4_addr_t boot_offset, bool eager_map)
 : _ram(ram),
   _dma(L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4Re::Dma_space>())),
   _boot_offset(boot_offset)
@@ -95,13 +95,28 @@ Ram_ds::Ram_ds(L4::Cap<L4Re::Dataspace> ram, l4_addr_t vm_base,
   info.printf("RAM: @ 0x%lx size=0x%x (%c%c)\n",
               _vm_start, (unsigned) _size, _cont ? 'c' : '-', _ident ? 'i' : '-');
 
+  if (_cont && (phys_ram & (L4_SUPERPAGESIZE - 1)))
+    Dbg(Dbg::Mmio, Dbg::Warn, "ram")
+      .printf("RAM: backing memory not superpage aligned, "
+              "guest will run on small pages\n");
+
+  // Align the local mapping like the guest-physical address so that the
+  // RAM can be mapped into the VM with the largest possible pages.
+  unsigned char const max_align
+    = sizeof(l4_addr_t) == 8 ? 30 : L4_SUPERPAGESHIFT;
+  unsigned char align = L4_SUPERPAGESHIFT;
+  while (align < max_align && (2UL << align) <= _size
+         && !(_vm_start & ((2UL << align) - 1)))
+    ++align;
+
   _local_start = 0;
   L4Re::chksys(env->rm()->attach(&_local_start, _size,
-                                 L4Re::Rm::Search_addr | L4Re::Rm::Eager_map,
-                                 L4::Ipc::make_cap_rw(ram), 0,
-                                 L4_SUPERPAGESHIFT));
+                                 L4Re::Rm::Search_addr
+                                 | (eager_map ? L4Re::Rm::Eager_map : 0),
+                                 L4::Ipc::make_cap_rw(ram), 0, align));
   _local_end = _local_start + _size;
-  info.printf("RAM: VMM mapping @ 0x%lx size=0x%x\n", _local_start, (unsigned)_size);
+  info.printf("RAM: VMM mapping @ 0x%lx size=0x%x align=%u\n", _local_start,
+              (unsigned)_size, align);
 
   assert(_vm_start != ~0UL);
 
@@ -36,9 +36,12 @@ public:
    *                    during boot. Required for architectures that use a
    *                    special virtual boot memory layout instead of
    *                    simply exposing the physical memory.
+   * \param eager_map   Populate the local mapping of the RAM right away.
+   *                    Must be false if the RAM shares pages copy-on-write
+   *                    with another dataspace.
    */
   explicit Ram_ds(L4::Cap<L4Re::Dataspace> ram, l4_addr_t vm_base = ~0UL,
-                  l4_addr_t boot_offset = 0);
+                  l4_addr_t boot_offset = 0, bool eager_map = true);
 
   virtual ~Ram_ds() = default;
 
@@ -0,0 +1,41 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/sys/l4int.h>
+#if defined(ARCH_amd64)
+#include <l4/util/rdtsc.h>
+#else
+#include <l4/re/env>
+#include <l4/sys/kip.h>
+#endif
+
+namespace Vmm {
+
+/**
+ * Cheap free-running counter for measuring the cost of VM exits.
+ *
+ * Counts TSC cycles on amd64 and ticks of the virtual generic timer on
+ * ARM.  Elsewhere the KIP clock is used, which only has microsecond
+ * resolution.  Values are only meaningful as differences on one CPU.
+ */
+inline l4_uint64_t tick_count()
+{
+#if defined(ARCH_amd64)
+  return l4_rdtsc();
+#elif defined(ARCH_arm64)
+  l4_uint64_t v;
+  asm volatile ("mrs %0, CNTVCT_EL0" : "=r" (v));
+  return v;
+#elif defined(ARCH_arm)
+  l4_uint32_t lo, hi;
+  asm volatile ("mrrc p15, 1, %0, %1, c14" : "=r" (lo), "=r" (hi));
+  return ((l4_uint64_t)hi << 32) | lo;
+#else
+  return l4_kip_clock(l4re_kip());
+#endif
+}
+
+} // namespace
@@ -295,6 +295,9 @@ public:
 
   Virtio::Event_connector_irq *event_connector() { return &_evcon; }
 
+  bool coalesce_write(l4_addr_t offset) const override
+  { return deferrable_write(offset); }
+
 private:
   Virtio::Event_connector_irq _evcon;
 };
@@ -189,6 +189,13 @@ private:
   }
 
 public:
+  /**
+   * Writes to QueueNotify only kick the device and may be deferred,
+   * see Vmm::Mmio_device::coalesce_write().
+   */
+  static bool deferrable_write(l4_addr_t reg)
+  { return reg == 0x50; }
+
   void set_irq_status(l4_uint32_t irq_status)
   {
     auto *vcfg = dev()->virtio_cfg();
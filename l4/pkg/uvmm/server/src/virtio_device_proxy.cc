@@ -222,6 +222,20 @@ public:
     return 0;
   }
 
+  long op_device_notification_irq(L4virtio::Device::Rights, unsigned index,
+                                  L4::Ipc::Cap<L4::Triggerable> &irq)
+  {
+    // all queues are notified through the single host IRQ
+    if (index)
+      return -L4_ERANGE;
+
+    irq = L4::Ipc::make_cap(_host_irq.obj_cap(), L4_CAP_FPAGE_RO);
+    return 0;
+  }
+
+  long op_bind(L4virtio::Device::Rights, unsigned, L4::Ipc::Snd_fpage)
+  { return -L4_ENOSYS; }
+
   long op_set_status(L4virtio::Device::Rights, unsigned)
   {
     warn.printf("Client uses IPC notification protocol. Not supported.\n");
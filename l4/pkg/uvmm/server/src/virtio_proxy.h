@@ -107,11 +107,16 @@ public:
 
   int config_queue(int num)
   {
+    int res;
     if (l4virtio_get_feature(_config->dev_features_map,
                              L4VIRTIO_FEATURE_CMD_CONFIG))
-      return _config->config_queue(num, _host_irq.get(), _guest_irq.get());
+      res = _config->config_queue(num, _host_irq.get(), _guest_irq.get());
     else
-      return _device->config_queue(num);
+      res = _device->config_queue(num);
+
+    if (res >= 0)
+      setup_queue_notify(num);
+    return res;
   }
 
   L4virtio::Device::Config_hdr *device_config() const
@@ -126,8 +131,13 @@ public:
   L4virtio::Device::Config_queue *queue_config(int num) const
   { return &_config->queues()[num]; }
 
-  void virtio_queue_notify(unsigned)
-  { _host_irq->trigger(); }
+  void virtio_queue_notify(unsigned num)
+  {
+    if (num < Max_notify_irqs && _queue_irq[num].is_valid())
+      _queue_irq[num]->trigger();
+    else
+      _host_irq->trigger();
+  }
 
   void set_status(l4_uint32_t status)
   {
@@ -163,6 +173,43 @@ public:
   l4_uint32_t irq_status() const { return _config->irq_status; }
 
 protected:
+  enum { Max_notify_irqs = 16 };
+
+  /**
+   * Notify queue `num` through its own device IRQ if the device publishes
+   * a notification index for it, e.g. one per queue pair of a multi-queue
+   * network device.  Other queues use the host IRQ.
+   */
+  void setup_queue_notify(unsigned num)
+  {
+    if (num >= Max_notify_irqs)
+      return;
+
+    L4virtio::Device::Config_queue *q = queue_config(num);
+    unsigned idx = q->device_notify_index;
+
+    _queue_irq[num] = L4::Cap<L4::Irq>();
+    if (!q->ready || !idx || idx >= Max_notify_irqs)
+      return;
+
+    if (!_notify_irq[idx].is_valid())
+      {
+        auto irq = L4Re::Util::cap_alloc.alloc<L4::Irq>();
+        if (!irq.is_valid())
+          return;
+
+        if (_device->device_notification_irq(idx, irq) < 0)
+          {
+            L4Re::Util::cap_alloc.free(irq);
+            return;
+          }
+
+        _notify_irq[idx] = irq;
+      }
+
+    _queue_irq[num] = _notify_irq[idx].get();
+  }
+
   L4::Cap<L4virtio::Device> _device;
   L4Re::Rm::Auto_region<L4virtio::Device::Config_hdr *> _config;
   L4Re::Util::Auto_cap<L4::Irq>::Cap _guest_irq;
@@ -170,6 +217,10 @@ protected:
 private:
   L4Re::Util::Auto_cap<L4::Irq>::Cap _host_irq;
   L4Re::Util::Auto_cap<L4Re::Dataspace>::Cap _config_cap;
+  /// Device IRQs by notification index, index 0 is _host_irq.
+  L4Re::Util::Auto_cap<L4::Irq>::Cap _notify_irq[Max_notify_irqs];
+  /// Device IRQ of each queue, invalid for queues using _host_irq.
+  L4::Cap<L4::Irq> _queue_irq[Max_notify_irqs];
 
   unsigned _config_page_size = 0;
 };
@@ -325,6 +376,9 @@ public:
 
   Virtio::Event_connector_irq *event_connector() { return &_evcon; }
 
+  bool coalesce_write(l4_addr_t offset) const override
+  { return deferrable_write(offset); }
+
 private:
   Virtio::Event_connector_irq _evcon;
 };
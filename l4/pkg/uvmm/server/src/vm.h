@@ -38,20 +38,49 @@ public:
   cxx::Ref_ptr<Vmm::Cpu_dev_array> cpus() const override
   { return _cpus; }
 
-  void create_default_devices(l4_addr_t rambase)
+  /**
+   * Create RAM, bus and CPU container of the VM.
+   *
+   * \param rambase    Guest physical address of the RAM.
+   * \param image_ram  If valid, RAM with a prepared boot image that the
+   *                   RAM of this VM is copied from copy-on-write.
+   */
+  void create_default_devices(l4_addr_t rambase,
+                              L4::Cap<L4Re::Dataspace> image_ram
+                                = L4::Cap<L4Re::Dataspace>::Invalid)
   {
     _vmm = Vmm::Guest::create_instance();
 
     L4Re::Env const *e = L4Re::Env::env();
 
+    bool shared = image_ram.is_valid();
     auto ram = L4Re::chkcap(e->get_cap<L4Re::Dataspace>("ram"),
                             "ram dataspace cap", -L4_ENOENT);
     _ram = Vdev::make_device<Vmm::Ram_ds>(ram, rambase,
-                                          Vmm::Guest::Boot_offset);
+                                          Vmm::Guest::Boot_offset, !shared);
+    if (shared)
+      L4Re::chksys(ram->copy_in(0, image_ram, 0, _ram->size()),
+                   "Copy boot image RAM");
+
+    auto ram_handler = Vdev::make_device<Ds_handler>(_ram->ram(),
+                                                     _ram->local_start(),
+                                                     _ram->size());
     _vmm->add_mmio_device(Region::ss(_ram->vm_start(), _ram->size()),
-                          Vdev::make_device<Ds_handler>(_ram->ram(),
-                                                        _ram->local_start(),
-                                                        _ram->size()));
+                          ram_handler);
+
+    if (shared)
+      ram_handler->set_copy_on_write(true);
+    else
+      {
+        // Map all of RAM up front, so that the guest starts out with the
+        // largest second-stage pages the backing memory allows.
+        ram_handler->map_eager(_vmm->vm_task(), _ram->vm_start(),
+                               _ram->vm_start() + _ram->size() - 1);
+        char buf[80];
+        Dbg(Dbg::Mmio, Dbg::Info, "ram")
+          .printf("RAM: VM mappings: %s\n",
+                  ram_handler->map_info(buf, sizeof(buf)));
+      }
 
     auto vbus_cap = e->get_cap<L4vbus::Vbus>("vbus");
     if (!vbus_cap)
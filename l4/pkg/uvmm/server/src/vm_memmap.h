@@ -32,4 +32,46 @@ struct Region
   { return (start <= r.start) && (r.end <= end); } // [ [ ... ] ]
 };
 
-typedef std::map<Region, cxx::Ref_ptr<Vmm::Mmio_device>> Vm_mem;
+/**
+ * Map of guest-physical regions to the devices handling them.
+ *
+ * Counts modifications in a generation number, so lookup caches can tell
+ * when their entries went stale.  Entries are added with operator[] and
+ * removed with erase().
+ */
+class Vm_mem : public std::map<Region, cxx::Ref_ptr<Vmm::Mmio_device>>
+{
+  typedef std::map<Region, cxx::Ref_ptr<Vmm::Mmio_device>> Base;
+
+public:
+  mapped_type &operator [] (Region const &r)
+  {
+    ++_generation;
+    return Base::operator [] (r);
+  }
+
+  iterator erase(const_iterator first, const_iterator last)
+  {
+    ++_generation;
+    return Base::erase(first, last);
+  }
+
+  iterator erase(const_iterator pos)
+  {
+    ++_generation;
+    return Base::erase(pos);
+  }
+
+  size_type erase(Region const &r)
+  {
+    ++_generation;
+    return Base::erase(r);
+  }
+
+  /// Current generation, never 0.
+  unsigned long generation() const
+  { return _generation; }
+
+private:
+  unsigned long _generation = 1;
+};
@@ -0,0 +1,197 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/cap_alloc>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+// provided by the L4Re file backend, not declared by the libc headers
+extern "C" ssize_t preadv(int, const struct iovec *, int, off_t);
+extern "C" ssize_t pwritev(int, const struct iovec *, int, off_t);
+
+Ds_backend::Ds_backend(char const *cap_name, bool read_only)
+{
+  _ds = L4Re::chkcap(L4Re::Env::env()->get_cap<L4Re::Dataspace>(cap_name),
+                     "image dataspace");
+  _size = _ds->size();
+  _read_only = read_only || !(_ds->flags() & L4Re::Dataspace::Map_rw);
+  attach();
+}
+
+Ds_backend::Ds_backend(l4_uint64_t size)
+{
+  auto *e = L4Re::Env::env();
+
+  _ds = L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4Re::Dataspace>(),
+                     "allocate RAM disk capability");
+  L4Re::chksys(e->mem_alloc()->alloc(size, _ds), "allocate RAM disk");
+  _size = size;
+  attach();
+}
+
+void
+Ds_backend::attach()
+{
+  unsigned long flags = L4Re::Rm::Search_addr;
+  if (_read_only)
+    flags |= L4Re::Rm::Read_only;
+
+  L4Re::chksys(L4Re::Env::env()->rm()->attach(&_base, _size, flags,
+                                              L4::Ipc::make_cap(_ds,
+                                                _read_only ? L4_CAP_FPAGE_RO
+                                                           : L4_CAP_FPAGE_RW),
+                                              0, L4_SUPERPAGESHIFT),
+               "attach image dataspace");
+}
+
+int
+Ds_backend::read(l4_uint64_t offset, struct iovec const *iov, unsigned cnt)
+{
+  for (unsigned i = 0; i < cnt; offset += iov[i].iov_len, ++i)
+    memcpy(iov[i].iov_base, _base.get() + offset, iov[i].iov_len);
+
+  return 0;
+}
+
+int
+Ds_backend::write(l4_uint64_t offset, struct iovec const *iov, unsigned cnt)
+{
+  for (unsigned i = 0; i < cnt; offset += iov[i].iov_len, ++i)
+    memcpy(_base.get() + offset, iov[i].iov_base, iov[i].iov_len);
+
+  return 0;
+}
+
+int
+Ds_backend::discard(l4_uint64_t offset, l4_uint64_t len)
+{
+  // whole pages go back to the dataspace manager, the rest is cleared
+  l4_uint64_t start = l4_round_page(offset);
+  l4_uint64_t end = l4_trunc_page(offset + len);
+
+  if (start >= end)
+    return write_zeroes(offset, len);
+
+  memset(_base.get() + offset, 0, start - offset);
+  memset(_base.get() + end, 0, offset + len - end);
+  return _ds->clear(start, end - start);
+}
+
+int
+Ds_backend::write_zeroes(l4_uint64_t offset, l4_uint64_t len)
+{
+  memset(_base.get() + offset, 0, len);
+  return 0;
+}
+
+File_backend::File_backend(char const *path, bool read_only)
+{
+  _read_only = read_only;
+  _fd = open(path, read_only ? O_RDONLY : O_RDWR);
+  if (_fd < 0 && !read_only && errno == EROFS)
+    {
+      _read_only = true;
+      _fd = open(path, O_RDONLY);
+    }
+
+  if (_fd < 0)
+    L4Re::chksys(-errno, path);
+
+  struct stat st;
+  if (fstat(_fd, &st) < 0)
+    L4Re::chksys(-errno, "stat image file");
+
+  _size = st.st_size;
+}
+
+File_backend::~File_backend()
+{
+  close(_fd);
+}
+
+int
+File_backend::read(l4_uint64_t offset, struct iovec const *iov, unsigned cnt)
+{
+  while (cnt)
+    {
+      unsigned n = cnt > IOV_MAX ? IOV_MAX : cnt;
+      size_t len = 0;
+      for (unsigned i = 0; i < n; ++i)
+        len += iov[i].iov_len;
+
+      ssize_t r = preadv(_fd, iov, n, offset);
+      if (r < 0)
+        return -errno;
+      if ((size_t)r != len)
+        return -L4_EIO;
+
+      offset += len;
+      iov += n;
+      cnt -= n;
+    }
+
+  return 0;
+}
+
+int
+File_backend::write(l4_uint64_t offset, struct iovec const *iov, unsigned cnt)
+{
+  while (cnt)
+    {
+      unsigned n = cnt > IOV_MAX ? IOV_MAX : cnt;
+      size_t len = 0;
+      for (unsigned i = 0; i < n; ++i)
+        len += iov[i].iov_len;
+
+      ssize_t r = pwritev(_fd, iov, n, offset);
+      if (r < 0)
+        return -errno;
+      if ((size_t)r != len)
+        return -L4_EIO;
+
+      offset += len;
+      iov += n;
+      cnt -= n;
+    }
+
+  return 0;
+}
+
+int
+File_backend::flush()
+{
+  return fsync(_fd) < 0 ? -errno : 0;
+}
+
+int
+File_backend::write_zeroes(l4_uint64_t offset, l4_uint64_t len)
+{
+  static char const zeroes[L4_PAGESIZE] = { 0 };
+
+  while (len)
+    {
+      struct iovec iov;
+      iov.iov_base = const_cast<char *>(zeroes);
+      iov.iov_len = len > sizeof(zeroes) ? sizeof(zeroes) : len;
+
+      int r = write(offset, &iov, 1);
+      if (r < 0)
+        return r;
+
+      offset += iov.iov_len;
+      len -= iov.iov_len;
+    }
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+#pragma once
+
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+#include <l4/sys/types.h>
+
+#include <sys/uio.h>
+
+/**
+ * Storage behind the block device.
+ *
+ * All functions may be called concurrently from the worker threads, with
+ * the data described by a list of local buffers.  Offsets and lengths are
+ * in bytes and checked against size() by the caller.
+ */
+class Backend
+{
+public:
+  virtual ~Backend() = default;
+
+  /// Size of the image in bytes.
+  l4_uint64_t size() const { return _size; }
+  bool read_only() const { return _read_only; }
+
+  /// Whether discard() releases the storage of the range.
+  virtual bool can_discard() const { return false; }
+
+  virtual int read(l4_uint64_t offset, struct iovec const *iov,
+                   unsigned cnt) = 0;
+  virtual int write(l4_uint64_t offset, struct iovec const *iov,
+                    unsigned cnt) = 0;
+  virtual int flush() { return 0; }
+  virtual int discard(l4_uint64_t offset, l4_uint64_t len) = 0;
+  virtual int write_zeroes(l4_uint64_t offset, l4_uint64_t len) = 0;
+
+protected:
+  l4_uint64_t _size = 0;
+  bool _read_only = false;
+};
+
+/**
+ * Image in a dataspace, either one passed in by capability or a RAM disk
+ * allocated by the server.
+ */
+class Ds_backend : public Backend
+{
+public:
+  /// Use the dataspace with the given capability name.
+  Ds_backend(char const *cap_name, bool read_only);
+  /// Allocate a RAM disk of the given size.
+  explicit Ds_backend(l4_uint64_t size);
+
+  bool can_discard() const { return !_read_only; }
+
+  int read(l4_uint64_t offset, struct iovec const *iov, unsigned cnt);
+  int write(l4_uint64_t offset, struct iovec const *iov, unsigned cnt);
+  int discard(l4_uint64_t offset, l4_uint64_t len);
+  int write_zeroes(l4_uint64_t offset, l4_uint64_t len);
+
+private:
+  void attach();
+
+  L4::Cap<L4Re::Dataspace> _ds;
+  L4Re::Rm::Auto_region<char *> _base;
+};
+
+/**
+ * Image in a file of the L4Re VFS, accessed with preadv()/pwritev().
+ */
+class File_backend : public Backend
+{
+public:
+  File_backend(char const *path, bool read_only);
+  ~File_backend();
+
+  int read(l4_uint64_t offset, struct iovec const *iov, unsigned cnt);
+  int write(l4_uint64_t offset, struct iovec const *iov, unsigned cnt);
+  int flush();
+  int discard(l4_uint64_t, l4_uint64_t) { return 0; }
+  int write_zeroes(l4_uint64_t offset, l4_uint64_t len);
+
+private:
+  int _fd;
+};
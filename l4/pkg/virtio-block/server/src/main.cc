@@ -0,0 +1,686 @@
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+
+/*
+ * Virtio block server.
+ *
+ * Exports an image in a dataspace, a RAM disk or a file as virtio block
+ * device with one or more request queues.  The server thread takes the
+ * requests from the queues, merges adjacent reads and writes into batches
+ * and hands them to a pool of worker threads, which move the data.  The
+ * workers report finished batches back to the server thread, which
+ * completes the requests and notifies the client once per batch of
+ * completions and queue.
+ */
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/br_manager>
+#include <l4/re/util/object_registry>
+#include <l4/re/util/pinned_thread>
+
+#include <l4/cxx/unique_ptr>
+
+#include <l4/l4virtio/server/virtio-block>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "backend.h"
+
+enum
+{
+  Sector_size     = 512,
+  Max_queues      = 16,
+  Max_workers     = 16,
+  Max_ds          = 16,       ///< memory regions a client may register
+  Max_merge_reqs  = 64,       ///< requests merged into one batch at most
+  Max_merge_bytes = 1 << 20,  ///< bytes merged into one batch at most
+};
+
+static struct option options[] =
+{
+    {"ds", 1, 0, 'd'},        // capability of the image dataspace
+    {"ramdisk", 1, 0, 'r'},   // size of a RAM disk in MiB
+    {"file", 1, 0, 'f'},      // path of the image file
+    {"read-only", 0, 0, 'R'}, // export the image read-only
+    {"queues", 1, 0, 'q'},    // number of request queues
+    {"workers", 1, 0, 'w'},   // number of worker threads
+    {"size", 1, 0, 's'},      // size of a request queue
+    {"stats", 1, 0, 'S'},     // print statistics every n seconds
+    {"id", 1, 0, 'i'},        // device ID string
+    {0, 0, 0, 0}
+};
+
+static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks> server;
+
+typedef L4virtio::Svr::Block_dev<L4virtio::Svr::No_custom_data> Block_dev;
+typedef Block_dev::Request Request;
+
+/**
+ * A request decoded by the server thread.
+ */
+struct Job
+{
+  explicit Job(cxx::unique_ptr<Request> &&r)
+  : req(cxx::move(r)), type(req->header().type),
+    offset(0), len(0), sz(1),
+    status(L4VIRTIO_BLOCK_S_OK), next(0)
+  {}
+
+  cxx::unique_ptr<Request> req;
+  l4_uint32_t type;
+  l4_uint64_t offset;                 ///< position on the image in bytes
+  l4_uint64_t len;                    ///< bytes of data
+  std::vector<struct iovec> iov;      ///< data buffers of reads and writes
+  std::vector<l4virtio_block_discard_t> ranges;
+  unsigned sz;                        ///< bytes written for the client
+  l4_uint8_t status;
+  Job *next;                          ///< next job of the batch
+};
+
+/**
+ * Jobs executed by one worker in one go.  A batch either contains adjacent
+ * reads or adjacent writes, or a single other request.
+ */
+struct Batch
+{
+  explicit Batch(Job *j)
+  : head(j), tail(&j->next), end(j->offset + j->len), reqs(1), next(0)
+  {}
+
+  ~Batch()
+  {
+    while (Job *j = head)
+      {
+        head = j->next;
+        delete j;
+      }
+  }
+
+  /// Append `j` if it continues the batch.
+  bool merge(Job *j)
+  {
+    if (j->type != head->type || j->offset != end
+        || (j->type != L4VIRTIO_BLOCK_T_IN && j->type != L4VIRTIO_BLOCK_T_OUT)
+        || reqs >= Max_merge_reqs
+        || end + j->len - head->offset > Max_merge_bytes)
+      return false;
+
+    *tail = j;
+    tail = &j->next;
+    end += j->len;
+    ++reqs;
+    return true;
+  }
+
+  Job *head;
+  Job **tail;
+  l4_uint64_t end;
+  unsigned reqs;
+  Batch *next;
+};
+
+/**
+ * Worker threads executing batches on the backend.
+ *
+ * Finished batches are collected in a list and the server thread is
+ * notified with `done_irq` whenever that list becomes non-empty.
+ */
+class Worker_pool
+{
+public:
+  Worker_pool(Backend *backend, unsigned workers)
+  : _backend(backend), _num_workers(workers), _head(0), _tail(&_head),
+    _done(0), _pending(0)
+  {
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_work, NULL);
+    pthread_cond_init(&_idle, NULL);
+  }
+
+  /// Start the workers, round-robin on the online CPUs.
+  void start(L4::Cap<L4::Irq> done_irq)
+  {
+    L4Re::Util::Online_cpus cpus;
+
+    _done_irq = done_irq;
+
+    if (!_num_workers)
+      _num_workers = cpus.num() < Max_workers ? cpus.num()
+                                              : unsigned(Max_workers);
+
+    for (unsigned i = 0; i < _num_workers; ++i)
+      L4Re::Util::start_pinned_thread(worker_thread, this, cpus[i],
+                                      "start block worker");
+  }
+
+  unsigned num_workers() const { return _num_workers; }
+
+  void submit(Batch *b)
+  {
+    pthread_mutex_lock(&_lock);
+    *_tail = b;
+    _tail = &b->next;
+    ++_pending;
+    pthread_cond_signal(&_work);
+    pthread_mutex_unlock(&_lock);
+  }
+
+  /// Take all finished batches.
+  Batch *take_done()
+  {
+    pthread_mutex_lock(&_lock);
+    Batch *b = _done;
+    _done = 0;
+    pthread_mutex_unlock(&_lock);
+    return b;
+  }
+
+  /// Wait until all submitted batches are finished.
+  void drain()
+  {
+    pthread_mutex_lock(&_lock);
+    while (_pending)
+      pthread_cond_wait(&_idle, &_lock);
+    pthread_mutex_unlock(&_lock);
+  }
+
+private:
+  static void *worker_thread(void *arg)
+  {
+    static_cast<Worker_pool *>(arg)->worker();
+    return 0;
+  }
+
+  void worker()
+  {
+    for (;;)
+      {
+        pthread_mutex_lock(&_lock);
+        while (!_head)
+          pthread_cond_wait(&_work, &_lock);
+
+        Batch *b = _head;
+        _head = b->next;
+        if (!_head)
+          _tail = &_head;
+        pthread_mutex_unlock(&_lock);
+
+        execute(b);
+
+        pthread_mutex_lock(&_lock);
+        bool notify = !_done;
+        b->next = _done;
+        _done = b;
+        if (!--_pending)
+          pthread_cond_broadcast(&_idle);
+        pthread_mutex_unlock(&_lock);
+
+        if (notify)
+          _done_irq->trigger();
+      }
+  }
+
+  void execute(Batch *b)
+  {
+    Job *j = b->head;
+    int r = 0;
+
+    switch (j->type)
+      {
+      case L4VIRTIO_BLOCK_T_IN:
+      case L4VIRTIO_BLOCK_T_OUT:
+        {
+          std::vector<struct iovec> merged;
+          std::vector<struct iovec> const *iov = &j->iov;
+          if (b->reqs > 1)
+            {
+              for (Job *m = j; m; m = m->next)
+                merged.insert(merged.end(), m->iov.begin(), m->iov.end());
+              iov = &merged;
+            }
+
+          if (j->type == L4VIRTIO_BLOCK_T_IN)
+            r = _backend->read(j->offset, iov->data(), iov->size());
+          else
+            r = _backend->write(j->offset, iov->data(), iov->size());
+          break;
+        }
+
+      case L4VIRTIO_BLOCK_T_FLUSH:
+        r = _backend->flush();
+        break;
+
+      case L4VIRTIO_BLOCK_T_DISCARD:
+        for (auto const &d: j->ranges)
+          if ((r = _backend->discard(d.sector * Sector_size,
+                                     (l4_uint64_t)d.num_sectors * Sector_size)) < 0)
+            break;
+        break;
+
+      case L4VIRTIO_BLOCK_T_WRITE_ZEROES:
+        for (auto const &d: j->ranges)
+          {
+            l4_uint64_t off = d.sector * Sector_size;
+            l4_uint64_t len = (l4_uint64_t)d.num_sectors * Sector_size;
+            if ((d.flags & 1) && _backend->can_discard())
+              r = _backend->discard(off, len);
+            else
+              r = _backend->write_zeroes(off, len);
+            if (r < 0)
+              break;
+          }
+        break;
+      }
+
+    if (r < 0)
+      for (Job *m = j; m; m = m->next)
+        m->status = L4VIRTIO_BLOCK_S_IOERR;
+  }
+
+  Backend *_backend;
+  unsigned _num_workers;
+  L4::Cap<L4::Irq> _done_irq;
+
+  pthread_mutex_t _lock;
+  pthread_cond_t _work;
+  pthread_cond_t _idle;
+  Batch *_head;
+  Batch **_tail;
+  Batch *_done;
+  unsigned _pending;    ///< submitted and not yet finished batches
+};
+
+class Virtio_block : public Block_dev
+{
+  struct Done_irq : public L4::Irqep_t<Done_irq>
+  {
+    explicit Done_irq(Virtio_block *d) : dev(d) {}
+    Virtio_block *dev;
+    void handle_irq()
+    { dev->complete(); }
+  };
+
+public:
+  /// Counters, only written by the server thread.
+  struct Stats
+  {
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long flushes;
+    unsigned long discards;
+    unsigned long errors;
+    unsigned long merged;    ///< requests merged into a previous one
+    unsigned long batches;
+    unsigned long long bytes;
+  };
+
+  Stats stats;
+
+  Virtio_block(Backend *backend, unsigned queue_size, unsigned num_queues,
+               unsigned workers, char const *id)
+  : Block_dev(0x44, queue_size, backend->size() / Sector_size,
+              backend->read_only(), num_queues),
+    stats(),
+    _backend(backend),
+    _pool(backend, workers),
+    _done_irq(this),
+    _open(0),
+    _id(id)
+  {
+    init_mem_info(Max_ds);
+    set_seg_max(queue_size - 2);
+    set_flush();
+    if (_backend->can_discard())
+      set_discard(0x400000, 16, L4_PAGESIZE / Sector_size);
+    if (!_backend->read_only())
+      set_write_zeroes(0x400000, 16, _backend->can_discard());
+  }
+
+  void start()
+  {
+    auto c = L4Re::chkcap(server.registry()->register_irq_obj(&_done_irq));
+    _pool.start(L4::cap_cast<L4::Irq>(c));
+  }
+
+  unsigned num_workers() const { return _pool.num_workers(); }
+
+  bool process_request(cxx::unique_ptr<Request> &&req)
+  {
+    cxx::unique_ptr<Job> j(new Job(cxx::move(req)));
+
+    j->status = decode(j.get());
+    if (j->status != L4VIRTIO_BLOCK_S_OK || j->type == L4VIRTIO_BLOCK_T_GET_ID)
+      {
+        if (j->status != L4VIRTIO_BLOCK_S_OK)
+          ++stats.errors;
+        finalize_request(cxx::move(j->req), j->sz, j->status);
+        return true;
+      }
+
+    if (_open && _open->merge(j.get()))
+      {
+        j.release();
+        ++stats.merged;
+        return true;
+      }
+
+    submit_open();
+    _open = new Batch(j.release());
+    return true;
+  }
+
+  void requests_fetched()
+  { submit_open(); }
+
+  void reset_device()
+  {
+    delete _open;
+    _open = 0;
+
+    // the workers may still access client memory
+    _pool.drain();
+    for (Batch *b = _pool.take_done(); b; )
+      {
+        Batch *n = b->next;
+        delete b;
+        b = n;
+      }
+  }
+
+  /// A new client replaces the old one, its memory is dropped.
+  bool reset_client()
+  {
+    init_mem_info(Max_ds);
+    return true;
+  }
+
+  bool queue_stopped()
+  { return false; }
+
+private:
+  void submit_open()
+  {
+    if (!_open)
+      return;
+
+    ++stats.batches;
+    _pool.submit(_open);
+    _open = 0;
+  }
+
+  /// Finish the requests of the batches done by the workers.
+  void complete()
+  {
+    l4_uint32_t notify = 0;
+
+    for (Batch *b = _pool.take_done(); b; )
+      {
+        for (Job *j = b->head; j; j = j->next)
+          {
+            account(j);
+            unsigned q = j->req->queue_index();
+            if (complete_request(cxx::move(j->req), j->sz, j->status))
+              notify |= 1U << q;
+          }
+
+        Batch *n = b->next;
+        delete b;
+        b = n;
+      }
+
+    for (; notify; notify &= notify - 1)
+      notify_client(__builtin_ctz(notify));
+  }
+
+  void account(Job const *j)
+  {
+    if (j->status != L4VIRTIO_BLOCK_S_OK)
+      {
+        ++stats.errors;
+        return;
+      }
+
+    switch (j->type)
+      {
+      case L4VIRTIO_BLOCK_T_IN:
+        ++stats.reads;
+        stats.bytes += j->len;
+        break;
+      case L4VIRTIO_BLOCK_T_OUT:
+        ++stats.writes;
+        stats.bytes += j->len;
+        break;
+      case L4VIRTIO_BLOCK_T_FLUSH:
+        ++stats.flushes;
+        break;
+      default:
+        ++stats.discards;
+        break;
+      }
+  }
+
+  bool in_range(l4_uint64_t offset, l4_uint64_t len) const
+  { return offset <= _backend->size() && len <= _backend->size() - offset; }
+
+  /**
+   * Collect the data buffers of a request and check it.
+   *
+   * \return Status of the request, requests with an error and device ID
+   *         requests are finished right away.
+   */
+  l4_uint8_t decode(Job *j)
+  {
+    Request *r = j->req.get();
+
+    switch (j->type)
+      {
+      case L4VIRTIO_BLOCK_T_OUT:
+        if (_backend->read_only())
+          return L4VIRTIO_BLOCK_S_IOERR;
+        // fall through
+      case L4VIRTIO_BLOCK_T_IN:
+        while (r->has_more())
+          {
+            Request::Data_block b = r->next_block();
+            struct iovec v;
+            v.iov_base = b.addr;
+            v.iov_len = b.len;
+            j->iov.push_back(v);
+            j->len += b.len;
+          }
+
+        // bound the sector first, the byte offset must not overflow
+        if (r->header().sector > _backend->size() / Sector_size)
+          return L4VIRTIO_BLOCK_S_IOERR;
+
+        j->offset = r->header().sector * Sector_size;
+        if (!in_range(j->offset, j->len))
+          return L4VIRTIO_BLOCK_S_IOERR;
+
+        if (j->type == L4VIRTIO_BLOCK_T_IN)
+          j->sz += j->len;
+        return L4VIRTIO_BLOCK_S_OK;
+
+      case L4VIRTIO_BLOCK_T_FLUSH:
+        return L4VIRTIO_BLOCK_S_OK;
+
+      case L4VIRTIO_BLOCK_T_GET_ID:
+        {
+          if (!r->has_more())
+            return L4VIRTIO_BLOCK_S_IOERR;
+
+          Request::Data_block b = r->next_block();
+          unsigned len = b.len < L4VIRTIO_BLOCK_ID_BYTES
+                         ? b.len : (unsigned)L4VIRTIO_BLOCK_ID_BYTES;
+          memset(b.addr, 0, len);
+          strncpy(static_cast<char *>(b.addr), _id, len);
+          j->sz += len;
+          return L4VIRTIO_BLOCK_S_OK;
+        }
+
+      case L4VIRTIO_BLOCK_T_DISCARD:
+        if (!_backend->can_discard())
+          return L4VIRTIO_BLOCK_S_UNSUPP;
+        return decode_ranges(j);
+
+      case L4VIRTIO_BLOCK_T_WRITE_ZEROES:
+        if (_backend->read_only())
+          return L4VIRTIO_BLOCK_S_UNSUPP;
+        return decode_ranges(j);
+
+      default:
+        return L4VIRTIO_BLOCK_S_UNSUPP;
+      }
+  }
+
+  /// Read the segments of a discard or write zeroes request.
+  l4_uint8_t decode_ranges(Job *j)
+  {
+    Request *r = j->req.get();
+
+    while (r->has_more())
+      {
+        Request::Data_block b = r->next_block();
+        if (b.len % sizeof(l4virtio_block_discard_t))
+          return L4VIRTIO_BLOCK_S_IOERR;
+
+        auto *d = static_cast<l4virtio_block_discard_t const *>(b.addr);
+        for (unsigned i = 0; i < b.len / sizeof(*d); ++i)
+          {
+            l4virtio_block_discard_t seg = d[i];
+            if (seg.sector > _backend->size() / Sector_size
+                || !in_range(seg.sector * Sector_size,
+                             (l4_uint64_t)seg.num_sectors * Sector_size))
+              return L4VIRTIO_BLOCK_S_IOERR;
+
+            j->ranges.push_back(seg);
+          }
+      }
+
+    return L4VIRTIO_BLOCK_S_OK;
+  }
+
+  Backend *_backend;
+  Worker_pool _pool;
+  Done_irq _done_irq;
+  /// Batch still open for merging, submitted in requests_fetched().
+  Batch *_open;
+  char const *_id;
+};
+
+static unsigned stats_interval;
+
+static void *stats_thread_loop(void *arg)
+{
+  Virtio_block *d = static_cast<Virtio_block *>(arg);
+
+  for (;;)
+    {
+      sleep(stats_interval);
+      Virtio_block::Stats const &st = d->stats;
+      printf("rd:%lu wr:%lu flush:%lu discard:%lu err:%lu merged:%lu batches:%lu bytes:%llu\n",
+             st.reads, st.writes, st.flushes, st.discards, st.errors,
+             st.merged, st.batches, st.bytes);
+    }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, index;
+  char const *ds = 0;
+  char const *file = 0;
+  char const *id = "l4vio_block";
+  unsigned long ramdisk_mb = 0;
+  bool read_only = false;
+  unsigned vq_max_num = 0x100;
+  unsigned num_queues = 1;
+  unsigned workers = 0;
+
+  printf("Hello from l4vio_block\n");
+
+  while ((opt = getopt_long(argc, argv, "d:r:f:Rq:w:s:S:i:", options,
+                            &index)) != -1)
+    {
+      switch (opt)
+        {
+        case 'd':
+          ds = optarg;
+          break;
+        case 'r':
+          ramdisk_mb = strtoul(optarg, 0, 0);
+          break;
+        case 'f':
+          file = optarg;
+          break;
+        case 'R':
+          read_only = true;
+          break;
+        case 'q':
+          num_queues = atoi(optarg);
+          break;
+        case 'w':
+          workers = atoi(optarg);
+          break;
+        case 's':
+          vq_max_num = atoi(optarg);
+          break;
+        case 'S':
+          stats_interval = atoi(optarg);
+          break;
+        case 'i':
+          id = optarg;
+          break;
+        }
+    }
+
+  if (!!ds + !!file + !!ramdisk_mb != 1)
+    {
+      printf("error: need exactly one of --ds, --file or --ramdisk\n");
+      return 1;
+    }
+
+  if (num_queues < 1 || num_queues > Max_queues
+      || workers > Max_workers
+      || vq_max_num < 4 || (vq_max_num & (vq_max_num - 1)))
+    {
+      printf("error: invalid number of queues, workers or queue size\n");
+      return 1;
+    }
+
+  Backend *backend;
+  if (ds)
+    backend = new Ds_backend(ds, read_only);
+  else if (file)
+    backend = new File_backend(file, read_only);
+  else
+    backend = new Ds_backend((l4_uint64_t)ramdisk_mb << 20);
+
+  Virtio_block *dev = new Virtio_block(backend, vq_max_num, num_queues,
+                                       workers, id);
+  dev->register_obj(server.registry(), "svr");
+  dev->start();
+
+  printf("%llu sectors%s, %u queue(s), %u worker(s)\n",
+         backend->size() / Sector_size,
+         backend->read_only() ? " (read-only)" : "",
+         num_queues, dev->num_workers());
+
+  if (stats_interval)
+    {
+      pthread_t stats_thread;
+      pthread_create(&stats_thread, NULL, stats_thread_loop, dev);
+    }
+
+  server.loop();
+  return 0;
+}
@@ -12,6 +12,7 @@
 #include <l4/re/util/cap_alloc>
 #include <l4/re/util/meta>
 #include <l4/re/util/object_registry>
+#include <l4/re/util/pinned_thread>
 #include <l4/re/util/br_manager>
 
 #include <l4/sys/factory>
@@ -30,6 +31,7 @@
 
 #include <cstring>
 #include <getopt.h>
+#include <unistd.h>
 
 #include <cstdio>
 #include <pthread.h>
@@ -60,7 +62,6 @@ struct Virtqueue : L4virtio::Svr::Virtqueue
 
 };
 
-//#define CONFIG_STATS 1
 //#define CONFIG_BENCHMARK 1
 
 enum
@@ -68,18 +69,28 @@ enum
   Merge_rx_buffers = true,
   Csum_offload     = false,
   Full_segmentation_offload = false,
+  Max_pairs        = 8,
 };
 
 static struct option options[] =
 {
     {"size", 1, 0, 's'},  // size of in/out queue == #buffers in queue
+    {"stats", 1, 0, 'S'}, // print statistics every n seconds
+    {"queues", 1, 0, 'q'}, // number of queue pairs per port
     {0, 0, 0, 0}
 };
 
+class Guard
+{
+public:
+  explicit Guard(pthread_mutex_t *m) : _m(m) { pthread_mutex_lock(_m); }
+  ~Guard() { pthread_mutex_unlock(_m); }
 
-#ifdef CONFIG_STATS
-static void *stats_thread_loop(void *);
-#endif
+private:
+  pthread_mutex_t *_m;
+};
+
+class Sock_pair;
 
 class Virtio_net :
   public L4virtio::Svr::Device,
@@ -136,36 +147,69 @@ public:
   {
     Rx = 0,
     Tx = 1,
+
+    Ctrl_mq              = 4, ///< VIRTIO_NET_CTRL_MQ
+    Ctrl_mq_vq_pairs_set = 0, ///< VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET
+    Ctrl_ok              = 0,
+    Ctrl_err             = 1,
+
+    Feature_ctrl_vq = 17,
+    Feature_mq      = 22,
+
+    /// Slot of the control queue in _queue_irq
+    Ctrl_slot = 2 * Max_pairs,
+  };
+
+  /// Counters of a queue pair, written by the worker of the pair.
+  struct Stats
+  {
+    unsigned long tx;             ///< packets sent by the client
+    unsigned long rx;             ///< packets received by the client
+    unsigned long dropped;        ///< packets truncated for the client
+    unsigned long irqs;           ///< notifications sent to the client
+    unsigned long irqs_suppressed; ///< notifications the client did not want
   };
 
-#ifdef CONFIG_STATS
-  unsigned long num_tx;
-  unsigned long num_rx;
-  unsigned long num_dropped;
-  unsigned long num_irqs;
-#endif
+  Stats stats[Max_pairs];
 
   struct Net_config_space
   {
+    l4_uint8_t mac[6];
+    l4_uint16_t status;
+    l4_uint16_t max_virtqueue_pairs;
   };
 
   L4virtio::Svr::Dev_config_t<Net_config_space> _dev_config;
 
-  explicit Virtio_net(unsigned vq_max)
+  /**
+   * Create a port with `pairs` receive/transmit queue pairs.  With more
+   * than one pair, the port offers VIRTIO_NET_F_MQ and a control queue.
+   */
+  Virtio_net(unsigned vq_max, unsigned pairs, Sock_pair *link)
   : L4virtio::Svr::Device(&_dev_config),
-    _dev_config(0x44, L4VIRTIO_ID_NET, 2),
-    _vq_max(vq_max)
-#ifdef CONFIG_STATS
-    , num_tx(0), num_rx(0), num_dropped(0), num_irqs(0)
-#endif
+    stats(),
+    _dev_config(0x44, L4VIRTIO_ID_NET, pairs > 1 ? 2 * pairs + 1 : 2),
+    _vq_max(vq_max),
+    _pairs(pairs),
+    _active_pairs(1),
+    _per_queue_notify(false),
+    _error(false),
+    _link(link)
   {
     Features hf(0);
     hf.ring_indirect_desc() = true;
+    hf.ring_event_idx() = true;
 
     hf.csum()       = Csum_offload;
     hf.guest_csum() = Csum_offload;
     hf.mrg_rxbuf()  = Merge_rx_buffers;
 
+    if (pairs > 1)
+      {
+        hf.ctrl_vq() = true;
+        hf.mq()      = true;
+      }
+
     if (Full_segmentation_offload)
       {
         hf.host_tso4() = true;
@@ -181,10 +225,11 @@ public:
 
     _dev_config.host_features(0) = hf.raw;
     _dev_config.host_features(1) = 1;
+    _dev_config.priv_config()->max_virtqueue_pairs = pairs;
     _dev_config.reset_hdr();
 
-    reset_queue_config(0, vq_max);
-    reset_queue_config(1, vq_max);
+    for (unsigned i = 0; i < num_queues(); ++i)
+      reset_queue_config(i, vq_max);
   }
 
   void register_single_driver_irq()
@@ -193,17 +238,27 @@ public:
     L4Re::chksys(server_iface()->realloc_rcv_cap(0));
   }
 
+  int register_driver_irq(unsigned idx)
+  {
+    if (idx >= array_length(_guest_irqs))
+      return -L4_ERANGE;
+
+    _guest_irqs[idx] = L4Re::chkcap(server_iface()->rcv_cap<L4::Irq>(0));
+    L4Re::chksys(server_iface()->realloc_rcv_cap(0));
+    return 0;
+  }
+
   Server_iface *server_iface() const
   { return L4::Epiface::server_iface(); }
 
-  L4::Cap<L4::Irq> device_notify_irq() const
-  { return _host_irq; }
+  /**
+   * The queues of pair i use notification index i, the control queue uses
+   * index `pairs`.  Index 0 is also the IRQ of register_iface().
+   */
+  inline L4::Cap<L4::Irq> device_notify_irq() const;
+  inline L4::Cap<L4::Irq> device_notify_irq_at(unsigned idx) const;
 
-  void reset()
-  {
-    for (Virtqueue &q: _q)
-      q.disable();
-  }
+  inline void reset();
 
   bool available()
   { return !obj_cap(); }
@@ -211,57 +266,98 @@ public:
   template<typename T, unsigned N >
   static unsigned array_length(T (&)[N]) { return N; }
 
-  int reconfig_queue(unsigned index)
-  {
-    if (index >= array_length(_q))
-      return -L4_ERANGE;
+  unsigned num_queues() const
+  { return _pairs > 1 ? 2 * _pairs + 1 : 2; }
 
-    if (setup_queue(_q + index, index, _vq_max))
-      return 0;
+  unsigned num_pairs() const { return _pairs; }
+  unsigned active_pairs() const { return access_once(&_active_pairs); }
+  void active_pairs(unsigned n) { _active_pairs = n; }
 
-    return -L4_EINVAL;
+  bool mq() const
+  { return _dev_config.negotiated(Feature_mq); }
+
+  /// Index of the control queue, it moves behind the data queues with MQ.
+  unsigned ctrl_index() const
+  {
+    if (mq())
+      return 2 * _pairs;
+
+    return _dev_config.negotiated(Feature_ctrl_vq) ? 2 : ~0U;
   }
 
+  inline int reconfig_queue(unsigned index);
+
   bool check_queues()
   {
-    for (Virtqueue &q: _q)
-      if (!q.ready())
-        {
-          reset();
-          printf("failed to start queues\n");
-          return false;
-        }
+    if (!_q[Rx].ready() || !_q[Tx].ready())
+      {
+        reset();
+        printf("failed to start queues\n");
+        return false;
+      }
 
     return true;
   }
 
-  Virtqueue *tx_q() { return &_q[Tx]; }
-  Virtqueue *rx_q() { return &_q[Rx]; }
-
+  Virtqueue *tx_q(unsigned pair = 0) { return &_q[2 * pair + Tx]; }
+  Virtqueue *rx_q(unsigned pair = 0) { return &_q[2 * pair + Rx]; }
+  Virtqueue *ctrl_q() { return &_ctrl_q; }
 
-  void notify_queue(L4virtio::Virtqueue *queue)
+  void notify_queue(L4virtio::Svr::Virtqueue *queue)
   {
-    //printf("%s\n", __func__);
-    if (queue->no_notify_guest())
-      return;
+    unsigned qn = queue == &_ctrl_q ? (unsigned)Ctrl_slot
+                                    : static_cast<Virtqueue *>(queue) - _q;
+    Stats &st = stats[qn == Ctrl_slot ? 0 : qn / 2];
+
+    // the transmit queues of a pair may be served by another worker
+    if (!queue->notify_guest_needed())
+      {
+        if (qn != Ctrl_slot)
+          __atomic_add_fetch(&st.irqs_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+      }
 
     // we do not care about this anywhere, so skip
     // _device_config->irq_status |= 1;
 
-    kick_guest_irq->trigger();
-#ifdef CONFIG_STATS
-    ++num_irqs;
-#endif
+    L4::Cap<L4::Irq> irq = _queue_irq[qn];
+    if (irq.is_valid())
+      irq->trigger();
+    else
+      kick_guest_irq->trigger();
+
+    if (qn != Ctrl_slot)
+      __atomic_add_fetch(&st.irqs, 1, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * Transition into the failed state from a worker thread.  The reset
+   * needs the locks of all pairs, so it is left to the server thread.
+   */
+  inline void defer_error();
+
+  bool failed() const
+  { return __atomic_load_n(&_error, __ATOMIC_RELAXED); }
+
+  /// Fail the device if a worker asked for it, runs on the server thread.
+  void handle_deferred_error()
+  {
+    // reset() clears the error, with the queues stopped
+    if (failed())
+      device_error();
   }
 
+  /// Whether the client kicks all queues through the IRQ of register_iface().
+  bool single_notify() const
+  { return !_per_queue_notify && mq(); }
+
   char const *name;
 
   template<typename REG>
-  void register_client(REG *registry, L4::Cap<L4::Irq> host_irq,
-                       unsigned num_ds)
+  void register_client(REG *registry, unsigned num_ds)
   {
     init_mem_info(num_ds);
-    _host_irq = host_irq;
+    _per_queue_notify = false;
     L4Re::chkcap(registry->register_obj(this));
     obj_cap()->dec_refcnt(1);
   }
@@ -270,24 +366,55 @@ public:
   void unregister_client(REG *registry)
   {
     reset();
-    reset_queue_config(0, _vq_max);
-    reset_queue_config(1, _vq_max);
+    for (unsigned i = 0; i < num_queues(); ++i)
+      reset_queue_config(i, _vq_max);
     init_mem_info(0);
 
+    for (auto &irq: _guest_irqs)
+      irq = L4::Cap<L4::Irq>();
+
     registry->unregister_obj(this);
   }
 
 private:
-  friend void *stats_thread_loop(void *);
+  /// Publish the notification indices of queue qn and pick its guest IRQ.
+  void bind_queue_irqs(unsigned qn, unsigned slot, unsigned notify_idx)
+  {
+    _dev_config.set_device_notify_index(qn, notify_idx);
+
+    unsigned idx = _dev_config.qconfig(qn)->driver_notify_index;
+    _queue_irq[slot] = idx < array_length(_guest_irqs)
+                       ? _guest_irqs[idx].get() : L4::Cap<L4::Irq>();
+  }
 
   unsigned _vq_max;
-  Virtqueue _q[2];
+  unsigned _pairs;
+  unsigned _active_pairs;
+  mutable bool _per_queue_notify;
+  bool _error;
+  Sock_pair *_link;
+  Virtqueue _q[2 * Max_pairs];
+  Virtqueue _ctrl_q;
   L4Re::Util::Auto_cap<L4::Irq>::Cap kick_guest_irq;
-  L4::Cap<L4::Irq> _host_irq;
+  /// Guest IRQs bound by notification index.
+  L4Re::Util::Auto_cap<L4::Irq>::Cap _guest_irqs[Max_pairs + 1];
+  /// Guest IRQ of each queue, invalid for queues using kick_guest_irq.
+  L4::Cap<L4::Irq> _queue_irq[Ctrl_slot + 1];
 };
 
 static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks> server;
 
+/**
+ * Point-to-point link between two virtio-net ports.
+ *
+ * Each queue pair has a host IRQ and a worker thread bound to it.  Worker j
+ * owns receive queue j of both ports and the transmit queues of the other
+ * port that are steered to it: transmit queue i goes to receive queue
+ * i % n, n being the number of queue pairs the receiving port enabled.
+ * Everything a worker touches is protected by the lock of its pair, and
+ * changing the steering takes the locks of all pairs.  The control queues
+ * and deferred device errors are handled on the server thread.
+ */
 class Sock_pair : public L4::Epiface_t<Sock_pair, L4::Factory>
 {
 private:
@@ -296,7 +423,7 @@ private:
     explicit Host_irq(Sock_pair *sp) : s(sp) {}
     Sock_pair *s;
     void handle_irq()
-    { s->kick(); }
+    { s->control(); }
   };
 
   struct Del_cap_irq : public L4::Irqep_t<Del_cap_irq>
@@ -323,15 +450,15 @@ private:
     unsigned _num_clients;
   };
 
-  Host_irq _host_irq;
+  Host_irq _ctrl_irq;
   Del_cap_irq _del_cap_irq;
 
 public:
-  L4::Cap<L4::Irq> host_irq() const
-  { return L4::cap_cast<L4::Irq>(_host_irq.obj_cap()); }
+  L4::Cap<L4::Irq> ctrl_irq() const
+  { return L4::cap_cast<L4::Irq>(_ctrl_irq.obj_cap()); }
 
   L4::Epiface *irq_object()
-  { return &_host_irq; }
+  { return &_ctrl_irq; }
 
   struct Buffer : Data_buffer
   {
@@ -345,6 +472,22 @@ public:
     }
   };
 
+  /// Buffer of a control request, remembers whether the driver reads it.
+  struct Ctrl_buffer : Data_buffer
+  {
+    bool writable;
+
+    Ctrl_buffer() = default;
+    Ctrl_buffer(L4virtio::Svr::Driver_mem_region const *r,
+                Virtqueue::Desc const &d,
+                Request_processor const *)
+    {
+      pos = static_cast<char *>(r->local(d.addr));
+      left = d.len;
+      writable = d.flags.write();
+    }
+  };
+
   struct End_point : Request_processor
   {
     Virtqueue::Head_desc head;
@@ -357,7 +500,13 @@ public:
     enum { merge_rx = Merge_rx_buffers };
     enum { hdr_size = Merge_rx_buffers ? 12 : 10 };
 
-    End_point(Virtio_net *dev, Virtqueue *queue) : d(dev), q(queue) {}
+    End_point() : hdr(0), d(0), q(0) {}
+
+    void init(Virtio_net *dev, Virtqueue *queue)
+    {
+      d = dev;
+      q = queue;
+    }
 
     void finish(l4_uint32_t total = 0)
     { q->finish(head, d, total); }
@@ -410,24 +559,51 @@ public:
   };
 
 
+  /**
+   * Packets from the transmit queues `srcs` of one port to one receive
+   * queue of the other port.  Only run by the worker of `pair`.
+   */
   struct Pipe
   {
     l4_uint32_t total;
-    End_point tx;
+    End_point txs[Max_pairs];
+    End_point *tx;
     End_point rx;
 
-    Pipe(Virtio_net *tx_port, Virtio_net *rx_port)
-    : tx(tx_port, tx_port->tx_q()),
-      rx(rx_port, rx_port->rx_q())
-    {}
+    unsigned pair;
+    unsigned srcs;      ///< bitmap of the transmit queues steered here
+    unsigned next_src;
+
+    Pipe(Virtio_net *tx_port, Virtio_net *rx_port, unsigned p)
+    : total(0), tx(&txs[p]), pair(p), srcs(0), next_src(0), nmerge(0)
+    {
+      for (unsigned i = 0; i < Max_pairs; ++i)
+        txs[i].init(tx_port, tx_port->tx_q(i));
+      rx.init(rx_port, rx_port->rx_q(p));
+    }
+
+    Virtio_net *src() const { return txs[0].d; }
+    Virtio_net *dst() const { return rx.d; }
+
+    bool src_ready(unsigned i) const
+    { return (srcs & (1U << i)) && txs[i].q->ready(); }
 
     bool ready() const
-    { return L4_LIKELY(tx.q->ready() && rx.q->ready()); }
+    {
+      return L4_LIKELY(rx.q->ready() && srcs)
+             && L4_LIKELY(!src()->failed() && !dst()->failed());
+    }
 
     bool work_pending() const
     {
-      return L4_LIKELY(ready()) && tx.q->desc_avail()
-             && rx.q->desc_avail();
+      if (L4_UNLIKELY(!ready()) || !rx.q->desc_avail())
+        return false;
+
+      for (unsigned i = 0; i < Max_pairs; ++i)
+        if (src_ready(i) && txs[i].q->desc_avail())
+          return true;
+
+      return false;
     }
 
     void disable_notify()
@@ -435,7 +611,9 @@ public:
       if (L4_UNLIKELY(!ready()))
         return;
 
-      tx.q->disable_notify();
+      for (unsigned i = 0; i < Max_pairs; ++i)
+        if (src_ready(i))
+          txs[i].q->disable_notify();
       rx.q->disable_notify();
     }
 
@@ -444,13 +622,28 @@ public:
       if (L4_UNLIKELY(!ready()))
         return;
 
-      tx.q->enable_notify();
+      for (unsigned i = 0; i < Max_pairs; ++i)
+        if (src_ready(i))
+          txs[i].q->enable_notify();
       rx.q->enable_notify();
     }
 
+    /// Start the next packet, round-robin over the steered transmit queues.
     bool start_tx_packet()
     {
-      return tx.start_packet(true);
+      for (unsigned n = 0; n < Max_pairs; ++n)
+        {
+          unsigned i = next_src;
+          next_src = (next_src + 1) % Max_pairs;
+          if (!src_ready(i))
+            continue;
+
+          tx = &txs[i];
+          if (tx->start_packet(true))
+            return true;
+        }
+
+      return false;
     }
 
     bool start_rx_packet()
@@ -460,12 +653,43 @@ public:
 
     unsigned nmerge;
 
+    /// Hand the receive buffers of a partially copied packet back, truncated.
+    void drop_rx()
+    {
+      if (rx.q->ready() && (rx.head || nmerge))
+        {
+          if (rx.head)
+            rx.q->consumed_x(nmerge++, rx.head, total);
+          if (rx.merge_rx)
+            rx.hdr->num_buffers = nmerge;
+          rx.hdr->flags.raw = 0;
+          rx.q->finish_x(nmerge, rx.d);
+        }
+
+      rx.head = Virtqueue::Head_desc();
+      nmerge = 0;
+    }
+
+    /**
+     * Drop the packet in flight, done before the steering changes and when
+     * a port is reset.  Queues that are no longer ready are left alone.
+     */
+    void abort()
+    {
+      drop_rx();
+
+      if (tx->head && tx->q->ready())
+        tx->finish();
+
+      tx->head = Virtqueue::Head_desc();
+    }
+
     bool copy()
     {
       try
         {
           // loop over all chained descriptors (rx and tx)
-          if (!tx.head)
+          if (!tx->head)
             {
               nmerge = 0;
               if (L4_UNLIKELY(!start_tx_packet()))
@@ -479,21 +703,23 @@ public:
             {
               if (0)
                 printf("%p: copy packet %p (%u) -> %p (%u)\n", this,
-                       tx.pkt.pos, tx.pkt.left, rx.pkt.pos, rx.pkt.left);
+                       tx->pkt.pos, tx->pkt.left, rx.pkt.pos, rx.pkt.left);
 
-              total += tx.pkt.copy_to(&rx.pkt);
+              total += tx->pkt.copy_to(&rx.pkt);
 
-              if (tx.pkt.done() && !tx.next())
+              if (tx->pkt.done() && !tx->next())
                 {
                   if (0)
                     printf("%p: finish packet rx buffers: %u last total %u\n",
                            this, nmerge + 1, total);
-                  tx.finish();
+                  tx->finish();
+                  ++tx->d->stats[pair].tx;
+                  ++rx.d->stats[pair].rx;
                   rx.q->consumed_x(nmerge++, rx.head, total);
                   if (rx.merge_rx)
                     rx.hdr->num_buffers = nmerge;
 
-                  if (tx.hdr->flags.need_csum() == 0)
+                  if (tx->hdr->flags.need_csum() == 0)
                     rx.hdr->flags.data_valid() = 1;
 
                   rx.q->finish_x(nmerge, rx.d);
@@ -515,6 +741,7 @@ public:
                   else
                     {
                       printf("%p: truncated rx packet, drop\n", this);
+                      ++rx.d->stats[pair].dropped;
                       rx.hdr->flags.raw = 0;
                       rx.q->finish_x(nmerge, rx.d);
                     }
@@ -532,25 +759,23 @@ public:
         }
       catch (L4virtio::Svr::Bad_descriptor const &e)
         {
-          if (e.proc == &tx)
+          if (e.proc == tx)
             {
               // failed TX queue, be nice to RX part.
-              tx.d->device_error();
-
-              if (rx.q->ready() && rx.head)
-                rx.finish(total);
+              tx->d->defer_error();
+              drop_rx();
 
               printf("error: TX queue error: bad descriptor: %d in device %p, queue %p\n",
-                     e.error, tx.d, tx.q);
+                     e.error, tx->d, tx->q);
             }
 
           if (e.proc == &rx)
             {
               // failed RX queue, send half pkt to TX part.
-              rx.d->device_error();
+              rx.d->defer_error();
 
-              if (tx.q->ready() && tx.head)
-                tx.finish();
+              if (tx->q->ready() && tx->head)
+                tx->finish();
 
               printf("error: RX queue error: bad descriptor: %d in device %p, queue %p\n",
                      e.error, rx.d, rx.q);
@@ -562,26 +787,122 @@ public:
   };
 
   enum { Npipes = 2, Nports = 2 };
+
+  /// A queue pair of both ports together with its worker.
+  struct Pair
+  {
+    pthread_mutex_t lock;
+    L4Re::Util::Auto_cap<L4::Irq>::Cap irq;
+    /// pipe[i] transmits from port i
+    Pipe *pipe[Npipes];
+    /// Notifications received for this pair from the clients of both ports.
+    unsigned long num_kicks;
+    Sock_pair *s;
+    unsigned index;
+  };
+
   Virtio_net *port[Nports];
-  Pipe *pipe[Npipes];
+  Pair pairs[Max_pairs];
 
   /**
    * \brief Create a new virtio Switch
    */
-  Sock_pair(unsigned vq_max)
-  : _host_irq(this),
-    _del_cap_irq(port, Nports)
+  Sock_pair(unsigned vq_max, unsigned num_pairs)
+  : _ctrl_irq(this),
+    _del_cap_irq(port, Nports),
+    _num_pairs(num_pairs)
   {
     for (Virtio_net *&p: port)
-      p = new Virtio_net(vq_max);
+      p = new Virtio_net(vq_max, num_pairs, this);
 
-    pipe[0] = new Pipe(port[0], port[1]);
-    pipe[1] = new Pipe(port[1], port[0]);
+    for (unsigned i = 0; i < _num_pairs; ++i)
+      {
+        Pair &p = pairs[i];
+        pthread_mutex_init(&p.lock, NULL);
+        p.irq = L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4::Irq>(),
+                             "allocate queue pair IRQ");
+        L4Re::chksys(L4Re::Env::env()->factory()->create(p.irq.get()),
+                     "create queue pair IRQ");
+        for (unsigned dir = 0; dir < Npipes; ++dir)
+          p.pipe[dir] = new Pipe(port[dir], port[1 - dir], i);
+        p.num_kicks = 0;
+        p.s = this;
+        p.index = i;
+      }
+
+    remap();
 
     auto c = L4Re::chkcap(server.registry()->register_irq_obj(&_del_cap_irq));
     L4Re::chksys(L4Re::Env::env()->main_thread()->register_del_irq(c));
   }
 
+  unsigned num_pairs() const { return _num_pairs; }
+
+  pthread_mutex_t *pair_lock(unsigned i)
+  { return &pairs[i].lock; }
+
+  L4::Cap<L4::Irq> pair_irq(unsigned i) const
+  { return pairs[i].irq.get(); }
+
+  /// Take the locks of all pairs, always in ascending order.
+  void lock_all()
+  {
+    for (unsigned i = 0; i < _num_pairs; ++i)
+      pthread_mutex_lock(&pairs[i].lock);
+  }
+
+  void unlock_all()
+  {
+    for (unsigned i = _num_pairs; i > 0; --i)
+      pthread_mutex_unlock(&pairs[i - 1].lock);
+  }
+
+  /**
+   * Steer the transmit queues to the enabled receive queues of the other
+   * port.  Pipes that change drop their packet in flight.  All pair locks
+   * must be held.
+   */
+  void remap()
+  {
+    for (unsigned dir = 0; dir < Npipes; ++dir)
+      {
+        unsigned active = port[1 - dir]->active_pairs();
+        for (unsigned j = 0; j < _num_pairs; ++j)
+          {
+            unsigned srcs = 0;
+            if (j < active)
+              for (unsigned i = j; i < _num_pairs; i += active)
+                srcs |= 1U << i;
+
+            Pipe *p = pairs[j].pipe[dir];
+            if (p->srcs == srcs)
+              continue;
+
+            p->abort();
+            p->srcs = srcs;
+          }
+      }
+  }
+
+  /// Drop all packets in flight.  All pair locks must be held.
+  void abort_all()
+  {
+    for (unsigned j = 0; j < _num_pairs; ++j)
+      for (auto *p: pairs[j].pipe)
+        p->abort();
+  }
+
+  /// Start the workers, round-robin on the online CPUs.
+  void start()
+  {
+    L4Re::Util::Online_cpus cpus;
+
+    for (unsigned i = 0; i < _num_pairs; ++i)
+      L4Re::Util::start_pinned_thread(worker_thread, &pairs[i], cpus[i],
+                                      "start queue pair worker",
+                                      pairs[i].irq.get());
+  }
+
   long op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &res,
                  l4_umword_t type, L4::Ipc::Varg_list_ref va)
   {
@@ -604,7 +925,7 @@ public:
       {
         if (p->available())
           {
-            p->register_client(server.registry(), host_irq(), num_ds);
+            p->register_client(server.registry(), num_ds);
             res = L4::Ipc::make_cap(p->obj_cap(), L4_CAP_FPAGE_RWSD);
 
             return L4_EOK;
@@ -614,30 +935,53 @@ public:
     return -L4_ENOMEM;
   }
 
-  void kick()
+  /// Handle deferred errors and the control queues, on the server thread.
+  void control()
+  {
+    for (auto *p: port)
+      {
+        p->handle_deferred_error();
+        process_ctrl(p);
+      }
+  }
+
+  void kick(unsigned pair)
   {
+    Pipe *const *pipes = pairs[pair].pipe;
+
+    // transmit queues steered to another pair are processed over there
+    for (unsigned dir = 0; dir < Npipes; ++dir)
+      {
+        unsigned active = port[1 - dir]->active_pairs();
+        if (pair >= active)
+          pairs[pair % active].irq->trigger();
+      }
+
+    Guard g(&pairs[pair].lock);
+
     for (;;)
       {
-        for (auto p: pipe)
-          p->disable_notify();
+        for (unsigned i = 0; i < Npipes; ++i)
+          pipes[i]->disable_notify();
 
         for (bool more = true; more; )
           {
             more = false;
-            for (auto p: pipe)
-              if (L4_LIKELY(p->ready()))
-                more |= p->copy();
+            for (unsigned i = 0; i < Npipes; ++i)
+              if (L4_LIKELY(pipes[i]->ready()))
+                more |= pipes[i]->copy();
           }
 
-        for (auto p: pipe)
-          p->enable_notify();
+        for (unsigned i = 0; i < Npipes; ++i)
+          pipes[i]->enable_notify();
 
-        L4virtio::wmb();
-        L4virtio::rmb();
+        // the re-enabled notification must be visible before the queues
+        // are checked again
+        L4virtio::mb();
 
         bool work = false;
-        for (auto p: pipe)
-          if (L4_UNLIKELY((work |= p->work_pending())))
+        for (unsigned i = 0; i < Npipes; ++i)
+          if (L4_UNLIKELY((work |= pipes[i]->work_pending())))
             break;
 
         if (L4_LIKELY(!work))
@@ -646,27 +990,201 @@ public:
         // seems there is already new work to do ...
       }
   }
+
+private:
+  static void *worker_thread(void *arg)
+  {
+    Pair *p = static_cast<Pair *>(arg);
+    p->s->worker(p->index);
+    return 0;
+  }
+
+  void worker(unsigned pair)
+  {
+    for (;;)
+      {
+        l4_msgtag_t tag = l4_ipc_receive(pairs[pair].irq.cap(), l4_utcb(),
+                                         L4_IPC_NEVER);
+        if (l4_ipc_error(tag, l4_utcb()))
+          continue;
+
+        ++pairs[pair].num_kicks;
+
+        // clients without per-queue IRQs kick every queue through pair 0
+        if (pair == 0 && _num_pairs > 1
+            && (port[0]->single_notify() || port[1]->single_notify()))
+          {
+            for (unsigned i = 1; i < _num_pairs; ++i)
+              pairs[i].irq->trigger();
+            ctrl_irq()->trigger();
+          }
+
+        kick(pair);
+      }
+  }
+
+  void process_ctrl(Virtio_net *p)
+  {
+    Virtqueue *q = p->ctrl_q();
+
+    while (q->ready())
+      {
+        auto r = q->next_avail();
+        if (!r)
+          return;
+
+        Request_processor rp;
+        Ctrl_buffer b;
+        Virtqueue::Head_desc head;
+        l4_uint8_t cmd[4];
+        unsigned len = 0;
+        char *ack = 0;
+
+        try
+          {
+            head = rp.start(p->mem_info(), r, &b);
+            for (;;)
+              {
+                if (b.writable)
+                  {
+                    if (!ack && b.left)
+                      ack = b.pos;
+                  }
+                else
+                  for (; b.left && len < sizeof(cmd); --b.left)
+                    cmd[len++] = *b.pos++;
+
+                if (!rp.next(p->mem_info(), &b))
+                  break;
+              }
+          }
+        catch (L4virtio::Svr::Bad_descriptor const &e)
+          {
+            printf("error: control queue error: bad descriptor: %d in device %p\n",
+                   e.error, p);
+            p->device_error();
+            return;
+          }
+
+        l4_uint8_t status = Virtio_net::Ctrl_err;
+        if (len == sizeof(cmd) && cmd[0] == Virtio_net::Ctrl_mq
+            && cmd[1] == Virtio_net::Ctrl_mq_vq_pairs_set && p->mq())
+          {
+            unsigned n = cmd[2] | (cmd[3] << 8);
+            if (n >= 1 && n <= _num_pairs)
+              {
+                lock_all();
+                p->active_pairs(n);
+                remap();
+                unlock_all();
+                status = Virtio_net::Ctrl_ok;
+              }
+          }
+
+        if (ack)
+          *ack = status;
+
+        q->finish(head, p, ack ? 1 : 0);
+      }
+  }
+
+  unsigned _num_pairs;
 };
 
-#ifdef CONFIG_STATS
-static void *stats_thread_loop(void *)
+L4::Cap<L4::Irq> Virtio_net::device_notify_irq() const
+{ return _link->pair_irq(0); }
+
+L4::Cap<L4::Irq> Virtio_net::device_notify_irq_at(unsigned idx) const
+{
+  if (idx >= _pairs + (_pairs > 1))
+    return L4::Cap<L4::Irq>();
+
+  _per_queue_notify = true;
+  return idx < _pairs ? _link->pair_irq(idx) : _link->ctrl_irq();
+}
+
+void Virtio_net::reset()
 {
+  _link->lock_all();
+
+  for (Virtqueue &q: _q)
+    q.disable();
+  _ctrl_q.disable();
+
+  for (auto &irq: _queue_irq)
+    irq = L4::Cap<L4::Irq>();
+
+  _error = false;
+  _active_pairs = 1;
+  _link->abort_all();
+  _link->remap();
+  _link->unlock_all();
+}
+
+int Virtio_net::reconfig_queue(unsigned index)
+{
+  if (index >= num_queues())
+    return -L4_ERANGE;
+
+  if (index == ctrl_index())
+    {
+      if (!setup_queue(&_ctrl_q, index, _vq_max))
+        return -L4_EINVAL;
+
+      bind_queue_irqs(index, Ctrl_slot, _pairs);
+      return 0;
+    }
+
+  if (index >= 2 * (mq() ? _pairs : 1))
+    return -L4_EINVAL;
+
+  Guard g(_link->pair_lock(index / 2));
+
+  if (!setup_queue(_q + index, index, _vq_max))
+    return -L4_EINVAL;
+
+  bind_queue_irqs(index, index, index / 2);
+  return 0;
+}
+
+void Virtio_net::defer_error()
+{
+  __atomic_store_n(&_error, true, __ATOMIC_RELAXED);
+  _link->ctrl_irq()->trigger();
+}
+
+static unsigned stats_interval;
+
+static void *stats_thread_loop(void *arg)
+{
+  Sock_pair *s = static_cast<Sock_pair *>(arg);
+
   for (;;)
     {
-      sleep(1);
-      for (unsigned i = 0; i < net.Num_ports; ++i)
+      sleep(stats_interval);
+      unsigned long kicks = 0;
+      for (unsigned i = 0; i < Sock_pair::Nports; ++i)
         {
-          Virtio_net *p = &net.port[i];
-          printf("%s: tx:%ld rx:%ld drp:%ld irqs:%ld ri:%d:%d  ",
-                 p->name, p->num_tx, p->num_rx, p->num_dropped, p->num_irqs,
-                 p->_device_config.status().running() ? (unsigned)p->_q[0].avail->idx : -1,
-                 (unsigned)p->_q[0].current_avail);
+          Virtio_net::Stats st = Virtio_net::Stats();
+          for (unsigned j = 0; j < s->num_pairs(); ++j)
+            {
+              Virtio_net::Stats const &q = s->port[i]->stats[j];
+              st.tx += q.tx;
+              st.rx += q.rx;
+              st.dropped += q.dropped;
+              st.irqs += q.irqs;
+              st.irqs_suppressed += q.irqs_suppressed;
+            }
+          printf("port%u: tx:%lu rx:%lu drp:%lu irqs:%lu (suppressed %lu) pairs:%u  ",
+                 i, st.tx, st.rx, st.dropped, st.irqs, st.irqs_suppressed,
+                 s->port[i]->active_pairs());
         }
-      printf("\n");
+      for (unsigned j = 0; j < s->num_pairs(); ++j)
+        kicks += s->pairs[j].num_kicks;
+      printf("kicks:%lu\n", kicks);
     }
   return NULL;
-};
-#endif
+}
 
 int main(int argc, char *argv[])
 {
@@ -677,10 +1195,11 @@ int main(int argc, char *argv[])
 
   int opt, index;
   unsigned vq_max_num = 0x100; // default value for data queues
+  unsigned num_pairs = 1;
 
   printf("Hello from l4vio_net_p2p\n");
 
-  while( (opt = getopt_long(argc, argv, "s:", options, &index)) != -1)
+  while( (opt = getopt_long(argc, argv, "s:S:q:", options, &index)) != -1)
     {
       switch (opt)
         {
@@ -688,23 +1207,36 @@ int main(int argc, char *argv[])
           vq_max_num = atoi(optarg);
           printf("Max number of buffers in virtqueue: %u\n", vq_max_num);
           break;
+        case 'S':
+          stats_interval = atoi(optarg);
+          break;
+        case 'q':
+          num_pairs = atoi(optarg);
+          if (num_pairs < 1 || num_pairs > Max_pairs)
+            {
+              printf("error: number of queue pairs must be 1..%u\n",
+                     (unsigned)Max_pairs);
+              return 1;
+            }
+          printf("Queue pairs per port: %u\n", num_pairs);
+          break;
         }
     }
 
-  Sock_pair *s = new Sock_pair(vq_max_num);
+  Sock_pair *s = new Sock_pair(vq_max_num, num_pairs);
   L4::Cap<void> cap = server.registry()->register_obj(s, "svr");
-  server.registry()->register_irq_obj(s->irq_object());
+  L4Re::chkcap(server.registry()->register_irq_obj(s->irq_object()));
   if (!cap.is_valid())
     printf("error registering switch\n");
 
-#ifdef CONFIG_STATS
-  pthread_t stats_thread;
-  pthread_create(&stats_thread, NULL, stats_thread_loop, NULL);
-#endif
+  s->start();
+
+  if (stats_interval)
+    {
+      pthread_t stats_thread;
+      pthread_create(&stats_thread, NULL, stats_thread_loop, s);
+    }
 
   server.loop();
   return 0;
 }
-
-
-
@@ -0,0 +1,960 @@
+/*
+ * Learning virtio-net switch.
+ *
+ * Each port is a virtio-net device for one client.  Every port has its own
+ * host IRQ and a worker thread bound to it, pinned to one of the online
+ * CPUs.  The worker forwards the packets sent by its client: the source
+ * address is learned, unicast packets to a known address are copied into
+ * the receive queue of the port the address was learned on, all other
+ * packets are flooded to all other ports.  Packets are copied once, from
+ * the transmit buffers of the sender directly into the receive buffers of
+ * the receiver.
+ *
+ * Used entries are published in batches: the transmit queue once per
+ * batch, a receive queue whenever the worker moves on to another
+ * destination.  A unicast packet waits for the destination to post receive
+ * buffers, flooded packets are dropped on ports without buffers.
+ *
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 2.  Please see the COPYING-GPL-2 file for details.
+ */
+
+#include <l4/re/dataspace>
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/cap_alloc>
+#include <l4/re/util/object_registry>
+#include <l4/re/util/pinned_thread>
+#include <l4/re/util/br_manager>
+
+#include <l4/sys/factory>
+#include <l4/sys/irq>
+#include <l4/sys/compiler.h>
+
+#include <l4/sys/cxx/ipc_epiface>
+#include <l4/sys/cxx/ipc_varg>
+
+#include <l4/cxx/utils>
+
+#include <l4/l4virtio/server/virtio>
+#include <l4/l4virtio/server/l4virtio>
+#include <l4/l4virtio/l4virtio>
+
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <debug.h>
+
+using L4virtio::Svr::Data_buffer;
+using L4virtio::Svr::Request_processor;
+
+// Burst versions of consumed and finish, see p2p-link
+struct Virtqueue : L4virtio::Svr::Virtqueue
+{
+  void consumed_x(l4_uint16_t n, Head_desc &r, l4_uint32_t len = 0)
+  {
+    l4_uint16_t i = (_used->idx + n) & _idx_mask;
+    _used->ring[i] = Used_elem(r.desc() - _desc, len);
+    r = Head_desc();
+  }
+
+  template<typename QUEUE_OBSERVER>
+  void finish_x(l4_uint16_t n, QUEUE_OBSERVER *o)
+  {
+    L4virtio::wmb();
+    _used->idx += n;
+    o->notify_queue(this);
+  }
+};
+
+enum
+{
+  Max_ports = 32,
+  Batch     = 32,  ///< packets forwarded before the used rings are published
+  Hdr_size  = 12,  ///< struct virtio_net_hdr with num_buffers
+};
+
+static struct option options[] =
+{
+    {"size", 1, 0, 's'},  // size of in/out queue == #buffers in queue
+    {"ports", 1, 0, 'p'}, // number of ports
+    {"stats", 1, 0, 'S'}, // print statistics every n seconds
+    {0, 0, 0, 0}
+};
+
+class Guard
+{
+public:
+  explicit Guard(pthread_mutex_t *m) : _m(m) { pthread_mutex_lock(_m); }
+  ~Guard() { pthread_mutex_unlock(_m); }
+
+private:
+  pthread_mutex_t *_m;
+};
+
+class Port;
+class Switch;
+
+struct Buffer : Data_buffer
+{
+  Buffer() = default;
+  Buffer(L4virtio::Svr::Driver_mem_region const *r,
+         Virtqueue::Desc const &d,
+         Request_processor const *)
+  {
+    pos = static_cast<char *>(r->local(d.addr));
+    left = d.len;
+  }
+};
+
+/// Position in a packet of a queue of a port.
+struct End_point : Request_processor
+{
+  Virtqueue::Head_desc head;
+  Buffer pkt;
+
+  Port *d;
+  Virtqueue *q;
+
+  End_point(Port *dev, Virtqueue *queue) : d(dev), q(queue) {}
+
+  /// Start the next available packet, false if there is none.
+  inline bool start();
+
+  /// Advance to the next descriptor of the packet, false at its end.
+  inline bool next();
+};
+
+/**
+ * One port of the switch.
+ *
+ * The transmit queue is only processed by the worker of the port, with
+ * tx_lock held.  The receive queue is filled by the workers of all other
+ * ports, with rx_lock held.  The server thread takes both locks to reset
+ * or reconfigure the queues.  A worker that finds a bad descriptor only
+ * marks the port failed, the reset is left to the server thread.
+ */
+class Port :
+  public L4virtio::Svr::Device,
+  public L4::Epiface_t<Port, L4virtio::Device>
+{
+public:
+  struct Hdr_flags
+  {
+    l4_uint8_t raw;
+    CXX_BITFIELD_MEMBER( 0, 0, need_csum, raw);
+    CXX_BITFIELD_MEMBER( 1, 1, data_valid, raw);
+  };
+
+  struct Hdr
+  {
+    Hdr_flags flags;
+    l4_uint8_t gso_type;
+    l4_uint16_t hdr_len;
+    l4_uint16_t gso_size;
+    l4_uint16_t csum_start;
+    l4_uint16_t csum_offset;
+    l4_uint16_t num_buffers;
+  };
+
+  struct Features : L4virtio::Svr::Dev_config::Features
+  {
+    Features() = default;
+    Features(l4_uint32_t raw) : L4virtio::Svr::Dev_config::Features(raw) {}
+
+    CXX_BITFIELD_MEMBER( 0,  0, csum, raw);       // host handles partial csum
+    CXX_BITFIELD_MEMBER( 1,  1, guest_csum, raw); // guest handles partial csum
+    CXX_BITFIELD_MEMBER( 5,  5, mac, raw);        // host has given mac
+    CXX_BITFIELD_MEMBER(15, 15, mrg_rxbuf, raw);  // host can merge receive buffers
+  };
+
+  enum
+  {
+    Rx = 0,
+    Tx = 1,
+
+    Feature_mrg_rxbuf = 15,
+  };
+
+  /**
+   * Counters of a port.  The tx side is written by the worker of the port,
+   * the rx side with rx_lock held.
+   */
+  struct Stats
+  {
+    unsigned long tx;        ///< packets sent by the client
+    unsigned long flooded;   ///< sent packets flooded to all ports
+    unsigned long kicks;     ///< notifications from the client
+    unsigned long tx_irqs;   ///< transmit notifications to the client
+    unsigned long rx;        ///< packets received by the client
+    unsigned long dropped;   ///< packets dropped or truncated for the client
+    unsigned long rx_irqs;   ///< receive notifications to the client
+    unsigned long irqs_suppressed; ///< notifications the client did not want
+  };
+
+  Stats stats;
+
+  struct Net_config_space
+  {
+  };
+
+  L4virtio::Svr::Dev_config_t<Net_config_space> _dev_config;
+
+  pthread_mutex_t tx_lock;
+  pthread_mutex_t rx_lock;
+
+  /// Packet of the transmit queue that is being forwarded.
+  End_point tx_ep;
+
+  Port(Switch *sw, unsigned index, unsigned vq_max)
+  : L4virtio::Svr::Device(&_dev_config),
+    stats(),
+    _dev_config(0x44, L4VIRTIO_ID_NET, 2),
+    tx_ep(this, &_q[Tx]),
+    _switch(sw),
+    _index(index),
+    _vq_max(vq_max),
+    _waiters(0),
+    _error(false)
+  {
+    Features hf(0);
+    hf.ring_indirect_desc() = true;
+    hf.ring_event_idx() = true;
+    hf.mrg_rxbuf() = true;
+
+    _dev_config.host_features(0) = hf.raw;
+    _dev_config.host_features(1) = 1;
+    _dev_config.reset_hdr();
+
+    reset_queue_config(0, vq_max);
+    reset_queue_config(1, vq_max);
+
+    pthread_mutex_init(&tx_lock, NULL);
+    pthread_mutex_init(&rx_lock, NULL);
+
+    _host_irq = L4Re::chkcap(L4Re::Util::cap_alloc.alloc<L4::Irq>(),
+                             "allocate port irq");
+    L4Re::chksys(L4Re::Env::env()->factory()->create(_host_irq.get()),
+                 "create port irq");
+  }
+
+  /**
+   * Start the worker of the port on the given CPU, the host IRQ is bound
+   * to it before it runs.
+   */
+  void start_worker(unsigned cpu)
+  {
+    L4Re::Util::start_pinned_thread(worker_thread, this, cpu,
+                                    "start port worker", _host_irq.get());
+  }
+
+  void register_single_driver_irq()
+  {
+    kick_guest_irq = L4Re::chkcap(server_iface()->rcv_cap<L4::Irq>(0));
+    L4Re::chksys(server_iface()->realloc_rcv_cap(0));
+  }
+
+  Server_iface *server_iface() const
+  { return L4::Epiface::server_iface(); }
+
+  L4::Cap<L4::Irq> device_notify_irq() const
+  { return _host_irq.get(); }
+
+  void reset()
+  {
+    Guard t(&tx_lock);
+    Guard r(&rx_lock);
+
+    for (Virtqueue &q: _q)
+      q.disable();
+
+    tx_ep.head = Virtqueue::Head_desc();
+    _error = false;
+    wake_waiters();
+  }
+
+  bool available()
+  { return !obj_cap(); }
+
+  template<typename T, unsigned N >
+  static unsigned array_length(T (&)[N]) { return N; }
+
+  int reconfig_queue(unsigned index)
+  {
+    if (index >= array_length(_q))
+      return -L4_ERANGE;
+
+    Guard t(&tx_lock);
+    Guard r(&rx_lock);
+
+    if (setup_queue(_q + index, index, _vq_max))
+      return 0;
+
+    return -L4_EINVAL;
+  }
+
+  bool check_queues()
+  {
+    for (Virtqueue &q: _q)
+      if (!q.ready())
+        {
+          reset();
+          printf("failed to start queues\n");
+          return false;
+        }
+
+    return true;
+  }
+
+  Virtqueue *tx_q() { return &_q[Tx]; }
+  Virtqueue *rx_q() { return &_q[Rx]; }
+
+  unsigned index() const { return _index; }
+
+  bool merge_rx() const
+  { return _dev_config.negotiated(Feature_mrg_rxbuf); }
+
+  void notify_queue(L4virtio::Svr::Virtqueue *queue)
+  {
+    if (!queue->notify_guest_needed())
+      {
+        __atomic_add_fetch(&stats.irqs_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+      }
+
+    kick_guest_irq->trigger();
+    if (queue == &_q[Rx])
+      ++stats.rx_irqs;
+    else
+      ++stats.tx_irqs;
+  }
+
+  /**
+   * Have the worker of port `src` retry once this port has new receive
+   * buffers.  Must be called with rx_lock held.
+   *
+   * \return true if there are still no receive buffers.
+   */
+  bool wait_for_buffers(Port *src)
+  {
+    __atomic_or_fetch(&_waiters, 1U << src->index(), __ATOMIC_RELAXED);
+    rx_q()->enable_notify();
+
+    // the waiter and the avail event must be visible before the check
+    L4virtio::mb();
+    return !rx_q()->desc_avail();
+  }
+
+  /// Run the worker of the port.
+  void kick()
+  { _host_irq->trigger(); }
+
+  /// Let the ports waiting for receive buffers retry.
+  inline void wake_waiters();
+
+  /**
+   * Transition into the failed state from a worker thread.  The reset
+   * needs the locks the worker holds, so it is left to the server thread.
+   */
+  inline void defer_error();
+
+  bool failed() const
+  { return __atomic_load_n(&_error, __ATOMIC_RELAXED); }
+
+  /// Fail the device if a worker asked for it, runs on the server thread.
+  void handle_deferred_error()
+  {
+    // reset() clears the error, with the queues stopped
+    if (failed())
+      device_error();
+  }
+
+  template<typename REG>
+  void register_client(REG *registry, unsigned num_ds)
+  {
+    init_mem_info(num_ds);
+    L4Re::chkcap(registry->register_obj(this));
+    obj_cap()->dec_refcnt(1);
+  }
+
+  template<typename REG>
+  void unregister_client(REG *registry)
+  {
+    reset();
+    reset_queue_config(0, _vq_max);
+    reset_queue_config(1, _vq_max);
+    init_mem_info(0);
+
+    registry->unregister_obj(this);
+  }
+
+private:
+  static void *worker_thread(void *arg)
+  {
+    static_cast<Port *>(arg)->worker();
+    return NULL;
+  }
+
+  inline void worker();
+
+  Switch *_switch;
+  unsigned _index;
+  unsigned _vq_max;
+  /// Ports waiting for receive buffers of this port, one bit per port.
+  l4_uint32_t _waiters;
+  bool _error;
+  Virtqueue _q[2];
+  L4Re::Util::Auto_cap<L4::Irq>::Cap kick_guest_irq;
+  L4Re::Util::Auto_cap<L4::Irq>::Cap _host_irq;
+};
+
+bool End_point::start()
+{
+  auto r = q->next_avail();
+  if (L4_UNLIKELY(!r))
+    return false;
+
+  head = Request_processor::start(d->mem_info(), r, &pkt);
+  return true;
+}
+
+bool End_point::next()
+{ return Request_processor::next(d->mem_info(), &pkt); }
+
+/**
+ * Learned station addresses.
+ *
+ * Open addressing with linear probing over a fixed number of slots.  A
+ * slot holds the 48-bit address and the port number plus one, 0 marks an
+ * empty slot.  Lookups on the forwarding path take no lock, updates are
+ * serialized.  Slots are never freed, forgetting a port only clears the
+ * port number, so the probe sequences stay intact.
+ */
+class Mac_table
+{
+public:
+  enum { Size = 1024, Shift = 64 - 10 };
+  enum : unsigned { No_port = ~0U };
+
+  Mac_table()
+  {
+    memset(_slots, 0, sizeof(_slots));
+    pthread_mutex_init(&_lock, NULL);
+  }
+
+  static l4_uint64_t addr(unsigned char const *a)
+  {
+    l4_uint64_t r = 0;
+    for (unsigned i = 0; i < 6; ++i)
+      r = (r << 8) | a[i];
+    return r;
+  }
+
+  /// Port the address was learned on, or No_port.
+  unsigned lookup(l4_uint64_t a) const
+  {
+    for (unsigned i = hash(a), n = 0; n < Size; ++n, i = (i + 1) % Size)
+      {
+        l4_uint64_t s = __atomic_load_n(&_slots[i], __ATOMIC_RELAXED);
+        if (!s)
+          break;
+        if ((s >> 16) == a)
+          return (s & 0xffff) ? unsigned(s & 0xffff) - 1 : unsigned(No_port);
+      }
+
+    return No_port;
+  }
+
+  /// Record that address `a` is behind `port`, ignored if the table is full.
+  void learn(l4_uint64_t a, unsigned port)
+  {
+    if (L4_LIKELY(lookup(a) == port))
+      return;
+
+    Guard g(&_lock);
+    for (unsigned i = hash(a), n = 0; n < Size; ++n, i = (i + 1) % Size)
+      if (!_slots[i] || (_slots[i] >> 16) == a)
+        {
+          __atomic_store_n(&_slots[i], (a << 16) | (port + 1),
+                           __ATOMIC_RELAXED);
+          return;
+        }
+  }
+
+  /// Forget all addresses learned on `port`.
+  void forget(unsigned port)
+  {
+    Guard g(&_lock);
+    for (l4_uint64_t &s: _slots)
+      if ((s & 0xffff) == port + 1)
+        __atomic_store_n(&s, s & ~0xffffULL, __ATOMIC_RELAXED);
+  }
+
+private:
+  static unsigned hash(l4_uint64_t a)
+  { return (a * 0x9e3779b97f4a7c15ULL) >> Shift; }
+
+  l4_uint64_t _slots[Size];
+  pthread_mutex_t _lock;
+};
+
+static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks> server;
+
+class Switch : public L4::Epiface_t<Switch, L4::Factory>
+{
+private:
+  struct Del_cap_irq : public L4::Irqep_t<Del_cap_irq>
+  {
+    explicit Del_cap_irq(Switch *sw) : s(sw) {}
+    Switch *s;
+
+    void handle_irq()
+    {
+      for (unsigned i = 0; i < s->_num_ports; ++i)
+        {
+          Port *p = s->_ports[i];
+          if (!p->available() && !p->obj_cap().validate().label())
+            {
+              printf("Client on port %u has gone. Unregistering.\n", i);
+              p->unregister_client(server.registry());
+              s->_macs.forget(i);
+            }
+        }
+    }
+  };
+
+  struct Error_irq : public L4::Irqep_t<Error_irq>
+  {
+    explicit Error_irq(Switch *sw) : s(sw) {}
+    Switch *s;
+
+    void handle_irq()
+    {
+      for (unsigned i = 0; i < s->_num_ports; ++i)
+        s->_ports[i]->handle_deferred_error();
+    }
+  };
+
+  /// Packet header and the Ethernet addresses.
+  struct Frame
+  {
+    Port::Hdr hdr;
+    unsigned char dst[6];
+    unsigned char src[6];
+  };
+
+  /**
+   * Receive queue the worker currently fills, its rx_lock is held and its
+   * used entries are published on flush().
+   */
+  struct Rx_batch
+  {
+    Port *port;
+    l4_uint16_t n;
+
+    Rx_batch() : port(0), n(0) {}
+    ~Rx_batch() { flush(); }
+
+    bool acquire(Port *p)
+    {
+      if (port != p)
+        {
+          flush();
+          pthread_mutex_lock(&p->rx_lock);
+          port = p;
+          n = 0;
+        }
+
+      return L4_LIKELY(p->rx_q()->ready() && !p->failed());
+    }
+
+    void flush()
+    {
+      if (!port)
+        return;
+
+      if (n)
+        port->rx_q()->finish_x(n, port);
+      pthread_mutex_unlock(&port->rx_lock);
+      port = 0;
+    }
+  };
+
+  enum Result { Idle, More, Blocked };
+
+  Port *_ports[Max_ports];
+  unsigned _num_ports;
+  Mac_table _macs;
+  Del_cap_irq _del_cap_irq;
+  Error_irq _error_irq;
+
+  /// Read the frame header of the packet at `tx`, false if it is too short.
+  static bool peek(End_point tx, Frame *f)
+  {
+    Data_buffer b(f);
+    for (;;)
+      {
+        tx.pkt.copy_to(&b);
+        if (b.done())
+          return true;
+        if (tx.pkt.done() && !tx.next())
+          return false;
+      }
+  }
+
+  /**
+   * Copy the packet at `tx` into the receive queue of the port of `b`.
+   */
+  static void deliver(End_point tx, Frame const &f, Rx_batch *b)
+  {
+    Port *dst = b->port;
+    Virtqueue *q = dst->rx_q();
+    End_point rx(dst, q);
+    Port::Hdr *hdr = 0;
+    l4_uint32_t total = 0;
+    l4_uint16_t nbuf = 0;
+
+    try
+      {
+        if (L4_UNLIKELY(!rx.start()))
+          {
+            ++dst->stats.dropped;
+            return;
+          }
+
+        hdr = reinterpret_cast<Port::Hdr *>(rx.pkt.pos);
+        if (L4_UNLIKELY(rx.pkt.left < Hdr_size))
+          {
+            q->consumed_x(b->n++, rx.head);
+            ++dst->stats.dropped;
+            return;
+          }
+
+        for (;;)
+          {
+            total += tx.pkt.copy_to(&rx.pkt);
+
+            if (tx.pkt.done() && !tx.next())
+              break;
+
+            if (rx.pkt.done() && !rx.next())
+              {
+                q->consumed_x(b->n++, rx.head, total);
+                ++nbuf;
+                total = 0;
+
+                if (L4_UNLIKELY(!dst->merge_rx() || !rx.start()))
+                  {
+                    // truncated
+                    hdr->num_buffers = nbuf;
+                    hdr->flags.raw = 0;
+                    ++dst->stats.dropped;
+                    return;
+                  }
+              }
+          }
+
+        q->consumed_x(b->n++, rx.head, total);
+        hdr->num_buffers = nbuf + 1;
+        if (f.hdr.flags.need_csum() == 0)
+          hdr->flags.data_valid() = 1;
+        ++dst->stats.rx;
+      }
+    catch (L4virtio::Svr::Bad_descriptor const &e)
+      {
+        if (e.proc != &rx)
+          {
+            // bad transmit descriptor, give the receive buffer back empty
+            if (rx.head)
+              {
+                hdr->flags.raw = 0;
+                q->consumed_x(b->n++, rx.head);
+              }
+            throw;
+          }
+
+        dst->defer_error();
+        printf("error: RX queue error: bad descriptor: %d on port %u\n",
+               e.error, dst->index());
+      }
+  }
+
+  /**
+   * Forward up to Batch packets from the transmit queue of `src`.
+   */
+  Result forward_batch(Port *src)
+  {
+    End_point &tx = src->tx_ep;
+    Virtqueue *q = src->tx_q();
+    Result res = More;
+    l4_uint16_t ntx = 0;
+    Rx_batch rxb;
+
+    try
+      {
+        for (unsigned i = 0; i < Batch; ++i)
+          {
+            if (!tx.head && !tx.start())
+              {
+                res = Idle;
+                break;
+              }
+
+            Frame f;
+            if (L4_UNLIKELY(!peek(tx, &f)))
+              {
+                q->consumed_x(ntx++, tx.head);
+                continue;
+              }
+
+            if (!(f.src[0] & 1))
+              _macs.learn(Mac_table::addr(f.src), src->index());
+
+            unsigned to = (f.dst[0] & 1) ? (unsigned)Mac_table::No_port
+                                         : _macs.lookup(Mac_table::addr(f.dst));
+            if (to != Mac_table::No_port)
+              {
+                Port *dst = _ports[to];
+                if (dst != src && rxb.acquire(dst))
+                  {
+                    if (!dst->rx_q()->desc_avail()
+                        && dst->wait_for_buffers(src))
+                      {
+                        // keep the packet until dst has buffers again
+                        res = Blocked;
+                        break;
+                      }
+
+                    deliver(tx, f, &rxb);
+                  }
+              }
+            else
+              {
+                ++src->stats.flooded;
+                for (unsigned p = 0; p < _num_ports; ++p)
+                  if (_ports[p] != src && rxb.acquire(_ports[p]))
+                    deliver(tx, f, &rxb);
+              }
+
+            q->consumed_x(ntx++, tx.head);
+            ++src->stats.tx;
+          }
+      }
+    catch (L4virtio::Svr::Bad_descriptor const &e)
+      {
+        src->defer_error();
+        tx.head = Virtqueue::Head_desc();
+        res = Idle;
+        printf("error: TX queue error: bad descriptor: %d on port %u\n",
+               e.error, src->index());
+      }
+
+    rxb.flush();
+    if (ntx)
+      q->finish_x(ntx, src);
+
+    return res;
+  }
+
+public:
+  Switch(unsigned num_ports, unsigned vq_max)
+  : _num_ports(num_ports),
+    _del_cap_irq(this),
+    _error_irq(this)
+  {
+    for (unsigned i = 0; i < _num_ports; ++i)
+      _ports[i] = new Port(this, i, vq_max);
+
+    auto c = L4Re::chkcap(server.registry()->register_irq_obj(&_del_cap_irq));
+    L4Re::chksys(L4Re::Env::env()->main_thread()->register_del_irq(c));
+    L4Re::chkcap(server.registry()->register_irq_obj(&_error_irq));
+  }
+
+  unsigned num_ports() const { return _num_ports; }
+
+  /// IRQ that has the server thread handle deferred device errors.
+  L4::Cap<L4::Irq> error_irq() const
+  { return L4::cap_cast<L4::Irq>(_error_irq.obj_cap()); }
+  Port *port(unsigned i) const { return _ports[i]; }
+
+  /// Start the workers, round-robin on the online CPUs.
+  void start()
+  {
+    L4Re::Util::Online_cpus cpus;
+
+    for (unsigned i = 0; i < _num_ports; ++i)
+      _ports[i]->start_worker(cpus[i]);
+  }
+
+  long op_create(L4::Factory::Rights, L4::Ipc::Cap<void> &res,
+                 l4_umword_t type, L4::Ipc::Varg_list_ref va)
+  {
+    // test for supported object types
+    if (type != 0)
+      return -L4_EINVAL;
+
+    L4::Ipc::Varg opt = va.next();
+    if (!opt.is_of_int())
+      return -L4_EINVAL;
+
+    unsigned num_ds = opt.value<l4_mword_t>();
+    if (num_ds == 0 || num_ds > 80)
+      {
+        printf("warning: client requested invalid number of data spaces: 0 < %u <= 80\n", num_ds);
+        return -L4_EINVAL;
+      }
+
+    for (unsigned i = 0; i < _num_ports; ++i)
+      {
+        Port *p = _ports[i];
+        if (p->available())
+          {
+            p->register_client(server.registry(), num_ds);
+            res = L4::Ipc::make_cap(p->obj_cap(), L4_CAP_FPAGE_RWSD);
+
+            return L4_EOK;
+          }
+      }
+
+    return -L4_ENOMEM;
+  }
+
+  /**
+   * Forward the packets sent on `src` until its transmit queue is empty
+   * or blocked on a destination.  Runs on the worker of `src`.
+   */
+  void forward(Port *src)
+  {
+    Guard g(&src->tx_lock);
+    Virtqueue *q = src->tx_q();
+
+    for (;;)
+      {
+        if (L4_UNLIKELY(!q->ready() || src->failed()))
+          return;
+
+        q->disable_notify();
+
+        Result r;
+        while ((r = forward_batch(src)) == More)
+          ;
+
+        // the destination kicks us when it has buffers
+        if (r == Blocked)
+          return;
+
+        q->enable_notify();
+
+        // the re-enabled notification must be visible before the check
+        L4virtio::mb();
+
+        if (L4_LIKELY(!q->desc_avail()))
+          return;
+      }
+  }
+};
+
+void Port::worker()
+{
+  for (;;)
+    {
+      l4_msgtag_t tag = l4_ipc_receive(_host_irq.cap(), l4_utcb(),
+                                       L4_IPC_NEVER);
+      if (l4_ipc_error(tag, l4_utcb()))
+        continue;
+
+      ++stats.kicks;
+
+      // the client may have posted receive buffers others wait for
+      wake_waiters();
+      _switch->forward(this);
+    }
+}
+
+void Port::wake_waiters()
+{
+  for (l4_uint32_t w = __atomic_exchange_n(&_waiters, 0, __ATOMIC_RELAXED);
+       w; w &= w - 1)
+    _switch->port(__builtin_ctz(w))->kick();
+}
+
+void Port::defer_error()
+{
+  __atomic_store_n(&_error, true, __ATOMIC_RELAXED);
+  _switch->error_irq()->trigger();
+}
+
+static unsigned stats_interval;
+
+static void *stats_thread_loop(void *arg)
+{
+  Switch *s = static_cast<Switch *>(arg);
+
+  for (;;)
+    {
+      sleep(stats_interval);
+      for (unsigned i = 0; i < s->num_ports(); ++i)
+        {
+          Port::Stats const &st = s->port(i)->stats;
+          printf("port%u: tx:%lu (flooded %lu) rx:%lu drp:%lu kicks:%lu "
+                 "irqs:%lu/%lu (suppressed %lu)\n",
+                 i, st.tx, st.flooded, st.rx, st.dropped, st.kicks,
+                 st.tx_irqs, st.rx_irqs, st.irqs_suppressed);
+        }
+    }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  Dbg::set_level(0xf);
+
+  int opt, index;
+  unsigned vq_max_num = 0x100; // default value for data queues
+  unsigned num_ports = 4;
+
+  printf("Hello from l4vio_switch\n");
+
+  while( (opt = getopt_long(argc, argv, "s:p:S:", options, &index)) != -1)
+    {
+      switch (opt)
+        {
+        case 's':
+          vq_max_num = atoi(optarg);
+          printf("Max number of buffers in virtqueue: %u\n", vq_max_num);
+          break;
+        case 'p':
+          num_ports = atoi(optarg);
+          if (num_ports < 2 || num_ports > Max_ports)
+            {
+              printf("error: number of ports must be in [2, %u]\n", Max_ports);
+              return 1;
+            }
+          break;
+        case 'S':
+          stats_interval = atoi(optarg);
+          break;
+        }
+    }
+
+  Switch *s = new Switch(num_ports, vq_max_num);
+  L4::Cap<void> cap = server.registry()->register_obj(s, "svr");
+  if (!cap.is_valid())
+    printf("error registering switch\n");
+
+  s->start();
+  printf("%u ports\n", num_ports);
+
+  if (stats_interval)
+    {
+      pthread_t stats_thread;
+      pthread_create(&stats_thread, NULL, stats_thread_loop, s);
+    }
+
+  server.loop();
+  return 0;
+}